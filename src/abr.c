@@ -0,0 +1,283 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+#include "abr.h"
+#include "source.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * The characters which separate the fields of each line of a renditions
+ * file.
+ */
+#define STREAMTEST_RENDITIONS_WHITESPACE " \t"
+
+/**
+ * Selects the highest rendition which the measured throughput of the client
+ * can sustain. While the client keeps up, the throughput measured is only
+ * the rate at which data is sent, thus the next higher rendition is tried
+ * once the client has kept up for STREAMTEST_ABR_UP_HOLD. Otherwise, the
+ * throughput measured is the capacity of the client, and the track moves
+ * down to the highest rendition fitting within
+ * STREAMTEST_ABR_SAFETY_PERCENT of that capacity.
+ *
+ * @param input
+ *     The measurements on which the choice should be based.
+ *
+ * @return
+ *     The index of the rendition which should be streamed.
+ */
+static int streamtest_abr_select_throughput(const streamtest_abr_input* input) {
+
+    const streamtest_renditions* renditions = input->renditions;
+    int current = renditions->current;
+
+    /* Probe upward while the client keeps up */
+    if (!input->congested && input->lag < STREAMTEST_ABR_LAG_LOW) {
+        if (current + 1 < renditions->count
+                && input->since_switch >= STREAMTEST_ABR_UP_HOLD)
+            return current + 1;
+        return current;
+    }
+
+    if (input->throughput == 0
+            || input->since_switch < STREAMTEST_ABR_DOWN_HOLD)
+        return current;
+
+    /* Fit within the measured capacity, never moving upward while the
+     * client is behind */
+    int64_t budget = input->throughput * STREAMTEST_ABR_SAFETY_PERCENT / 100;
+    int selected = 0;
+    while (selected + 1 < current
+            && renditions->items[selected + 1].bitrate <= budget)
+        selected++;
+
+    if (renditions->items[current].bitrate <= budget)
+        return current;
+
+    return selected;
+
+}
+
+/**
+ * Moves one rendition down while the client falls behind or the socket is
+ * congested, and one rendition up once the client has kept up for
+ * STREAMTEST_ABR_UP_HOLD, without regard to measured throughput.
+ *
+ * @param input
+ *     The measurements on which the choice should be based.
+ *
+ * @return
+ *     The index of the rendition which should be streamed.
+ */
+static int streamtest_abr_select_lag(const streamtest_abr_input* input) {
+
+    const streamtest_renditions* renditions = input->renditions;
+    int current = renditions->current;
+
+    if (input->congested || input->lag > STREAMTEST_ABR_LAG_HIGH) {
+        if (current > 0 && input->since_switch >= STREAMTEST_ABR_DOWN_HOLD)
+            return current - 1;
+    }
+
+    else if (input->lag < STREAMTEST_ABR_LAG_LOW) {
+        if (current + 1 < renditions->count
+                && input->since_switch >= STREAMTEST_ABR_UP_HOLD)
+            return current + 1;
+    }
+
+    return current;
+
+}
+
+/**
+ * Always selects the current rendition, such that a track streams its
+ * lowest rendition throughout. This serves as a baseline against which
+ * other policies can be compared.
+ *
+ * @param input
+ *     The measurements on which the choice should be based.
+ *
+ * @return
+ *     The index of the current rendition.
+ */
+static int streamtest_abr_select_fixed(const streamtest_abr_input* input) {
+    return input->renditions->current;
+}
+
+/**
+ * All available rate-selection policies, the first being the default.
+ */
+static const streamtest_abr_policy streamtest_abr_policies[] = {
+    { "throughput", streamtest_abr_select_throughput },
+    { "lag",        streamtest_abr_select_lag        },
+    { "fixed",      streamtest_abr_select_fixed      }
+};
+
+const streamtest_abr_policy* streamtest_abr_find_policy(const char* name) {
+
+    if (name[0] == '\0')
+        return &streamtest_abr_policies[0];
+
+    int count = sizeof(streamtest_abr_policies)
+        / sizeof(streamtest_abr_policies[0]);
+
+    for (int i = 0; i < count; i++) {
+        if (strcmp(streamtest_abr_policies[i].name, name) == 0)
+            return &streamtest_abr_policies[i];
+    }
+
+    return NULL;
+
+}
+
+/**
+ * Compares two renditions by bitrate, for sorting with qsort().
+ *
+ * @param a
+ *     The first rendition.
+ *
+ * @param b
+ *     The second rendition.
+ *
+ * @return
+ *     A negative value, zero or a positive value if the bitrate of the first
+ *     rendition is less than, equal to or greater than that of the second.
+ */
+static int streamtest_rendition_compare(const void* a, const void* b) {
+
+    int first = ((const streamtest_rendition*) a)->bitrate;
+    int second = ((const streamtest_rendition*) b)->bitrate;
+
+    return (first > second) - (first < second);
+
+}
+
+/**
+ * Splits off the next whitespace-delimited field of the given line.
+ *
+ * @param line
+ *     Pointer to the remainder of the line, which is advanced past the
+ *     field and any whitespace following it.
+ *
+ * @return
+ *     The field, which is null-terminated in place.
+ */
+static char* streamtest_renditions_field(char** line) {
+
+    char* field = *line;
+    char* end = field + strcspn(field, STREAMTEST_RENDITIONS_WHITESPACE);
+
+    if (*end != '\0')
+        *(end++) = '\0';
+
+    *line = end + strspn(end, STREAMTEST_RENDITIONS_WHITESPACE);
+    return field;
+
+}
+
+streamtest_renditions* streamtest_renditions_load(const char* filename) {
+
+    FILE* file = fopen(filename, "r");
+    if (file == NULL)
+        return NULL;
+
+    streamtest_renditions* renditions =
+        calloc(1, sizeof(streamtest_renditions));
+
+    bool valid = true;
+    char* line = NULL;
+    size_t line_size = 0;
+    while (getline(&line, &line_size, file) != -1) {
+
+        /* Strip line terminator and leading whitespace */
+        line[strcspn(line, "\r\n")] = '\0';
+        char* remaining = line + strspn(line,
+                STREAMTEST_RENDITIONS_WHITESPACE);
+
+        /* Ignore blank lines and comments */
+        if (*remaining == '\0' || *remaining == '#')
+            continue;
+
+        char* bitrate = streamtest_renditions_field(&remaining);
+        char* mimetype = streamtest_renditions_field(&remaining);
+        char* spec = remaining;
+
+        /* Every rendition must have a positive bitrate and a source */
+        char* end;
+        long value = strtol(bitrate, &end, 10);
+        if (*end != '\0' || value <= 0 || value > INT32_MAX
+                || *mimetype == '\0' || *spec == '\0') {
+            valid = false;
+            break;
+        }
+
+        renditions->items = realloc(renditions->items,
+                sizeof(streamtest_rendition) * (renditions->count + 1));
+
+        streamtest_rendition* rendition =
+            &renditions->items[renditions->count++];
+        rendition->bitrate = value;
+        rendition->mimetype = strdup(mimetype);
+        rendition->spec = strdup(spec);
+        rendition->source = NULL;
+
+    }
+
+    free(line);
+    fclose(file);
+
+    /* A malformed or empty list is useless */
+    if (!valid || renditions->count == 0) {
+        streamtest_renditions_free(renditions);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    qsort(renditions->items, renditions->count,
+            sizeof(streamtest_rendition), streamtest_rendition_compare);
+
+    return renditions;
+
+}
+
+void streamtest_renditions_free(streamtest_renditions* renditions) {
+
+    for (int i = 0; i < renditions->count; i++) {
+        streamtest_rendition* rendition = &renditions->items[i];
+        if (rendition->source != NULL)
+            streamtest_source_close(rendition->source);
+        free(rendition->spec);
+        free(rendition->mimetype);
+    }
+
+    free(renditions->items);
+    free(renditions);
+
+}
+
@@ -0,0 +1,244 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef STREAMTEST_ABR_H
+#define STREAMTEST_ABR_H
+
+#include "config.h"
+#include "source.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * The prefix which denotes a source spec that refers to a set of renditions
+ * of the same media, encoded at different bitrates, rather than a single
+ * source. The remainder of the spec is the path of the file listing the
+ * renditions, as accepted by streamtest_renditions_load().
+ */
+#define STREAMTEST_RENDITIONS_PREFIX "abr:"
+
+/**
+ * The percentage of the measured throughput of the client which the bitrate
+ * of a rendition may occupy, leaving headroom for protocol overhead and
+ * variation in throughput.
+ */
+#define STREAMTEST_ABR_SAFETY_PERCENT 80
+
+/**
+ * The client lag, in microseconds, below which the client is considered to
+ * be keeping up with the data sent.
+ */
+#define STREAMTEST_ABR_LAG_LOW 100000
+
+/**
+ * The client lag, in microseconds, beyond which the client is considered to
+ * be falling behind the data sent.
+ */
+#define STREAMTEST_ABR_LAG_HIGH 500000
+
+/**
+ * The minimum time since the previous switch before switching to a higher
+ * bitrate, in microseconds. A higher bitrate is only tried once the client
+ * has kept up for a while.
+ */
+#define STREAMTEST_ABR_UP_HOLD 3000000
+
+/**
+ * The minimum time since the previous switch before switching to a lower
+ * bitrate, in microseconds, such that the effect of one switch is measured
+ * before the next.
+ */
+#define STREAMTEST_ABR_DOWN_HOLD 500000
+
+/**
+ * A single encoding of the media streamed by a track.
+ */
+typedef struct streamtest_rendition {
+
+    /**
+     * The bitrate of this encoding, in bits per second.
+     */
+    int bitrate;
+
+    /**
+     * The mimetype of this encoding.
+     */
+    char* mimetype;
+
+    /**
+     * The spec of the source of this encoding, as accepted by
+     * streamtest_source_open().
+     */
+    char* spec;
+
+    /**
+     * The source of this encoding, or NULL if not yet opened. Once opened,
+     * the source remains open for as long as the renditions, such that the
+     * track can switch back and forth without delay.
+     */
+    streamtest_source* source;
+
+} streamtest_rendition;
+
+/**
+ * Several encodings of the same media which a track switches between as the
+ * throughput of the client changes. All renditions cover the same media
+ * time, such that a position within one corresponds to a position within
+ * any other.
+ */
+typedef struct streamtest_renditions {
+
+    /**
+     * All renditions, in order of increasing bitrate.
+     */
+    streamtest_rendition* items;
+
+    /**
+     * The number of renditions. There is always at least one.
+     */
+    int count;
+
+    /**
+     * The index of the rendition currently being streamed.
+     */
+    int current;
+
+    /**
+     * The time of the most recent switch between renditions, or of the start
+     * of streaming if the track has not yet switched, as returned by
+     * streamtest_utime().
+     */
+    int64_t last_switch;
+
+} streamtest_renditions;
+
+/**
+ * The measurements available to a rate-selection policy when choosing which
+ * rendition a track should stream.
+ */
+typedef struct streamtest_abr_input {
+
+    /**
+     * The renditions of the track, including the rendition currently being
+     * streamed.
+     */
+    const streamtest_renditions* renditions;
+
+    /**
+     * The rate at which the client has most recently been acknowledging
+     * data, in bits per second, or zero if not yet measured. While the
+     * client keeps up, this is only the rate at which data is sent.
+     */
+    int64_t throughput;
+
+    /**
+     * How far the client currently lags behind the data sent, in
+     * microseconds.
+     */
+    int64_t lag;
+
+    /**
+     * Whether the socket of the connection is congested.
+     */
+    bool congested;
+
+    /**
+     * The time since the track last switched renditions (or began
+     * streaming), in microseconds.
+     */
+    int64_t since_switch;
+
+} streamtest_abr_input;
+
+/**
+ * A rate-selection policy, choosing which rendition a track should stream.
+ * A different choice than the current rendition is acted upon at the next
+ * point where the renditions are aligned.
+ *
+ * @param input
+ *     The measurements on which the choice should be based.
+ *
+ * @return
+ *     The index of the rendition which should be streamed.
+ */
+typedef int streamtest_abr_select(const streamtest_abr_input* input);
+
+/**
+ * A named rate-selection policy.
+ */
+typedef struct streamtest_abr_policy {
+
+    /**
+     * The name by which the policy is requested.
+     */
+    const char* name;
+
+    /**
+     * The function choosing which rendition should be streamed.
+     */
+    streamtest_abr_select* select;
+
+} streamtest_abr_policy;
+
+/**
+ * Returns the rate-selection policy having the given name. The available
+ * policies are "throughput" (the default, used if the name is empty), which
+ * selects the highest rendition the measured throughput allows, "lag",
+ * which moves one rendition at a time based solely on client lag, and
+ * "fixed", which never switches.
+ *
+ * @param name
+ *     The name of the policy.
+ *
+ * @return
+ *     The policy having the given name, or NULL if there is no such policy.
+ */
+const streamtest_abr_policy* streamtest_abr_find_policy(const char* name);
+
+/**
+ * Loads the renditions listed within the given file. Each line of the file
+ * describes one rendition, consisting of its bitrate in bits per second,
+ * its mimetype and the spec of its source, separated by whitespace. Blank
+ * lines and lines beginning with "#" are ignored. No sources are opened.
+ * Streaming begins with the rendition of lowest bitrate.
+ *
+ * @param filename
+ *     The path to the file listing the renditions.
+ *
+ * @return
+ *     A newly-allocated streamtest_renditions, or NULL if the file cannot be
+ *     read, is malformed or lists no renditions, in which case errno is set
+ *     appropriately.
+ */
+streamtest_renditions* streamtest_renditions_load(const char* filename);
+
+/**
+ * Frees the given renditions, closing the sources of any which were opened.
+ *
+ * @param renditions
+ *     The renditions to free.
+ */
+void streamtest_renditions_free(streamtest_renditions* renditions);
+
+#endif
+
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+#include "backpressure.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+int streamtest_backpressure_parse_policy(const char* name,
+        streamtest_backpressure_policy* policy) {
+
+    if (name[0] == '\0' || strcmp(name, "none") == 0)
+        *policy = STREAMTEST_BACKPRESSURE_NONE;
+
+    else if (strcmp(name, "drop") == 0)
+        *policy = STREAMTEST_BACKPRESSURE_DROP;
+
+    else if (strcmp(name, "shrink") == 0)
+        *policy = STREAMTEST_BACKPRESSURE_SHRINK;
+
+    else if (strcmp(name, "pause") == 0)
+        *policy = STREAMTEST_BACKPRESSURE_PAUSE;
+
+    else
+        return 1;
+
+    return 0;
+
+}
+
+void streamtest_backpressure_init(streamtest_backpressure* backpressure,
+        streamtest_backpressure_policy policy) {
+    memset(backpressure, 0, sizeof(streamtest_backpressure));
+    backpressure->policy = policy;
+}
+
+void streamtest_backpressure_blocked(streamtest_backpressure* backpressure,
+        int64_t usecs) {
+    backpressure->pass_blocked += usecs;
+    backpressure->blocked_total += usecs;
+}
+
+void streamtest_backpressure_flushed(streamtest_backpressure* backpressure,
+        int64_t usecs) {
+
+    backpressure->flushes++;
+    backpressure->flush_total += usecs;
+    if (usecs > backpressure->flush_max)
+        backpressure->flush_max = usecs;
+
+    streamtest_backpressure_blocked(backpressure, usecs);
+
+}
+
+bool streamtest_backpressure_update(streamtest_backpressure* backpressure,
+        int64_t now) {
+
+    /* Fold the pass which just ended into the average */
+    backpressure->average += (backpressure->pass_blocked
+            - backpressure->average) / STREAMTEST_BACKPRESSURE_WEIGHT;
+    backpressure->pass_blocked = 0;
+
+    bool changed = false;
+
+    /* Congestion begins once the average exceeds the threshold ... */
+    if (!backpressure->congested
+            && backpressure->average > STREAMTEST_BACKPRESSURE_USECS) {
+
+        backpressure->congested = true;
+        backpressure->congested_since = now;
+        backpressure->congestions++;
+
+        if (backpressure->shrink == 0) {
+            backpressure->shrink = 1;
+            backpressure->last_shrink = now;
+        }
+
+        changed = true;
+
+    }
+
+    /* ... and ends only once the average is well below the threshold, such
+     * that the response to congestion does not immediately end it */
+    else if (backpressure->congested
+            && backpressure->average < STREAMTEST_BACKPRESSURE_USECS / 4) {
+
+        backpressure->congested = false;
+        backpressure->congested_total += now
+            - backpressure->congested_since;
+
+        changed = true;
+
+    }
+
+    /* Shrink further while congestion persists, recovering gradually */
+    if (now - backpressure->last_shrink
+            >= STREAMTEST_BACKPRESSURE_SHRINK_INTERVAL) {
+
+        if (backpressure->congested
+                && backpressure->shrink < STREAMTEST_BACKPRESSURE_MAX_SHRINK) {
+            backpressure->shrink++;
+            backpressure->last_shrink = now;
+        }
+
+        else if (!backpressure->congested && backpressure->shrink > 0) {
+            backpressure->shrink--;
+            backpressure->last_shrink = now;
+        }
+
+    }
+
+    return changed;
+
+}
+
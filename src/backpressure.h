@@ -0,0 +1,251 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef STREAMTEST_BACKPRESSURE_H
+#define STREAMTEST_BACKPRESSURE_H
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * The average time per pass of the sender spent writing to or flushing the
+ * socket, in microseconds, beyond which the socket is considered congested.
+ * Writes which do not block complete within a few microseconds, thus
+ * exceeding this consistently indicates that the network (or the client)
+ * cannot keep up.
+ */
+#define STREAMTEST_BACKPRESSURE_USECS 1000
+
+/**
+ * The weight of the most recent pass within the average time blocked per
+ * pass, as a fraction of one. The average moves 1/N of the way toward each
+ * new measurement, such that brief stalls do not count as congestion.
+ */
+#define STREAMTEST_BACKPRESSURE_WEIGHT 8
+
+/**
+ * The number of times the frame size of each track may be halved while the
+ * socket is congested, if frames are shrunk.
+ */
+#define STREAMTEST_BACKPRESSURE_MAX_SHRINK 3
+
+/**
+ * The minimum time between changes to the number of times frames are
+ * halved, in microseconds.
+ */
+#define STREAMTEST_BACKPRESSURE_SHRINK_INTERVAL 1000000
+
+/**
+ * All possible responses to sustained backpressure from the socket.
+ */
+typedef enum streamtest_backpressure_policy {
+
+    /**
+     * Backpressure is measured and logged, but otherwise ignored.
+     */
+    STREAMTEST_BACKPRESSURE_NONE,
+
+    /**
+     * Images are dropped while the socket is congested. Other tracks, whose
+     * frames cannot be dropped without corrupting the stream, are paused.
+     */
+    STREAMTEST_BACKPRESSURE_DROP,
+
+    /**
+     * Raw frames are read at a fraction of their usual size while the socket
+     * is congested, halving again each STREAMTEST_BACKPRESSURE_SHRINK_INTERVAL
+     * that congestion persists, and restored gradually once congestion
+     * clears. Tracks whose frames cannot be resized are paused.
+     */
+    STREAMTEST_BACKPRESSURE_SHRINK,
+
+    /**
+     * No frames are read while the socket is congested, though data already
+     * read continues to be sent.
+     */
+    STREAMTEST_BACKPRESSURE_PAUSE
+
+} streamtest_backpressure_policy;
+
+/**
+ * Detection of sustained backpressure from the socket of a connection,
+ * along with running totals of time spent blocked on that socket. These
+ * values are only updated by the sender.
+ */
+typedef struct streamtest_backpressure {
+
+    /**
+     * The response to sustained backpressure.
+     */
+    streamtest_backpressure_policy policy;
+
+    /**
+     * The time spent writing to or flushing the socket during the current
+     * pass of the sender, in microseconds.
+     */
+    int64_t pass_blocked;
+
+    /**
+     * The moving average of the time spent writing to or flushing the socket
+     * per pass of the sender, in microseconds.
+     */
+    int64_t average;
+
+    /**
+     * Whether the socket is currently considered congested.
+     */
+    bool congested;
+
+    /**
+     * The time the current period of congestion began, as returned by
+     * streamtest_utime(). This is only meaningful while congested.
+     */
+    int64_t congested_since;
+
+    /**
+     * The number of times frames are currently halved, if frames are shrunk
+     * in response to congestion.
+     */
+    int shrink;
+
+    /**
+     * The time at which shrink was last changed, as returned by
+     * streamtest_utime().
+     */
+    int64_t last_shrink;
+
+    /**
+     * The total number of flushes.
+     */
+    uint64_t flushes;
+
+    /**
+     * The total time spent flushing, in microseconds.
+     */
+    int64_t flush_total;
+
+    /**
+     * The longest time spent on a single flush, in microseconds.
+     */
+    int64_t flush_max;
+
+    /**
+     * The total time spent writing to or flushing the socket, in
+     * microseconds.
+     */
+    int64_t blocked_total;
+
+    /**
+     * The total number of periods of congestion.
+     */
+    uint64_t congestions;
+
+    /**
+     * The total duration of all periods of congestion which have ended, in
+     * microseconds.
+     */
+    int64_t congested_total;
+
+    /**
+     * The total number of frames which were not read, or were dropped, due
+     * to congestion.
+     */
+    uint64_t frames_deferred;
+
+} streamtest_backpressure;
+
+/**
+ * Parses the given name of a backpressure policy, which may be "none",
+ * "drop", "shrink" or "pause". An empty name is equivalent to "none".
+ *
+ * @param name
+ *     The name to parse.
+ *
+ * @param policy
+ *     Storage for the parsed policy.
+ *
+ * @return
+ *     Zero if the name was parsed successfully, non-zero if the name is not
+ *     recognized.
+ */
+int streamtest_backpressure_parse_policy(const char* name,
+        streamtest_backpressure_policy* policy);
+
+/**
+ * Initializes the given backpressure detector such that the socket is not
+ * considered congested and all totals are zero.
+ *
+ * @param backpressure
+ *     The detector to initialize.
+ *
+ * @param policy
+ *     The response to sustained backpressure.
+ */
+void streamtest_backpressure_init(streamtest_backpressure* backpressure,
+        streamtest_backpressure_policy policy);
+
+/**
+ * Records time spent writing to the socket.
+ *
+ * @param backpressure
+ *     The detector to update.
+ *
+ * @param usecs
+ *     The time spent writing, in microseconds.
+ */
+void streamtest_backpressure_blocked(streamtest_backpressure* backpressure,
+        int64_t usecs);
+
+/**
+ * Records time spent flushing the socket.
+ *
+ * @param backpressure
+ *     The detector to update.
+ *
+ * @param usecs
+ *     The time spent flushing, in microseconds.
+ */
+void streamtest_backpressure_flushed(streamtest_backpressure* backpressure,
+        int64_t usecs);
+
+/**
+ * Updates whether the socket is considered congested, based on the time
+ * blocked during the pass of the sender which just ended. This function
+ * must be invoked at the end of each pass.
+ *
+ * @param backpressure
+ *     The detector to update.
+ *
+ * @param now
+ *     The current time, as returned by streamtest_utime().
+ *
+ * @return
+ *     true if the socket has become congested or is no longer congested,
+ *     false if nothing has changed.
+ */
+bool streamtest_backpressure_update(streamtest_backpressure* backpressure,
+        int64_t now);
+
+#endif
+
@@ -0,0 +1,303 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+#include "chunks.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+uint64_t streamtest_chunks_stored_length(uint32_t length, bool encoded) {
+
+    if (encoded)
+        return ((uint64_t) length + 2) / 3 * 4;
+
+    return length;
+
+}
+
+/**
+ * The multipliers used by streamtest_chunks_hash(), being the primes of
+ * XXH64, whose round function is also used.
+ */
+#define STREAMTEST_CHUNKS_PRIME_1 0x9E3779B185EBCA87ULL
+#define STREAMTEST_CHUNKS_PRIME_2 0xC2B2AE3D27D4EB4FULL
+#define STREAMTEST_CHUNKS_PRIME_3 0x165667B19E3779F9ULL
+
+/**
+ * Rotates the given value left by the given number of bits.
+ *
+ * @param value
+ *     The value to rotate.
+ *
+ * @param bits
+ *     The number of bits to rotate by, which must be between 1 and 63
+ *     inclusive.
+ *
+ * @return
+ *     The rotated value.
+ */
+static uint64_t streamtest_chunks_rotate(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+/**
+ * Mixes a single 64-bit word into the given hash lane.
+ *
+ * @param lane
+ *     The current value of the lane.
+ *
+ * @param word
+ *     The word to mix in.
+ *
+ * @return
+ *     The new value of the lane.
+ */
+static uint64_t streamtest_chunks_round(uint64_t lane, uint64_t word) {
+    lane += word * STREAMTEST_CHUNKS_PRIME_2;
+    return streamtest_chunks_rotate(lane, 31) * STREAMTEST_CHUNKS_PRIME_1;
+}
+
+uint64_t streamtest_chunks_hash(const unsigned char* data, size_t length) {
+
+    uint64_t lanes[4] = {
+        STREAMTEST_CHUNKS_PRIME_1 + STREAMTEST_CHUNKS_PRIME_2,
+        STREAMTEST_CHUNKS_PRIME_2,
+        0,
+        -STREAMTEST_CHUNKS_PRIME_1
+    };
+
+    /* Bulk of data, 32 bytes at a time across independent lanes */
+    size_t offset = 0;
+    for (; offset + 32 <= length; offset += 32) {
+        for (int i = 0; i < 4; i++) {
+            uint64_t word;
+            memcpy(&word, data + offset + i * 8, sizeof(word));
+            lanes[i] = streamtest_chunks_round(lanes[i], word);
+        }
+    }
+
+    uint64_t hash = streamtest_chunks_rotate(lanes[0], 1)
+        + streamtest_chunks_rotate(lanes[1], 7)
+        + streamtest_chunks_rotate(lanes[2], 12)
+        + streamtest_chunks_rotate(lanes[3], 18);
+
+    hash ^= length * STREAMTEST_CHUNKS_PRIME_3;
+
+    /* Remaining whole words, then remaining bytes */
+    for (; offset + 8 <= length; offset += 8) {
+        uint64_t word;
+        memcpy(&word, data + offset, sizeof(word));
+        hash = streamtest_chunks_round(hash, word);
+    }
+
+    for (; offset < length; offset++)
+        hash = streamtest_chunks_round(hash, data[offset]);
+
+    /* Final avalanche */
+    hash ^= hash >> 33;
+    hash *= STREAMTEST_CHUNKS_PRIME_2;
+    hash ^= hash >> 29;
+    hash *= STREAMTEST_CHUNKS_PRIME_3;
+    hash ^= hash >> 32;
+
+    return hash;
+
+}
+
+bool streamtest_chunks_detect(int fd) {
+
+    char magic[STREAMTEST_CHUNKS_MAGIC_LENGTH];
+    return pread(fd, magic, sizeof(magic), 0) == sizeof(magic)
+        && memcmp(magic, STREAMTEST_CHUNKS_MAGIC, sizeof(magic)) == 0;
+
+}
+
+/**
+ * Verifies that the header and table of the given mapped file are
+ * consistent with each other and with the size of the file.
+ *
+ * @param data
+ *     The start of the mapping.
+ *
+ * @param size
+ *     The size of the mapping, in bytes.
+ *
+ * @return
+ *     true if the file is a valid, non-empty pre-chunked file written by a
+ *     host of the same byte order, false otherwise.
+ */
+static bool streamtest_chunks_valid(const unsigned char* data, size_t size) {
+
+    if (size < sizeof(streamtest_chunks_header))
+        return false;
+
+    const streamtest_chunks_header* header =
+        (const streamtest_chunks_header*) data;
+
+    if (memcmp(header->magic, STREAMTEST_CHUNKS_MAGIC,
+                STREAMTEST_CHUNKS_MAGIC_LENGTH) != 0
+            || header->byte_order != STREAMTEST_CHUNKS_BYTE_ORDER
+            || header->count == 0)
+        return false;
+
+    /* Table (and hashes, if any) must fit within file */
+    uint64_t table = (uint64_t) sizeof(streamtest_chunks_entry)
+        * ((uint64_t) header->count + 1);
+    if (header->flags & STREAMTEST_CHUNKS_HASHED)
+        table += sizeof(uint64_t) * (uint64_t) header->count;
+
+    if (header->count > INT32_MAX - 1
+            || table > size - sizeof(streamtest_chunks_header))
+        return false;
+
+    const streamtest_chunks_entry* entries =
+        (const streamtest_chunks_entry*) (header + 1);
+    uint64_t payload = size - sizeof(streamtest_chunks_header) - table;
+    bool encoded = header->flags & STREAMTEST_CHUNKS_BASE64;
+
+    /* Each chunk must lie within the payload, in order of time */
+    for (uint32_t i = 0; i < header->count; i++) {
+
+        const streamtest_chunks_entry* entry = &entries[i];
+        uint64_t length = streamtest_chunks_stored_length(entry->length,
+                encoded);
+
+        if (entry->offset > payload || length > payload - entry->offset
+                || entries[i + 1].timestamp < entry->timestamp)
+            return false;
+
+    }
+
+    return entries[0].timestamp >= 0;
+
+}
+
+streamtest_chunks* streamtest_chunks_map(int fd) {
+
+    struct stat stat_buf;
+    if (fstat(fd, &stat_buf))
+        return NULL;
+
+    size_t size = stat_buf.st_size;
+    if (size < sizeof(streamtest_chunks_header)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    void* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+        return NULL;
+
+    if (!streamtest_chunks_valid(data, size)) {
+        munmap(data, size);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    /* Chunks are generally read from start to finish */
+    posix_madvise(data, size, POSIX_MADV_SEQUENTIAL);
+
+    const streamtest_chunks_header* header =
+        (const streamtest_chunks_header*) data;
+
+    streamtest_chunks* chunks = malloc(sizeof(streamtest_chunks));
+    chunks->data = data;
+    chunks->size = size;
+    chunks->count = header->count;
+    chunks->encoded = header->flags & STREAMTEST_CHUNKS_BASE64;
+    chunks->indexed = header->flags & STREAMTEST_CHUNKS_INDEXED;
+    chunks->entries = (const streamtest_chunks_entry*) (header + 1);
+    chunks->payload = (const unsigned char*)
+        (chunks->entries + chunks->count + 1);
+    chunks->hashes = NULL;
+    chunks->shared = NULL;
+
+    /* Hashes precede the payload */
+    if (header->flags & STREAMTEST_CHUNKS_HASHED) {
+
+        chunks->hashes = (const uint64_t*) chunks->payload;
+        chunks->payload = (const unsigned char*)
+            (chunks->hashes + chunks->count);
+
+    }
+
+    return chunks;
+
+}
+
+int streamtest_chunks_find(const streamtest_chunks* chunks,
+        int64_t timestamp) {
+
+    /* Past the end of the final chunk */
+    if (timestamp >= chunks->entries[chunks->count].timestamp)
+        return chunks->count;
+
+    /* Binary search for the last chunk not later than the given time */
+    int low = 0;
+    int high = chunks->count - 1;
+    while (low < high) {
+
+        int middle = low + (high - low + 1) / 2;
+        if (chunks->entries[middle].timestamp <= timestamp)
+            low = middle;
+        else
+            high = middle - 1;
+
+    }
+
+    return low;
+
+}
+
+int streamtest_chunks_next_keyframe(const streamtest_chunks* chunks,
+        int chunk) {
+
+    while (chunk < chunks->count
+            && !(chunks->entries[chunk].flags & STREAMTEST_CHUNKS_KEYFRAME))
+        chunk++;
+
+    return chunk;
+
+}
+
+const unsigned char* streamtest_chunks_data(const streamtest_chunks* chunks,
+        int chunk) {
+
+    return chunks->payload + chunks->entries[chunk].offset;
+
+}
+
+void streamtest_chunks_unmap(streamtest_chunks* chunks) {
+    munmap(chunks->data, chunks->size);
+    free(chunks->shared);
+    free(chunks);
+}
+
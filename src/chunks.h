@@ -0,0 +1,338 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef STREAMTEST_CHUNKS_H
+#define STREAMTEST_CHUNKS_H
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The magic number at the beginning of all pre-chunked files.
+ */
+#define STREAMTEST_CHUNKS_MAGIC "GUACCHK1"
+
+/**
+ * The length of STREAMTEST_CHUNKS_MAGIC, in bytes.
+ */
+#define STREAMTEST_CHUNKS_MAGIC_LENGTH 8
+
+/**
+ * The value of the byte_order field of every pre-chunked file, as written
+ * in the native byte order of the host which wrote the file. Files written
+ * by a host of differing byte order will not contain this value, and cannot
+ * be mapped.
+ */
+#define STREAMTEST_CHUNKS_BYTE_ORDER 0x01020304
+
+/**
+ * Flag within the header of a pre-chunked file which indicates that the
+ * payload of each chunk is stored already base64-encoded, such that it can
+ * be written to the client without further processing.
+ */
+#define STREAMTEST_CHUNKS_BASE64 0x1
+
+/**
+ * Flag within the header of a pre-chunked file which indicates that the
+ * table marks each chunk which begins with a keyframe (see
+ * STREAMTEST_CHUNKS_KEYFRAME), such that playback may resume from those
+ * chunks without the chunks before them. Without this flag, the position of
+ * keyframes is unknown.
+ */
+#define STREAMTEST_CHUNKS_INDEXED 0x2
+
+/**
+ * Flag within the header of a pre-chunked file which indicates that the
+ * table is followed by count 64-bit content hashes, one per chunk, each
+ * being the streamtest_chunks_hash() of the media data of that chunk (before
+ * any base64 encoding). Hashes are not verified when the file is mapped, as
+ * that would read the entire file; chunks having equal hashes and lengths
+ * are instead compared byte for byte before being treated as identical, such
+ * that each is held in memory only once within the chunk store shared by
+ * all connections (see store.h).
+ */
+#define STREAMTEST_CHUNKS_HASHED 0x4
+
+/**
+ * Flag within an entry of the table of a pre-chunked file which indicates
+ * that the chunk begins with a keyframe. This flag is only meaningful if
+ * the file has the STREAMTEST_CHUNKS_INDEXED flag.
+ */
+#define STREAMTEST_CHUNKS_KEYFRAME 0x1
+
+/**
+ * The header at the beginning of every pre-chunked file. The header is
+ * immediately followed by count + 1 entries, the last of which marks the end
+ * of the final chunk, then by count content hashes if the file has the
+ * STREAMTEST_CHUNKS_HASHED flag, and then by the payload of all chunks. All
+ * values are in the native byte order of the host which wrote the file.
+ */
+typedef struct streamtest_chunks_header {
+
+    /**
+     * STREAMTEST_CHUNKS_MAGIC, without null terminator.
+     */
+    char magic[STREAMTEST_CHUNKS_MAGIC_LENGTH];
+
+    /**
+     * STREAMTEST_CHUNKS_BYTE_ORDER.
+     */
+    uint32_t byte_order;
+
+    /**
+     * Bitwise OR of all flags which apply to the file, such as
+     * STREAMTEST_CHUNKS_BASE64, STREAMTEST_CHUNKS_INDEXED or
+     * STREAMTEST_CHUNKS_HASHED.
+     */
+    uint32_t flags;
+
+    /**
+     * The number of chunks within the file.
+     */
+    uint32_t count;
+
+    /**
+     * Unused. Always zero.
+     */
+    uint32_t reserved;
+
+} streamtest_chunks_header;
+
+/**
+ * An entry within the table of a pre-chunked file, describing where a single
+ * chunk is stored and when it should be sent.
+ */
+typedef struct streamtest_chunks_entry {
+
+    /**
+     * The time at which the chunk should be sent, in microseconds relative to
+     * the start of the file. Timestamps never decrease from one entry to the
+     * next.
+     */
+    int64_t timestamp;
+
+    /**
+     * The offset of the chunk within the payload, in bytes.
+     */
+    uint64_t offset;
+
+    /**
+     * The number of bytes of media data within the chunk, before any
+     * base64 encoding.
+     */
+    uint32_t length;
+
+    /**
+     * Bitwise OR of all flags which apply to the chunk, such as
+     * STREAMTEST_CHUNKS_KEYFRAME. Always zero in files written before
+     * chunks could be flagged.
+     */
+    uint32_t flags;
+
+} streamtest_chunks_entry;
+
+/**
+ * A pre-chunked file which has been mapped into memory. Chunks are located
+ * purely through the table of the file, without parsing the media within.
+ */
+typedef struct streamtest_chunks {
+
+    /**
+     * The start of the mapping.
+     */
+    void* data;
+
+    /**
+     * The size of the mapping, in bytes.
+     */
+    size_t size;
+
+    /**
+     * The count + 1 entries of the table of the file.
+     */
+    const streamtest_chunks_entry* entries;
+
+    /**
+     * The payload of all chunks.
+     */
+    const unsigned char* payload;
+
+    /**
+     * The content hash of each chunk, or NULL if the file does not have the
+     * STREAMTEST_CHUNKS_HASHED flag.
+     */
+    const uint64_t* hashes;
+
+    /**
+     * The location of the data of each chunk within the chunk store, or NULL
+     * if the file has not been added to the chunk store and each chunk is
+     * read from its own payload. The location of each chunk is NULL until
+     * that chunk is first read through the store.
+     */
+    const unsigned char** shared;
+
+    /**
+     * The number of chunks within the file.
+     */
+    int count;
+
+    /**
+     * Whether the payload of each chunk is base64-encoded.
+     */
+    bool encoded;
+
+    /**
+     * Whether the table marks which chunks begin with a keyframe.
+     */
+    bool indexed;
+
+} streamtest_chunks;
+
+/**
+ * Returns the number of bytes occupied within the payload of a pre-chunked
+ * file by a chunk containing the given amount of media data.
+ *
+ * @param length
+ *     The number of bytes of media data within the chunk.
+ *
+ * @param encoded
+ *     Whether the payload is base64-encoded.
+ *
+ * @return
+ *     The number of bytes occupied by the chunk.
+ */
+uint64_t streamtest_chunks_stored_length(uint32_t length, bool encoded);
+
+/**
+ * Computes the content hash of the given data, as stored within hashed
+ * pre-chunked files. The data is consumed as four independent lanes of
+ * 64-bit words, such that 32 bytes are mixed per iteration without any
+ * dependency between lanes, allowing the compiler to vectorize the loop.
+ *
+ * @param data
+ *     The data to hash.
+ *
+ * @param length
+ *     The number of bytes of data to hash.
+ *
+ * @return
+ *     The 64-bit content hash of the given data.
+ */
+uint64_t streamtest_chunks_hash(const unsigned char* data, size_t length);
+
+/**
+ * Tests whether the file having the given file descriptor is a pre-chunked
+ * file, based on its first bytes. The position of the file descriptor is not
+ * changed.
+ *
+ * @param fd
+ *     The file descriptor of the regular file to test.
+ *
+ * @return
+ *     true if the file begins with STREAMTEST_CHUNKS_MAGIC, false otherwise.
+ */
+bool streamtest_chunks_detect(int fd);
+
+/**
+ * Maps the pre-chunked file having the given file descriptor into memory,
+ * verifying that its table describes only data within the file. The file
+ * descriptor may be closed once mapped.
+ *
+ * @param fd
+ *     The file descriptor of the pre-chunked file.
+ *
+ * @return
+ *     A newly-allocated streamtest_chunks, or NULL if the file cannot be
+ *     mapped, in which case errno is set appropriately. If the file is
+ *     malformed, empty or was written by a host of differing byte order,
+ *     errno is set to EINVAL.
+ */
+streamtest_chunks* streamtest_chunks_map(int fd);
+
+/**
+ * Returns the data of the given chunk within the payload of the file, as
+ * stored (base64-encoded if the file is encoded). Files added to the chunk
+ * store should instead be read with streamtest_store_data().
+ *
+ * @param chunks
+ *     The pre-chunked file containing the chunk.
+ *
+ * @param chunk
+ *     The index of the chunk.
+ *
+ * @return
+ *     The stored data of the chunk.
+ */
+const unsigned char* streamtest_chunks_data(const streamtest_chunks* chunks,
+        int chunk);
+
+/**
+ * Returns the index of the chunk which should be sent at the given time,
+ * being the last chunk whose timestamp is not later than the given time.
+ * Times beyond either end of the file are clamped to the first chunk or to
+ * the end of the file (the entry following the last chunk).
+ *
+ * @param chunks
+ *     The pre-chunked file to search.
+ *
+ * @param timestamp
+ *     The time to search for, in microseconds relative to the start of the
+ *     file.
+ *
+ * @return
+ *     The index of the matching entry, from zero to the number of chunks
+ *     inclusive.
+ */
+int streamtest_chunks_find(const streamtest_chunks* chunks,
+        int64_t timestamp);
+
+/**
+ * Returns the index of the first chunk at or after the given chunk which
+ * begins with a keyframe.
+ *
+ * @param chunks
+ *     The pre-chunked file to search, which must have a table marking
+ *     keyframes.
+ *
+ * @param chunk
+ *     The index of the chunk to begin searching from.
+ *
+ * @return
+ *     The index of the matching chunk, or the number of chunks if no chunk
+ *     at or after the given chunk begins with a keyframe.
+ */
+int streamtest_chunks_next_keyframe(const streamtest_chunks* chunks,
+        int chunk);
+
+/**
+ * Unmaps the given pre-chunked file, freeing all associated resources.
+ *
+ * @param chunks
+ *     The pre-chunked file to unmap.
+ */
+void streamtest_chunks_unmap(streamtest_chunks* chunks);
+
+#endif
+
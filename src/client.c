@@ -21,24 +21,38 @@
  */
 
 #include "config.h"
+#include "abr.h"
+#include "backpressure.h"
 #include "client.h"
+#include "command.h"
+#include "events.h"
+#include "follow.h"
+#include "metrics.h"
+#include "pcm.h"
+#include "playlist.h"
+#include "realtime.h"
+#include "recorder.h"
+#include "scheduler.h"
+#include "sender.h"
+#include "shaper.h"
+#include "source.h"
+#include "timing.h"
+#include "trace.h"
+#include "track.h"
 
 #include <guacamole/client.h>
 #include <guacamole/protocol.h>
 #include <guacamole/socket.h>
 
-#include <assert.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
 #include <unistd.h>
 
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-
 /**
  * NULL-terminated array of arguments accepted by this client plugin.
  */
@@ -47,17 +61,58 @@ const char* GUAC_CLIENT_ARGS[] = {
     "mimetype",
     "bytes-per-frame",
     "frame-usecs",
+    "bitrate",
+    "max-burst",
+    "shaper-bitrate",
+    "shaper-depth",
+    "shaper-quantum",
+    "trace",
+    "follow",
+    "sync-tolerance",
+    "loop",
+    "pcm-rate",
+    "pcm-channels",
+    "pcm-bits",
+    "max-lag",
+    "metrics-listen",
+    "record",
+    "events",
+    "backpressure",
+    "realtime",
+    "degrade-file",
+    "abr-policy",
+    "max-batch-delay",
+    "sleep-strategy",
+    "source-backend",
     NULL
 };
 
 /**
- * The array index of each argument accepted by this client plugin.
+ * The array index of each argument accepted by this client plugin. With the
+ * exception of IDX_FOLLOW, IDX_SYNC_TOLERANCE, IDX_LOOP, IDX_MAX_LAG,
+ * IDX_METRICS_LISTEN, IDX_RECORD, IDX_EVENTS, IDX_BACKPRESSURE, IDX_REALTIME,
+ * IDX_ABR_POLICY, IDX_MAX_BATCH_DELAY, IDX_SLEEP_STRATEGY and
+ * IDX_SOURCE_BACKEND, which apply to the connection as a whole, each argument
+ * may contain one value per line, with each line applying to a different
+ * track. The number of tracks is dictated by the number of lines within the
+ * IDX_FILENAME argument. If any other argument contains fewer lines than
+ * there are tracks, its last line applies to all remaining tracks.
  */
 enum STREAMTEST_ARGS_IDX {
 
     /**
      * The index of the argument containing the filename of the media file to
-     * be streamed.
+     * be streamed. If the filename begins with STREAMTEST_PLAYLIST_PREFIX,
+     * the remainder is the path to a playlist of sources to stream one after
+     * another, each with its own mimetype, and IDX_MIMETYPE is ignored. If
+     * the filename begins with STREAMTEST_RENDITIONS_PREFIX, the remainder
+     * is the path to a list of renditions of the same media at different
+     * bitrates, switched between as the throughput of the client changes,
+     * and IDX_MIMETYPE and IDX_BITRATE are ignored. If the filename begins
+     * with STREAMTEST_SOURCE_MIX_PREFIX, the remainder
+     * is the path to a description of several 16-bit raw PCM files to be
+     * mixed into one stream, and IDX_MIMETYPE must describe their common
+     * format.
      */
     IDX_FILENAME,
 
@@ -69,7 +124,9 @@ enum STREAMTEST_ARGS_IDX {
 
     /**
      * The index of the argument containing the number of bytes to stream from
-     * the provided file (per frame).
+     * the provided file (per frame). Image sequences are streamed one whole
+     * image per frame, and this is only the initial size of the buffer into
+     * which each frame is read.
      */
     IDX_BYTES_PER_FRAME,
 
@@ -79,6 +136,207 @@ enum STREAMTEST_ARGS_IDX {
      */
     IDX_FRAME_USECS,
 
+    /**
+     * The index of the argument containing the target bitrate of the stream,
+     * in bits per second. If specified, the frame size and duration are
+     * derived automatically, and IDX_BYTES_PER_FRAME and IDX_FRAME_USECS are
+     * ignored.
+     */
+    IDX_BITRATE,
+
+    /**
+     * The index of the argument containing the maximum number of bytes which
+     * may be sent within a single frame when the frame size is derived from
+     * IDX_BITRATE. This argument is optional.
+     */
+    IDX_MAX_BURST,
+
+    /**
+     * The index of the argument containing the sustained rate of the token
+     * bucket rate shaper, in bits per second. If omitted, no rate shaping is
+     * performed.
+     */
+    IDX_SHAPER_BITRATE,
+
+    /**
+     * The index of the argument containing the depth of the token bucket, in
+     * bytes. If omitted, the bucket will hold exactly one frame.
+     */
+    IDX_SHAPER_DEPTH,
+
+    /**
+     * The index of the argument containing the minimum number of bytes which
+     * the rate shaper may send at once. If omitted, any amount of data may be
+     * sent once tokens are available.
+     */
+    IDX_SHAPER_QUANTUM,
+
+    /**
+     * The index of the argument containing the filename of a traffic trace
+     * to replay. If specified, data is read from the media file in frames
+     * whose sizes and timing match the records of the trace, rather than in
+     * fixed-size frames at a fixed interval.
+     */
+    IDX_TRACE,
+
+    /**
+     * The index of the argument which specifies whether the media file is
+     * still being written and should be followed. If "true", reaching the
+     * end of the file does not end the stream. Instead, data appended to the
+     * file is streamed as soon as it is written.
+     */
+    IDX_FOLLOW,
+
+    /**
+     * The index of the argument containing the largest permitted difference
+     * in media time between any two tracks, in microseconds. If specified,
+     * the tracks of the connection are monitored for synchronization. This
+     * argument is optional.
+     */
+    IDX_SYNC_TOLERANCE,
+
+    /**
+     * The index of the argument which specifies whether each track should
+     * restart from the beginning once all data has been sent. If "true",
+     * tracks with a playlist restart from its first item, while all other
+     * tracks restart their only source.
+     */
+    IDX_LOOP,
+
+    /**
+     * The index of the argument containing the sample rate, in samples per
+     * second, that raw PCM audio should be converted to. If omitted, the
+     * sample rate of the source is kept.
+     */
+    IDX_PCM_RATE,
+
+    /**
+     * The index of the argument containing the number of channels that raw
+     * PCM audio should be down-mixed (or up-mixed) to. If omitted, the
+     * channels of the source are kept.
+     */
+    IDX_PCM_CHANNELS,
+
+    /**
+     * The index of the argument containing the number of bits per sample
+     * that raw PCM audio should be converted to, which must be 8 or 16. If
+     * omitted, the bit depth of the source is kept where supported by
+     * clients, and reduced to 16 bits otherwise. If any of IDX_PCM_RATE,
+     * IDX_PCM_CHANNELS or IDX_PCM_BITS is given, the mimetype of the track
+     * must describe raw PCM audio, such as "audio/L16;rate=48000,channels=2",
+     * and the frame size applies to the unconverted audio.
+     */
+    IDX_PCM_BITS,
+
+    /**
+     * The index of the argument containing the largest permitted lag between
+     * sending a sync instruction and the client acknowledging it, in
+     * milliseconds. While the client lags further behind than this, frames
+     * of image sequences are dropped rather than sent. If omitted,
+     * STREAMTEST_DEFAULT_MAX_LAG is used. If zero, frames are never dropped
+     * due to lag.
+     */
+    IDX_MAX_LAG,
+
+    /**
+     * The index of the argument containing the address at which metrics of
+     * all connections given the same address, by any process, should be
+     * exported in Prometheus text format. This may be a TCP port, which is
+     * bound on the loopback interface only, or STREAMTEST_METRICS_UNIX_PREFIX
+     * followed by the path of a UNIX domain socket. Only one process listens
+     * at a time; see STREAMTEST_METRICS_SHARED_DIR. If omitted, metrics are
+     * not exported.
+     */
+    IDX_METRICS_LISTEN,
+
+    /**
+     * The index of the argument containing the path of a file to which
+     * everything sent to the client should be recorded, in the format
+     * defined by recording.h, for later replay with streamtest-replay. If
+     * omitted, nothing is recorded.
+     */
+    IDX_RECORD,
+
+    /**
+     * The index of the argument containing the path prefix of dumps of the
+     * event log of the connection. If given, the most recent
+     * STREAMTEST_EVENTS_CAPACITY events of the connection are retained in
+     * memory and dumped, in the format defined by events.h, when F12 is
+     * pressed, when the process receives SIGUSR1, or when streaming fails.
+     * Dumps can be converted for viewing with streamtest-events. If
+     * omitted, no events are retained.
+     */
+    IDX_EVENTS,
+
+    /**
+     * The index of the argument containing the response to sustained
+     * backpressure from the socket: "none" (the default) to only measure
+     * and log backpressure, "drop" to drop images, "shrink" to read smaller
+     * raw frames, or "pause" to read no frames until congestion clears.
+     * Tracks which cannot respond as requested are paused. See
+     * streamtest_backpressure_policy.
+     */
+    IDX_BACKPRESSURE,
+
+    /**
+     * The index of the argument containing the response to a track falling
+     * more than a frame behind the wall clock: "none" (the default) to
+     * deliver every frame late, "drop" to skip stale data, "keyframe" to
+     * skip stale data and resume from the next keyframe of an indexed
+     * pre-chunked file, or "degrade" to switch to the lower-rate rendition
+     * given by IDX_DEGRADE_FILE before skipping stale data. Tracks which
+     * cannot respond as requested drop stale data, or fall back to
+     * delivering every frame late. See streamtest_realtime_policy.
+     */
+    IDX_REALTIME,
+
+    /**
+     * The index of the argument containing the path of a lower-rate
+     * rendition of the track's media, of the same type and duration, to
+     * switch to should the track fall behind while IDX_REALTIME is
+     * "degrade". The rendition and the original must be regular files
+     * which are either both pre-chunked or both not, and image sequences
+     * must be pre-chunked. The track may not have a playlist, trace or
+     * followed file. This argument is optional.
+     */
+    IDX_DEGRADE_FILE,
+
+    /**
+     * The index of the argument containing the name of the rate-selection
+     * policy choosing which rendition each track having several renditions
+     * should stream: "throughput" (the default), "lag" or "fixed". See
+     * streamtest_abr_find_policy().
+     */
+    IDX_ABR_POLICY,
+
+    /**
+     * The index of the argument containing the longest time, in
+     * microseconds, that any frame may be sent ahead of its deadline such
+     * that several frames may be read and sent at once. Tracks whose frames
+     * are shorter than this delay read as many whole frames as fit within it
+     * at each wakeup. Tracks replaying a trace and image sequences are
+     * never batched, while pre-chunked files are paced by their own
+     * timestamps regardless. If omitted, each frame is read separately.
+     */
+    IDX_MAX_BATCH_DELAY,
+
+    /**
+     * The index of the argument containing the name of the strategy by
+     * which the process-wide scheduler sleeps between frames: "slack",
+     * "spin", "timerfd", or empty for the default. As the scheduler is
+     * shared, the strategy of the most recent connection applies to all
+     * connections. See streamtest_sleep_parse_strategy().
+     */
+    IDX_SLEEP_STRATEGY,
+
+    /**
+     * The index of the argument containing the name of the backend through
+     * which regular files are read: "read" (the default), "mmap",
+     * "io_uring", "synthetic" or "pipe". See
+     * streamtest_source_find_backend().
+     */
+    IDX_SOURCE_BACKEND,
+
     /**
      * The number of arguments that should be given to guac_client_init. If
      * argc does not contain this value, something has gone horribly wrong.
@@ -87,9 +345,40 @@ enum STREAMTEST_ARGS_IDX {
 
 };
 
+/**
+ * The X11 keysym of the space key, which toggles whether playback is paused.
+ */
+#define STREAMTEST_KEYSYM_SPACE 0x0020
+
+/**
+ * The X11 keysym of the left arrow key, which seeks backward.
+ */
+#define STREAMTEST_KEYSYM_LEFT 0xFF51
+
+/**
+ * The X11 keysym of the up arrow key, which doubles the playback rate.
+ */
+#define STREAMTEST_KEYSYM_UP 0xFF52
+
+/**
+ * The X11 keysym of the right arrow key, which seeks forward.
+ */
+#define STREAMTEST_KEYSYM_RIGHT 0xFF53
+
+/**
+ * The X11 keysym of the down arrow key, which halves the playback rate.
+ */
+#define STREAMTEST_KEYSYM_DOWN 0xFF54
+
+/**
+ * The X11 keysym of the F12 key, which dumps the event log.
+ */
+#define STREAMTEST_KEYSYM_F12 0xFFC9
+
 /**
  * Handler which will be invoked when a key event is received along the socket
- * associated with the given guac_client.
+ * associated with the given guac_client. Key events are translated into
+ * commands which are applied by the sender.
  *
  * @param client
  *     The guac_client associated with the received key event.
@@ -110,9 +399,66 @@ static int streamtest_client_key_handler(guac_client* client, int keysym,
     /* Get stream state from client */
     streamtest_state* state = (streamtest_state*) client->data;
 
-    /* Toggle paused state when space is pressed */
-    if (pressed && keysym == 0x20)
-        state->paused = !state->paused;
+    streamtest_events_record(state->events, pressed
+            ? STREAMTEST_EVENT_KEY_PRESSED : STREAMTEST_EVENT_KEY_RELEASED,
+            STREAMTEST_EVENTS_NO_TRACK, keysym);
+
+    /* Only key presses are meaningful */
+    if (!pressed)
+        return 0;
+
+    bool queued;
+    switch (keysym) {
+
+        /* Toggle paused state when space is pressed */
+        case STREAMTEST_KEYSYM_SPACE:
+            queued = streamtest_command_queue_push(&state->commands,
+                    STREAMTEST_COMMAND_PAUSE, 0);
+            break;
+
+        /* Seek with left/right arrows */
+        case STREAMTEST_KEYSYM_LEFT:
+            queued = streamtest_command_queue_push(&state->commands,
+                    STREAMTEST_COMMAND_SEEK, -STREAMTEST_SEEK_USECS);
+            break;
+
+        case STREAMTEST_KEYSYM_RIGHT:
+            queued = streamtest_command_queue_push(&state->commands,
+                    STREAMTEST_COMMAND_SEEK, STREAMTEST_SEEK_USECS);
+            break;
+
+        /* Change rate with up/down arrows */
+        case STREAMTEST_KEYSYM_UP:
+            queued = streamtest_command_queue_push(&state->commands,
+                    STREAMTEST_COMMAND_RATE, 1);
+            break;
+
+        case STREAMTEST_KEYSYM_DOWN:
+            queued = streamtest_command_queue_push(&state->commands,
+                    STREAMTEST_COMMAND_RATE, -1);
+            break;
+
+        /* Dump event log with F12 */
+        case STREAMTEST_KEYSYM_F12:
+            queued = streamtest_command_queue_push(&state->commands,
+                    STREAMTEST_COMMAND_DUMP, 0);
+            break;
+
+        /* Ignore all other keys */
+        default:
+            return 0;
+
+    }
+
+    /* Commands are dropped, not blocked on, if the sender falls behind */
+    if (!queued) {
+        guac_client_log(client, GUAC_LOG_DEBUG, "Command queue is full. "
+                "Ignoring key %i.", keysym);
+        return 0;
+    }
+
+    /* Apply command immediately */
+    streamtest_sender_notify(state->sender);
 
     /* Success */
     return 0;
@@ -120,6 +466,33 @@ static int streamtest_client_key_handler(guac_client* client, int keysym,
 }
 
 
+/**
+ * Frees the given playback state, including all of its tracks. The sender of
+ * the connection, if any, must already have been freed.
+ *
+ * @param client
+ *     The guac_client associated with the given state.
+ *
+ * @param state
+ *     The state to free.
+ */
+static void streamtest_free_state(guac_client* client,
+        streamtest_state* state) {
+
+    for (int i = 0; i < state->track_count; i++)
+        streamtest_track_free(client, state->tracks[i]);
+
+    if (state->recorder != NULL)
+        streamtest_recorder_free(client, state->recorder);
+
+    if (state->events != NULL)
+        streamtest_events_free(state->events);
+
+    streamtest_metrics_free(state->metrics);
+    free(state);
+
+}
+
 /**
  * Handler which will be invoked when the data associated with the given
  * guac_client needs to be freed.
@@ -136,14 +509,11 @@ static int streamtest_client_free_handler(guac_client* client) {
     /* Get stream state from client */
     streamtest_state* state = (streamtest_state*) client->data;
 
-    /* Close file being streamed */
-    close(state->fd);
+    /* Stop streaming prior to freeing anything in use by the sender */
+    streamtest_sender_free(state->sender);
 
-    /* Free stream */
-    guac_client_free_stream(client, state->stream);
-
-    /* Free state itself */
-    free(state);
+    /* Free all tracks and the state itself */
+    streamtest_free_state(client, state);
 
     /* Success */
     return 0;
@@ -151,282 +521,867 @@ static int streamtest_client_free_handler(guac_client* client) {
 }
 
 /**
- * Writes the given buffer as a set of blob instructions to the given socket.
- * The buffer will be split into as many blob instructions as necessary.
+ * Derives the frame size and duration which achieve the given bitrate with
+ * as few instructions as possible. Frames are made as large as the jitter
+ * bound (STREAMTEST_MAX_JITTER_USECS) and maximum burst allow, and are
+ * rounded down to a whole number of maximum-size blobs where possible such
+ * that no frame ends with a partial blob.
+ *
+ * @param bitrate
+ *     The target bitrate, in bits per second.
  *
- * @param socket
- *     The guac_socket over which the blob instructions should be sent.
+ * @param max_burst
+ *     The maximum number of bytes to send in any one frame, or zero if there
+ *     is no limit beyond that imposed by the jitter bound.
  *
- * @param stream
- *     The stream to associate with each blob.
+ * @param frame_bytes
+ *     Pointer to the int which should receive the derived frame size, in
+ *     bytes.
  *
- * @param buffer
- *     The buffer containing the data that should be sent over the given
- *     guac_socket as blobs.
+ * @param frame_duration
+ *     Pointer to the int which should receive the derived frame duration, in
+ *     microseconds.
  *
- * @param length
- *     The number of bytes within the given buffer.
+ * @return
+ *     Zero if a suitable frame size and duration were derived, non-zero if
+ *     the maximum burst is too small to achieve the requested bitrate.
  */
-static void streamtest_write_blobs(guac_socket* socket, guac_stream* stream,
-        unsigned char* buffer, int length) {
+static int streamtest_derive_frame_rate(int bitrate, int max_burst,
+        int* frame_bytes, int* frame_duration) {
 
-    /* Flush all data in buffer as blobs */
-    while (length > 0) {
+    /* Largest frame which stays within jitter bound */
+    int64_t bytes = (int64_t) bitrate * STREAMTEST_MAX_JITTER_USECS / 8000000;
 
-        /* Determine size of blob to be written */
-        int chunk_size = length;
-        if (chunk_size > 6048)
-            chunk_size = 6048;
+    /* Further limit by maximum burst, if any */
+    if (max_burst > 0 && bytes > max_burst)
+        bytes = max_burst;
 
-        /* Send audio data */
-        guac_protocol_send_blob(socket, stream, buffer, chunk_size);
+    /* Avoid partial blobs */
+    if (bytes >= STREAMTEST_BLOB_SIZE)
+        bytes -= bytes % STREAMTEST_BLOB_SIZE;
+    else if (bytes < 1)
+        bytes = 1;
 
-        /* Advance to next blob */
-        buffer += chunk_size;
-        length -= chunk_size;
+    /* Derive duration from final frame size, rounding to nearest */
+    int64_t duration = (bytes * 8000000 + bitrate / 2) / bitrate;
+    if (duration < STREAMTEST_MIN_FRAME_USECS)
+        return 1;
 
-    }
+    *frame_bytes = bytes;
+    *frame_duration = duration;
+    return 0;
 
 }
 
 /**
- * Attempts to fill the given buffer with bytes from the provided file
- * descriptor, returning the number of bytes successfully read. Multiple read
- * attempts will be made automatically until the entire buffer is full, end-of-
- * file is encountered, or an error occurs.
+ * Returns the number of lines within the given argument. A trailing newline
+ * does not begin a new line.
  *
- * @param fd
- *     The file descriptor to read data from.
- *
- * @param buffer
- *     The buffer into which data should be read.
- *
- * @param length
- *     The number of bytes to store within the given buffer.
+ * @param arg
+ *     The argument whose lines should be counted.
  *
  * @return
- *     The number of bytes read. This will ALWAYS be the size of the buffer
- *     unless end-of-file is encountered or an error occurs. If end-of-file is
- *     reached, zero is returned. If an error occurs, -1 is returned, and errno
- *     is set appropriately.
+ *     The number of lines within the given argument, which is always at
+ *     least one.
  */
-static int streamtest_fill_buffer(int fd, unsigned char* buffer, int length) {
+static int streamtest_count_lines(const char* arg) {
+
+    int count = 1;
 
-    int bytes_read = 0;
+    const char* newline = strchr(arg, '\n');
+    while (newline != NULL && newline[1] != '\0') {
+        newline = strchr(newline + 1, '\n');
+        count++;
+    }
+
+    return count;
 
-    /* Continue reading until buffer is full */
-    while (length > 0) {
+}
 
-        /* Attempt to fill remaining space in buffer */
-        int result = read(fd, buffer, length);
+/**
+ * Returns a newly-allocated copy of the line of the given argument which
+ * applies to the track having the given index. If the argument has fewer
+ * lines than required, its last line is returned.
+ *
+ * @param arg
+ *     The argument to retrieve a line from.
+ *
+ * @param index
+ *     The index of the track whose value should be returned.
+ *
+ * @return
+ *     A newly-allocated string containing the value of the argument for the
+ *     given track, without any line terminator. This string must eventually
+ *     be freed with free().
+ */
+static char* streamtest_track_arg(const char* arg, int index) {
 
-        /* Stop if end-of-file is reached */
-        if (result == 0)
-            return bytes_read;
+    /* Advance to requested line, stopping at the last */
+    const char* line = arg;
+    for (int i = 0; i < index; i++) {
 
-        /* Abort on error */
-        if (result == -1)
-            return -1;
+        const char* newline = strchr(line, '\n');
+        if (newline == NULL || newline[1] == '\0')
+            break;
 
-        /* Advance to next block of data (if any) */
-        bytes_read += result;
-        buffer += result;
-        length -= result;
+        line = newline + 1;
 
     }
 
-    return bytes_read;
+    return strndup(line, strcspn(line, "\r\n"));
 
 }
 
 /**
- * Returns an arbitrary timestamp in microseconds. This timestamp is relative
- * only to previous calls of streamtest_utime() and is intended only for the
- * sake of determining relative or elapsed time.
+ * Verifies that the given source spec, if a mix, is paired with a mimetype
+ * describing 16-bit raw PCM audio, the only format which can be mixed.
+ *
+ * @param client
+ *     The guac_client associated with the connection being streamed.
+ *
+ * @param spec
+ *     The spec of the source to verify.
+ *
+ * @param mimetype
+ *     The mimetype of the media provided by the source.
  *
  * @return
- *     An arbitrary timestamp in microseconds.
+ *     Zero if the source is not a mix or can be mixed, non-zero otherwise.
  */
-static int streamtest_utime() {
+static int streamtest_check_mix(guac_client* client, const char* spec,
+        const char* mimetype) {
 
-    struct timespec current;
+    if (strncmp(spec, STREAMTEST_SOURCE_MIX_PREFIX,
+                strlen(STREAMTEST_SOURCE_MIX_PREFIX)) != 0)
+        return 0;
 
-    /* Get current time */
-    clock_gettime(CLOCK_REALTIME, &current);
+    streamtest_pcm_format format;
+    if (streamtest_pcm_parse_format(mimetype, &format) || format.bits != 16) {
+        guac_client_log(client, GUAC_LOG_ERROR, "Mix \"%s\" must be 16-bit "
+                "raw PCM audio, not \"%s\"", spec, mimetype);
+        return 1;
+    }
 
-    /* Calculate microseconds */
-    return (int) (current.tv_sec * 1000000 + current.tv_nsec / 1000);
+    return 0;
 
 }
 
 /**
- * Suspends execution for the given number of microseconds.
+ * Opens the lower-rate rendition of a single track, if any, verifying that
+ * the track can switch to it from its original source.
+ *
+ * @param client
+ *     The guac_client associated with the connection being streamed.
+ *
+ * @param argv
+ *     The values of all arguments which apply to the track, in the same
+ *     order as GUAC_CLIENT_ARGS.
+ *
+ * @param source
+ *     The original source of the track.
  *
- * @param usecs
- *     The number of microseconds to sleep for.
+ * @param mode
+ *     The playback mode of the track.
+ *
+ * @param playlist
+ *     The playlist of the track, or NULL if the track streams only one
+ *     source.
+ *
+ * @param rendition
+ *     Storage for the newly-opened source of the rendition, or NULL if the
+ *     track has no lower-rate rendition.
+ *
+ * @return
+ *     Zero if the rendition was opened or none was requested, non-zero if
+ *     the rendition cannot be opened or switched to.
  */
-static void streamtest_usleep(int usecs) {
+static int streamtest_open_rendition(guac_client* client, char** argv,
+        streamtest_source* source, streamtest_playback_mode mode,
+        streamtest_playlist* playlist, streamtest_source** rendition) {
+
+    *rendition = NULL;
+
+    const char* path = argv[IDX_DEGRADE_FILE];
+    if (path[0] == '\0')
+        return 0;
+
+    /* Switching is only possible at a known position within one file */
+    if (playlist != NULL || argv[IDX_TRACE][0] != '\0'
+            || strcmp(argv[IDX_FOLLOW], "true") == 0) {
+        guac_client_log(client, GUAC_LOG_ERROR, "Lower-rate rendition "
+                "\"%s\" cannot be combined with a playlist, trace or "
+                "followed file", path);
+        return 1;
+    }
 
-    /* Calculate sleep duration in seconds and nanoseconds */
-    struct timespec sleep_duration = {
-        .tv_sec  =  usecs / 1000000,
-        .tv_nsec = (usecs % 1000000) * 1000
-    };
+    streamtest_source* opened = streamtest_source_open(path,
+            streamtest_source_find_backend(argv[IDX_SOURCE_BACKEND]));
+    if (opened == NULL) {
+        guac_client_log(client, GUAC_LOG_ERROR, "Unable to open lower-rate "
+                "rendition \"%s\": %s", path, strerror(errno));
+        return 1;
+    }
+
+    /* Positions must be comparable between the two files */
+    bool chunked = streamtest_source_chunked(source, NULL);
+    if (!source->seekable || !opened->seekable
+            || source->type == STREAMTEST_SOURCE_MIX
+            || opened->type == STREAMTEST_SOURCE_MIX
+            || streamtest_source_chunked(opened, NULL) != chunked
+            || (mode == STREAMTEST_IMAGE && !chunked)) {
+        guac_client_log(client, GUAC_LOG_ERROR, "Lower-rate rendition "
+                "\"%s\" and \"%s\" must be regular files which are both "
+                "pre-chunked or both not (image sequences must be "
+                "pre-chunked)", path, argv[IDX_FILENAME]);
+        streamtest_source_close(opened);
+        return 1;
+    }
 
-    /* Sleep for specified amount of time */
-    nanosleep(&sleep_duration, NULL);
+    guac_client_log(client, GUAC_LOG_DEBUG, "Opened lower-rate rendition "
+            "\"%s\" of \"%s\"", path, argv[IDX_FILENAME]);
+
+    *rendition = opened;
+    return 0;
 
 }
 
 /**
- * Display a progress bar which indicates the current stream status.
+ * Opens the sources of all renditions of a single track, verifying that the
+ * track can switch between them. The source of the first rendition, having
+ * the lowest bitrate, has already been opened as the source of the track.
  *
  * @param client
- *     The guac_client associated with the libguac-client-streamtest
- *     connection whose current status should be redrawn.
+ *     The guac_client associated with the connection being streamed.
+ *
+ * @param argv
+ *     The values of all arguments which apply to the track, in the same
+ *     order as GUAC_CLIENT_ARGS.
+ *
+ * @param source
+ *     The source of the first rendition.
+ *
+ * @param mode
+ *     The playback mode of the first rendition, which all renditions must
+ *     share.
+ *
+ * @param renditions
+ *     The renditions of the track. On success, the source of each rendition
+ *     is open, and the given source is owned by the renditions.
+ *
+ * @return
+ *     Zero if all renditions were opened, non-zero if any rendition cannot
+ *     be opened or switched to, in which case no sources other than the
+ *     given source remain open.
  */
-static void streamtest_render_progress(guac_client* client) {
-
-    /* Get stream state from client */
-    streamtest_state* state = (streamtest_state*) client->data;
+static int streamtest_open_renditions(guac_client* client, char** argv,
+        streamtest_source* source, streamtest_playback_mode mode,
+        streamtest_renditions* renditions) {
+
+    /* Switching is only possible at known positions within files */
+    if (argv[IDX_TRACE][0] != '\0' || strcmp(argv[IDX_FOLLOW], "true") == 0
+            || argv[IDX_DEGRADE_FILE][0] != '\0') {
+        guac_client_log(client, GUAC_LOG_ERROR, "Renditions cannot be "
+                "combined with a trace, followed file or lower-rate "
+                "rendition");
+        return 1;
+    }
 
-    /* Only render progress bar for audio streams */
-    if (state->mode != STREAMTEST_AUDIO)
-        return;
+    const streamtest_source_backend* backend =
+        streamtest_source_find_backend(argv[IDX_SOURCE_BACKEND]);
+    renditions->items[0].source = source;
+    bool chunked = streamtest_source_chunked(source, NULL);
+
+    int opened;
+    for (opened = 0; opened < renditions->count; opened++) {
+
+        streamtest_rendition* rendition = &renditions->items[opened];
+        if (rendition->source == NULL) {
+            rendition->source = streamtest_source_open(rendition->spec,
+                    backend);
+            if (rendition->source == NULL) {
+                guac_client_log(client, GUAC_LOG_ERROR, "Unable to open "
+                        "rendition \"%s\": %s", rendition->spec,
+                        strerror(errno));
+                break;
+            }
+        }
 
-    /* Get current position within file */
-    int position = lseek(state->fd, 0, SEEK_CUR);
-    if (position == -1) {
-        guac_client_log(client, GUAC_LOG_WARNING,
-                "Unable to determine current position in stream: %s",
-                strerror(errno));
-        return;
-    }
+        /* Raw PCM is converted with a format fixed for the whole track */
+        streamtest_pcm_format format;
+        if (streamtest_pcm_parse_format(rendition->mimetype, &format) == 0) {
+            guac_client_log(client, GUAC_LOG_ERROR, "Rendition \"%s\" "
+                    "cannot be switched to, as raw PCM audio cannot have "
+                    "renditions", rendition->spec);
+            break;
+        }
 
-    /*
-     * Render background
-     */
+        /* Positions must be comparable between all renditions */
+        streamtest_playback_mode rendition_mode;
+        if (!rendition->source->seekable
+                || rendition->source->type == STREAMTEST_SOURCE_MIX
+                || streamtest_source_chunked(rendition->source, NULL)
+                    != chunked
+                || streamtest_track_mode(rendition->mimetype,
+                    &rendition_mode) || rendition_mode != mode
+                || (mode == STREAMTEST_IMAGE && !chunked)) {
+            guac_client_log(client, GUAC_LOG_ERROR, "Rendition \"%s\" "
+                    "cannot be switched to, as all renditions must be "
+                    "regular files of the same kind of media which are "
+                    "either all pre-chunked or all not (image sequences "
+                    "must be pre-chunked)", rendition->spec);
+            break;
+        }
 
-    guac_protocol_send_rect(client->socket,
-            GUAC_DEFAULT_LAYER,
-            0, 0, STREAMTEST_PROGRESS_WIDTH, STREAMTEST_PROGRESS_HEIGHT);
+        guac_client_log(client, GUAC_LOG_DEBUG, "Opened rendition \"%s\" "
+                "(\"%s\" at %i bits per second)", rendition->spec,
+                rendition->mimetype, rendition->bitrate);
 
-    guac_protocol_send_cfill(client->socket,
-            GUAC_COMP_OVER, GUAC_DEFAULT_LAYER,
-            0x40, 0x40, 0x40, 0xFF);
+    }
 
-    /*
-     * Render progress
-     */
+    if (opened == renditions->count)
+        return 0;
 
-    guac_protocol_send_rect(client->socket,
-            GUAC_DEFAULT_LAYER, 0, 0,
-            (position+1) / ((state->file_size+1) / STREAMTEST_PROGRESS_WIDTH),
-            STREAMTEST_PROGRESS_HEIGHT);
+    /* Close everything but the given source on failure */
+    for (int i = 1; i < renditions->count; i++) {
+        if (renditions->items[i].source != NULL) {
+            streamtest_source_close(renditions->items[i].source);
+            renditions->items[i].source = NULL;
+        }
+    }
 
-    if (state->paused)
-        guac_protocol_send_cfill(client->socket,
-                GUAC_COMP_OVER, GUAC_DEFAULT_LAYER,
-                0x80, 0x80, 0x00, 0xFF);
-    else
-        guac_protocol_send_cfill(client->socket,
-                GUAC_COMP_OVER, GUAC_DEFAULT_LAYER,
-                0x00, 0x80, 0x00, 0xFF);
+    renditions->items[0].source = NULL;
+    return 1;
 
 }
 
 /**
- * Called periodically by guacd whenever the plugin should handle accumulated
- * data and render a frame.
+ * Opens the source of a single track and begins its stream, validating all
+ * arguments specific to that track. If the track has a playlist, the
+ * filename and mimetype arguments must be those of its first item.
  *
  * @param client
- *     The guac_client associated with the plugin that should render a frame.
+ *     The guac_client associated with the connection being streamed.
+ *
+ * @param index
+ *     The index of the track to open.
+ *
+ * @param argv
+ *     The values of all arguments which apply to the track, in the same
+ *     order as GUAC_CLIENT_ARGS.
+ *
+ * @param playlist
+ *     The playlist of the track, or NULL if the track streams only one
+ *     source. On success, the playlist is owned by the track.
+ *
+ * @param renditions
+ *     The renditions of the track, or NULL if the track streams a single
+ *     encoding. If given, the filename, mimetype and bitrate arguments must
+ *     be those of the first rendition. On success, the renditions are owned
+ *     by the track.
  *
  * @return
- *     Non-zero if an error occurs, zero otherwise.
+ *     A newly-allocated streamtest_track, or NULL if the track cannot be
+ *     opened.
  */
-static int streamtest_client_message_handler(guac_client* client) {
+static streamtest_track* streamtest_open_track(guac_client* client,
+        int index, char** argv, streamtest_playlist* playlist,
+        streamtest_renditions* renditions) {
 
-    /* Get stream state from client */
-    streamtest_state* state = (streamtest_state*) client->data;
+    /* Determine playback mode from mimetype */
+    streamtest_playback_mode mode;
+    if (streamtest_track_mode(argv[IDX_MIMETYPE], &mode)) {
+        guac_client_log(client, GUAC_LOG_ERROR,
+                "Invalid media type \"%s\" (not audio nor video)",
+                argv[IDX_MIMETYPE]);
+        return NULL;
+    }
 
-    int frame_start;
-    int frame_duration;
+    if (streamtest_check_mix(client, argv[IDX_FILENAME], argv[IDX_MIMETYPE]))
+        return NULL;
 
-    /* Record start of frame */
-    frame_start = streamtest_utime();
+    guac_client_log(client, GUAC_LOG_DEBUG,
+            "Recognized type \"%s\" of stream %i as %s",
+            argv[IDX_MIMETYPE], index,
+            mode == STREAMTEST_AUDIO ? "audio"
+            : mode == STREAMTEST_VIDEO ? "video" : "an image sequence");
 
-    /* Read from stream and write as blob(s) */
-    if (!state->paused) {
+    /* Derive frame duration/size from bitrate, if given */
+    int frame_bytes;
+    int frame_duration;
+    if (argv[IDX_BITRATE][0] != '\0') {
 
-        /* Attempt to fill the available buffer space */
-        int length = streamtest_fill_buffer(state->fd,
-                state->frame_buffer, state->frame_bytes);
+        int bitrate = atoi(argv[IDX_BITRATE]);
+        int max_burst = atoi(argv[IDX_MAX_BURST]);
 
-        /* Abort connection if we cannot read */
-        if (length == -1) {
+        if (bitrate <= 0) {
             guac_client_log(client, GUAC_LOG_ERROR,
-                    "Unable to read from specified file: %s",
-                    strerror(errno));
-            return 1;
+                    "Invalid bitrate \"%s\"", argv[IDX_BITRATE]);
+            return NULL;
+        }
+
+        if (streamtest_derive_frame_rate(bitrate, max_burst,
+                    &frame_bytes, &frame_duration)) {
+            guac_client_log(client, GUAC_LOG_ERROR,
+                    "Maximum burst of %i bytes is too small for a bitrate of "
+                    "%i bits per second", max_burst, bitrate);
+            return NULL;
         }
 
-        /* Write all data read as blobs */
-        if (length > 0)
-            streamtest_write_blobs(client->socket, state->stream,
-                    state->frame_buffer, length);
+        guac_client_log(client, GUAC_LOG_DEBUG,
+                "Derived frame size from requested bitrate of %i bits per "
+                "second (actual bitrate will be %i bits per second)", bitrate,
+                (int) ((int64_t) frame_bytes * 8000000 / frame_duration));
+
+    }
+
+    /* Otherwise use explicit frame duration/size */
+    else {
+        frame_duration = atoi(argv[IDX_FRAME_USECS]);
+        frame_bytes    = atoi(argv[IDX_BYTES_PER_FRAME]);
+    }
+
+    /* Coalesce frames shorter than the permitted batching delay into
+     * batches read and sent at once, scaling size and duration alike such
+     * that the average rate is unchanged */
+    int batch = 1;
+    int max_batch_delay = atoi(argv[IDX_MAX_BATCH_DELAY]);
+    if (frame_bytes > 0 && frame_duration > 0
+            && max_batch_delay >= frame_duration * 2
+            && argv[IDX_TRACE][0] == '\0' && mode != STREAMTEST_IMAGE) {
+
+        batch = max_batch_delay / frame_duration;
+        if (batch > INT_MAX / frame_bytes)
+            batch = INT_MAX / frame_bytes;
 
-        /* Disconnect on EOF */
-        else {
-            guac_client_log(client, GUAC_LOG_INFO, "Media streaming complete");
-            guac_client_stop(client);
+        frame_bytes *= batch;
+        frame_duration *= batch;
+
+        guac_client_log(client, GUAC_LOG_DEBUG, "Batching %i frames of "
+                "stream %i into each read", batch, index);
+
+    }
+
+    /* Abort if frame duration/size are nonsensical. Frames shorter than the
+     * minimum are permitted only if batched. */
+    if (frame_bytes <= 0 || frame_duration < STREAMTEST_MIN_FRAME_USECS) {
+        guac_client_log(client, GUAC_LOG_ERROR, "Frames must contain at "
+                "least one byte and last at least %i microseconds",
+                STREAMTEST_MIN_FRAME_USECS);
+        return NULL;
+    }
+
+    /* Shape output with token bucket, if requested */
+    int shaper_bitrate = 0;
+    int shaper_depth = frame_bytes;
+    int shaper_quantum = 1;
+    if (argv[IDX_SHAPER_BITRATE][0] != '\0') {
+
+        shaper_bitrate = atoi(argv[IDX_SHAPER_BITRATE]);
+
+        if (argv[IDX_SHAPER_DEPTH][0] != '\0')
+            shaper_depth = atoi(argv[IDX_SHAPER_DEPTH]);
+
+        if (argv[IDX_SHAPER_QUANTUM][0] != '\0')
+            shaper_quantum = atoi(argv[IDX_SHAPER_QUANTUM]);
+
+        /* The bucket must be able to hold at least one quantum */
+        if (shaper_bitrate <= 0 || shaper_quantum <= 0
+                || shaper_depth < shaper_quantum) {
+            guac_client_log(client, GUAC_LOG_ERROR, "Rate shaper requires a "
+                    "positive bitrate and a bucket depth no smaller than its "
+                    "quantum");
+            return NULL;
         }
 
+        guac_client_log(client, GUAC_LOG_DEBUG, "Shaping output to %i bits "
+                "per second (bucket depth %i bytes, quantum %i bytes)",
+                shaper_bitrate, shaper_depth, shaper_quantum);
+
+    }
+
+    /* Convert raw PCM audio, if requested */
+    streamtest_pcm_format pcm_output = {
+        .rate     = atoi(argv[IDX_PCM_RATE]),
+        .channels = atoi(argv[IDX_PCM_CHANNELS]),
+        .bits     = atoi(argv[IDX_PCM_BITS])
+    };
+
+    if (pcm_output.rate < 0 || pcm_output.channels < 0
+            || pcm_output.channels > STREAMTEST_PCM_MAX_CHANNELS
+            || (pcm_output.bits != 0 && pcm_output.bits != 8
+                && pcm_output.bits != 16)) {
+        guac_client_log(client, GUAC_LOG_ERROR, "PCM conversion requires a "
+                "positive sample rate, between 1 and %i channels, and 8 or 16 "
+                "bits per sample", STREAMTEST_PCM_MAX_CHANNELS);
+        return NULL;
     }
 
-    /* Update progress bar */
-    streamtest_render_progress(client);
-    guac_socket_flush(client->socket);
+    streamtest_pcm_format pcm_input;
+    if ((pcm_output.rate != 0 || pcm_output.channels != 0
+                || pcm_output.bits != 0)
+            && streamtest_pcm_parse_format(argv[IDX_MIMETYPE], &pcm_input)) {
+        guac_client_log(client, GUAC_LOG_ERROR, "PCM conversion requires raw "
+                "PCM audio, not \"%s\"", argv[IDX_MIMETYPE]);
+        return NULL;
+    }
+
+    /* Attempt to open specified source, abort on error (the backend was
+     * validated as the connection began) */
+    const streamtest_source_backend* backend =
+        streamtest_source_find_backend(argv[IDX_SOURCE_BACKEND]);
+    streamtest_source* source = streamtest_source_open(argv[IDX_FILENAME],
+            backend);
+    if (source == NULL) {
+        guac_client_log(client, GUAC_LOG_ERROR,
+                "Unable to open \"%s\": %s",
+                argv[IDX_FILENAME], strerror(errno));
+        return NULL;
+    }
 
-    /* Sleep for remainder of frame */
-    frame_duration = streamtest_utime() - frame_start;
-    if (frame_duration < state->frame_duration)
-        streamtest_usleep(state->frame_duration - frame_duration);
+    /* Only regular files have a known size */
+    int file_size = streamtest_source_size(source);
+    if (source->seekable && file_size == -1) {
+        guac_client_log(client, GUAC_LOG_ERROR,
+                "Unable to determine size of file \"%s\": %s",
+                argv[IDX_FILENAME], strerror(errno));
+        streamtest_source_close(source);
+        return NULL;
+    }
 
-    /* Warn (at debug level) if frame takes too long */
+    if (source->seekable)
+        guac_client_log(client, GUAC_LOG_DEBUG,
+                "Successfully opened file \"%s\" (%i bytes)",
+                argv[IDX_FILENAME], file_size);
     else
         guac_client_log(client, GUAC_LOG_DEBUG,
-                "Frame took longer than requested duration: %i microseconds",
-                frame_duration);
+                "Successfully opened \"%s\" (non-seekable stream)",
+                argv[IDX_FILENAME]);
+
+    /* Pre-chunked files carry their own timing, and are streamed exactly as
+     * stored */
+    streamtest_source_layout layout;
+    if (streamtest_source_chunked(source, &layout)) {
+
+        if (argv[IDX_TRACE][0] != '\0' || pcm_output.rate != 0
+                || pcm_output.channels != 0 || pcm_output.bits != 0) {
+            guac_client_log(client, GUAC_LOG_ERROR, "Pre-chunked file "
+                    "\"%s\" cannot be combined with a trace or PCM "
+                    "conversion", argv[IDX_FILENAME]);
+            streamtest_source_close(source);
+            return NULL;
+        }
 
-    /* Success */
-    return 0;
+        guac_client_log(client, GUAC_LOG_DEBUG, "File \"%s\" is "
+                "pre-chunked (%i chunks%s)", argv[IDX_FILENAME],
+                layout.count, layout.encoded ? ", base64-encoded" : "");
+
+    }
+
+    /* Open lower-rate rendition in advance, such that switching incurs no
+     * delay */
+    streamtest_source* rendition;
+    if (streamtest_open_rendition(client, argv, source, mode, playlist,
+                &rendition)) {
+        streamtest_source_close(source);
+        return NULL;
+    }
+
+    /* Open all renditions in advance, such that switching incurs no
+     * delay */
+    if (renditions != NULL && streamtest_open_renditions(client, argv,
+                source, mode, renditions)) {
+        streamtest_source_close(source);
+        return NULL;
+    }
+
+    /* Allocate track */
+    streamtest_track* track = malloc(sizeof(streamtest_track));
+    track->index = index;
+    track->mode = mode;
+    track->progress_y = 0;
+
+    /* Set frame duration/size */
+    track->frame_duration = frame_duration;
+    track->frame_bytes    = frame_bytes;
+    track->batch          = batch;
+
+    /* Allocate token bucket if shaping */
+    if (shaper_bitrate > 0) {
+        track->shaper = malloc(sizeof(streamtest_shaper));
+        streamtest_shaper_init(track->shaper, shaper_bitrate, shaper_depth,
+                shaper_quantum, streamtest_utime());
+        track->buffer_size = frame_bytes + shaper_depth;
+    }
+
+    /* Otherwise, data is sent as soon as each frame is read */
+    else {
+        track->shaper = NULL;
+        track->buffer_size = frame_bytes;
+    }
+
+    /* Open trace and read first record, if replaying */
+    track->trace = NULL;
+    track->trace_delta = 0;
+    track->trace_complete = false;
+    if (argv[IDX_TRACE][0] != '\0') {
+
+        track->trace = streamtest_trace_open(argv[IDX_TRACE]);
+        if (track->trace == NULL) {
+            guac_client_log(client, GUAC_LOG_ERROR,
+                    "Unable to open trace \"%s\": %s",
+                    argv[IDX_TRACE], strerror(errno));
+            streamtest_source_close(source);
+            free(track->shaper);
+            free(track);
+            return NULL;
+        }
+
+        if (streamtest_trace_next(track->trace, &track->trace_record) <= 0) {
+            guac_client_log(client, GUAC_LOG_ERROR,
+                    "Trace \"%s\" contains no valid records",
+                    argv[IDX_TRACE]);
+            streamtest_trace_close(track->trace);
+            streamtest_source_close(source);
+            free(track->shaper);
+            free(track);
+            return NULL;
+        }
+
+        guac_client_log(client, GUAC_LOG_DEBUG, "Replaying %s trace \"%s\"",
+                track->trace->format == STREAMTEST_TRACE_BINARY
+                    ? "binary" : "CSV", argv[IDX_TRACE]);
+
+    }
+
+    /* Watch for appended data if following a regular file (data from
+     * non-seekable sources is always streamed as it arrives, and need not be
+     * followed, while mixes always end with their longest input) */
+    track->follow = NULL;
+    track->live = false;
+    if (strcmp(argv[IDX_FOLLOW], "true") == 0
+            && source->type == STREAMTEST_SOURCE_FILE) {
+
+        track->follow = streamtest_follow_alloc(argv[IDX_FILENAME]);
+        if (track->follow == NULL) {
+            guac_client_log(client, GUAC_LOG_ERROR,
+                    "Unable to follow \"%s\": %s",
+                    argv[IDX_FILENAME], strerror(errno));
+            if (track->trace != NULL)
+                streamtest_trace_close(track->trace);
+            streamtest_source_close(source);
+            free(track->shaper);
+            free(track);
+            return NULL;
+        }
+
+        guac_client_log(client, GUAC_LOG_DEBUG, "Following \"%s\" for "
+                "appended data", argv[IDX_FILENAME]);
+
+    }
+
+    track->frame_buffer = malloc(track->buffer_size);
+    track->buffer_length = 0;
+    track->eof = false;
+    track->watch = NULL;
+    track->next_frame = 0;
+    track->media_time = 0;
+    track->media_start = 0;
+    track->source = source;
+    track->source_backend = backend;
+    track->file_size = file_size;
+    memset(&track->stats, 0, sizeof(track->stats));
+
+    /* Open the next item in advance, if any */
+    track->playlist = playlist;
+    track->loop = (strcmp(argv[IDX_LOOP], "true") == 0);
+    track->item = 0;
+    track->switch_pending = false;
+    streamtest_track_prefetch(client, track);
+
+    /* Read the first frames ahead in the background, such that the first
+     * frame need not wait on the disk once streaming begins */
+    streamtest_source_prefetch(source,
+            STREAMTEST_STARTUP_FRAMES * track->buffer_size);
+
+    /* Streaming begins with the rendition of lowest bitrate, if any */
+    track->renditions = renditions;
+    if (renditions != NULL)
+        renditions->last_switch = streamtest_utime();
+
+    /* Lower-rate rendition, if any, is switched to only if behind */
+    track->degrade_source = rendition;
+    track->catching_up = false;
+
+    /* Converter is created as the stream begins */
+    track->pcm_output = pcm_output;
+    track->pcm = NULL;
+    track->pcm_buffer = NULL;
+    track->pcm_buffer_size = 0;
+
+    /* Images are read whole before each is streamed */
+    track->image_buffer = NULL;
+    track->image_buffer_size = 0;
+    track->image_length = 0;
+
+    /* Pre-chunked data is sent from its source, never copied */
+    track->chunk_data = NULL;
+    track->chunk_length = 0;
+    track->chunk_encoded = false;
+    track->chunk_duration = 0;
+
+    /* Begin stream */
+    track->mimetype = strdup(argv[IDX_MIMETYPE]);
+    streamtest_track_begin_stream(client, track);
+
+    guac_client_log(client, GUAC_LOG_DEBUG,
+            "Frames of stream %i will last %i microseconds and contain %i "
+            "bytes", index, track->frame_duration, track->frame_bytes);
+
+    return track;
 
 }
 
 /**
- * Returns the size of the file associated with the given file descriptor, in
- * bytes. If an error occurs, -1 is returned, and errno is set appropriately.
+ * Loads the playlist or renditions (if any) of the track having the given
+ * index and opens that track, validating all arguments specific to the
+ * track. Tracks with playlists begin with the first item of the playlist,
+ * while tracks with renditions begin with the rendition of lowest bitrate.
+ * If looping is requested, tracks without playlists are given a playlist
+ * containing only their own source.
+ *
+ * @param client
+ *     The guac_client associated with the connection being streamed.
+ *
+ * @param index
+ *     The index of the track to open.
  *
- * @param fd
- *     The file descriptor assocaited with the file whose size should be
- *     returned.
+ * @param argv
+ *     All arguments passed during the Guacamole protocol handshake, where
+ *     each line of a per-track argument applies to a different track.
  *
  * @return
- *     The size of the file assocaited with the given file descriptor, in
- *     bytes, or -1 if an error occurs.
+ *     A newly-allocated streamtest_track, or NULL if the track cannot be
+ *     opened.
  */
-static int streamtest_get_file_size(int fd) {
+static streamtest_track* streamtest_load_track(guac_client* client,
+        int index, char** argv) {
+
+    char* track_argv[STREAMTEST_ARGS_COUNT];
+    for (int i = 0; i < STREAMTEST_ARGS_COUNT; i++)
+        track_argv[i] = streamtest_track_arg(argv[i], index);
+
+    streamtest_playlist* playlist = NULL;
+    streamtest_renditions* renditions = NULL;
+    size_t prefix_length = strlen(STREAMTEST_PLAYLIST_PREFIX);
+    size_t renditions_prefix_length = strlen(STREAMTEST_RENDITIONS_PREFIX);
+
+    /* Begin with first item of playlist, if any */
+    if (strncmp(track_argv[IDX_FILENAME], STREAMTEST_PLAYLIST_PREFIX,
+                prefix_length) == 0) {
+
+        const char* path = track_argv[IDX_FILENAME] + prefix_length;
+        playlist = streamtest_playlist_load(path);
+        if (playlist == NULL) {
+            guac_client_log(client, GUAC_LOG_ERROR,
+                    "Unable to load playlist \"%s\": %s",
+                    path, strerror(errno));
+            goto fail;
+        }
 
-    struct stat stat_buf;
+        /* Every item must be playable */
+        for (int i = 0; i < playlist->count; i++) {
+            streamtest_playback_mode mode;
+            if (streamtest_track_mode(playlist->items[i].mimetype, &mode)) {
+                guac_client_log(client, GUAC_LOG_ERROR, "Invalid media "
+                        "type \"%s\" of item %i of playlist \"%s\"",
+                        playlist->items[i].mimetype, i + 1, path);
+                streamtest_playlist_free(playlist);
+                playlist = NULL;
+                goto fail;
+            }
+            if (streamtest_check_mix(client, playlist->items[i].spec,
+                        playlist->items[i].mimetype)) {
+                streamtest_playlist_free(playlist);
+                playlist = NULL;
+                goto fail;
+            }
+        }
+
+        guac_client_log(client, GUAC_LOG_DEBUG, "Loaded playlist \"%s\" "
+                "of stream %i (%i items)", path, index, playlist->count);
 
-    /* Attempt to read file stats */
-    int result = fstat(fd, &stat_buf);
-    if (result != 0)
-        return -1;
+        free(track_argv[IDX_FILENAME]);
+        free(track_argv[IDX_MIMETYPE]);
+        track_argv[IDX_FILENAME] = strdup(playlist->items[0].spec);
+        track_argv[IDX_MIMETYPE] = strdup(playlist->items[0].mimetype);
+
+    }
 
-    /* Return file size only */
-    return stat_buf.st_size;
+    /* Begin with lowest rendition, if switching between renditions */
+    else if (strncmp(track_argv[IDX_FILENAME], STREAMTEST_RENDITIONS_PREFIX,
+                renditions_prefix_length) == 0) {
+
+        const char* path = track_argv[IDX_FILENAME]
+            + renditions_prefix_length;
+        renditions = streamtest_renditions_load(path);
+        if (renditions == NULL) {
+            guac_client_log(client, GUAC_LOG_ERROR,
+                    "Unable to load renditions \"%s\": %s",
+                    path, strerror(errno));
+            goto fail;
+        }
+
+        /* Positions within renditions do not carry over between loops */
+        if (strcmp(track_argv[IDX_LOOP], "true") == 0) {
+            guac_client_log(client, GUAC_LOG_ERROR, "Renditions \"%s\" "
+                    "cannot be looped", path);
+            streamtest_renditions_free(renditions);
+            renditions = NULL;
+            goto fail;
+        }
+
+        guac_client_log(client, GUAC_LOG_DEBUG, "Loaded renditions \"%s\" "
+                "of stream %i (%i renditions)", path, index,
+                renditions->count);
+
+        /* Frames are sized for the bitrate of the first rendition */
+        char bitrate[16];
+        snprintf(bitrate, sizeof(bitrate), "%i",
+                renditions->items[0].bitrate);
+
+        free(track_argv[IDX_FILENAME]);
+        free(track_argv[IDX_MIMETYPE]);
+        free(track_argv[IDX_BITRATE]);
+        track_argv[IDX_FILENAME] = strdup(renditions->items[0].spec);
+        track_argv[IDX_MIMETYPE] = strdup(renditions->items[0].mimetype);
+        track_argv[IDX_BITRATE] = strdup(bitrate);
+
+    }
+
+    /* A lone source can be looped as a playlist of one */
+    else if (strcmp(track_argv[IDX_LOOP], "true") == 0)
+        playlist = streamtest_playlist_alloc(track_argv[IDX_FILENAME],
+                track_argv[IDX_MIMETYPE]);
+
+    streamtest_track* track = streamtest_open_track(client, index,
+            track_argv, playlist, renditions);
+
+    if (track == NULL && playlist != NULL)
+        streamtest_playlist_free(playlist);
+
+    if (track == NULL && renditions != NULL)
+        streamtest_renditions_free(renditions);
+
+    for (int i = 0; i < STREAMTEST_ARGS_COUNT; i++)
+        free(track_argv[i]);
+
+    return track;
+
+fail:
+    for (int i = 0; i < STREAMTEST_ARGS_COUNT; i++)
+        free(track_argv[i]);
+
+    return NULL;
 
 }
 
@@ -448,125 +1403,225 @@ static int streamtest_get_file_size(int fd) {
  */
 int guac_client_init(guac_client* client, int argc, char** argv) {
 
+    /* Startup latency is measured from here */
+    int64_t init_time = streamtest_utime();
+
     /* Validate argument count */
     if (argc != STREAMTEST_ARGS_COUNT) {
         guac_client_log(client, GUAC_LOG_ERROR, "Wrong number of arguments.");
         return 1;
     }
 
-    /* Allocate stream for media */
-    streamtest_playback_mode mode;
-    guac_stream* stream = guac_client_alloc_stream(client);
-
-    /* Determine playback mode from mimetype */
-    if (strncmp(argv[IDX_MIMETYPE], "audio/", 6) == 0) {
-        mode = STREAMTEST_AUDIO;
-        guac_client_log(client, GUAC_LOG_DEBUG,
-                "Recognized type \"%s\" as audio",
-                argv[IDX_MIMETYPE]);
-    }
-    else if (strncmp(argv[IDX_MIMETYPE], "video/", 6) == 0) {
-        mode = STREAMTEST_VIDEO;
-        guac_client_log(client, GUAC_LOG_DEBUG,
-                "Recognized type \"%s\" as video",
-                argv[IDX_MIMETYPE]);
+    /* Each line of the filename argument describes a separate track */
+    int track_count = streamtest_count_lines(argv[IDX_FILENAME]);
+    if (track_count > STREAMTEST_MAX_TRACKS) {
+        guac_client_log(client, GUAC_LOG_ERROR, "At most %i streams may be "
+                "streamed at once", STREAMTEST_MAX_TRACKS);
+        return 1;
     }
 
-    /* Abort if type cannot be recognized */
-    else {
+    /* Monitor synchronization of tracks, if requested */
+    int sync_tolerance = atoi(argv[IDX_SYNC_TOLERANCE]);
+    if (sync_tolerance < 0) {
         guac_client_log(client, GUAC_LOG_ERROR,
-                "Invalid media type \"%s\" (not audio nor video)",
-                argv[IDX_MIMETYPE]);
+                "Invalid sync tolerance \"%s\"", argv[IDX_SYNC_TOLERANCE]);
         return 1;
     }
 
-    /* Initialize streaming depending on playback mode */
-    switch (mode) {
-
-        /* Set up progress bar for audio streams */
-        case STREAMTEST_AUDIO:
-
-            /* Begin audio stream */
-            guac_protocol_send_audio(client->socket, stream,
-                    argv[IDX_MIMETYPE]);
+    /* Drop images while the client lags too far behind */
+    int max_lag = STREAMTEST_DEFAULT_MAX_LAG;
+    if (argv[IDX_MAX_LAG][0] != '\0')
+        max_lag = atoi(argv[IDX_MAX_LAG]);
 
-            /* Init display */
-            guac_protocol_send_size(client->socket, GUAC_DEFAULT_LAYER,
-                    STREAMTEST_PROGRESS_WIDTH,
-                    STREAMTEST_PROGRESS_HEIGHT);
-            break;
-
-        /* Set up generic video area for video streams */
-        case STREAMTEST_VIDEO:
-
-            /* Begin video stream */
-            guac_protocol_send_video(client->socket, stream,
-                    GUAC_DEFAULT_LAYER, argv[IDX_MIMETYPE]);
+    if (max_lag < 0) {
+        guac_client_log(client, GUAC_LOG_ERROR,
+                "Invalid maximum lag \"%s\"", argv[IDX_MAX_LAG]);
+        return 1;
+    }
 
-            /* Init display */
-            guac_protocol_send_size(client->socket, GUAC_DEFAULT_LAYER,
-                    client->info.optimal_width,
-                    client->info.optimal_height);
-            break;
+    /* Respond to backpressure from the socket as requested */
+    streamtest_backpressure_policy backpressure;
+    if (streamtest_backpressure_parse_policy(argv[IDX_BACKPRESSURE],
+                &backpressure)) {
+        guac_client_log(client, GUAC_LOG_ERROR,
+                "Invalid backpressure policy \"%s\"",
+                argv[IDX_BACKPRESSURE]);
+        return 1;
+    }
 
-        /* There are no other playback modes */
-        default:
-            assert(false);
+    /* Batching is optional */
+    if (atoi(argv[IDX_MAX_BATCH_DELAY]) < 0) {
+        guac_client_log(client, GUAC_LOG_ERROR,
+                "Invalid maximum batching delay \"%s\"",
+                argv[IDX_MAX_BATCH_DELAY]);
+        return 1;
+    }
 
+    /* Respond to tracks falling behind as requested */
+    streamtest_realtime_policy realtime;
+    if (streamtest_realtime_parse_policy(argv[IDX_REALTIME], &realtime)) {
+        guac_client_log(client, GUAC_LOG_ERROR,
+                "Invalid real-time policy \"%s\"", argv[IDX_REALTIME]);
+        return 1;
     }
 
-    /* Attempt to open specified file, abort on error */
-    int fd = open(argv[IDX_FILENAME], O_RDONLY);
-    if (fd == -1) {
+    /* Sleep between frames as requested */
+    streamtest_sleep_strategy sleep_strategy;
+    if (streamtest_sleep_parse_strategy(argv[IDX_SLEEP_STRATEGY],
+                &sleep_strategy)) {
         guac_client_log(client, GUAC_LOG_ERROR,
-                "Unable to open \"%s\": %s",
-                argv[IDX_FILENAME], strerror(errno));
+                "Invalid sleep strategy \"%s\"", argv[IDX_SLEEP_STRATEGY]);
         return 1;
     }
 
-    int file_size = streamtest_get_file_size(fd);
-    if (file_size == -1) {
+    /* Switch between renditions as the chosen policy dictates */
+    const streamtest_abr_policy* abr_policy =
+        streamtest_abr_find_policy(argv[IDX_ABR_POLICY]);
+    if (abr_policy == NULL) {
         guac_client_log(client, GUAC_LOG_ERROR,
-                "Unable to determine size of file \"%s\": %s",
-                argv[IDX_FILENAME], strerror(errno));
+                "Invalid rate-selection policy \"%s\"",
+                argv[IDX_ABR_POLICY]);
         return 1;
     }
 
-    guac_client_log(client, GUAC_LOG_DEBUG,
-            "Successfully opened file \"%s\" (%i bytes)",
-            argv[IDX_FILENAME], file_size);
+    /* Read regular files through the requested backend, which each track
+     * looks up again as it is opened */
+    if (streamtest_source_find_backend(argv[IDX_SOURCE_BACKEND]) == NULL) {
+        guac_client_log(client, GUAC_LOG_ERROR,
+                "Invalid or unsupported source backend \"%s\"",
+                argv[IDX_SOURCE_BACKEND]);
+        return 1;
+    }
 
     /* Allocate state structure */
     streamtest_state* state = malloc(sizeof(streamtest_state));
+    state->track_count = 0;
+    state->recorder = NULL;
+    state->events = NULL;
+
+    /* Publish metrics for other processes exporting the same address. As
+     * metrics serve only monitoring, failure is not fatal. */
+    const char* metrics_listen = argv[IDX_METRICS_LISTEN];
+    bool metrics_published = metrics_listen[0] != '\0';
+    state->metrics = streamtest_metrics_alloc(metrics_listen);
+    if (state->metrics == NULL) {
+        guac_client_log(client, GUAC_LOG_WARNING, "Unable to publish "
+                "metrics for \"%s\": %s", metrics_listen, strerror(errno));
+        state->metrics = streamtest_metrics_alloc("");
+        metrics_published = false;
+    }
 
-    /* Set frame duration/size */
-    state->frame_duration = atoi(argv[IDX_FRAME_USECS]);
-    state->frame_bytes    = atoi(argv[IDX_BYTES_PER_FRAME]);
-    state->frame_buffer   = malloc(state->frame_bytes);
+    /* Retain recent events for dumping, if requested */
+    if (argv[IDX_EVENTS][0] != '\0')
+        state->events = streamtest_events_alloc(argv[IDX_EVENTS]);
 
-    guac_client_log(client, GUAC_LOG_DEBUG,
-            "Frames will last %i microseconds and contain %i bytes",
-            state->frame_duration, state->frame_bytes);
+    /* Record everything sent, if requested, beginning with the first
+     * instruction */
+    const char* record = argv[IDX_RECORD];
+    if (record[0] != '\0') {
+
+        state->recorder = streamtest_recorder_alloc(client, record);
+        if (state->recorder == NULL) {
+            guac_client_log(client, GUAC_LOG_ERROR, "Unable to record to "
+                    "\"%s\": %s", record, strerror(errno));
+            streamtest_free_state(client, state);
+            return 1;
+        }
+
+        guac_client_log(client, GUAC_LOG_DEBUG, "Recording to \"%s\"",
+                record);
+
+    }
+
+    /* Open all tracks */
+    for (int i = 0; i < track_count; i++) {
+
+        streamtest_track* track = streamtest_load_track(client, i, argv);
+        if (track == NULL) {
+            streamtest_free_state(client, state);
+            return 1;
+        }
 
-    /* Start with the file closed, playback not paused */
-    state->mode = mode;
-    state->stream = stream;
-    state->fd = fd;
+        state->tracks[state->track_count++] = track;
+
+    }
+
+    /* Stack progress bars of audio tracks */
+    int audio_count = 0;
+    int video_count = 0;
+    for (int i = 0; i < track_count; i++) {
+
+        streamtest_track* track = state->tracks[i];
+        if (track->mode != STREAMTEST_AUDIO) {
+            video_count++;
+            continue;
+        }
+
+        track->progress_y = audio_count * STREAMTEST_PROGRESS_HEIGHT;
+        audio_count++;
+
+    }
+
+    /* Video and images need the whole display, while audio needs only its
+     * progress bars */
+    if (video_count > 0)
+        guac_protocol_send_size(client->socket, GUAC_DEFAULT_LAYER,
+                client->info.optimal_width,
+                client->info.optimal_height);
+    else
+        guac_protocol_send_size(client->socket, GUAC_DEFAULT_LAYER,
+                STREAMTEST_PROGRESS_WIDTH,
+                STREAMTEST_PROGRESS_HEIGHT * audio_count);
+
+    if (sync_tolerance > 0)
+        guac_client_log(client, GUAC_LOG_DEBUG, "Monitoring %i streams for "
+                "skew beyond %i microseconds", track_count, sync_tolerance);
+
+    /* Start with playback not paused */
     state->paused = false;
-    state->file_size = file_size;
+    state->rate = 0;
+    state->sync_tolerance = sync_tolerance;
+    state->max_lag = max_lag;
+    state->realtime = realtime;
+    state->abr_policy = abr_policy;
+    state->init_time = init_time;
+    state->first_byte = -1;
+    memset(&state->sync, 0, sizeof(state->sync));
+    streamtest_latency_init(&state->latency);
+    streamtest_backpressure_init(&state->backpressure, backpressure);
+    streamtest_command_queue_init(&state->commands);
 
-    /* Set client handlers and data */
-    client->handle_messages = streamtest_client_message_handler;
-    client->key_handler     = streamtest_client_key_handler;
-    client->free_handler    = streamtest_client_free_handler;
     client->data = state;
 
-    /* Render initial progress bar */
-    streamtest_render_progress(client);
-    guac_socket_flush(client->socket);
+    /* Begin streaming via the process-wide scheduler */
+    streamtest_scheduler_set_sleep(sleep_strategy);
+    state->sender = streamtest_sender_alloc(client);
+    if (state->sender == NULL) {
+        guac_client_log(client, GUAC_LOG_ERROR,
+                "Unable to start scheduler: %s", strerror(errno));
+        streamtest_free_state(client, state);
+        return 1;
+    }
+
+    /* Export metrics, if requested, only once streaming has begun such that
+     * the first frame is not delayed. Failure affects only monitoring, thus
+     * streaming continues regardless. */
+    if (metrics_published) {
+        if (streamtest_metrics_export(metrics_listen))
+            guac_client_log(client, GUAC_LOG_WARNING, "Unable to export "
+                    "metrics at \"%s\": %s", metrics_listen,
+                    strerror(errno));
+        else
+            guac_client_log(client, GUAC_LOG_DEBUG, "Exporting metrics at "
+                    "\"%s\" (or standing by for the process which is)",
+                    metrics_listen);
+    }
+
+    /* Set client handlers (output is handled by the scheduler) */
+    client->key_handler     = streamtest_client_key_handler;
+    client->free_handler    = streamtest_client_free_handler;
 
     /* Initialization complete */
     return 0;
 
 }
-
@@ -24,8 +24,17 @@
 #define STREAMTEST_CLIENT_H
 
 #include "config.h"
-
-#include <guacamole/stream.h>
+#include "abr.h"
+#include "backpressure.h"
+#include "command.h"
+#include "events.h"
+#include "latency.h"
+#include "metrics.h"
+#include "realtime.h"
+#include "recorder.h"
+#include "sender.h"
+#include "stats.h"
+#include "track.h"
 
 #include <stdbool.h>
 
@@ -40,72 +49,157 @@
 #define STREAMTEST_PROGRESS_HEIGHT 32 
 
 /**
- * The mode of playback to use. While data will be streamed identically
- * regardless of its type, the manner of setup for the display is different.
- * Audio streams will require a progress bar, while video streams need to use
- * the display for their own output.
+ * The maximum number of bytes to send within a single blob instruction.
+ */
+#define STREAMTEST_BLOB_SIZE 6048
+
+/**
+ * The shortest permitted frame duration, in microseconds.
+ */
+#define STREAMTEST_MIN_FRAME_USECS 100
+
+/**
+ * The longest frame duration which will be derived from a requested bitrate,
+ * in microseconds. As all data within a frame is sent at once, data may
+ * arrive up to this much earlier or later than it would for an ideal
+ * constant-rate stream.
+ */
+#define STREAMTEST_MAX_JITTER_USECS 20000
+
+/**
+ * The maximum number of tracks which may be streamed over one connection.
+ */
+#define STREAMTEST_MAX_TRACKS 8
+
+/**
+ * The default largest permitted lag between sending a sync instruction and
+ * the client acknowledging it, in milliseconds, beyond which images are
+ * dropped rather than sent.
  */
-typedef enum streamtest_playback_mode {
+#define STREAMTEST_DEFAULT_MAX_LAG 500
+
+/**
+ * The number of frames of each track which are read ahead in the background
+ * while the connection is being initialized, such that the first frames can
+ * be sent as soon as streaming begins.
+ */
+#define STREAMTEST_STARTUP_FRAMES 8
+
+/**
+ * The current playback state of a connection. With the exception of the
+ * command queue, this state is only modified during initialization and by
+ * the sender.
+ */
+typedef struct streamtest_state {
 
     /**
-     * Audio is being streamed, and its current progress should be displayed as
-     * a progress bar.
+     * All tracks being streamed over the connection.
      */
-    STREAMTEST_AUDIO,
+    streamtest_track* tracks[STREAMTEST_MAX_TRACKS];
 
     /**
-     * Video is being streamed. No progress bar should be displayed, and the
-     * Guacamole display should be used solely for video output.
+     * The number of tracks within the tracks array.
      */
-    STREAMTEST_VIDEO
+    int track_count;
 
-} streamtest_playback_mode;
+    /**
+     * Whether playback is currently paused.
+     */
+    bool paused;
 
-/**
- * The current playback state.
- */
-typedef struct streamtest_state {
+    /**
+     * The current playback rate, as a power of two. Each increment doubles
+     * the rate at which frames are sent, while each decrement halves it. Zero
+     * represents the rate specified by the frame duration of each track.
+     */
+    int rate;
 
     /**
-     * Whether we are currently playing audio or video.
+     * The largest permitted difference between the media time of any two
+     * tracks, in microseconds, or zero if the tracks are not monitored for
+     * synchronization.
      */
-    streamtest_playback_mode mode;
+    int sync_tolerance;
 
     /**
-     * The duration of each frame, in microseconds.
+     * Statistics describing the synchronization of all tracks, if
+     * monitored.
      */
-    int frame_duration;
+    streamtest_sync_stats sync;
 
     /**
-     * The number of bytes to stream with each frame.
+     * Round trip and lag measurements of the client, derived from the sync
+     * instructions sent by the sender.
      */
-    int frame_bytes;
+    streamtest_latency latency;
 
     /**
-     * A buffer into which bytes pending streaming can be read. This buffer
-     * will be at least frame_bytes in size.
+     * Detection of, and the response to, sustained backpressure from the
+     * socket of the connection.
      */
-    unsigned char* frame_buffer;
+    streamtest_backpressure backpressure;
 
     /**
-     * The stream over which data from the specified file will be streamed.
+     * Metrics describing this connection, which are exported alongside
+     * those of all other connections of this process if requested.
      */
-    guac_stream* stream;
+    streamtest_metrics* metrics;
 
     /**
-     * The file descriptor of the file being streamed.
+     * The recorder which is recording everything sent to the client, or NULL
+     * if nothing is being recorded.
      */
-    int fd;
+    streamtest_recorder* recorder;
 
     /**
-     * The total number of bytes within the file.
+     * The log of recent events of this connection, or NULL if events are
+     * not being retained.
      */
-    int file_size;
+    streamtest_events* events;
 
     /**
-     * Whether playback is currently paused.
+     * The largest permitted lag between sending a sync instruction and the
+     * client acknowledging it, in milliseconds, beyond which images are
+     * dropped rather than sent, or zero if images are never dropped due to
+     * lag.
      */
-    bool paused;
+    int max_lag;
+
+    /**
+     * The response to any track falling more than a frame behind the wall
+     * clock.
+     */
+    streamtest_realtime_policy realtime;
+
+    /**
+     * The policy choosing which rendition each track having several
+     * renditions should stream.
+     */
+    const streamtest_abr_policy* abr_policy;
+
+    /**
+     * The time at which initialization of the connection began, as returned
+     * by streamtest_utime().
+     */
+    int64_t init_time;
+
+    /**
+     * The time between initialization of the connection beginning and the
+     * first media data being flushed to the client, in microseconds, or -1
+     * if no media data has yet been sent.
+     */
+    int64_t first_byte;
+
+    /**
+     * Commands which have been received from the user but not yet applied by
+     * the sender.
+     */
+    streamtest_command_queue commands;
+
+    /**
+     * The sender which is streaming all tracks.
+     */
+    streamtest_sender* sender;
 
 } streamtest_state;
 
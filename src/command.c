@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+#include "command.h"
+
+#include <stdbool.h>
+
+/**
+ * Mask which, when applied to an ever-increasing head or tail counter,
+ * produces the corresponding index within the commands array.
+ */
+#define STREAMTEST_COMMAND_QUEUE_MASK (STREAMTEST_COMMAND_QUEUE_SIZE - 1)
+
+void streamtest_command_queue_init(streamtest_command_queue* queue) {
+    queue->head = 0;
+    queue->tail = 0;
+}
+
+bool streamtest_command_queue_push(streamtest_command_queue* queue,
+        streamtest_command_type type, int value) {
+
+    /* Only the producer modifies tail */
+    unsigned int tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+
+    /* Acquire head such that the consumer is done with any slot we reuse */
+    unsigned int head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+
+    /* Refuse to overwrite commands which have not yet been consumed */
+    if (tail - head >= STREAMTEST_COMMAND_QUEUE_SIZE)
+        return false;
+
+    /* Store command */
+    streamtest_command* command =
+        &queue->commands[tail & STREAMTEST_COMMAND_QUEUE_MASK];
+    command->type = type;
+    command->value = value;
+
+    /* Publish command to consumer */
+    __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+
+}
+
+bool streamtest_command_queue_pop(streamtest_command_queue* queue,
+        streamtest_command* command) {
+
+    /* Only the consumer modifies head */
+    unsigned int head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+
+    /* Acquire tail such that the command contents are visible */
+    unsigned int tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+
+    /* Nothing to do if queue is empty */
+    if (head == tail)
+        return false;
+
+    /* Copy out command */
+    *command = queue->commands[head & STREAMTEST_COMMAND_QUEUE_MASK];
+
+    /* Release slot back to producer */
+    __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+
+}
+
@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef STREAMTEST_COMMAND_H
+#define STREAMTEST_COMMAND_H
+
+#include "config.h"
+
+#include <stdbool.h>
+
+/**
+ * The number of commands which may be pending within a
+ * streamtest_command_queue at any one time. This MUST be a power of two.
+ */
+#define STREAMTEST_COMMAND_QUEUE_SIZE 64
+
+/**
+ * All possible types of playback commands. Commands are produced by input
+ * handlers (such as the key handler) and consumed by the sender, such that
+ * playback state is only ever modified by the code that uses it.
+ */
+typedef enum streamtest_command_type {
+
+    /**
+     * Toggle whether playback is paused. The command value is ignored.
+     */
+    STREAMTEST_COMMAND_PAUSE,
+
+    /**
+     * Seek relative to the current position within the stream. The command
+     * value is the signed offset to seek by, in microseconds of media time.
+     */
+    STREAMTEST_COMMAND_SEEK,
+
+    /**
+     * Change the playback rate. The command value is the signed number of
+     * times the current rate should be doubled (positive) or halved
+     * (negative).
+     */
+    STREAMTEST_COMMAND_RATE,
+
+    /**
+     * Dump the event log of the connection, if any. The command value is
+     * ignored.
+     */
+    STREAMTEST_COMMAND_DUMP
+
+} streamtest_command_type;
+
+/**
+ * A single playback command.
+ */
+typedef struct streamtest_command {
+
+    /**
+     * The type of this command.
+     */
+    streamtest_command_type type;
+
+    /**
+     * The value associated with this command. The meaning of this value
+     * depends on the command type.
+     */
+    int value;
+
+} streamtest_command;
+
+/**
+ * A lock-free queue of commands which may be safely shared between exactly
+ * one producer thread and exactly one consumer thread at any given time.
+ */
+typedef struct streamtest_command_queue {
+
+    /**
+     * Storage for all pending commands. Only the commands between head
+     * (inclusive) and tail (exclusive), modulo the size of this array, are
+     * valid.
+     */
+    streamtest_command commands[STREAMTEST_COMMAND_QUEUE_SIZE];
+
+    /**
+     * The number of commands which have been removed from the queue. This
+     * value is only modified by the consumer.
+     */
+    unsigned int head;
+
+    /**
+     * The number of commands which have been added to the queue. This value
+     * is only modified by the producer.
+     */
+    unsigned int tail;
+
+} streamtest_command_queue;
+
+/**
+ * Initializes the given command queue such that it is empty. This function
+ * MUST be called before the queue is shared between threads.
+ *
+ * @param queue
+ *     The queue to initialize.
+ */
+void streamtest_command_queue_init(streamtest_command_queue* queue);
+
+/**
+ * Adds a command to the end of the given queue. This function may only be
+ * called by the producer thread.
+ *
+ * @param queue
+ *     The queue to add the command to.
+ *
+ * @param type
+ *     The type of the command to add.
+ *
+ * @param value
+ *     The value associated with the command.
+ *
+ * @return
+ *     true if the command was added, false if the queue is full.
+ */
+bool streamtest_command_queue_push(streamtest_command_queue* queue,
+        streamtest_command_type type, int value);
+
+/**
+ * Removes the command at the front of the given queue, if any. This function
+ * may only be called by the consumer thread.
+ *
+ * @param queue
+ *     The queue to remove the command from.
+ *
+ * @param command
+ *     The streamtest_command to populate with the removed command.
+ *
+ * @return
+ *     true if a command was removed and stored within the given
+ *     streamtest_command, false if the queue is empty.
+ */
+bool streamtest_command_queue_pop(streamtest_command_queue* queue,
+        streamtest_command* command);
+
+#endif
+
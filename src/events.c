@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+#include "events.h"
+#include "timing.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * The number of dumps requested via SIGUSR1 since the process started.
+ */
+static unsigned int streamtest_events_requests = 0;
+
+/**
+ * Guard which ensures the SIGUSR1 handler is installed only once.
+ */
+static pthread_once_t streamtest_events_handler_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Handler for SIGUSR1, which requests a dump of all event logs. Dumps are
+ * written by the sender of each connection at its next pass, as nothing
+ * more than incrementing a counter is safe within a signal handler.
+ *
+ * @param signum
+ *     The signal received, which will always be SIGUSR1.
+ */
+static void streamtest_events_signal_handler(int signum) {
+    __atomic_fetch_add(&streamtest_events_requests, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Installs the SIGUSR1 handler. This function is invoked only once per
+ * process.
+ */
+static void streamtest_events_install_handler() {
+
+    struct sigaction action = {
+        .sa_handler = streamtest_events_signal_handler,
+        .sa_flags = SA_RESTART
+    };
+
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR1, &action, NULL);
+
+}
+
+streamtest_events* streamtest_events_alloc(const char* path) {
+
+    pthread_once(&streamtest_events_handler_once,
+            streamtest_events_install_handler);
+
+    streamtest_events* events = calloc(1, sizeof(streamtest_events));
+    events->path = strdup(path);
+
+    /* Only requests received from now on apply */
+    events->requests_handled = __atomic_load_n(&streamtest_events_requests,
+            __ATOMIC_RELAXED);
+
+    return events;
+
+}
+
+void streamtest_events_record(streamtest_events* events,
+        streamtest_event_type type, int track, int64_t value) {
+
+    if (events == NULL)
+        return;
+
+    /* Claim the next slot, overwriting the oldest event */
+    uint64_t sequence = __atomic_fetch_add(&events->head, 1,
+            __ATOMIC_RELAXED);
+    streamtest_events_slot* slot =
+        &events->slots[sequence & (STREAMTEST_EVENTS_CAPACITY - 1)];
+
+    /* Mark slot as incomplete before modifying the event within */
+    __atomic_store_n(&slot->sequence, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    streamtest_event* event = &slot->event;
+    __atomic_store_n(&event->timestamp, streamtest_ntime(), __ATOMIC_RELAXED);
+    __atomic_store_n(&event->type, type, __ATOMIC_RELAXED);
+    __atomic_store_n(&event->track, track, __ATOMIC_RELAXED);
+    __atomic_store_n(&event->value, value, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&slot->sequence, sequence + 1, __ATOMIC_RELEASE);
+
+}
+
+/**
+ * Copies the event having the given sequence number from the given log, if
+ * that event is still retained and has been completely stored.
+ *
+ * @param events
+ *     The log to copy the event from.
+ *
+ * @param sequence
+ *     The sequence number of the event.
+ *
+ * @param event
+ *     The streamtest_event to populate with the copied event.
+ *
+ * @return
+ *     true if the event was copied, false otherwise.
+ */
+static bool streamtest_events_copy(streamtest_events* events,
+        uint64_t sequence, streamtest_event* event) {
+
+    streamtest_events_slot* slot =
+        &events->slots[sequence & (STREAMTEST_EVENTS_CAPACITY - 1)];
+
+    if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != sequence + 1)
+        return false;
+
+    streamtest_event* stored = &slot->event;
+    event->timestamp = __atomic_load_n(&stored->timestamp, __ATOMIC_RELAXED);
+    event->type = __atomic_load_n(&stored->type, __ATOMIC_RELAXED);
+    event->track = __atomic_load_n(&stored->track, __ATOMIC_RELAXED);
+    event->value = __atomic_load_n(&stored->value, __ATOMIC_RELAXED);
+
+    /* The event is valid only if not overwritten while copying */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) == sequence + 1;
+
+}
+
+bool streamtest_events_dump_requested(streamtest_events* events) {
+
+    unsigned int requests = __atomic_load_n(&streamtest_events_requests,
+            __ATOMIC_RELAXED);
+
+    if (requests == events->requests_handled)
+        return false;
+
+    events->requests_handled = requests;
+    return true;
+
+}
+
+int streamtest_events_dump(streamtest_events* events, char** path) {
+
+    /* Copy retained events, oldest first */
+    uint64_t head = __atomic_load_n(&events->head, __ATOMIC_ACQUIRE);
+    uint64_t first = 0;
+    if (head > STREAMTEST_EVENTS_CAPACITY)
+        first = head - STREAMTEST_EVENTS_CAPACITY;
+
+    streamtest_event* copied = malloc(sizeof(streamtest_event)
+            * (head - first));
+
+    int count = 0;
+    for (uint64_t sequence = first; sequence < head; sequence++) {
+        if (streamtest_events_copy(events, sequence, &copied[count]))
+            count++;
+    }
+
+    /* Each dump is written to its own file */
+    int length = snprintf(NULL, 0, "%s.%i", events->path, events->dumps + 1);
+    char* dump_path = malloc(length + 1);
+    snprintf(dump_path, length + 1, "%s.%i", events->path, events->dumps + 1);
+
+    streamtest_events_header header = {
+        .magic = STREAMTEST_EVENTS_MAGIC,
+        .byte_order = STREAMTEST_EVENTS_BYTE_ORDER,
+        .count = count
+    };
+
+    FILE* output = fopen(dump_path, "wb");
+    if (output == NULL)
+        goto fail;
+
+    int result = fwrite(&header, sizeof(header), 1, output) != 1
+        || fwrite(copied, sizeof(streamtest_event), count, output) != count;
+
+    if (fclose(output) || result)
+        goto fail;
+
+    events->dumps++;
+    free(copied);
+
+    if (path != NULL)
+        *path = dump_path;
+    else
+        free(dump_path);
+
+    return count;
+
+fail:
+    free(dump_path);
+    free(copied);
+    return -1;
+
+}
+
+void streamtest_events_free(streamtest_events* events) {
+    free(events->path);
+    free(events);
+}
+
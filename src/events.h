@@ -0,0 +1,303 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef STREAMTEST_EVENTS_H
+#define STREAMTEST_EVENTS_H
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * The magic number at the beginning of all event dumps.
+ */
+#define STREAMTEST_EVENTS_MAGIC "GUACEVT1"
+
+/**
+ * The length of STREAMTEST_EVENTS_MAGIC, in bytes.
+ */
+#define STREAMTEST_EVENTS_MAGIC_LENGTH 8
+
+/**
+ * The value of the byte_order field of every event dump, as written in the
+ * native byte order of the host which wrote the dump. Dumps written by a
+ * host of differing byte order will not contain this value, and cannot be
+ * converted.
+ */
+#define STREAMTEST_EVENTS_BYTE_ORDER 0x01020304
+
+/**
+ * The number of events retained by each event log, beyond which the oldest
+ * events are overwritten. This MUST be a power of two.
+ */
+#define STREAMTEST_EVENTS_CAPACITY 16384
+
+/**
+ * The value of the track field of events which do not relate to any one
+ * track.
+ */
+#define STREAMTEST_EVENTS_NO_TRACK -1
+
+/**
+ * All possible types of events.
+ */
+typedef enum streamtest_event_type {
+
+    /**
+     * A frame of a track is due and is about to be read. The event value is
+     * how late the frame is relative to its deadline, in nanoseconds.
+     */
+    STREAMTEST_EVENT_FRAME_START,
+
+    /**
+     * A frame of a track has been read. The event value is the number of
+     * bytes now buffered for the track.
+     */
+    STREAMTEST_EVENT_READ_DONE,
+
+    /**
+     * Buffered data of a track has been sent as blobs. The event value is the
+     * number of bytes sent.
+     */
+    STREAMTEST_EVENT_BLOB_SENT,
+
+    /**
+     * A sync instruction has been sent and the socket flushed. The event
+     * value is the timestamp of the sync, in milliseconds.
+     */
+    STREAMTEST_EVENT_FLUSH_DONE,
+
+    /**
+     * The sender has finished a pass and is about to sleep. The event value
+     * is how long the sender intends to sleep, in nanoseconds, or -1 if the
+     * sender will sleep until woken.
+     */
+    STREAMTEST_EVENT_SLEEP_START,
+
+    /**
+     * The sender has woken to begin a pass. The event value is how late the
+     * sender woke relative to its intended wake time, in nanoseconds, or -1
+     * if the sender was woken for other reasons.
+     */
+    STREAMTEST_EVENT_SLEEP_END,
+
+    /**
+     * A key has been pressed. The event value is the keysym of the key.
+     */
+    STREAMTEST_EVENT_KEY_PRESSED,
+
+    /**
+     * A key has been released. The event value is the keysym of the key.
+     */
+    STREAMTEST_EVENT_KEY_RELEASED
+
+} streamtest_event_type;
+
+/**
+ * A single event, as stored within an event log and written to event dumps.
+ */
+typedef struct streamtest_event {
+
+    /**
+     * The time the event occurred, in nanoseconds, as returned by
+     * streamtest_ntime().
+     */
+    int64_t timestamp;
+
+    /**
+     * The streamtest_event_type of the event.
+     */
+    uint32_t type;
+
+    /**
+     * The index of the track the event relates to, or
+     * STREAMTEST_EVENTS_NO_TRACK.
+     */
+    int32_t track;
+
+    /**
+     * A value describing the event, the meaning of which depends on the
+     * event type.
+     */
+    int64_t value;
+
+} streamtest_event;
+
+/**
+ * The header at the beginning of every event dump. The header is immediately
+ * followed by count events, oldest first. All values are in the native byte
+ * order of the host which wrote the dump.
+ */
+typedef struct streamtest_events_header {
+
+    /**
+     * STREAMTEST_EVENTS_MAGIC, without null terminator.
+     */
+    char magic[STREAMTEST_EVENTS_MAGIC_LENGTH];
+
+    /**
+     * STREAMTEST_EVENTS_BYTE_ORDER.
+     */
+    uint32_t byte_order;
+
+    /**
+     * The number of events within the dump.
+     */
+    uint32_t count;
+
+} streamtest_events_header;
+
+/**
+ * A single slot within an event log.
+ */
+typedef struct streamtest_events_slot {
+
+    /**
+     * The event most recently stored within this slot.
+     */
+    streamtest_event event;
+
+    /**
+     * One greater than the sequence number of the event stored within this
+     * slot, or zero if no event has been stored. This is updated only after
+     * the event has been completely stored, such that partially-stored
+     * events can be detected.
+     */
+    uint64_t sequence;
+
+} streamtest_events_slot;
+
+/**
+ * A fixed-size ring of the most recent events of a connection. Events may be
+ * recorded by any number of threads at once without locking.
+ */
+typedef struct streamtest_events {
+
+    /**
+     * Storage for the most recent STREAMTEST_EVENTS_CAPACITY events.
+     */
+    streamtest_events_slot slots[STREAMTEST_EVENTS_CAPACITY];
+
+    /**
+     * The total number of events recorded, which is also the sequence
+     * number of the next event.
+     */
+    uint64_t head;
+
+    /**
+     * The path prefix of all dumps of this log.
+     */
+    char* path;
+
+    /**
+     * The number of dumps written.
+     */
+    int dumps;
+
+    /**
+     * The number of dump requests received via signal which have been
+     * handled.
+     */
+    unsigned int requests_handled;
+
+} streamtest_events;
+
+/**
+ * Allocates a new, empty event log. The first event log allocated by the
+ * process installs a SIGUSR1 handler, such that sending SIGUSR1 to the
+ * process requests a dump of all event logs.
+ *
+ * @param path
+ *     The path prefix of all dumps of the new log. Each dump is written to a
+ *     file named by this prefix, a period, and the number of the dump,
+ *     beginning with 1.
+ *
+ * @return
+ *     The newly-allocated event log.
+ */
+streamtest_events* streamtest_events_alloc(const char* path);
+
+/**
+ * Records an event within the given log. If the log is NULL, this function
+ * has no effect, such that events can be recorded unconditionally.
+ *
+ * @param events
+ *     The log to record the event within, or NULL.
+ *
+ * @param type
+ *     The type of the event.
+ *
+ * @param track
+ *     The index of the track the event relates to, or
+ *     STREAMTEST_EVENTS_NO_TRACK.
+ *
+ * @param value
+ *     A value describing the event, the meaning of which depends on the
+ *     event type.
+ */
+void streamtest_events_record(streamtest_events* events,
+        streamtest_event_type type, int track, int64_t value);
+
+/**
+ * Returns whether a dump of the given log has been requested via signal
+ * since this function last returned true for the same log. This function
+ * may only be called by one thread at a time for any given log.
+ *
+ * @param events
+ *     The log to test.
+ *
+ * @return
+ *     true if a dump has been requested, false otherwise.
+ */
+bool streamtest_events_dump_requested(streamtest_events* events);
+
+/**
+ * Writes all events currently retained by the given log to the next dump
+ * file, oldest first. Events may continue to be recorded while dumping,
+ * though events overwritten during the dump are omitted. This function may
+ * only be called by one thread at a time for any given log.
+ *
+ * @param events
+ *     The log to dump.
+ *
+ * @param path
+ *     Storage for a pointer to the path of the dump file written, which
+ *     must be freed with free(), or NULL if the path is not needed.
+ *
+ * @return
+ *     The number of events written, or -1 if the dump could not be
+ *     written, in which case errno is set appropriately.
+ */
+int streamtest_events_dump(streamtest_events* events, char** path);
+
+/**
+ * Frees the given event log. No thread may be recording events within the
+ * log.
+ *
+ * @param events
+ *     The log to free.
+ */
+void streamtest_events_free(streamtest_events* events);
+
+#endif
+
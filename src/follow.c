@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+#include "follow.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <sys/inotify.h>
+
+streamtest_follow* streamtest_follow_alloc(const char* filename) {
+
+    /* Events are consumed without blocking, as readiness is signalled
+     * separately via epoll */
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd == -1)
+        return NULL;
+
+    int wd = inotify_add_watch(fd, filename, IN_MODIFY);
+    if (wd == -1) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return NULL;
+    }
+
+    streamtest_follow* follow = malloc(sizeof(streamtest_follow));
+    follow->fd = fd;
+    follow->wd = wd;
+    return follow;
+
+}
+
+bool streamtest_follow_changed(streamtest_follow* follow) {
+
+    /* Large enough for at least one event of any size */
+    char buffer[sizeof(struct inotify_event) + NAME_MAX + 1]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    bool changed = false;
+
+    /* Drain all pending events */
+    ssize_t length;
+    while ((length = read(follow->fd, buffer, sizeof(buffer))) > 0) {
+
+        char* current = buffer;
+        while (current < buffer + length) {
+
+            struct inotify_event* event = (struct inotify_event*) current;
+            if (event->mask & IN_MODIFY)
+                changed = true;
+
+            current += sizeof(struct inotify_event) + event->len;
+
+        }
+
+    }
+
+    return changed;
+
+}
+
+void streamtest_follow_free(streamtest_follow* follow) {
+    inotify_rm_watch(follow->fd, follow->wd);
+    close(follow->fd);
+    free(follow);
+}
+
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef STREAMTEST_FOLLOW_H
+#define STREAMTEST_FOLLOW_H
+
+#include "config.h"
+
+#include <stdbool.h>
+
+/**
+ * Monitors a file which is still being written, such that data appended to
+ * the file can be streamed as soon as it lands. Changes are detected through
+ * inotify, never by polling.
+ */
+typedef struct streamtest_follow {
+
+    /**
+     * The inotify file descriptor, which becomes readable whenever the
+     * followed file is modified.
+     */
+    int fd;
+
+    /**
+     * The inotify watch descriptor of the followed file.
+     */
+    int wd;
+
+} streamtest_follow;
+
+/**
+ * Begins monitoring the given file for modifications.
+ *
+ * @param filename
+ *     The path to the file to follow.
+ *
+ * @return
+ *     A newly-allocated streamtest_follow, or NULL if the file cannot be
+ *     monitored, in which case errno is set appropriately.
+ */
+streamtest_follow* streamtest_follow_alloc(const char* filename);
+
+/**
+ * Consumes all pending inotify events for the followed file, returning
+ * whether the file has been modified since the last call. This function
+ * never blocks.
+ *
+ * @param follow
+ *     The followed file to check.
+ *
+ * @return
+ *     true if the file has been modified since this function was last
+ *     called, false otherwise.
+ */
+bool streamtest_follow_changed(streamtest_follow* follow);
+
+/**
+ * Stops monitoring the followed file, freeing all associated resources.
+ *
+ * @param follow
+ *     The followed file to stop monitoring.
+ */
+void streamtest_follow_free(streamtest_follow* follow);
+
+#endif
+
@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+#include "image.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * The signature which begins every PNG image.
+ */
+static const unsigned char streamtest_image_png_signature[] = {
+    0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'
+};
+
+int streamtest_image_parse_format(const char* mimetype,
+        streamtest_image_format* format) {
+
+    if (strcmp(mimetype, "image/jpeg") == 0)
+        *format = STREAMTEST_IMAGE_JPEG;
+    else if (strcmp(mimetype, "image/png") == 0)
+        *format = STREAMTEST_IMAGE_PNG;
+    else if (strcmp(mimetype, "image/webp") == 0)
+        *format = STREAMTEST_IMAGE_WEBP;
+    else
+        return 1;
+
+    return 0;
+
+}
+
+/**
+ * Determines the length of the JPEG image at the start of the given data by
+ * walking its segments. Entropy-coded data following each start-of-scan
+ * segment is scanned for the next marker, relying on byte stuffing to
+ * distinguish markers from data, while all other segments are skipped by
+ * length such that embedded thumbnails are never mistaken for the end of
+ * the image.
+ *
+ * @param data
+ *     The data beginning with the image.
+ *
+ * @param length
+ *     The number of bytes of data available.
+ *
+ * @return
+ *     The length of the image in bytes, zero if more data is needed, or -1
+ *     if the data is not a JPEG image.
+ */
+static int streamtest_image_jpeg_length(const unsigned char* data,
+        int length) {
+
+    /* Every image begins with start-of-image */
+    if (length < 2)
+        return 0;
+
+    if (data[0] != 0xFF || data[1] != 0xD8)
+        return -1;
+
+    int64_t i = 2;
+    bool entropy = false;
+    while (i < length) {
+
+        /* Skip entropy-coded data, including stuffed bytes and restart
+         * markers, stopping at the next real marker */
+        if (entropy) {
+
+            if (data[i] != 0xFF) {
+                i++;
+                continue;
+            }
+
+            if (i + 1 >= length)
+                return 0;
+
+            int next = data[i + 1];
+            if (next == 0x00 || (next >= 0xD0 && next <= 0xD7)) {
+                i += 2;
+                continue;
+            }
+
+            entropy = false;
+
+        }
+
+        if (i + 1 >= length)
+            return 0;
+
+        if (data[i] != 0xFF)
+            return -1;
+
+        int marker = data[i + 1];
+
+        /* Fill bytes may precede any marker */
+        if (marker == 0xFF) {
+            i++;
+            continue;
+        }
+
+        /* End-of-image */
+        if (marker == 0xD9)
+            return i + 2;
+
+        /* Markers without a segment */
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+            i += 2;
+            continue;
+        }
+
+        /* All other segments have an explicit length */
+        if (i + 3 >= length)
+            return 0;
+
+        int segment = (data[i + 2] << 8) | data[i + 3];
+        if (segment < 2)
+            return -1;
+
+        i += 2 + segment;
+
+        /* Start-of-scan is followed by entropy-coded data */
+        if (marker == 0xDA)
+            entropy = true;
+
+    }
+
+    return 0;
+
+}
+
+/**
+ * Determines the length of the PNG image at the start of the given data by
+ * walking its chunks up to and including IEND.
+ *
+ * @param data
+ *     The data beginning with the image.
+ *
+ * @param length
+ *     The number of bytes of data available.
+ *
+ * @return
+ *     The length of the image in bytes, zero if more data is needed, or -1
+ *     if the data is not a PNG image.
+ */
+static int streamtest_image_png_length(const unsigned char* data,
+        int length) {
+
+    int signature = sizeof(streamtest_image_png_signature);
+
+    /* Verify as much of the signature as is available */
+    if (memcmp(data, streamtest_image_png_signature,
+                length < signature ? length : signature) != 0)
+        return -1;
+
+    int64_t i = signature;
+    while (i + 8 <= length) {
+
+        uint32_t chunk = ((uint32_t) data[i] << 24)
+                       | ((uint32_t) data[i + 1] << 16)
+                       | ((uint32_t) data[i + 2] << 8)
+                       |  (uint32_t) data[i + 3];
+
+        /* Chunk lengths are limited to 2^31 - 1 */
+        if (chunk > INT32_MAX)
+            return -1;
+
+        /* Length and type, data, then CRC */
+        int64_t end = i + 12 + chunk;
+        if (end > INT32_MAX)
+            return -1;
+
+        if (memcmp(data + i + 4, "IEND", 4) == 0)
+            return end <= length ? end : 0;
+
+        i = end;
+
+    }
+
+    return 0;
+
+}
+
+/**
+ * Determines the length of the WebP image at the start of the given data
+ * from its RIFF header.
+ *
+ * @param data
+ *     The data beginning with the image.
+ *
+ * @param length
+ *     The number of bytes of data available.
+ *
+ * @return
+ *     The length of the image in bytes, zero if more data is needed, or -1
+ *     if the data is not a WebP image.
+ */
+static int streamtest_image_webp_length(const unsigned char* data,
+        int length) {
+
+    if (length < 12)
+        return 0;
+
+    if (memcmp(data, "RIFF", 4) != 0 || memcmp(data + 8, "WEBP", 4) != 0)
+        return -1;
+
+    uint32_t size = (uint32_t) data[4]
+                  | ((uint32_t) data[5] << 8)
+                  | ((uint32_t) data[6] << 16)
+                  | ((uint32_t) data[7] << 24);
+
+    /* RIFF header, then payload padded to an even length */
+    int64_t total = 8 + (int64_t) size + (size & 1);
+    if (total > INT32_MAX)
+        return -1;
+
+    return total <= length ? total : 0;
+
+}
+
+int streamtest_image_length(streamtest_image_format format,
+        const unsigned char* data, int length) {
+
+    switch (format) {
+
+        case STREAMTEST_IMAGE_JPEG:
+            return streamtest_image_jpeg_length(data, length);
+
+        case STREAMTEST_IMAGE_PNG:
+            return streamtest_image_png_length(data, length);
+
+        case STREAMTEST_IMAGE_WEBP:
+            return streamtest_image_webp_length(data, length);
+
+    }
+
+    return -1;
+
+}
+
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef STREAMTEST_IMAGE_H
+#define STREAMTEST_IMAGE_H
+
+#include "config.h"
+
+/**
+ * All supported formats of pre-encoded image frames.
+ */
+typedef enum streamtest_image_format {
+
+    /**
+     * JPEG images ("image/jpeg").
+     */
+    STREAMTEST_IMAGE_JPEG,
+
+    /**
+     * PNG images ("image/png").
+     */
+    STREAMTEST_IMAGE_PNG,
+
+    /**
+     * WebP images ("image/webp").
+     */
+    STREAMTEST_IMAGE_WEBP
+
+} streamtest_image_format;
+
+/**
+ * Determines the image format described by the given mimetype.
+ *
+ * @param mimetype
+ *     The mimetype of the images to be streamed.
+ *
+ * @param format
+ *     Pointer to the streamtest_image_format which should receive the
+ *     format.
+ *
+ * @return
+ *     Zero if the mimetype describes a supported image format, non-zero
+ *     otherwise.
+ */
+int streamtest_image_parse_format(const char* mimetype,
+        streamtest_image_format* format);
+
+/**
+ * Determines the length of the image at the start of the given data, such
+ * that images concatenated within a single file or stream can be separated
+ * without decoding them. Only the structure of each image (markers, chunks
+ * or headers) is examined.
+ *
+ * @param format
+ *     The format of the image.
+ *
+ * @param data
+ *     The data beginning with the image.
+ *
+ * @param length
+ *     The number of bytes of data available.
+ *
+ * @return
+ *     The length of the image in bytes, zero if the data available contains
+ *     only part of the image, or -1 if the data is not an image of the given
+ *     format.
+ */
+int streamtest_image_length(streamtest_image_format format,
+        const unsigned char* data, int length);
+
+#endif
+
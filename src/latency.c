@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+#include "latency.h"
+
+#include <guacamole/timestamp.h>
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Returns the limit of the given bucket of a latency histogram, in
+ * microseconds. Values within the bucket are below this limit.
+ *
+ * @param bucket
+ *     The index of the bucket, which must not be the last.
+ *
+ * @return
+ *     The limit of the given bucket, in microseconds.
+ */
+static int64_t streamtest_latency_limit(int bucket) {
+    return (int64_t) 1000 << bucket;
+}
+
+/**
+ * Adds the given value to the given histogram.
+ *
+ * @param histogram
+ *     The histogram to add to.
+ *
+ * @param value
+ *     The value to add, in microseconds.
+ */
+static void streamtest_latency_record(
+        streamtest_latency_histogram* histogram, int64_t value) {
+
+    if (value < 0)
+        value = 0;
+
+    int bucket = 0;
+    while (bucket < STREAMTEST_LATENCY_BUCKETS - 1
+            && value >= streamtest_latency_limit(bucket))
+        bucket++;
+
+    histogram->buckets[bucket]++;
+    histogram->samples++;
+    histogram->total += value;
+    if (value > histogram->max)
+        histogram->max = value;
+
+}
+
+/**
+ * Updates the throughput of the client given that all bytes sent prior to
+ * a sync have just been acknowledged. A new sample is taken only once
+ * STREAMTEST_THROUGHPUT_INTERVAL has passed since the previous sample.
+ *
+ * @param latency
+ *     The latency measurements of the connection.
+ *
+ * @param bytes
+ *     The total number of bytes sent prior to the acknowledged sync.
+ *
+ * @param now
+ *     The current time, as returned by streamtest_utime().
+ */
+static void streamtest_latency_delivered(streamtest_latency* latency,
+        uint64_t bytes, int64_t now) {
+
+    /* The first acknowledgement only starts the measurement */
+    if (latency->acked_at == 0) {
+        latency->acked_bytes = bytes;
+        latency->acked_at = now;
+        return;
+    }
+
+    int64_t elapsed = now - latency->acked_at;
+    if (elapsed < STREAMTEST_THROUGHPUT_INTERVAL)
+        return;
+
+    int64_t sample = (int64_t) (bytes - latency->acked_bytes) * 8000000
+        / elapsed;
+
+    if (latency->throughput == 0)
+        latency->throughput = sample;
+    else
+        latency->throughput += (sample - latency->throughput)
+            / STREAMTEST_THROUGHPUT_WEIGHT;
+
+    latency->acked_bytes = bytes;
+    latency->acked_at = now;
+
+}
+
+void streamtest_latency_init(streamtest_latency* latency) {
+    memset(latency, 0, sizeof(streamtest_latency));
+}
+
+void streamtest_latency_sent(streamtest_latency* latency,
+        guac_timestamp timestamp, uint64_t bytes, int64_t now) {
+
+    latency->last_sent = now;
+
+    /* Syncs sent within the same millisecond are indistinguishable once
+     * acknowledged, thus only the first is measured */
+    if (latency->pending_count > 0) {
+        int newest = (latency->pending_start + latency->pending_count - 1)
+            % STREAMTEST_LATENCY_PENDING;
+        if (latency->pending[newest].timestamp == timestamp)
+            return;
+    }
+
+    /* Forget the oldest sync if the client is too far behind */
+    if (latency->pending_count == STREAMTEST_LATENCY_PENDING) {
+        latency->pending_start = (latency->pending_start + 1)
+            % STREAMTEST_LATENCY_PENDING;
+        latency->pending_count--;
+    }
+
+    int index = (latency->pending_start + latency->pending_count)
+        % STREAMTEST_LATENCY_PENDING;
+    latency->pending[index].timestamp = timestamp;
+    latency->pending[index].sent = now;
+    latency->pending[index].bytes = bytes;
+    latency->pending_count++;
+
+}
+
+void streamtest_latency_update(streamtest_latency* latency,
+        guac_timestamp received, int64_t now) {
+
+    /* Each acknowledgement also covers all syncs sent before it, but only
+     * the acknowledged sync itself has a known round trip */
+    if (received != latency->last_received) {
+
+        latency->last_received = received;
+
+        while (latency->pending_count > 0) {
+
+            streamtest_latency_probe* probe =
+                &latency->pending[latency->pending_start];
+            if (probe->timestamp > received)
+                break;
+
+            if (probe->timestamp == received) {
+                streamtest_latency_record(&latency->rtt, now - probe->sent);
+                streamtest_latency_delivered(latency, probe->bytes, now);
+            }
+
+            latency->pending_start = (latency->pending_start + 1)
+                % STREAMTEST_LATENCY_PENDING;
+            latency->pending_count--;
+
+        }
+
+    }
+
+    streamtest_latency_record(&latency->lag,
+            streamtest_latency_lag(latency, now));
+
+}
+
+int64_t streamtest_latency_lag(const streamtest_latency* latency,
+        int64_t now) {
+
+    /* The client lags by the age of the oldest unacknowledged sync */
+    if (latency->pending_count == 0)
+        return 0;
+
+    return now - latency->pending[latency->pending_start].sent;
+
+}
+
+int64_t streamtest_latency_percentile(
+        const streamtest_latency_histogram* histogram, int percentile) {
+
+    if (histogram->samples == 0)
+        return 0;
+
+    /* Find the bucket containing the value of the given rank */
+    uint64_t rank = (histogram->samples * percentile + 99) / 100;
+    if (rank == 0)
+        rank = 1;
+
+    uint64_t count = 0;
+    for (int i = 0; i < STREAMTEST_LATENCY_BUCKETS - 1; i++) {
+        count += histogram->buckets[i];
+        if (count >= rank)
+            return streamtest_latency_limit(i);
+    }
+
+    return -1;
+
+}
+
@@ -0,0 +1,274 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef STREAMTEST_LATENCY_H
+#define STREAMTEST_LATENCY_H
+
+#include "config.h"
+
+#include <guacamole/timestamp.h>
+
+#include <stdint.h>
+
+/**
+ * The number of buckets within each latency histogram. The first bucket
+ * counts values below one millisecond, each following bucket counts values
+ * below twice the limit of the bucket before it, and the last bucket counts
+ * everything else.
+ */
+#define STREAMTEST_LATENCY_BUCKETS 16
+
+/**
+ * The maximum number of sync instructions which may await acknowledgement at
+ * once. If the client falls further behind than this, the oldest syncs are
+ * forgotten, and their round trips are not measured.
+ */
+#define STREAMTEST_LATENCY_PENDING 256
+
+/**
+ * The longest the sender may go without sending a sync instruction while
+ * streaming, in microseconds. If no data has been sent for this long, a sync
+ * is sent solely to probe the latency of the client.
+ */
+#define STREAMTEST_PROBE_INTERVAL 1000000
+
+/**
+ * The shortest interval over which the throughput of the client is
+ * measured, in microseconds. Acknowledgements arriving sooner than this
+ * after the start of a measurement are accumulated into the next sample.
+ */
+#define STREAMTEST_THROUGHPUT_INTERVAL 100000
+
+/**
+ * The weight of each new throughput sample within the average throughput
+ * of the client, as a fraction of one. The average moves 1/N of the way
+ * toward each new sample.
+ */
+#define STREAMTEST_THROUGHPUT_WEIGHT 4
+
+/**
+ * The distribution of a latency measurement, in microseconds.
+ */
+typedef struct streamtest_latency_histogram {
+
+    /**
+     * The number of values within each bucket.
+     */
+    uint64_t buckets[STREAMTEST_LATENCY_BUCKETS];
+
+    /**
+     * The total number of values recorded.
+     */
+    uint64_t samples;
+
+    /**
+     * The sum of all values recorded.
+     */
+    uint64_t total;
+
+    /**
+     * The largest value recorded.
+     */
+    int64_t max;
+
+} streamtest_latency_histogram;
+
+/**
+ * A sync instruction which has been sent but not yet acknowledged.
+ */
+typedef struct streamtest_latency_probe {
+
+    /**
+     * The timestamp sent within the sync instruction, which the client will
+     * send back once all prior instructions have been handled.
+     */
+    guac_timestamp timestamp;
+
+    /**
+     * The time at which the sync was sent, as returned by streamtest_utime().
+     */
+    int64_t sent;
+
+    /**
+     * The total number of bytes sent as blobs over the connection at the
+     * time the sync was sent, all of which have been received by the client
+     * once the sync is acknowledged.
+     */
+    uint64_t bytes;
+
+} streamtest_latency_probe;
+
+/**
+ * Round-trip and lag measurements of a single connection, derived from the
+ * sync instructions sent by the sender and echoed back by the client. These
+ * values are only updated by the sender.
+ */
+typedef struct streamtest_latency {
+
+    /**
+     * Syncs which have been sent but not yet acknowledged, oldest first, as
+     * a ring buffer.
+     */
+    streamtest_latency_probe pending[STREAMTEST_LATENCY_PENDING];
+
+    /**
+     * The index of the oldest pending sync within the ring buffer.
+     */
+    int pending_start;
+
+    /**
+     * The number of pending syncs.
+     */
+    int pending_count;
+
+    /**
+     * The most recent timestamp acknowledged by the client.
+     */
+    guac_timestamp last_received;
+
+    /**
+     * The time at which the most recent sync was sent, as returned by
+     * streamtest_utime().
+     */
+    int64_t last_sent;
+
+    /**
+     * The number of bytes known to have been received by the client at the
+     * start of the current throughput measurement.
+     */
+    uint64_t acked_bytes;
+
+    /**
+     * The time at which the current throughput measurement started, as
+     * returned by streamtest_utime(), or zero if no sync has yet been
+     * acknowledged.
+     */
+    int64_t acked_at;
+
+    /**
+     * The moving average of the rate at which the client acknowledges data,
+     * in bits per second, or zero if not yet measured. While the client
+     * keeps up, this is the rate at which data is sent rather than the
+     * capacity of the client.
+     */
+    int64_t throughput;
+
+    /**
+     * The time between sending each sync and observing its
+     * acknowledgement. As acknowledgements are only observed by the sender
+     * as it streams, each round trip may be overestimated by up to the time
+     * between the sender's passes.
+     */
+    streamtest_latency_histogram rtt;
+
+    /**
+     * The age of the oldest unacknowledged sync, sampled on each pass of the
+     * sender, being how far the client lags behind the data sent.
+     */
+    streamtest_latency_histogram lag;
+
+} streamtest_latency;
+
+/**
+ * Resets the given latency measurements, forgetting all syncs sent and all
+ * values recorded.
+ *
+ * @param latency
+ *     The latency measurements to reset.
+ */
+void streamtest_latency_init(streamtest_latency* latency);
+
+/**
+ * Records that a sync instruction containing the given timestamp has just
+ * been sent.
+ *
+ * @param latency
+ *     The latency measurements of the connection.
+ *
+ * @param timestamp
+ *     The timestamp within the sync instruction.
+ *
+ * @param bytes
+ *     The total number of bytes sent as blobs over the connection prior to
+ *     the sync.
+ *
+ * @param now
+ *     The current time, as returned by streamtest_utime().
+ */
+void streamtest_latency_sent(streamtest_latency* latency,
+        guac_timestamp timestamp, uint64_t bytes, int64_t now);
+
+/**
+ * Records the round trip of each sync acknowledged since the previous call,
+ * given the most recent timestamp acknowledged by the client, updates the
+ * throughput of the client, and samples the lag of the client.
+ *
+ * @param latency
+ *     The latency measurements of the connection.
+ *
+ * @param received
+ *     The most recent timestamp acknowledged by the client.
+ *
+ * @param now
+ *     The current time, as returned by streamtest_utime().
+ */
+void streamtest_latency_update(streamtest_latency* latency,
+        guac_timestamp received, int64_t now);
+
+/**
+ * Returns how far the client currently lags behind the data sent, being the
+ * age of the oldest unacknowledged sync.
+ *
+ * @param latency
+ *     The latency measurements of the connection.
+ *
+ * @param now
+ *     The current time, as returned by streamtest_utime().
+ *
+ * @return
+ *     The current lag of the client, in microseconds, or zero if all syncs
+ *     sent have been acknowledged.
+ */
+int64_t streamtest_latency_lag(const streamtest_latency* latency,
+        int64_t now);
+
+/**
+ * Returns an upper bound on the given percentile of the values within the
+ * given histogram, being the limit of the bucket containing that
+ * percentile.
+ *
+ * @param histogram
+ *     The histogram to inspect.
+ *
+ * @param percentile
+ *     The percentile to return, from 0 to 100.
+ *
+ * @return
+ *     The limit of the bucket containing the given percentile, in
+ *     microseconds, or -1 if the percentile lies within the last bucket,
+ *     which has no limit. Zero if the histogram is empty.
+ */
+int64_t streamtest_latency_percentile(
+        const streamtest_latency_histogram* histogram, int percentile);
+
+#endif
+
@@ -0,0 +1,1443 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+#include "metrics.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/eventfd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+/**
+ * The upper limit of each histogram bucket but the last, in microseconds.
+ */
+static const int64_t streamtest_metrics_bucket_limits[] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000
+};
+
+/**
+ * The largest scrape request which will be read before the response is
+ * sent, in bytes. Anything beyond this is ignored.
+ */
+#define STREAMTEST_METRICS_MAX_REQUEST 8192
+
+/**
+ * The process-wide exporter, which serves the metrics of all connections
+ * published for its address over HTTP.
+ */
+typedef struct streamtest_metrics_exporter {
+
+    /**
+     * The address the exporter was started with, as given to
+     * streamtest_metrics_export().
+     */
+    char* address;
+
+    /**
+     * The shared directory of the address, which is scanned for the metrics
+     * of each connection whenever a scrape is serviced.
+     */
+    char* directory;
+
+    /**
+     * The lock file which is held for as long as the exporter runs, such
+     * that other processes do not attempt to export the same address.
+     */
+    int lock_fd;
+
+    /**
+     * The path of the UNIX domain socket created by the exporter, or NULL
+     * if the exporter is listening on a TCP port.
+     */
+    char* path;
+
+    /**
+     * The listening socket.
+     */
+    int listen_fd;
+
+    /**
+     * An eventfd which is signalled to stop the exporter thread.
+     */
+    int stop_fd;
+
+    /**
+     * The exporter thread.
+     */
+    pthread_t thread;
+
+} streamtest_metrics_exporter;
+
+/**
+ * The metrics of a connection of this process which have been published
+ * within the shared directory of their address.
+ */
+typedef struct streamtest_metrics_file {
+
+    /**
+     * The published metrics, as mapped from the file.
+     */
+    streamtest_metrics* metrics;
+
+    /**
+     * The path of the file from which the metrics are mapped.
+     */
+    char* path;
+
+    /**
+     * The next published metrics, or NULL if this is the last.
+     */
+    struct streamtest_metrics_file* next;
+
+} streamtest_metrics_file;
+
+/**
+ * The state of metrics within this process. The metrics themselves are held
+ * within the shared directory of their address, not here.
+ */
+typedef struct streamtest_metrics_registry {
+
+    /**
+     * The number of current connections of this process.
+     */
+    int active;
+
+    /**
+     * The serial number to be used within the name of the next file
+     * published by this process.
+     */
+    unsigned int serial;
+
+    /**
+     * The running exporter, or NULL if this process is not exporting
+     * metrics.
+     */
+    streamtest_metrics_exporter* exporter;
+
+    /**
+     * The address which another process was exporting when this process
+     * attempted to export it, or NULL if this process is not standing by to
+     * take over.
+     */
+    char* standby;
+
+    /**
+     * The lock file of the standby address, which is not held by this
+     * process, or -1 if not standing by.
+     */
+    int standby_fd;
+
+    /**
+     * All metrics of this process which are currently published, or NULL if
+     * none are. As the files of published metrics are shared with other
+     * processes, their paths are kept here rather than within the files.
+     */
+    streamtest_metrics_file* published;
+
+} streamtest_metrics_registry;
+
+/**
+ * The process-wide metrics state.
+ */
+static streamtest_metrics_registry streamtest_metrics_instance = {
+    .standby_fd = -1
+};
+
+/**
+ * Lock which guards the process-wide registry. Counters themselves are
+ * updated without this lock.
+ */
+static pthread_mutex_t streamtest_metrics_instance_lock =
+    PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * A growable buffer of text.
+ */
+typedef struct streamtest_metrics_text {
+
+    /**
+     * The text, which is always null-terminated.
+     */
+    char* data;
+
+    /**
+     * The length of the text, excluding the null terminator.
+     */
+    int length;
+
+    /**
+     * The number of bytes allocated for data.
+     */
+    int size;
+
+} streamtest_metrics_text;
+
+/**
+ * Atomically reads the given counter.
+ *
+ * @param counter
+ *     The counter to read.
+ *
+ * @return
+ *     The current value of the counter.
+ */
+static uint64_t streamtest_metrics_read(uint64_t* counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+/**
+ * Adds the current values of the given histogram to another histogram
+ * which is not shared with any other thread.
+ *
+ * @param total
+ *     The histogram to add to.
+ *
+ * @param histogram
+ *     The histogram to read.
+ */
+static void streamtest_metrics_sum_histogram(
+        streamtest_metrics_histogram* total,
+        streamtest_metrics_histogram* histogram) {
+
+    for (int i = 0; i < STREAMTEST_METRICS_BUCKETS; i++)
+        total->buckets[i] += streamtest_metrics_read(&histogram->buckets[i]);
+
+    total->count += streamtest_metrics_read(&histogram->count);
+    total->sum += streamtest_metrics_read(&histogram->sum);
+
+}
+
+/**
+ * Adds the current values of the given metrics to a set of metrics which is
+ * not shared with any other thread.
+ *
+ * @param total
+ *     The metrics to add to.
+ *
+ * @param metrics
+ *     The metrics to read.
+ */
+static void streamtest_metrics_sum(streamtest_metrics* total,
+        streamtest_metrics* metrics) {
+
+    total->bytes_sent += streamtest_metrics_read(&metrics->bytes_sent);
+    total->blobs_sent += streamtest_metrics_read(&metrics->blobs_sent);
+    total->frames += streamtest_metrics_read(&metrics->frames);
+    total->overruns += streamtest_metrics_read(&metrics->overruns);
+    total->socket_blocked += streamtest_metrics_read(
+            &metrics->socket_blocked);
+
+    streamtest_metrics_sum_histogram(&total->sleep_error,
+            &metrics->sleep_error);
+    streamtest_metrics_sum_histogram(&total->read_latency,
+            &metrics->read_latency);
+    streamtest_metrics_sum_histogram(&total->flush_latency,
+            &metrics->flush_latency);
+    streamtest_metrics_sum_histogram(&total->first_byte,
+            &metrics->first_byte);
+
+}
+
+/**
+ * Returns the path of the file having the given name within the given
+ * directory.
+ *
+ * @param directory
+ *     The directory containing the file.
+ *
+ * @param name
+ *     The name of the file.
+ *
+ * @return
+ *     A newly-allocated string containing the path of the file.
+ */
+static char* streamtest_metrics_path(const char* directory,
+        const char* name) {
+
+    char* path = malloc(strlen(directory) + strlen(name) + 2);
+    sprintf(path, "%s/%s", directory, name);
+    return path;
+
+}
+
+/**
+ * Returns the path of the shared directory of the given metrics address,
+ * creating the directory if it does not yet exist.
+ *
+ * @param address
+ *     The address whose directory should be returned, as accepted by
+ *     streamtest_metrics_export().
+ *
+ * @return
+ *     A newly-allocated string containing the path of the directory, or
+ *     NULL if the directory could not be created, in which case errno is
+ *     set appropriately.
+ */
+static char* streamtest_metrics_directory(const char* address) {
+
+    char* directory = malloc(strlen(STREAMTEST_METRICS_SHARED_DIR)
+            + strlen(STREAMTEST_METRICS_SHARED_PREFIX) + strlen(address) + 2);
+
+    sprintf(directory, "%s/%s%s", STREAMTEST_METRICS_SHARED_DIR,
+            STREAMTEST_METRICS_SHARED_PREFIX, address);
+
+    /* Addresses may be paths, but the directory must not be nested */
+    char* name = directory + strlen(STREAMTEST_METRICS_SHARED_DIR) + 1;
+    for (char* current = name; *current != '\0'; current++) {
+        if (*current == '/')
+            *current = '_';
+    }
+
+    if (mkdir(directory, 0700) && errno != EEXIST) {
+        free(directory);
+        return NULL;
+    }
+
+    return directory;
+
+}
+
+/**
+ * Opens (creating if necessary) the given file within the given directory,
+ * ensuring it is at least large enough to hold a streamtest_metrics.
+ *
+ * @param directory
+ *     The shared directory of a metrics address.
+ *
+ * @param name
+ *     The name of the file within the directory.
+ *
+ * @return
+ *     The open file, or -1 if the file could not be opened, in which case
+ *     errno is set appropriately.
+ */
+static int streamtest_metrics_open(const char* directory,
+        const char* name) {
+
+    char* path = streamtest_metrics_path(directory, name);
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    free(path);
+    if (fd == -1)
+        return -1;
+
+    /* Extending leaves existing contents untouched, and new contents zero */
+    struct stat file_stat;
+    if (fstat(fd, &file_stat)
+            || (file_stat.st_size < (off_t) sizeof(streamtest_metrics)
+                && ftruncate(fd, sizeof(streamtest_metrics)))) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+
+}
+
+/**
+ * Maps the metrics within the given file, which must be at least large
+ * enough to hold a streamtest_metrics.
+ *
+ * @param fd
+ *     The file to map.
+ *
+ * @param prot
+ *     The desired protection of the mapping, as accepted by mmap().
+ *
+ * @return
+ *     The mapped metrics, or NULL if the file could not be mapped, in which
+ *     case errno is set appropriately.
+ */
+static streamtest_metrics* streamtest_metrics_map(int fd, int prot) {
+
+    void* mapped = mmap(NULL, sizeof(streamtest_metrics), prot, MAP_SHARED,
+            fd, 0);
+
+    if (mapped == MAP_FAILED)
+        return NULL;
+
+    return (streamtest_metrics*) mapped;
+
+}
+
+/**
+ * Opens, locks and maps the retired totals within the given shared
+ * directory. Only one process may modify the set of published metrics, or
+ * add up the metrics within it, at any given time.
+ *
+ * @param directory
+ *     The shared directory of a metrics address.
+ *
+ * @param fd
+ *     Storage for the open file, which must be passed to
+ *     streamtest_metrics_unlock() once the totals are no longer needed.
+ *
+ * @return
+ *     The retired totals, or NULL if they could not be mapped, in which
+ *     case errno is set appropriately.
+ */
+static streamtest_metrics* streamtest_metrics_lock(const char* directory,
+        int* fd) {
+
+    *fd = streamtest_metrics_open(directory, STREAMTEST_METRICS_RETIRED);
+    if (*fd == -1)
+        return NULL;
+
+    streamtest_metrics* retired = NULL;
+    if (flock(*fd, LOCK_EX) == 0)
+        retired = streamtest_metrics_map(*fd,
+                PROT_READ | PROT_WRITE);
+
+    if (retired == NULL)
+        close(*fd);
+
+    return retired;
+
+}
+
+/**
+ * Unmaps and unlocks the retired totals mapped by streamtest_metrics_lock().
+ *
+ * @param retired
+ *     The retired totals.
+ *
+ * @param fd
+ *     The file returned by streamtest_metrics_lock().
+ */
+static void streamtest_metrics_unlock(streamtest_metrics* retired, int fd) {
+    munmap(retired, sizeof(streamtest_metrics));
+    close(fd);
+}
+
+/**
+ * Creates and maps a new file within the shared directory of the given
+ * address for the metrics of a new connection.
+ *
+ * @param address
+ *     The address at which the metrics will be exported.
+ *
+ * @return
+ *     The newly-published metrics, with all counters zero, or NULL if the
+ *     metrics could not be published, in which case errno is set
+ *     appropriately.
+ */
+static streamtest_metrics* streamtest_metrics_publish(const char* address) {
+
+    char* directory = streamtest_metrics_directory(address);
+    if (directory == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&streamtest_metrics_instance_lock);
+    unsigned int serial = streamtest_metrics_instance.serial++;
+    pthread_mutex_unlock(&streamtest_metrics_instance_lock);
+
+    char name[64];
+    snprintf(name, sizeof(name), "%ld.%u", (long) getpid(), serial);
+
+    int lock_fd;
+    streamtest_metrics* retired = streamtest_metrics_lock(directory,
+            &lock_fd);
+    if (retired == NULL)
+        goto fail_lock;
+
+    int fd = streamtest_metrics_open(directory, name);
+    if (fd == -1)
+        goto fail_open;
+
+    streamtest_metrics* metrics = streamtest_metrics_map(fd,
+            PROT_READ | PROT_WRITE);
+    close(fd);
+    if (metrics == NULL)
+        goto fail_open;
+
+    /* Any file left behind by an earlier process of the same ID has not
+     * yet been retired, as that is done only when scanning */
+    streamtest_metrics_sum(retired, metrics);
+    memset(metrics, 0, sizeof(streamtest_metrics));
+
+    streamtest_metrics_file* file = malloc(sizeof(streamtest_metrics_file));
+    file->metrics = metrics;
+    file->path = streamtest_metrics_path(directory, name);
+
+    pthread_mutex_lock(&streamtest_metrics_instance_lock);
+    file->next = streamtest_metrics_instance.published;
+    streamtest_metrics_instance.published = file;
+    pthread_mutex_unlock(&streamtest_metrics_instance_lock);
+
+    streamtest_metrics_unlock(retired, lock_fd);
+    free(directory);
+    return metrics;
+
+fail_open:
+    streamtest_metrics_unlock(retired, lock_fd);
+
+fail_lock:
+    free(directory);
+    return NULL;
+
+}
+
+streamtest_metrics* streamtest_metrics_alloc(const char* address) {
+
+    streamtest_metrics* metrics;
+
+    /* Metrics which are exported must be visible to other processes */
+    if (address[0] != '\0') {
+        metrics = streamtest_metrics_publish(address);
+        if (metrics == NULL)
+            return NULL;
+    }
+
+    else
+        metrics = calloc(1, sizeof(streamtest_metrics));
+
+    pthread_mutex_lock(&streamtest_metrics_instance_lock);
+    streamtest_metrics_instance.active++;
+    pthread_mutex_unlock(&streamtest_metrics_instance_lock);
+
+    return metrics;
+
+}
+
+void streamtest_metrics_add(uint64_t* counter, uint64_t amount) {
+    __atomic_fetch_add(counter, amount, __ATOMIC_RELAXED);
+}
+
+void streamtest_metrics_observe(streamtest_metrics_histogram* histogram,
+        int64_t usecs) {
+
+    if (usecs < 0)
+        usecs = 0;
+
+    /* Find first bucket containing the value, defaulting to the last */
+    int bucket = 0;
+    while (bucket < STREAMTEST_METRICS_BUCKETS - 1
+            && usecs > streamtest_metrics_bucket_limits[bucket])
+        bucket++;
+
+    streamtest_metrics_add(&histogram->buckets[bucket], 1);
+    streamtest_metrics_add(&histogram->count, 1);
+    streamtest_metrics_add(&histogram->sum, usecs);
+
+}
+
+/**
+ * Appends formatted text to the given buffer, growing the buffer as
+ * necessary.
+ *
+ * @param text
+ *     The buffer to append to.
+ *
+ * @param format
+ *     A printf-style format string.
+ *
+ * @param ...
+ *     Any arguments to use when filling the format string.
+ */
+static void streamtest_metrics_append(streamtest_metrics_text* text,
+        const char* format, ...) {
+
+    for (;;) {
+
+        va_list args;
+        va_start(args, format);
+        int length = vsnprintf(text->data + text->length,
+                text->size - text->length, format, args);
+        va_end(args);
+
+        /* Done if the text fit */
+        if (text->length + length < text->size) {
+            text->length += length;
+            return;
+        }
+
+        /* Otherwise, grow and retry */
+        text->size = (text->size + length) * 2;
+        text->data = realloc(text->data, text->size);
+
+    }
+
+}
+
+/**
+ * Appends a single counter or gauge, in Prometheus text format, to the given
+ * buffer.
+ *
+ * @param text
+ *     The buffer to append to.
+ *
+ * @param name
+ *     The name of the metric.
+ *
+ * @param type
+ *     The Prometheus type of the metric, either "counter" or "gauge".
+ *
+ * @param help
+ *     A description of the metric.
+ *
+ * @param value
+ *     The current value of the metric.
+ */
+static void streamtest_metrics_append_value(streamtest_metrics_text* text,
+        const char* name, const char* type, const char* help,
+        uint64_t value) {
+
+    streamtest_metrics_append(text,
+            "# HELP %s %s\n"
+            "# TYPE %s %s\n"
+            "%s %" PRIu64 "\n",
+            name, help, name, type, name, value);
+
+}
+
+/**
+ * Appends a single counter of microseconds, in Prometheus text format, to
+ * the given buffer. The value is converted to seconds.
+ *
+ * @param text
+ *     The buffer to append to.
+ *
+ * @param name
+ *     The name of the metric.
+ *
+ * @param help
+ *     A description of the metric.
+ *
+ * @param usecs
+ *     The current value of the metric, in microseconds.
+ */
+static void streamtest_metrics_append_seconds(streamtest_metrics_text* text,
+        const char* name, const char* help, uint64_t usecs) {
+
+    streamtest_metrics_append(text,
+            "# HELP %s %s\n"
+            "# TYPE %s counter\n"
+            "%s %g\n",
+            name, help, name, name, usecs / 1000000.0);
+
+}
+
+/**
+ * Appends a histogram, in Prometheus text format, to the given buffer.
+ * Durations are converted from microseconds to seconds.
+ *
+ * @param text
+ *     The buffer to append to.
+ *
+ * @param name
+ *     The name of the metric.
+ *
+ * @param help
+ *     A description of the metric.
+ *
+ * @param histogram
+ *     The histogram to append.
+ */
+static void streamtest_metrics_append_histogram(
+        streamtest_metrics_text* text, const char* name, const char* help,
+        streamtest_metrics_histogram* histogram) {
+
+    streamtest_metrics_append(text,
+            "# HELP %s %s\n"
+            "# TYPE %s histogram\n",
+            name, help, name);
+
+    /* Prometheus buckets are cumulative */
+    uint64_t cumulative = 0;
+    for (int i = 0; i < STREAMTEST_METRICS_BUCKETS - 1; i++) {
+        cumulative += histogram->buckets[i];
+        streamtest_metrics_append(text,
+                "%s_bucket{le=\"%g\"} %" PRIu64 "\n", name,
+                streamtest_metrics_bucket_limits[i] / 1000000.0, cumulative);
+    }
+
+    streamtest_metrics_append(text,
+            "%s_bucket{le=\"+Inf\"} %" PRIu64 "\n"
+            "%s_sum %g\n"
+            "%s_count %" PRIu64 "\n",
+            name, histogram->count,
+            name, histogram->sum / 1000000.0,
+            name, histogram->count);
+
+}
+
+/**
+ * Adds the metrics within the given published file to the given totals. If
+ * the process which published the file no longer exists, its metrics are
+ * instead moved into the retired totals and the file is removed. The
+ * retired totals must be locked.
+ *
+ * @param directory
+ *     The shared directory containing the file.
+ *
+ * @param name
+ *     The name of the file.
+ *
+ * @param total
+ *     The totals of current connections to add to.
+ *
+ * @param retired
+ *     The retired totals of the directory.
+ *
+ * @return
+ *     true if the file contains the metrics of a current connection, false
+ *     otherwise.
+ */
+static bool streamtest_metrics_scan_file(const char* directory,
+        const char* name, streamtest_metrics* total,
+        streamtest_metrics* retired) {
+
+    /* Ignore anything not named after a process */
+    char* end;
+    long pid = strtol(name, &end, 10);
+    if (end == name || *end != '.' || pid <= 0)
+        return false;
+
+    char* path = streamtest_metrics_path(directory, name);
+
+    bool current = false;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd != -1) {
+
+        /* Files are extended before the metrics within them are used */
+        struct stat file_stat;
+        streamtest_metrics* metrics = NULL;
+        if (fstat(fd, &file_stat) == 0
+                && file_stat.st_size >= (off_t) sizeof(streamtest_metrics))
+            metrics = streamtest_metrics_map(fd, PROT_READ);
+
+        close(fd);
+
+        /* Connections of processes which ended without freeing their
+         * metrics are retired on their behalf */
+        bool stale = kill(pid, 0) && errno == ESRCH;
+        if (metrics != NULL) {
+            streamtest_metrics_sum(stale ? retired : total, metrics);
+            munmap(metrics, sizeof(streamtest_metrics));
+        }
+
+        if (stale)
+            unlink(path);
+        else
+            current = true;
+
+    }
+
+    free(path);
+    return current;
+
+}
+
+/**
+ * Renders the metrics of all connections published within the given shared
+ * directory, past and present, in Prometheus text format.
+ *
+ * @param directory
+ *     The shared directory of the address being exported.
+ *
+ * @param text
+ *     The buffer to append the rendered metrics to.
+ */
+static void streamtest_metrics_render(const char* directory,
+        streamtest_metrics_text* text) {
+
+    streamtest_metrics total = { 0 };
+    int active = 0;
+
+    /* Publishing and retiring connections waits for the scan */
+    int fd;
+    streamtest_metrics* retired = streamtest_metrics_lock(directory, &fd);
+    if (retired != NULL) {
+
+        DIR* dir = opendir(directory);
+        if (dir != NULL) {
+
+            struct dirent* entry;
+            while ((entry = readdir(dir)) != NULL) {
+                if (streamtest_metrics_scan_file(directory, entry->d_name,
+                            &total, retired))
+                    active++;
+            }
+
+            closedir(dir);
+
+        }
+
+        streamtest_metrics_sum(&total, retired);
+        streamtest_metrics_unlock(retired, fd);
+
+    }
+
+    streamtest_metrics_append_value(text, "streamtest_active_connections",
+            "gauge", "Number of connections currently streaming.", active);
+
+    streamtest_metrics_append_value(text, "streamtest_bytes_sent_total",
+            "counter", "Bytes of media data sent within blobs.",
+            total.bytes_sent);
+
+    streamtest_metrics_append_value(text, "streamtest_blobs_sent_total",
+            "counter", "Blob instructions sent.", total.blobs_sent);
+
+    streamtest_metrics_append_value(text, "streamtest_frames_total",
+            "counter", "Frames read from media sources.", total.frames);
+
+    streamtest_metrics_append_value(text, "streamtest_frame_overruns_total",
+            "counter", "Frames which took longer than the frame interval.",
+            total.overruns);
+
+    streamtest_metrics_append_seconds(text,
+            "streamtest_socket_blocked_seconds_total",
+            "Time spent writing to or flushing client sockets.",
+            total.socket_blocked);
+
+    streamtest_metrics_append_histogram(text,
+            "streamtest_sleep_error_seconds",
+            "How late each frame was read relative to its deadline.",
+            &total.sleep_error);
+
+    streamtest_metrics_append_histogram(text,
+            "streamtest_read_latency_seconds",
+            "How long each frame took to read from its source.",
+            &total.read_latency);
+
+    streamtest_metrics_append_histogram(text,
+            "streamtest_flush_latency_seconds",
+            "How long each flush of a client socket took.",
+            &total.flush_latency);
+
+    streamtest_metrics_append_histogram(text,
+            "streamtest_time_to_first_byte_seconds",
+            "How long each connection took to send its first media data.",
+            &total.first_byte);
+
+}
+
+/**
+ * Writes the entirety of the given buffer to the given socket.
+ *
+ * @param fd
+ *     The socket to write to.
+ *
+ * @param buffer
+ *     The data to write.
+ *
+ * @param length
+ *     The number of bytes to write.
+ *
+ * @return
+ *     Zero if all data was written, non-zero otherwise.
+ */
+static int streamtest_metrics_write(int fd, const char* buffer, int length) {
+
+    while (length > 0) {
+
+        /* Do not raise SIGPIPE if the scraper has gone away */
+        ssize_t written = send(fd, buffer, length, MSG_NOSIGNAL);
+        if (written == -1) {
+            if (errno == EINTR)
+                continue;
+            return 1;
+        }
+
+        buffer += written;
+        length -= written;
+
+    }
+
+    return 0;
+
+}
+
+/**
+ * Services a single scrape, reading the HTTP request and responding with the
+ * current metrics regardless of the path requested. The connection is
+ * closed once the response has been sent.
+ *
+ * @param directory
+ *     The shared directory of the address being exported.
+ *
+ * @param fd
+ *     The accepted connection.
+ */
+static void streamtest_metrics_serve(const char* directory, int fd) {
+
+    /* Do not allow a stalled scraper to block the exporter indefinitely */
+    struct timeval timeout = { .tv_sec = STREAMTEST_METRICS_TIMEOUT };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    /* Read request headers, up to the blank line which ends them */
+    char request[STREAMTEST_METRICS_MAX_REQUEST + 1];
+    int length = 0;
+    while (length < STREAMTEST_METRICS_MAX_REQUEST) {
+
+        ssize_t received = recv(fd, request + length,
+                STREAMTEST_METRICS_MAX_REQUEST - length, 0);
+
+        if (received == -1 && errno == EINTR)
+            continue;
+
+        /* Give up on errors and timeouts */
+        if (received <= 0) {
+            if (length == 0)
+                return;
+            break;
+        }
+
+        length += received;
+        request[length] = '\0';
+
+        if (strstr(request, "\r\n\r\n") != NULL
+                || strstr(request, "\n\n") != NULL)
+            break;
+
+    }
+
+    streamtest_metrics_text body = { 0 };
+    streamtest_metrics_render(directory, &body);
+
+    streamtest_metrics_text response = { 0 };
+    streamtest_metrics_append(&response,
+            "HTTP/1.0 200 OK\r\n"
+            "Content-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: %i\r\n"
+            "Connection: close\r\n"
+            "\r\n", body.length);
+
+    if (!streamtest_metrics_write(fd, response.data, response.length))
+        streamtest_metrics_write(fd, body.data, body.length);
+
+    free(response.data);
+    free(body.data);
+
+}
+
+/**
+ * The body of the exporter thread, which accepts and services scrapes one at
+ * a time until signalled to stop.
+ *
+ * @param data
+ *     The streamtest_metrics_exporter being serviced.
+ *
+ * @return
+ *     Always NULL.
+ */
+static void* streamtest_metrics_thread(void* data) {
+
+    streamtest_metrics_exporter* exporter =
+        (streamtest_metrics_exporter*) data;
+
+    struct pollfd fds[] = {
+        { .fd = exporter->listen_fd, .events = POLLIN },
+        { .fd = exporter->stop_fd,   .events = POLLIN }
+    };
+
+    for (;;) {
+
+        int count = poll(fds, 2, -1);
+        if (count == -1) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        if (fds[1].revents)
+            break;
+
+        if (!(fds[0].revents & POLLIN))
+            continue;
+
+        int fd = accept(exporter->listen_fd, NULL, NULL);
+        if (fd == -1)
+            continue;
+
+        streamtest_metrics_serve(exporter->directory, fd);
+        close(fd);
+
+    }
+
+    return NULL;
+
+}
+
+/**
+ * Creates a UNIX domain socket listening at the given path. If a socket
+ * already exists at the path but nothing is listening on it, it is assumed
+ * to have been left behind by an exporter which did not exit cleanly, and is
+ * replaced.
+ *
+ * @param path
+ *     The path of the socket to create.
+ *
+ * @return
+ *     The listening socket, or -1 if the socket could not be created, in
+ *     which case errno is set appropriately.
+ */
+static int streamtest_metrics_listen_unix(const char* path) {
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return -1;
+
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr))) {
+
+        if (errno != EADDRINUSE)
+            goto fail;
+
+        /* Refuse to replace a socket which is still in use */
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (probe == -1)
+            goto fail;
+
+        int in_use = !connect(probe, (struct sockaddr*) &addr, sizeof(addr));
+        close(probe);
+
+        if (in_use) {
+            errno = EADDRINUSE;
+            goto fail;
+        }
+
+        if (unlink(path) || bind(fd, (struct sockaddr*) &addr, sizeof(addr)))
+            goto fail;
+
+    }
+
+    if (listen(fd, SOMAXCONN)) {
+        unlink(path);
+        goto fail;
+    }
+
+    return fd;
+
+fail:
+    close(fd);
+    return -1;
+
+}
+
+/**
+ * Creates a TCP socket listening on the given port of the loopback
+ * interface.
+ *
+ * @param port
+ *     The port to listen on.
+ *
+ * @return
+ *     The listening socket, or -1 if the socket could not be created, in
+ *     which case errno is set appropriately.
+ */
+static int streamtest_metrics_listen_tcp(int port) {
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK)
+    };
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return -1;
+
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr))
+            || listen(fd, SOMAXCONN)) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+
+}
+
+/**
+ * Allocates and starts the process-wide exporter, storing it within the
+ * registry. The instance lock must be held.
+ *
+ * @param address
+ *     The address to listen on, as accepted by streamtest_metrics_export().
+ *
+ * @param lock_fd
+ *     The lock file of the address, which must already be locked by this
+ *     process. If the exporter is started, it takes ownership of this file.
+ *
+ * @return
+ *     Zero if the exporter was started successfully, non-zero otherwise, in
+ *     which case errno is set appropriately.
+ */
+static int streamtest_metrics_start(const char* address, int lock_fd) {
+
+    streamtest_metrics_exporter* exporter =
+        calloc(1, sizeof(streamtest_metrics_exporter));
+
+    exporter->directory = streamtest_metrics_directory(address);
+    if (exporter->directory == NULL)
+        goto fail_directory;
+
+    size_t prefix_length = strlen(STREAMTEST_METRICS_UNIX_PREFIX);
+
+    /* UNIX domain socket */
+    if (strncmp(address, STREAMTEST_METRICS_UNIX_PREFIX,
+                prefix_length) == 0) {
+        exporter->path = strdup(address + prefix_length);
+        exporter->listen_fd = streamtest_metrics_listen_unix(exporter->path);
+    }
+
+    /* TCP port on loopback interface */
+    else {
+
+        char* end;
+        long port = strtol(address, &end, 10);
+        if (*address == '\0' || *end != '\0' || port <= 0 || port > 65535) {
+            errno = EINVAL;
+            goto fail_listen;
+        }
+
+        exporter->listen_fd = streamtest_metrics_listen_tcp(port);
+
+    }
+
+    if (exporter->listen_fd == -1)
+        goto fail_listen;
+
+    exporter->stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (exporter->stop_fd == -1)
+        goto fail_eventfd;
+
+    int error = pthread_create(&exporter->thread, NULL,
+            streamtest_metrics_thread, exporter);
+    if (error) {
+        errno = error;
+        goto fail_thread;
+    }
+
+    exporter->address = strdup(address);
+    exporter->lock_fd = lock_fd;
+    streamtest_metrics_instance.exporter = exporter;
+    return 0;
+
+fail_thread:
+    close(exporter->stop_fd);
+
+fail_eventfd:
+    close(exporter->listen_fd);
+    if (exporter->path != NULL)
+        unlink(exporter->path);
+
+fail_listen:
+    free(exporter->path);
+    free(exporter->directory);
+
+fail_directory:
+    free(exporter);
+    return 1;
+
+}
+
+/**
+ * Stops and frees the process-wide exporter. The instance lock must be held.
+ */
+static void streamtest_metrics_stop() {
+
+    streamtest_metrics_exporter* exporter =
+        streamtest_metrics_instance.exporter;
+
+    /* Signal exporter thread to stop and wait for it to do so */
+    uint64_t value = 1;
+    if (write(exporter->stop_fd, &value, sizeof(value)) == sizeof(value))
+        pthread_join(exporter->thread, NULL);
+
+    close(exporter->stop_fd);
+    close(exporter->listen_fd);
+
+    if (exporter->path != NULL) {
+        unlink(exporter->path);
+        free(exporter->path);
+    }
+
+    /* Allow another process to take over */
+    close(exporter->lock_fd);
+
+    free(exporter->directory);
+    free(exporter->address);
+    free(exporter);
+
+    streamtest_metrics_instance.exporter = NULL;
+
+}
+
+/**
+ * Begins exporting the given address if no other process is exporting it,
+ * or otherwise stands by to take over once that process stops. The instance
+ * lock must be held, and no exporter may be running.
+ *
+ * @param address
+ *     The address to export, as accepted by streamtest_metrics_export().
+ *
+ * @return
+ *     Zero if this process is now exporting or standing by to export the
+ *     given address, non-zero otherwise, in which case errno is set
+ *     appropriately.
+ */
+static int streamtest_metrics_claim(const char* address) {
+
+    char* directory = streamtest_metrics_directory(address);
+    if (directory == NULL)
+        return 1;
+
+    char* path = streamtest_metrics_path(directory,
+            STREAMTEST_METRICS_EXPORTER);
+    int lock_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+
+    free(path);
+    free(directory);
+    if (lock_fd == -1)
+        return 1;
+
+    /* Stand by if another process holds the lock */
+    if (flock(lock_fd, LOCK_EX | LOCK_NB)) {
+
+        if (errno != EWOULDBLOCK) {
+            close(lock_fd);
+            return 1;
+        }
+
+        streamtest_metrics_instance.standby = strdup(address);
+        streamtest_metrics_instance.standby_fd = lock_fd;
+        return 0;
+
+    }
+
+    if (streamtest_metrics_start(address, lock_fd)) {
+        int error = errno;
+        close(lock_fd);
+        errno = error;
+        return 1;
+    }
+
+    return 0;
+
+}
+
+/**
+ * Stops standing by to export metrics, if doing so. The instance lock must
+ * be held.
+ */
+static void streamtest_metrics_abandon() {
+
+    streamtest_metrics_registry* registry = &streamtest_metrics_instance;
+    if (registry->standby == NULL)
+        return;
+
+    if (registry->standby_fd != -1)
+        close(registry->standby_fd);
+
+    free(registry->standby);
+
+    registry->standby_fd = -1;
+    registry->standby = NULL;
+
+}
+
+int streamtest_metrics_export(const char* address) {
+
+    int retval = 0;
+
+    pthread_mutex_lock(&streamtest_metrics_instance_lock);
+
+    streamtest_metrics_exporter* exporter =
+        streamtest_metrics_instance.exporter;
+
+    const char* standby = streamtest_metrics_instance.standby;
+
+    /* Only one exporter may run per process */
+    if (exporter != NULL) {
+        if (strcmp(exporter->address, address) != 0) {
+            errno = EEXIST;
+            retval = 1;
+        }
+    }
+
+    /* Likewise if standing by for another process */
+    else if (standby != NULL) {
+        if (strcmp(standby, address) != 0) {
+            errno = EEXIST;
+            retval = 1;
+        }
+    }
+
+    else
+        retval = streamtest_metrics_claim(address);
+
+    pthread_mutex_unlock(&streamtest_metrics_instance_lock);
+
+    return retval;
+
+}
+
+void streamtest_metrics_retry() {
+
+    pthread_mutex_lock(&streamtest_metrics_instance_lock);
+
+    streamtest_metrics_registry* registry = &streamtest_metrics_instance;
+
+    /* Take over once the exporting process releases its lock, giving up
+     * entirely if the address cannot then be exported */
+    if (registry->standby != NULL
+            && flock(registry->standby_fd, LOCK_EX | LOCK_NB) == 0) {
+
+        if (streamtest_metrics_start(registry->standby,
+                    registry->standby_fd) == 0)
+            registry->standby_fd = -1;
+
+        streamtest_metrics_abandon();
+
+    }
+
+    pthread_mutex_unlock(&streamtest_metrics_instance_lock);
+
+}
+
+/**
+ * Removes the given metrics from the metrics published by this process,
+ * returning the path of their file.
+ *
+ * @param metrics
+ *     The metrics to remove.
+ *
+ * @return
+ *     The path of the file from which the given metrics are mapped, which
+ *     must be freed with free(), or NULL if the metrics were never
+ *     published and are private to this process.
+ */
+static char* streamtest_metrics_unpublish(streamtest_metrics* metrics) {
+
+    char* path = NULL;
+
+    pthread_mutex_lock(&streamtest_metrics_instance_lock);
+
+    streamtest_metrics_file** current = &streamtest_metrics_instance.published;
+    while (*current != NULL) {
+
+        streamtest_metrics_file* file = *current;
+        if (file->metrics == metrics) {
+            *current = file->next;
+            path = file->path;
+            free(file);
+            break;
+        }
+
+        current = &file->next;
+
+    }
+
+    pthread_mutex_unlock(&streamtest_metrics_instance_lock);
+
+    return path;
+
+}
+
+/**
+ * Moves the given published metrics into the retired totals of their
+ * directory and removes their file. If the totals cannot be locked, the
+ * file is left in place, to be retired once this process has ended.
+ *
+ * @param metrics
+ *     The published metrics to retire.
+ *
+ * @param path
+ *     The path of the file from which the metrics are mapped.
+ */
+static void streamtest_metrics_retire(streamtest_metrics* metrics,
+        const char* path) {
+
+    char* directory = strdup(path);
+    *strrchr(directory, '/') = '\0';
+
+    int fd;
+    streamtest_metrics* retired = streamtest_metrics_lock(directory, &fd);
+    if (retired != NULL) {
+        streamtest_metrics_sum(retired, metrics);
+        unlink(path);
+        streamtest_metrics_unlock(retired, fd);
+    }
+
+    free(directory);
+
+}
+
+void streamtest_metrics_free(streamtest_metrics* metrics) {
+
+    /* Retain counts such that totals never decrease */
+    char* path = streamtest_metrics_unpublish(metrics);
+    if (path != NULL) {
+        streamtest_metrics_retire(metrics, path);
+        munmap(metrics, sizeof(streamtest_metrics));
+        free(path);
+    }
+
+    else
+        free(metrics);
+
+    pthread_mutex_lock(&streamtest_metrics_instance_lock);
+
+    streamtest_metrics_registry* registry = &streamtest_metrics_instance;
+
+    /* Stop exporting (or standing by) once the last connection is gone */
+    if (--registry->active == 0) {
+        if (registry->exporter != NULL)
+            streamtest_metrics_stop();
+        streamtest_metrics_abandon();
+    }
+
+    pthread_mutex_unlock(&streamtest_metrics_instance_lock);
+
+}
+
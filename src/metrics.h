@@ -0,0 +1,249 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef STREAMTEST_METRICS_H
+#define STREAMTEST_METRICS_H
+
+#include "config.h"
+
+#include <stdint.h>
+
+/**
+ * The prefix which denotes a metrics address that refers to a UNIX domain
+ * socket rather than a TCP port. The remainder of the address is the path
+ * of the socket.
+ */
+#define STREAMTEST_METRICS_UNIX_PREFIX "unix:"
+
+/**
+ * The directory within which the metrics of connections sharing a metrics
+ * address are published, such that whichever process exports that address
+ * can include the connections of every other process. As guacd forks a
+ * separate process for each connection, this is the only way the metrics
+ * of different connections can be aggregated. This should be a tmpfs, as
+ * counters are updated in place.
+ */
+#define STREAMTEST_METRICS_SHARED_DIR "/dev/shm"
+
+/**
+ * The prefix of the name of the directory, within
+ * STREAMTEST_METRICS_SHARED_DIR, containing the metrics published for a
+ * particular address. The remainder of the name is the address itself, with
+ * any slashes replaced by underscores.
+ */
+#define STREAMTEST_METRICS_SHARED_PREFIX "guac-streamtest-metrics-"
+
+/**
+ * The name of the file, within the directory of a metrics address, which
+ * holds the sums of the metrics of all connections which have ended. Each
+ * current connection is published within a file named after its process ID
+ * and a serial number, separated by a period.
+ */
+#define STREAMTEST_METRICS_RETIRED "retired"
+
+/**
+ * The name of the file, within the directory of a metrics address, which is
+ * locked for as long as a process is exporting that address. Other
+ * processes wishing to export the same address wait for this lock rather
+ * than repeatedly attempting to listen.
+ */
+#define STREAMTEST_METRICS_EXPORTER "exporter"
+
+/**
+ * The number of buckets within each metrics histogram, including the final
+ * bucket which counts all values beyond the limit of the others.
+ */
+#define STREAMTEST_METRICS_BUCKETS 11
+
+/**
+ * The longest a single scrape may take to send its request or receive its
+ * response, in seconds, before the exporter gives up on it.
+ */
+#define STREAMTEST_METRICS_TIMEOUT 1
+
+/**
+ * The distribution of a duration, in the form of a Prometheus histogram.
+ * All members are updated atomically, and may be read at any time.
+ */
+typedef struct streamtest_metrics_histogram {
+
+    /**
+     * The number of values within each bucket. Unlike Prometheus buckets,
+     * these counts are not cumulative.
+     */
+    uint64_t buckets[STREAMTEST_METRICS_BUCKETS];
+
+    /**
+     * The total number of values recorded.
+     */
+    uint64_t count;
+
+    /**
+     * The sum of all values recorded, in microseconds.
+     */
+    uint64_t sum;
+
+} streamtest_metrics_histogram;
+
+/**
+ * The metrics of a single connection. If the connection exports metrics,
+ * these are mapped from a file within the shared directory of its metrics
+ * address for as long as the connection exists. Counters are updated
+ * atomically without locking, and are summed across all connections (past
+ * and present, of any process) only when scraped.
+ */
+typedef struct streamtest_metrics {
+
+    /**
+     * The total number of bytes of media data sent as blobs.
+     */
+    uint64_t bytes_sent;
+
+    /**
+     * The total number of blob instructions sent.
+     */
+    uint64_t blobs_sent;
+
+    /**
+     * The total number of frames read.
+     */
+    uint64_t frames;
+
+    /**
+     * The total number of frames which took longer than the frame interval.
+     */
+    uint64_t overruns;
+
+    /**
+     * The total time spent writing to or flushing the socket, in
+     * microseconds.
+     */
+    uint64_t socket_blocked;
+
+    /**
+     * How late each frame was read relative to its deadline.
+     */
+    streamtest_metrics_histogram sleep_error;
+
+    /**
+     * How long each frame took to read from its source.
+     */
+    streamtest_metrics_histogram read_latency;
+
+    /**
+     * How long each flush of the socket took.
+     */
+    streamtest_metrics_histogram flush_latency;
+
+    /**
+     * How long each connection took to send its first media data, measured
+     * from the start of its initialization.
+     */
+    streamtest_metrics_histogram first_byte;
+
+} streamtest_metrics;
+
+/**
+ * Allocates the metrics of a new connection. If an address is given, the
+ * metrics are published within the shared directory of that address (see
+ * STREAMTEST_METRICS_SHARED_DIR), such that they are included by whichever
+ * process exports that address.
+ *
+ * @param address
+ *     The address at which the metrics of the connection will be exported,
+ *     as accepted by streamtest_metrics_export(), or an empty string if the
+ *     metrics will not be exported.
+ *
+ * @return
+ *     The newly-allocated metrics, with all counters zero, or NULL if the
+ *     metrics could not be published, in which case errno is set
+ *     appropriately.
+ */
+streamtest_metrics* streamtest_metrics_alloc(const char* address);
+
+/**
+ * Atomically adds the given amount to the given counter.
+ *
+ * @param counter
+ *     The counter to increase, which must be a member of a
+ *     streamtest_metrics.
+ *
+ * @param amount
+ *     The amount to add.
+ */
+void streamtest_metrics_add(uint64_t* counter, uint64_t amount);
+
+/**
+ * Atomically records the given duration within the given histogram.
+ *
+ * @param histogram
+ *     The histogram to record the duration within.
+ *
+ * @param usecs
+ *     The duration to record, in microseconds. Negative durations are
+ *     recorded as zero.
+ */
+void streamtest_metrics_observe(streamtest_metrics_histogram* histogram,
+        int64_t usecs);
+
+/**
+ * Begins exporting the metrics of all connections published for the given
+ * address, by this or any other process, in Prometheus text format, over
+ * HTTP. The exporter runs within its own thread until no connections of
+ * this process remain. If the exporter is already running at the same
+ * address, this has no effect. If another process is already exporting the
+ * address, this process stands by, and takes over from that process within
+ * a call to streamtest_metrics_retry() once it stops.
+ *
+ * @param address
+ *     Either a TCP port number, which is bound on the loopback interface
+ *     only, or STREAMTEST_METRICS_UNIX_PREFIX followed by the path of a UNIX
+ *     domain socket to create.
+ *
+ * @return
+ *     Zero if metrics are being exported at the given address, non-zero
+ *     otherwise, in which case errno is set appropriately. If metrics are
+ *     already being exported at a different address, errno is set to
+ *     EEXIST.
+ */
+int streamtest_metrics_export(const char* address);
+
+/**
+ * Attempts to take over exporting metrics if an earlier call to
+ * streamtest_metrics_export() found its address in use by another process
+ * which has since stopped. This is cheap, and should be called
+ * periodically.
+ */
+void streamtest_metrics_retry();
+
+/**
+ * Unpublishes and frees the given metrics, retaining their counts within
+ * the totals of their address, if any. If no connections of this process
+ * remain, the exporter (if any) is stopped.
+ *
+ * @param metrics
+ *     The metrics to free.
+ */
+void streamtest_metrics_free(streamtest_metrics* metrics);
+
+#endif
+
@@ -0,0 +1,283 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+#include "mixer.h"
+#include "pcm.h"
+#include "source.h"
+#include "timing.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * The characters which separate the gain of a mix input from its path.
+ */
+#define STREAMTEST_MIXER_WHITESPACE " \t"
+
+/**
+ * Opens the given file and appends it to the inputs of the given mixer.
+ *
+ * @param mixer
+ *     The mixer to append to.
+ *
+ * @param path
+ *     The path of the file to mix.
+ *
+ * @param gain
+ *     The linear gain to apply to the file.
+ *
+ * @return
+ *     Zero on success, non-zero if the file cannot be opened, is not a
+ *     regular file, or the gain is out of range, in which case errno is set
+ *     appropriately.
+ */
+static int streamtest_mixer_append(streamtest_mixer* mixer,
+        const char* path, double gain) {
+
+    /* Gain must be representable by the mixing kernels */
+    double fixed = round(gain * STREAMTEST_PCM_GAIN_UNITY);
+    if (fabs(fixed) > STREAMTEST_PCM_GAIN_MAX) {
+        errno = EINVAL;
+        return 1;
+    }
+
+    streamtest_source* source = streamtest_source_open(path, NULL);
+    if (source == NULL)
+        return 1;
+
+    /* Inputs are read in lockstep, which only regular files allow */
+    if (source->type != STREAMTEST_SOURCE_FILE) {
+        streamtest_source_close(source);
+        errno = EINVAL;
+        return 1;
+    }
+
+    mixer->inputs = realloc(mixer->inputs,
+            sizeof(streamtest_mixer_input) * (mixer->count + 1));
+
+    streamtest_mixer_input* input = &mixer->inputs[mixer->count++];
+    input->source = source;
+    input->gain = fixed;
+    return 0;
+
+}
+
+streamtest_mixer* streamtest_mixer_load(const char* filename) {
+
+    FILE* file = fopen(filename, "r");
+    if (file == NULL)
+        return NULL;
+
+    streamtest_mixer* mixer = calloc(1, sizeof(streamtest_mixer));
+
+    int error;
+    char* line = NULL;
+    size_t line_size = 0;
+    while (getline(&line, &line_size, file) != -1) {
+
+        /* Strip line terminator */
+        line[strcspn(line, "\r\n")] = '\0';
+
+        /* Skip leading whitespace */
+        char* gain = line + strspn(line, STREAMTEST_MIXER_WHITESPACE);
+
+        /* Ignore blank lines and comments */
+        if (*gain == '\0' || *gain == '#')
+            continue;
+
+        /* Gain ends at first whitespace, path begins after it */
+        char* path;
+        double value = strtod(gain, &path);
+        if (path == gain || strchr(STREAMTEST_MIXER_WHITESPACE, *path) == NULL
+                || *path == '\0') {
+            errno = EINVAL;
+            goto fail;
+        }
+
+        path += strspn(path, STREAMTEST_MIXER_WHITESPACE);
+        if (*path == '\0') {
+            errno = EINVAL;
+            goto fail;
+        }
+
+        if (streamtest_mixer_append(mixer, path, value))
+            goto fail;
+
+    }
+
+    free(line);
+    fclose(file);
+
+    /* An empty mix is useless */
+    if (mixer->count == 0) {
+        streamtest_mixer_free(mixer);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return mixer;
+
+fail:
+    error = errno;
+    free(line);
+    fclose(file);
+    streamtest_mixer_free(mixer);
+    errno = error;
+    return NULL;
+
+}
+
+int streamtest_mixer_size(streamtest_mixer* mixer) {
+
+    int size = 0;
+    for (int i = 0; i < mixer->count; i++) {
+
+        int input_size = streamtest_source_size(mixer->inputs[i].source);
+        if (input_size == -1)
+            return -1;
+
+        if (input_size > size)
+            size = input_size;
+
+    }
+
+    return size;
+
+}
+
+int streamtest_mixer_read(streamtest_mixer* mixer, unsigned char* buffer,
+        int length) {
+
+    int total = 0;
+
+    /* Return the remainder of a sample split by the previous read */
+    if (mixer->spilled && length > 0) {
+        *(buffer++) = mixer->spill;
+        mixer->spilled = false;
+        mixer->position++;
+        length--;
+        total++;
+    }
+
+    if (length == 0)
+        return total;
+
+    /* Mix whole samples, splitting the last if necessary */
+    int bytes = (length + 1) / 2 * 2;
+    if (mixer->buffer_size < bytes) {
+        mixer->buffer_size = bytes;
+        mixer->read_buffer = realloc(mixer->read_buffer, bytes);
+        mixer->mix_buffer = realloc(mixer->mix_buffer, bytes);
+    }
+
+    memset(mixer->mix_buffer, 0, bytes);
+
+    int mixed = 0;
+    bool eof = true;
+    for (int i = 0; i < mixer->count; i++) {
+
+        streamtest_mixer_input* input = &mixer->inputs[i];
+
+        int result = streamtest_source_read(input->source,
+                mixer->read_buffer, bytes);
+        if (result == -1)
+            return -1;
+
+        if (!input->source->eof)
+            eof = false;
+
+        /* Regular files read short only at their end, where any partial
+         * sample is meaningless */
+        int samples = result / 2;
+        int64_t start = streamtest_ntime();
+        streamtest_pcm_mix(mixer->mix_buffer, mixer->read_buffer, samples,
+                input->gain);
+        mixer->mix_nsecs += streamtest_ntime() - start;
+        mixer->samples += samples;
+
+        /* Inputs which have ended are silent */
+        if (samples * 2 > mixed)
+            mixed = samples * 2;
+
+    }
+
+    mixer->eof = eof;
+
+    /* Keep the second byte of a split sample for the next read */
+    if (mixed > length) {
+        mixer->spill = mixer->mix_buffer[length];
+        mixer->spilled = true;
+        mixed = length;
+    }
+
+    memcpy(buffer, mixer->mix_buffer, mixed);
+    mixer->position += mixed;
+    return total + mixed;
+
+}
+
+int streamtest_mixer_seek(streamtest_mixer* mixer, off_t position) {
+
+    position -= position % 2;
+
+    for (int i = 0; i < mixer->count; i++) {
+
+        streamtest_source* source = mixer->inputs[i].source;
+
+        int size = streamtest_source_size(source);
+        if (size == -1)
+            return 1;
+
+        if (streamtest_source_seek(source, position < size ? position : size))
+            return 1;
+
+    }
+
+    mixer->position = position;
+    mixer->spilled = false;
+    mixer->eof = false;
+    return 0;
+
+}
+
+void streamtest_mixer_prefetch(streamtest_mixer* mixer, int length) {
+    for (int i = 0; i < mixer->count; i++)
+        streamtest_source_prefetch(mixer->inputs[i].source, length);
+}
+
+void streamtest_mixer_free(streamtest_mixer* mixer) {
+
+    for (int i = 0; i < mixer->count; i++)
+        streamtest_source_close(mixer->inputs[i].source);
+
+    free(mixer->inputs);
+    free(mixer->read_buffer);
+    free(mixer->mix_buffer);
+    free(mixer);
+
+}
+
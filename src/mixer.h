@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef STREAMTEST_MIXER_H
+#define STREAMTEST_MIXER_H
+
+#include "config.h"
+#include "source.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * A single source being mixed, along with its gain.
+ */
+typedef struct streamtest_mixer_input {
+
+    /**
+     * The source of the 16-bit raw PCM audio to be mixed. This is always a
+     * regular file.
+     */
+    streamtest_source* source;
+
+    /**
+     * The gain applied to the audio of this input, in units of
+     * 1/STREAMTEST_PCM_GAIN_UNITY.
+     */
+    int gain;
+
+} streamtest_mixer_input;
+
+/**
+ * Mixes the 16-bit raw PCM audio of several files into a single stream of
+ * audio, reading only as much of each file as is needed for each frame.
+ * All inputs must share the same sample rate and channel layout. Inputs
+ * which end early contribute silence for the remainder of the mix.
+ */
+typedef struct streamtest_mixer {
+
+    /**
+     * All inputs being mixed.
+     */
+    streamtest_mixer_input* inputs;
+
+    /**
+     * The number of inputs. There is always at least one input.
+     */
+    int count;
+
+    /**
+     * Buffer receiving audio read from each input prior to mixing.
+     */
+    unsigned char* read_buffer;
+
+    /**
+     * Buffer receiving mixed audio.
+     */
+    unsigned char* mix_buffer;
+
+    /**
+     * The size of read_buffer and mix_buffer, in bytes.
+     */
+    int buffer_size;
+
+    /**
+     * The number of bytes of mixed audio produced since the start of the
+     * mix.
+     */
+    off_t position;
+
+    /**
+     * The second byte of the last sample mixed, if only the first byte could
+     * be returned by the previous read.
+     */
+    unsigned char spill;
+
+    /**
+     * Whether spill contains a byte not yet returned.
+     */
+    bool spilled;
+
+    /**
+     * Whether all inputs have ended.
+     */
+    bool eof;
+
+    /**
+     * The number of input samples mixed, counting each input separately.
+     * This is a running total which may be reset by the user of the mixer
+     * once accounted for.
+     */
+    uint64_t samples;
+
+    /**
+     * The time spent mixing, excluding reads, in nanoseconds. This is a
+     * running total which may be reset by the user of the mixer once
+     * accounted for.
+     */
+    uint64_t mix_nsecs;
+
+} streamtest_mixer;
+
+/**
+ * Loads the mix described by the given file, opening all of its inputs.
+ * Each line of the file describes one input, consisting of a linear gain
+ * (such as "0.5") followed by whitespace and the path of a regular file
+ * containing 16-bit raw PCM audio. Blank lines and lines beginning with "#"
+ * are ignored.
+ *
+ * @param filename
+ *     The path of the file describing the mix.
+ *
+ * @return
+ *     A newly-allocated streamtest_mixer, or NULL if the file cannot be read,
+ *     any input cannot be opened, or the file describes no inputs, in which
+ *     case errno is set appropriately. Inputs which are not regular files,
+ *     and gains outside the range supported by streamtest_pcm_mix(), result
+ *     in EINVAL.
+ */
+streamtest_mixer* streamtest_mixer_load(const char* filename);
+
+/**
+ * Returns the size of the mix, which is the size of its largest input.
+ *
+ * @param mixer
+ *     The mixer whose size should be returned.
+ *
+ * @return
+ *     The size of the mixed audio, in bytes, or -1 if the size of an input
+ *     cannot be determined.
+ */
+int streamtest_mixer_size(streamtest_mixer* mixer);
+
+/**
+ * Reads up to the given number of bytes of mixed audio, reading the
+ * corresponding audio of each input.
+ *
+ * @param mixer
+ *     The mixer to read from.
+ *
+ * @param buffer
+ *     The buffer to read mixed audio into.
+ *
+ * @param length
+ *     The number of bytes to read.
+ *
+ * @return
+ *     The number of bytes read, which will be less than the length requested
+ *     only if all inputs have ended, or -1 if an error occurs, in which case
+ *     errno is set appropriately.
+ */
+int streamtest_mixer_read(streamtest_mixer* mixer, unsigned char* buffer,
+        int length);
+
+/**
+ * Moves all inputs to the given position within the mix. Inputs shorter
+ * than the position are moved to their end.
+ *
+ * @param mixer
+ *     The mixer to seek within.
+ *
+ * @param position
+ *     The position within the mixed audio, in bytes, which is rounded down
+ *     to a whole sample.
+ *
+ * @return
+ *     Zero on success, non-zero if an error occurs, in which case errno is
+ *     set appropriately.
+ */
+int streamtest_mixer_seek(streamtest_mixer* mixer, off_t position);
+
+/**
+ * Advises the kernel that the given number of bytes of each input are about
+ * to be read.
+ *
+ * @param mixer
+ *     The mixer whose inputs will be read.
+ *
+ * @param length
+ *     The number of bytes of each input expected to be read.
+ */
+void streamtest_mixer_prefetch(streamtest_mixer* mixer, int length);
+
+/**
+ * Closes all inputs of the given mixer and frees the mixer.
+ *
+ * @param mixer
+ *     The mixer to free.
+ */
+void streamtest_mixer_free(streamtest_mixer* mixer);
+
+#endif
+
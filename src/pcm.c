@@ -0,0 +1,1126 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+#include "pcm.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define STREAMTEST_PCM_X86
+#include <immintrin.h>
+#endif
+
+/**
+ * The base-2 logarithm of STREAMTEST_PCM_GAIN_UNITY, such that scaled
+ * samples can be divided by unity gain with a shift.
+ */
+#define STREAMTEST_PCM_GAIN_SHIFT 12
+
+/**
+ * Decodes and down-mixes 16-bit input sample frames into planes of floating
+ * point samples. Kernels need only handle the layouts they accelerate,
+ * returning the number of frames decoded, with the scalar kernel decoding
+ * any remainder.
+ */
+typedef int streamtest_pcm_decode_kernel(const unsigned char* input,
+        int frames, int input_channels, int output_channels, float** planes);
+
+/**
+ * Resamples a single plane by linear interpolation, returning the number of
+ * output samples produced. Kernels may stop early, with the scalar kernel
+ * producing any remainder.
+ */
+typedef int streamtest_pcm_resample_kernel(const float* samples, int length,
+        uint64_t position, uint64_t step, float* output);
+
+/**
+ * Quantizes and interleaves planes of floating point samples into output
+ * sample frames, returning the number of frames encoded. Kernels need only
+ * handle the layouts they accelerate, with the scalar kernel encoding any
+ * remainder.
+ */
+typedef int streamtest_pcm_encode_kernel(float** planes, int frames,
+        int channels, int bits, unsigned char* output);
+
+/**
+ * Scales 16-bit samples, adding them to the output with saturation,
+ * returning the number of samples mixed. Kernels may stop early, with the
+ * scalar kernel mixing any remainder.
+ */
+typedef int streamtest_pcm_mix_kernel(unsigned char* output,
+        const unsigned char* input, int samples, int gain);
+
+/**
+ * A set of conversion kernels suited to a particular CPU.
+ */
+typedef struct streamtest_pcm_kernels {
+
+    /**
+     * Human-readable name of this set of kernels.
+     */
+    const char* name;
+
+    /**
+     * Kernel decoding 16-bit input.
+     */
+    streamtest_pcm_decode_kernel* decode;
+
+    /**
+     * Kernel resampling a single plane.
+     */
+    streamtest_pcm_resample_kernel* resample;
+
+    /**
+     * Kernel encoding output.
+     */
+    streamtest_pcm_encode_kernel* encode;
+
+    /**
+     * Kernel mixing 16-bit samples.
+     */
+    streamtest_pcm_mix_kernel* mix;
+
+} streamtest_pcm_kernels;
+
+/**
+ * Reads a single little-endian signed sample, scaled to the range [-1, 1).
+ *
+ * @param sample
+ *     The first byte of the sample.
+ *
+ * @param bits
+ *     The number of bits per sample: 8, 16, 24 or 32.
+ *
+ * @return
+ *     The value of the sample.
+ */
+static float streamtest_pcm_read_sample(const unsigned char* sample,
+        int bits) {
+
+    switch (bits) {
+
+        case 8:
+            return (int8_t) sample[0] / 128.0f;
+
+        case 16:
+            return (int16_t) (sample[0] | (sample[1] << 8)) / 32768.0f;
+
+        case 24:
+            return (int32_t) (((uint32_t) sample[0] << 8)
+                            | ((uint32_t) sample[1] << 16)
+                            | ((uint32_t) sample[2] << 24))
+                / 2147483648.0f;
+
+        default:
+            return (int32_t) ((uint32_t) sample[0]
+                            | ((uint32_t) sample[1] << 8)
+                            | ((uint32_t) sample[2] << 16)
+                            | ((uint32_t) sample[3] << 24))
+                / 2147483648.0f;
+
+    }
+
+}
+
+/**
+ * Decodes and down-mixes input sample frames of any layout. When there are
+ * fewer output channels than input channels, each output channel is the
+ * average of every input channel congruent to it modulo the number of output
+ * channels, such that stereo down-mixes to mono and 5.1 down-mixes to stereo
+ * as expected. When there are more output channels, input channels are
+ * repeated.
+ *
+ * @param input
+ *     The first byte of the first sample frame to decode.
+ *
+ * @param frames
+ *     The number of sample frames to decode.
+ *
+ * @param format
+ *     The format of the input.
+ *
+ * @param output_channels
+ *     The number of output channels.
+ *
+ * @param planes
+ *     The plane receiving the first decoded sample of each output channel.
+ */
+static void streamtest_pcm_decode_scalar(const unsigned char* input,
+        int frames, const streamtest_pcm_format* format, int output_channels,
+        float** planes) {
+
+    int sample_size = format->bits / 8;
+    int frame_size = sample_size * format->channels;
+
+    for (int channel = 0; channel < output_channels; channel++) {
+
+        float* plane = planes[channel];
+
+        /* Upmix by repeating input channels */
+        if (output_channels >= format->channels) {
+            const unsigned char* sample = input
+                + (channel % format->channels) * sample_size;
+            for (int i = 0; i < frames; i++, sample += frame_size)
+                plane[i] = streamtest_pcm_read_sample(sample, format->bits);
+            continue;
+        }
+
+        /* Downmix by averaging congruent input channels */
+        int count = (format->channels - channel + output_channels - 1)
+                  / output_channels;
+        float scale = 1.0f / count;
+        const unsigned char* frame = input;
+        for (int i = 0; i < frames; i++, frame += frame_size) {
+            float sum = 0;
+            for (int source = channel; source < format->channels;
+                    source += output_channels)
+                sum += streamtest_pcm_read_sample(frame + source * sample_size,
+                        format->bits);
+            plane[i] = sum * scale;
+        }
+
+    }
+
+}
+
+/**
+ * Resamples a single plane by linear interpolation, starting at the given
+ * output sample.
+ *
+ * @param samples
+ *     The input samples, where the first sample is the last sample of the
+ *     previous chunk.
+ *
+ * @param length
+ *     The number of input samples following the first.
+ *
+ * @param position
+ *     The position of the first output sample relative to the first input
+ *     sample, as a 32.32 fixed-point value.
+ *
+ * @param step
+ *     The distance between output samples, as a 32.32 fixed-point value.
+ *
+ * @param output
+ *     The buffer receiving output samples.
+ *
+ * @param start
+ *     The index of the first output sample to produce.
+ *
+ * @return
+ *     The total number of output samples produced, including the start
+ *     index.
+ */
+static int streamtest_pcm_resample_scalar(const float* samples, int length,
+        uint64_t position, uint64_t step, float* output, int start) {
+
+    int count = start;
+    position += step * start;
+
+    /* Interpolate only between samples which are both available */
+    while ((position >> 32) < (uint64_t) length) {
+        int index = position >> 32;
+        float fraction = (uint32_t) position * (1.0f / 4294967296.0f);
+        float a = samples[index];
+        output[count++] = a + fraction * (samples[index + 1] - a);
+        position += step;
+    }
+
+    return count;
+
+}
+
+/**
+ * Writes a single little-endian signed sample, clamping to the range of the
+ * output.
+ *
+ * @param value
+ *     The value of the sample, nominally within [-1, 1].
+ *
+ * @param bits
+ *     The number of bits per sample: 8 or 16.
+ *
+ * @param output
+ *     The buffer to write the sample to.
+ */
+static void streamtest_pcm_write_sample(float value, int bits,
+        unsigned char* output) {
+
+    if (value > 1.0f)
+        value = 1.0f;
+    else if (value < -1.0f)
+        value = -1.0f;
+
+    if (bits == 8) {
+        output[0] = (uint8_t) (int8_t) lrintf(value * 127.0f);
+        return;
+    }
+
+    int16_t sample = lrintf(value * 32767.0f);
+    output[0] = (uint16_t) sample & 0xFF;
+    output[1] = (uint16_t) sample >> 8;
+
+}
+
+/**
+ * Quantizes and interleaves planes of samples into output sample frames of
+ * any layout, starting at the given frame.
+ *
+ * @param planes
+ *     The planes to encode, one per channel.
+ *
+ * @param frames
+ *     The total number of frames within each plane.
+ *
+ * @param channels
+ *     The number of channels.
+ *
+ * @param bits
+ *     The number of bits per output sample: 8 or 16.
+ *
+ * @param output
+ *     The buffer receiving the first output sample frame.
+ *
+ * @param start
+ *     The index of the first frame to encode.
+ */
+static void streamtest_pcm_encode_scalar(float** planes, int frames,
+        int channels, int bits, unsigned char* output, int start) {
+
+    int sample_size = bits / 8;
+    unsigned char* sample = output + start * channels * sample_size;
+
+    for (int i = start; i < frames; i++) {
+        for (int channel = 0; channel < channels; channel++) {
+            streamtest_pcm_write_sample(planes[channel][i], bits, sample);
+            sample += sample_size;
+        }
+    }
+
+}
+
+/**
+ * Mixes 16-bit samples of any layout, starting at the given sample.
+ *
+ * @param output
+ *     The samples to add to.
+ *
+ * @param input
+ *     The samples to scale and add.
+ *
+ * @param samples
+ *     The total number of samples within both buffers.
+ *
+ * @param gain
+ *     The gain to apply, in units of 1/STREAMTEST_PCM_GAIN_UNITY.
+ *
+ * @param start
+ *     The index of the first sample to mix.
+ */
+static void streamtest_pcm_mix_scalar(unsigned char* output,
+        const unsigned char* input, int samples, int gain, int start) {
+
+    for (int i = start; i < samples; i++) {
+
+        int16_t sample = input[i * 2] | (input[i * 2 + 1] << 8);
+        int16_t current = output[i * 2] | (output[i * 2 + 1] << 8);
+
+        /* Round to nearest, exactly as the vector kernels do */
+        int32_t scaled = ((int32_t) sample * gain
+                + STREAMTEST_PCM_GAIN_UNITY / 2) >> STREAMTEST_PCM_GAIN_SHIFT;
+        if (scaled > INT16_MAX)
+            scaled = INT16_MAX;
+        else if (scaled < INT16_MIN)
+            scaled = INT16_MIN;
+
+        int32_t sum = current + scaled;
+        if (sum > INT16_MAX)
+            sum = INT16_MAX;
+        else if (sum < INT16_MIN)
+            sum = INT16_MIN;
+
+        output[i * 2] = (uint16_t) sum & 0xFF;
+        output[i * 2 + 1] = (uint16_t) sum >> 8;
+
+    }
+
+}
+
+#ifdef __SSE2__
+
+/**
+ * Decodes 16-bit mono to mono, stereo to mono and stereo to stereo using
+ * SSE2.
+ */
+static int streamtest_pcm_decode_sse2(const unsigned char* input,
+        int frames, int input_channels, int output_channels, float** planes) {
+
+    int i = 0;
+
+    /* Mono: sign-extend eight samples at a time */
+    if (input_channels == 1 && output_channels == 1) {
+        const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+        for (; i + 8 <= frames; i += 8) {
+            __m128i v = _mm_loadu_si128((const __m128i*) (input + i * 2));
+            __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+            __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+            __m128 low = _mm_mul_ps(_mm_cvtepi32_ps(lo), scale);
+            __m128 high = _mm_mul_ps(_mm_cvtepi32_ps(hi), scale);
+            _mm_storeu_ps(planes[0] + i, low);
+            _mm_storeu_ps(planes[0] + i + 4, high);
+        }
+    }
+
+    /* Stereo to mono: sum each pair of samples, four frames at a time */
+    else if (input_channels == 2 && output_channels == 1) {
+        const __m128 scale = _mm_set1_ps(1.0f / 65536.0f);
+        const __m128i ones = _mm_set1_epi16(1);
+        for (; i + 4 <= frames; i += 4) {
+            __m128i v = _mm_loadu_si128((const __m128i*) (input + i * 4));
+            __m128i sum = _mm_madd_epi16(v, ones);
+            __m128 mixed = _mm_mul_ps(_mm_cvtepi32_ps(sum), scale);
+            _mm_storeu_ps(planes[0] + i, mixed);
+        }
+    }
+
+    /* Stereo: split each frame into its sign-extended halves */
+    else if (input_channels == 2 && output_channels == 2) {
+        const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+        for (; i + 4 <= frames; i += 4) {
+            __m128i v = _mm_loadu_si128((const __m128i*) (input + i * 4));
+            __m128i left = _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+            __m128i right = _mm_srai_epi32(v, 16);
+            __m128 l = _mm_mul_ps(_mm_cvtepi32_ps(left), scale);
+            __m128 r = _mm_mul_ps(_mm_cvtepi32_ps(right), scale);
+            _mm_storeu_ps(planes[0] + i, l);
+            _mm_storeu_ps(planes[1] + i, r);
+        }
+    }
+
+    return i;
+
+}
+
+/**
+ * Resamples a single plane four output samples at a time using SSE2.
+ */
+static int streamtest_pcm_resample_sse2(const float* samples, int length,
+        uint64_t position, uint64_t step, float* output) {
+
+    int count = 0;
+
+    /* Stop once the last sample of a block would be unavailable */
+    while (((position + step * 3) >> 32) < (uint64_t) length) {
+
+        int index[4];
+        float fraction[4];
+        for (int lane = 0; lane < 4; lane++) {
+            uint64_t lane_position = position + step * lane;
+            index[lane] = lane_position >> 32;
+            fraction[lane] = (uint32_t) lane_position * (1.0f / 4294967296.0f);
+        }
+
+        __m128 a = _mm_set_ps(samples[index[3]], samples[index[2]],
+                samples[index[1]], samples[index[0]]);
+        __m128 b = _mm_set_ps(samples[index[3] + 1], samples[index[2] + 1],
+                samples[index[1] + 1], samples[index[0] + 1]);
+        __m128 f = _mm_loadu_ps(fraction);
+
+        _mm_storeu_ps(output + count,
+                _mm_add_ps(a, _mm_mul_ps(f, _mm_sub_ps(b, a))));
+
+        count += 4;
+        position += step * 4;
+
+    }
+
+    return count;
+
+}
+
+/**
+ * Clamps four samples to [-1, 1] and scales them to integers.
+ */
+static inline __m128i streamtest_pcm_quantize_sse2(const float* samples,
+        __m128 scale) {
+
+    __m128 v = _mm_loadu_ps(samples);
+    v = _mm_min_ps(_mm_max_ps(v, _mm_set1_ps(-1.0f)), _mm_set1_ps(1.0f));
+    return _mm_cvtps_epi32(_mm_mul_ps(v, scale));
+
+}
+
+/**
+ * Encodes mono and stereo output at 8 or 16 bits per sample using SSE2.
+ */
+static int streamtest_pcm_encode_sse2(float** planes, int frames,
+        int channels, int bits, unsigned char* output) {
+
+    int i = 0;
+
+    if (bits == 16) {
+
+        const __m128 scale = _mm_set1_ps(32767.0f);
+
+        /* Mono: pack eight samples at a time */
+        if (channels == 1) {
+            for (; i + 8 <= frames; i += 8) {
+                const float* plane = planes[0] + i;
+                __m128i a = streamtest_pcm_quantize_sse2(plane, scale);
+                __m128i b = streamtest_pcm_quantize_sse2(plane + 4, scale);
+                _mm_storeu_si128((__m128i*) (output + i * 2),
+                        _mm_packs_epi32(a, b));
+            }
+        }
+
+        /* Stereo: pack four frames at a time, then interleave halves */
+        else if (channels == 2) {
+            for (; i + 4 <= frames; i += 4) {
+                __m128i left =
+                    streamtest_pcm_quantize_sse2(planes[0] + i, scale);
+                __m128i right =
+                    streamtest_pcm_quantize_sse2(planes[1] + i, scale);
+                __m128i packed = _mm_packs_epi32(left, right);
+                _mm_storeu_si128((__m128i*) (output + i * 4),
+                        _mm_unpacklo_epi16(packed, _mm_srli_si128(packed, 8)));
+            }
+        }
+
+    }
+
+    else if (bits == 8) {
+
+        const __m128 scale = _mm_set1_ps(127.0f);
+
+        /* Mono: pack sixteen samples at a time */
+        if (channels == 1) {
+            for (; i + 16 <= frames; i += 16) {
+                const float* plane = planes[0] + i;
+                __m128i lo = _mm_packs_epi32(
+                        streamtest_pcm_quantize_sse2(plane, scale),
+                        streamtest_pcm_quantize_sse2(plane + 4, scale));
+                __m128i hi = _mm_packs_epi32(
+                        streamtest_pcm_quantize_sse2(plane + 8, scale),
+                        streamtest_pcm_quantize_sse2(plane + 12, scale));
+                _mm_storeu_si128((__m128i*) (output + i),
+                        _mm_packs_epi16(lo, hi));
+            }
+        }
+
+        /* Stereo: pack eight frames at a time, interleaving as 16-bit */
+        else if (channels == 2) {
+            for (; i + 8 <= frames; i += 8) {
+                __m128i left = _mm_packs_epi32(
+                        streamtest_pcm_quantize_sse2(planes[0] + i, scale),
+                        streamtest_pcm_quantize_sse2(planes[0] + i + 4, scale));
+                __m128i right = _mm_packs_epi32(
+                        streamtest_pcm_quantize_sse2(planes[1] + i, scale),
+                        streamtest_pcm_quantize_sse2(planes[1] + i + 4, scale));
+                _mm_storeu_si128((__m128i*) (output + i * 2),
+                        _mm_packs_epi16(_mm_unpacklo_epi16(left, right),
+                                        _mm_unpackhi_epi16(left, right)));
+            }
+        }
+
+    }
+
+    return i;
+
+}
+
+/**
+ * Mixes 16-bit samples eight at a time using SSE2.
+ */
+static int streamtest_pcm_mix_sse2(unsigned char* output,
+        const unsigned char* input, int samples, int gain) {
+
+    const __m128i factor = _mm_set1_epi16(gain);
+    const __m128i round = _mm_set1_epi32(STREAMTEST_PCM_GAIN_UNITY / 2);
+
+    int i = 0;
+    for (; i + 8 <= samples; i += 8) {
+
+        __m128i v = _mm_loadu_si128((const __m128i*) (input + i * 2));
+
+        /* Form full 32-bit products from their low and high halves */
+        __m128i lo = _mm_mullo_epi16(v, factor);
+        __m128i hi = _mm_mulhi_epi16(v, factor);
+        __m128i a = _mm_srai_epi32(
+                _mm_add_epi32(_mm_unpacklo_epi16(lo, hi), round),
+                STREAMTEST_PCM_GAIN_SHIFT);
+        __m128i b = _mm_srai_epi32(
+                _mm_add_epi32(_mm_unpackhi_epi16(lo, hi), round),
+                STREAMTEST_PCM_GAIN_SHIFT);
+
+        __m128i* out = (__m128i*) (output + i * 2);
+        _mm_storeu_si128(out, _mm_adds_epi16(_mm_loadu_si128(out),
+                    _mm_packs_epi32(a, b)));
+
+    }
+
+    return i;
+
+}
+
+/**
+ * Kernels for CPUs supporting SSE2.
+ */
+static const streamtest_pcm_kernels streamtest_pcm_sse2 = {
+    .name     = "SSE2",
+    .decode   = streamtest_pcm_decode_sse2,
+    .resample = streamtest_pcm_resample_sse2,
+    .encode   = streamtest_pcm_encode_sse2,
+    .mix      = streamtest_pcm_mix_sse2
+};
+
+#endif
+
+#ifdef STREAMTEST_PCM_X86
+
+/**
+ * Decodes 16-bit mono to mono, stereo to mono and stereo to stereo using
+ * AVX2.
+ */
+__attribute__((target("avx2")))
+static int streamtest_pcm_decode_avx2(const unsigned char* input,
+        int frames, int input_channels, int output_channels, float** planes) {
+
+    int i = 0;
+
+    /* Mono: sign-extend eight samples at a time */
+    if (input_channels == 1 && output_channels == 1) {
+        const __m256 scale = _mm256_set1_ps(1.0f / 32768.0f);
+        for (; i + 8 <= frames; i += 8) {
+            __m256i v = _mm256_cvtepi16_epi32(
+                    _mm_loadu_si128((const __m128i*) (input + i * 2)));
+            _mm256_storeu_ps(planes[0] + i,
+                    _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+        }
+    }
+
+    /* Stereo to mono: sum each pair of samples, eight frames at a time */
+    else if (input_channels == 2 && output_channels == 1) {
+        const __m256 scale = _mm256_set1_ps(1.0f / 65536.0f);
+        const __m256i ones = _mm256_set1_epi16(1);
+        for (; i + 8 <= frames; i += 8) {
+            __m256i v = _mm256_loadu_si256((const __m256i*) (input + i * 4));
+            __m256i sum = _mm256_madd_epi16(v, ones);
+            _mm256_storeu_ps(planes[0] + i,
+                    _mm256_mul_ps(_mm256_cvtepi32_ps(sum), scale));
+        }
+    }
+
+    /* Stereo: split each frame into its sign-extended halves */
+    else if (input_channels == 2 && output_channels == 2) {
+        const __m256 scale = _mm256_set1_ps(1.0f / 32768.0f);
+        for (; i + 8 <= frames; i += 8) {
+            __m256i v = _mm256_loadu_si256((const __m256i*) (input + i * 4));
+            __m256i left = _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16);
+            __m256i right = _mm256_srai_epi32(v, 16);
+            _mm256_storeu_ps(planes[0] + i,
+                    _mm256_mul_ps(_mm256_cvtepi32_ps(left), scale));
+            _mm256_storeu_ps(planes[1] + i,
+                    _mm256_mul_ps(_mm256_cvtepi32_ps(right), scale));
+        }
+    }
+
+    return i;
+
+}
+
+/**
+ * Resamples a single plane eight output samples at a time using AVX2
+ * gathers.
+ */
+__attribute__((target("avx2")))
+static int streamtest_pcm_resample_avx2(const float* samples, int length,
+        uint64_t position, uint64_t step, float* output) {
+
+    int count = 0;
+
+    /* Stop once the last sample of a block would be unavailable */
+    while (((position + step * 7) >> 32) < (uint64_t) length) {
+
+        int32_t index[8];
+        float fraction[8];
+        for (int lane = 0; lane < 8; lane++) {
+            uint64_t lane_position = position + step * lane;
+            index[lane] = lane_position >> 32;
+            fraction[lane] = (uint32_t) lane_position * (1.0f / 4294967296.0f);
+        }
+
+        __m256i indices = _mm256_loadu_si256((const __m256i*) index);
+        __m256 a = _mm256_i32gather_ps(samples, indices, 4);
+        __m256 b = _mm256_i32gather_ps(samples + 1, indices, 4);
+        __m256 f = _mm256_loadu_ps(fraction);
+
+        _mm256_storeu_ps(output + count,
+                _mm256_add_ps(a, _mm256_mul_ps(f, _mm256_sub_ps(b, a))));
+
+        count += 8;
+        position += step * 8;
+
+    }
+
+    return count;
+
+}
+
+/**
+ * Encodes 16-bit mono output using AVX2, deferring to SSE2 for other
+ * layouts.
+ */
+__attribute__((target("avx2")))
+static int streamtest_pcm_encode_avx2(float** planes, int frames,
+        int channels, int bits, unsigned char* output) {
+
+    if (channels != 1 || bits != 16)
+        return streamtest_pcm_encode_sse2(planes, frames, channels, bits,
+                output);
+
+    const __m256 scale = _mm256_set1_ps(32767.0f);
+    const __m256 min = _mm256_set1_ps(-1.0f);
+    const __m256 max = _mm256_set1_ps(1.0f);
+
+    int i = 0;
+    for (; i + 16 <= frames; i += 16) {
+
+        __m256 a = _mm256_loadu_ps(planes[0] + i);
+        __m256 b = _mm256_loadu_ps(planes[0] + i + 8);
+        a = _mm256_min_ps(_mm256_max_ps(a, min), max);
+        b = _mm256_min_ps(_mm256_max_ps(b, min), max);
+
+        /* Packing interleaves 128-bit lanes, which must be reordered */
+        __m256i packed = _mm256_packs_epi32(
+                _mm256_cvtps_epi32(_mm256_mul_ps(a, scale)),
+                _mm256_cvtps_epi32(_mm256_mul_ps(b, scale)));
+        _mm256_storeu_si256((__m256i*) (output + i * 2),
+                _mm256_permute4x64_epi64(packed, 0xD8));
+
+    }
+
+    return i;
+
+}
+
+/**
+ * Mixes 16-bit samples sixteen at a time using AVX2. Unpacking and packing
+ * both operate within 128-bit lanes, so samples remain in order.
+ */
+__attribute__((target("avx2")))
+static int streamtest_pcm_mix_avx2(unsigned char* output,
+        const unsigned char* input, int samples, int gain) {
+
+    const __m256i factor = _mm256_set1_epi16(gain);
+    const __m256i round = _mm256_set1_epi32(STREAMTEST_PCM_GAIN_UNITY / 2);
+
+    int i = 0;
+    for (; i + 16 <= samples; i += 16) {
+
+        __m256i v = _mm256_loadu_si256((const __m256i*) (input + i * 2));
+
+        /* Form full 32-bit products from their low and high halves */
+        __m256i lo = _mm256_mullo_epi16(v, factor);
+        __m256i hi = _mm256_mulhi_epi16(v, factor);
+        __m256i a = _mm256_srai_epi32(
+                _mm256_add_epi32(_mm256_unpacklo_epi16(lo, hi), round),
+                STREAMTEST_PCM_GAIN_SHIFT);
+        __m256i b = _mm256_srai_epi32(
+                _mm256_add_epi32(_mm256_unpackhi_epi16(lo, hi), round),
+                STREAMTEST_PCM_GAIN_SHIFT);
+
+        __m256i* out = (__m256i*) (output + i * 2);
+        _mm256_storeu_si256(out, _mm256_adds_epi16(_mm256_loadu_si256(out),
+                    _mm256_packs_epi32(a, b)));
+
+    }
+
+    return i;
+
+}
+
+/**
+ * Kernels for CPUs supporting AVX2.
+ */
+static const streamtest_pcm_kernels streamtest_pcm_avx2 = {
+    .name     = "AVX2",
+    .decode   = streamtest_pcm_decode_avx2,
+    .resample = streamtest_pcm_resample_avx2,
+    .encode   = streamtest_pcm_encode_avx2,
+    .mix      = streamtest_pcm_mix_avx2
+};
+
+#endif
+
+/**
+ * Decode kernel which accelerates nothing.
+ */
+static int streamtest_pcm_decode_none(const unsigned char* input,
+        int frames, int input_channels, int output_channels, float** planes) {
+    return 0;
+}
+
+/**
+ * Resample kernel which accelerates nothing.
+ */
+static int streamtest_pcm_resample_none(const float* samples, int length,
+        uint64_t position, uint64_t step, float* output) {
+    return 0;
+}
+
+/**
+ * Encode kernel which accelerates nothing.
+ */
+static int streamtest_pcm_encode_none(float** planes, int frames,
+        int channels, int bits, unsigned char* output) {
+    return 0;
+}
+
+/**
+ * Mix kernel which accelerates nothing.
+ */
+static int streamtest_pcm_mix_none(unsigned char* output,
+        const unsigned char* input, int samples, int gain) {
+    return 0;
+}
+
+/**
+ * Kernels for CPUs without supported vector extensions.
+ */
+static const streamtest_pcm_kernels streamtest_pcm_scalar = {
+    .name     = "scalar",
+    .decode   = streamtest_pcm_decode_none,
+    .resample = streamtest_pcm_resample_none,
+    .encode   = streamtest_pcm_encode_none,
+    .mix      = streamtest_pcm_mix_none
+};
+
+/**
+ * Returns the best set of kernels supported by the current CPU.
+ *
+ * @return
+ *     The kernels to use for all conversions.
+ */
+static const streamtest_pcm_kernels* streamtest_pcm_get_kernels() {
+
+    static const streamtest_pcm_kernels* cached = NULL;
+
+    /* CPU features cannot change, so only check once */
+    const streamtest_pcm_kernels* kernels =
+        __atomic_load_n(&cached, __ATOMIC_ACQUIRE);
+    if (kernels != NULL)
+        return kernels;
+
+    kernels = &streamtest_pcm_scalar;
+
+#ifdef __SSE2__
+    kernels = &streamtest_pcm_sse2;
+#endif
+
+#ifdef STREAMTEST_PCM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        kernels = &streamtest_pcm_avx2;
+#endif
+
+    __atomic_store_n(&cached, kernels, __ATOMIC_RELEASE);
+    return kernels;
+
+}
+
+const char* streamtest_pcm_kernel_name() {
+    return streamtest_pcm_get_kernels()->name;
+}
+
+int streamtest_pcm_parse_format(const char* mimetype,
+        streamtest_pcm_format* format) {
+
+    int bits;
+    int length = -1;
+
+    /* Mimetype must begin "audio/L<bits>;" */
+    if (sscanf(mimetype, "audio/L%d;%n", &bits, &length) != 1
+            || length == -1
+            || (bits != 8 && bits != 16 && bits != 24 && bits != 32))
+        return 1;
+
+    format->bits = bits;
+    format->rate = 0;
+    format->channels = 1;
+
+    /* Parse comma-separated parameters */
+    const char* param = mimetype + length;
+    while (*param != '\0') {
+
+        int value;
+        if (sscanf(param, "rate=%d%n", &value, &length) == 1)
+            format->rate = value;
+        else if (sscanf(param, "channels=%d%n", &value, &length) == 1)
+            format->channels = value;
+        else
+            return 1;
+
+        param += length;
+        if (*param == ',')
+            param++;
+        else if (*param != '\0')
+            return 1;
+
+    }
+
+    /* Rate is required, and channels must be within supported limits */
+    if (format->rate <= 0 || format->channels <= 0
+            || format->channels > STREAMTEST_PCM_MAX_CHANNELS)
+        return 1;
+
+    return 0;
+
+}
+
+void streamtest_pcm_format_mimetype(const streamtest_pcm_format* format,
+        char* buffer) {
+    snprintf(buffer, STREAMTEST_PCM_MIMETYPE_LENGTH,
+            "audio/L%i;rate=%i,channels=%i",
+            format->bits, format->rate, format->channels);
+}
+
+streamtest_pcm_converter* streamtest_pcm_converter_alloc(
+        const streamtest_pcm_format* input,
+        const streamtest_pcm_format* output) {
+
+    streamtest_pcm_converter* converter =
+        calloc(1, sizeof(streamtest_pcm_converter));
+
+    converter->input = *input;
+    converter->output = *output;
+    converter->input_frame_size = input->channels * input->bits / 8;
+    converter->output_frame_size = output->channels * output->bits / 8;
+    converter->step = ((uint64_t) input->rate << 32) / output->rate;
+
+    return converter;
+
+}
+
+int streamtest_pcm_max_output(streamtest_pcm_converter* converter,
+        int length) {
+
+    int64_t frames = (converter->carry_length + length)
+                   / converter->input_frame_size;
+
+    /* One extra frame may be produced from the previous chunk's phase */
+    int64_t output = frames * converter->output.rate / converter->input.rate
+                   + 2;
+
+    return output * converter->output_frame_size;
+
+}
+
+/**
+ * Grows the planes of the given converter such that they can hold at least
+ * the given number of input frames and the corresponding output.
+ *
+ * @param converter
+ *     The converter whose planes should be grown.
+ *
+ * @param frames
+ *     The number of input frames which must fit.
+ */
+static void streamtest_pcm_reserve(streamtest_pcm_converter* converter,
+        int frames) {
+
+    int channels = converter->output.channels;
+
+    if (frames > converter->capacity) {
+        converter->capacity = frames;
+        for (int channel = 0; channel < channels; channel++)
+            converter->planes[channel] = realloc(converter->planes[channel],
+                    (frames + 1) * sizeof(float));
+    }
+
+    int resampled = (int64_t) frames * converter->output.rate
+                  / converter->input.rate + 2;
+
+    if (resampled > converter->resampled_capacity) {
+        converter->resampled_capacity = resampled;
+        for (int channel = 0; channel < channels; channel++)
+            converter->resampled[channel] = realloc(
+                    converter->resampled[channel], resampled * sizeof(float));
+    }
+
+}
+
+/**
+ * Decodes the given whole input frames into the planes of the given
+ * converter, starting at the given plane offset.
+ *
+ * @param converter
+ *     The converter whose planes should receive the decoded samples.
+ *
+ * @param kernels
+ *     The kernels to use.
+ *
+ * @param input
+ *     The first input frame.
+ *
+ * @param frames
+ *     The number of frames to decode.
+ *
+ * @param offset
+ *     The index within each plane of the first decoded sample.
+ */
+static void streamtest_pcm_decode(streamtest_pcm_converter* converter,
+        const streamtest_pcm_kernels* kernels, const unsigned char* input,
+        int frames, int offset) {
+
+    int channels = converter->output.channels;
+
+    float* planes[STREAMTEST_PCM_MAX_CHANNELS];
+    for (int channel = 0; channel < channels; channel++)
+        planes[channel] = converter->planes[channel] + offset;
+
+    int decoded = 0;
+    if (converter->input.bits == 16)
+        decoded = kernels->decode(input, frames, converter->input.channels,
+                channels, planes);
+
+    /* Decode anything the kernel could not */
+    if (decoded < frames) {
+        for (int channel = 0; channel < channels; channel++)
+            planes[channel] += decoded;
+        streamtest_pcm_decode_scalar(
+                input + decoded * converter->input_frame_size,
+                frames - decoded, &converter->input, channels, planes);
+    }
+
+}
+
+int streamtest_pcm_convert(streamtest_pcm_converter* converter,
+        const unsigned char* input, int length, unsigned char* output) {
+
+    const streamtest_pcm_kernels* kernels = streamtest_pcm_get_kernels();
+    int channels = converter->output.channels;
+    int frame_size = converter->input_frame_size;
+
+    /* Nothing to convert until at least one whole frame is available */
+    int frames = (converter->carry_length + length) / frame_size;
+    if (frames == 0) {
+        memcpy(converter->carry + converter->carry_length, input, length);
+        converter->carry_length += length;
+        return 0;
+    }
+
+    streamtest_pcm_reserve(converter, frames);
+
+    /* Complete any partial frame left over from the previous chunk */
+    int offset = 1;
+    if (converter->carry_length > 0) {
+        int needed = frame_size - converter->carry_length;
+        memcpy(converter->carry + converter->carry_length, input, needed);
+        streamtest_pcm_decode(converter, kernels, converter->carry, 1,
+                offset++);
+        input += needed;
+        length -= needed;
+    }
+
+    /* Decode all remaining whole frames, keeping any partial frame */
+    int whole = frames - offset + 1;
+    streamtest_pcm_decode(converter, kernels, input, whole, offset);
+    converter->carry_length = length - whole * frame_size;
+    memcpy(converter->carry, input + whole * frame_size,
+            converter->carry_length);
+
+    /* Continue from the last sample of the previous chunk */
+    for (int channel = 0; channel < channels; channel++) {
+        float* plane = converter->planes[channel];
+        plane[0] = converter->primed ? converter->history[channel] : plane[1];
+        converter->history[channel] = plane[frames];
+    }
+
+    converter->primed = true;
+
+    /* Resample only if rates differ, otherwise encode planes directly */
+    float* planes[STREAMTEST_PCM_MAX_CHANNELS];
+    int produced = frames;
+    if (converter->input.rate != converter->output.rate) {
+
+        for (int channel = 0; channel < channels; channel++) {
+            planes[channel] = converter->resampled[channel];
+            int count = kernels->resample(converter->planes[channel], frames,
+                    converter->position, converter->step, planes[channel]);
+            produced = streamtest_pcm_resample_scalar(
+                    converter->planes[channel], frames, converter->position,
+                    converter->step, planes[channel], count);
+        }
+
+        converter->position += converter->step * produced;
+        converter->position -= (uint64_t) frames << 32;
+
+    }
+    else {
+        for (int channel = 0; channel < channels; channel++)
+            planes[channel] = converter->planes[channel] + 1;
+    }
+
+    /* Encode, finishing anything the kernel could not */
+    int encoded = kernels->encode(planes, produced, channels,
+            converter->output.bits, output);
+    streamtest_pcm_encode_scalar(planes, produced, channels,
+            converter->output.bits, output, encoded);
+
+    return produced * converter->output_frame_size;
+
+}
+
+void streamtest_pcm_mix(unsigned char* output, const unsigned char* input,
+        int samples, int gain) {
+
+    int mixed = streamtest_pcm_get_kernels()->mix(output, input, samples,
+            gain);
+
+    /* Mix anything the kernel could not */
+    streamtest_pcm_mix_scalar(output, input, samples, gain, mixed);
+
+}
+
+void streamtest_pcm_reset(streamtest_pcm_converter* converter) {
+    converter->carry_length = 0;
+    converter->position = 0;
+    converter->primed = false;
+}
+
+void streamtest_pcm_converter_free(streamtest_pcm_converter* converter) {
+
+    for (int channel = 0; channel < STREAMTEST_PCM_MAX_CHANNELS; channel++) {
+        free(converter->planes[channel]);
+        free(converter->resampled[channel]);
+    }
+
+    free(converter);
+
+}
+
@@ -0,0 +1,306 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef STREAMTEST_PCM_H
+#define STREAMTEST_PCM_H
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * The maximum number of channels supported for raw PCM audio.
+ */
+#define STREAMTEST_PCM_MAX_CHANNELS 8
+
+/**
+ * The maximum length of a raw PCM mimetype produced by
+ * streamtest_pcm_format_mimetype(), including the null terminator.
+ */
+#define STREAMTEST_PCM_MIMETYPE_LENGTH 64
+
+/**
+ * The gain applied by streamtest_pcm_mix() which leaves samples unchanged.
+ * Gains are fixed-point values in units of 1/STREAMTEST_PCM_GAIN_UNITY.
+ */
+#define STREAMTEST_PCM_GAIN_UNITY 4096
+
+/**
+ * The largest gain accepted by streamtest_pcm_mix(), just under 8x.
+ */
+#define STREAMTEST_PCM_GAIN_MAX 32767
+
+/**
+ * The format of raw, little-endian, signed PCM audio, as described by
+ * mimetypes like "audio/L16;rate=44100,channels=2".
+ */
+typedef struct streamtest_pcm_format {
+
+    /**
+     * The number of samples per second, per channel.
+     */
+    int rate;
+
+    /**
+     * The number of interleaved channels.
+     */
+    int channels;
+
+    /**
+     * The number of bits per sample. Input may be 8, 16, 24 or 32 bits per
+     * sample, while output may only be 8 or 16 bits per sample, as those are
+     * the only depths supported by Guacamole clients.
+     */
+    int bits;
+
+} streamtest_pcm_format;
+
+/**
+ * Converts raw PCM audio from one format to another, one chunk at a time.
+ * Channels are down-mixed (or duplicated), samples are resampled by linear
+ * interpolation and re-quantized to the output bit depth. All state needed
+ * to continue seamlessly from one chunk to the next, including partial
+ * sample frames and the resampling phase, is kept between calls.
+ */
+typedef struct streamtest_pcm_converter {
+
+    /**
+     * The format of the audio being converted.
+     */
+    streamtest_pcm_format input;
+
+    /**
+     * The format of the converted audio.
+     */
+    streamtest_pcm_format output;
+
+    /**
+     * The number of bytes in each input sample frame (one sample for each
+     * channel).
+     */
+    int input_frame_size;
+
+    /**
+     * The number of bytes in each output sample frame.
+     */
+    int output_frame_size;
+
+    /**
+     * Bytes of a partial input sample frame left over from the previous
+     * chunk.
+     */
+    unsigned char carry[4 * STREAMTEST_PCM_MAX_CHANNELS];
+
+    /**
+     * The number of bytes within carry.
+     */
+    int carry_length;
+
+    /**
+     * The distance between consecutive output samples, in input samples, as
+     * a 32.32 fixed-point value.
+     */
+    uint64_t step;
+
+    /**
+     * The position of the next output sample relative to the last input
+     * sample of the previous chunk, as a 32.32 fixed-point value.
+     */
+    uint64_t position;
+
+    /**
+     * Whether any input has been converted yet, such that history contains
+     * the last sample of the previous chunk.
+     */
+    bool primed;
+
+    /**
+     * The last down-mixed sample of each output channel within the previous
+     * chunk.
+     */
+    float history[STREAMTEST_PCM_MAX_CHANNELS];
+
+    /**
+     * Down-mixed samples of each output channel at the input rate. The first
+     * element of each plane is the last sample of the previous chunk.
+     */
+    float* planes[STREAMTEST_PCM_MAX_CHANNELS];
+
+    /**
+     * Down-mixed samples of each output channel at the output rate.
+     */
+    float* resampled[STREAMTEST_PCM_MAX_CHANNELS];
+
+    /**
+     * The number of input sample frames that each plane can hold, excluding
+     * the leading history sample.
+     */
+    int capacity;
+
+    /**
+     * The number of output sample frames that each resampled plane can
+     * hold.
+     */
+    int resampled_capacity;
+
+} streamtest_pcm_converter;
+
+/**
+ * Parses the given raw PCM mimetype, such as
+ * "audio/L16;rate=44100,channels=2". If the number of channels is omitted,
+ * a single channel is assumed.
+ *
+ * @param mimetype
+ *     The mimetype to parse.
+ *
+ * @param format
+ *     The streamtest_pcm_format to populate.
+ *
+ * @return
+ *     Zero if the mimetype describes a supported raw PCM format, non-zero
+ *     otherwise.
+ */
+int streamtest_pcm_parse_format(const char* mimetype,
+        streamtest_pcm_format* format);
+
+/**
+ * Writes the mimetype describing the given raw PCM format to the given
+ * buffer, which must be at least STREAMTEST_PCM_MIMETYPE_LENGTH bytes.
+ *
+ * @param format
+ *     The format to describe.
+ *
+ * @param buffer
+ *     The buffer to write the mimetype to.
+ */
+void streamtest_pcm_format_mimetype(const streamtest_pcm_format* format,
+        char* buffer);
+
+/**
+ * Returns the name of the set of conversion kernels in use, as chosen for
+ * the current CPU.
+ *
+ * @return
+ *     "AVX2", "SSE2" or "scalar".
+ */
+const char* streamtest_pcm_kernel_name();
+
+/**
+ * Allocates a converter between the given raw PCM formats.
+ *
+ * @param input
+ *     The format of the audio to be converted.
+ *
+ * @param output
+ *     The format to convert to. Only 8 and 16 bits per sample are
+ *     supported.
+ *
+ * @return
+ *     A newly-allocated streamtest_pcm_converter.
+ */
+streamtest_pcm_converter* streamtest_pcm_converter_alloc(
+        const streamtest_pcm_format* input,
+        const streamtest_pcm_format* output);
+
+/**
+ * Returns the largest number of bytes which may be produced by converting
+ * the given number of input bytes.
+ *
+ * @param converter
+ *     The converter which will perform the conversion.
+ *
+ * @param length
+ *     The number of input bytes to be converted.
+ *
+ * @return
+ *     The largest number of bytes which streamtest_pcm_convert() may write
+ *     for the given input length.
+ */
+int streamtest_pcm_max_output(streamtest_pcm_converter* converter,
+        int length);
+
+/**
+ * Converts the given chunk of input audio. Input need not be aligned to
+ * sample frames, as any partial frame is kept until the next call.
+ *
+ * @param converter
+ *     The converter to use.
+ *
+ * @param input
+ *     The input audio.
+ *
+ * @param length
+ *     The number of bytes of input audio.
+ *
+ * @param output
+ *     The buffer to write converted audio to, which must be at least the
+ *     size returned by streamtest_pcm_max_output() for the given length.
+ *
+ * @return
+ *     The number of bytes of converted audio written.
+ */
+int streamtest_pcm_convert(streamtest_pcm_converter* converter,
+        const unsigned char* input, int length, unsigned char* output);
+
+/**
+ * Scales the given 16-bit little-endian samples by the given gain, adding
+ * them to the samples already within the output buffer. Both the scaled
+ * samples and the sums saturate rather than wrap.
+ *
+ * @param output
+ *     The 16-bit samples to add to.
+ *
+ * @param input
+ *     The 16-bit samples to scale and add.
+ *
+ * @param samples
+ *     The number of samples within both buffers.
+ *
+ * @param gain
+ *     The gain to apply to the input, in units of
+ *     1/STREAMTEST_PCM_GAIN_UNITY, between -STREAMTEST_PCM_GAIN_MAX and
+ *     STREAMTEST_PCM_GAIN_MAX.
+ */
+void streamtest_pcm_mix(unsigned char* output, const unsigned char* input,
+        int samples, int gain);
+
+/**
+ * Discards all state carried between chunks, such that the next chunk is
+ * converted as if it were the first. This must be done whenever the input
+ * becomes discontinuous, such as after seeking.
+ *
+ * @param converter
+ *     The converter to reset.
+ */
+void streamtest_pcm_reset(streamtest_pcm_converter* converter);
+
+/**
+ * Frees the given converter.
+ *
+ * @param converter
+ *     The converter to free.
+ */
+void streamtest_pcm_converter_free(streamtest_pcm_converter* converter);
+
+#endif
+
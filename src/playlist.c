@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+#include "playlist.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * The characters which separate the mimetype of a playlist item from its
+ * spec.
+ */
+#define STREAMTEST_PLAYLIST_WHITESPACE " \t"
+
+/**
+ * Appends a new item to the given playlist.
+ *
+ * @param playlist
+ *     The playlist to append to.
+ *
+ * @param spec
+ *     The spec of the source of the new item.
+ *
+ * @param mimetype
+ *     The mimetype of the media provided by the source.
+ */
+static void streamtest_playlist_append(streamtest_playlist* playlist,
+        const char* spec, const char* mimetype) {
+
+    playlist->items = realloc(playlist->items,
+            sizeof(streamtest_playlist_item) * (playlist->count + 1));
+
+    streamtest_playlist_item* item = &playlist->items[playlist->count++];
+    item->spec = strdup(spec);
+    item->mimetype = strdup(mimetype);
+
+}
+
+streamtest_playlist* streamtest_playlist_load(const char* filename) {
+
+    FILE* file = fopen(filename, "r");
+    if (file == NULL)
+        return NULL;
+
+    streamtest_playlist* playlist = calloc(1, sizeof(streamtest_playlist));
+
+    char* line = NULL;
+    size_t line_size = 0;
+    while (getline(&line, &line_size, file) != -1) {
+
+        /* Strip line terminator */
+        line[strcspn(line, "\r\n")] = '\0';
+
+        /* Skip leading whitespace */
+        char* mimetype = line + strspn(line, STREAMTEST_PLAYLIST_WHITESPACE);
+
+        /* Ignore blank lines and comments */
+        if (*mimetype == '\0' || *mimetype == '#')
+            continue;
+
+        /* Mimetype ends at first whitespace, spec begins after it */
+        char* spec = mimetype + strcspn(mimetype,
+                STREAMTEST_PLAYLIST_WHITESPACE);
+
+        if (*spec != '\0') {
+            *(spec++) = '\0';
+            spec += strspn(spec, STREAMTEST_PLAYLIST_WHITESPACE);
+        }
+
+        /* Every item must have a source */
+        if (*spec == '\0')
+            continue;
+
+        streamtest_playlist_append(playlist, spec, mimetype);
+
+    }
+
+    free(line);
+    fclose(file);
+
+    /* An empty playlist is useless */
+    if (playlist->count == 0) {
+        streamtest_playlist_free(playlist);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return playlist;
+
+}
+
+streamtest_playlist* streamtest_playlist_alloc(const char* spec,
+        const char* mimetype) {
+
+    streamtest_playlist* playlist = calloc(1, sizeof(streamtest_playlist));
+    streamtest_playlist_append(playlist, spec, mimetype);
+    return playlist;
+
+}
+
+int streamtest_playlist_next(streamtest_playlist* playlist, int index,
+        bool loop) {
+
+    if (++index < playlist->count)
+        return index;
+
+    return loop ? 0 : -1;
+
+}
+
+void streamtest_playlist_free(streamtest_playlist* playlist) {
+
+    for (int i = 0; i < playlist->count; i++) {
+        free(playlist->items[i].spec);
+        free(playlist->items[i].mimetype);
+    }
+
+    free(playlist->items);
+    free(playlist);
+
+}
+
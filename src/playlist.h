@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef STREAMTEST_PLAYLIST_H
+#define STREAMTEST_PLAYLIST_H
+
+#include "config.h"
+
+#include <stdbool.h>
+
+/**
+ * The prefix which denotes a source spec that refers to a playlist rather
+ * than a single source. The remainder of the spec is the path of the
+ * playlist file.
+ */
+#define STREAMTEST_PLAYLIST_PREFIX "playlist:"
+
+/**
+ * A single entry of a playlist.
+ */
+typedef struct streamtest_playlist_item {
+
+    /**
+     * The mimetype of the media provided by the source of this item.
+     */
+    char* mimetype;
+
+    /**
+     * The spec of the source of this item, as accepted by
+     * streamtest_source_open().
+     */
+    char* spec;
+
+} streamtest_playlist_item;
+
+/**
+ * An ordered list of sources which are streamed one after another over the
+ * same track.
+ */
+typedef struct streamtest_playlist {
+
+    /**
+     * All items within the playlist, in order.
+     */
+    streamtest_playlist_item* items;
+
+    /**
+     * The number of items within the playlist. There is always at least one
+     * item.
+     */
+    int count;
+
+} streamtest_playlist;
+
+/**
+ * Loads the playlist stored within the given file. Each line of the file
+ * describes one item, consisting of a mimetype followed by whitespace and
+ * the spec of the source. Blank lines and lines beginning with "#" are
+ * ignored.
+ *
+ * @param filename
+ *     The path to the playlist file.
+ *
+ * @return
+ *     A newly-allocated streamtest_playlist, or NULL if the file cannot be
+ *     read or contains no valid items, in which case errno is set
+ *     appropriately.
+ */
+streamtest_playlist* streamtest_playlist_load(const char* filename);
+
+/**
+ * Allocates a playlist containing only the given source. This allows a
+ * single source to be looped.
+ *
+ * @param spec
+ *     The spec of the source.
+ *
+ * @param mimetype
+ *     The mimetype of the media provided by the source.
+ *
+ * @return
+ *     A newly-allocated streamtest_playlist containing exactly one item.
+ */
+streamtest_playlist* streamtest_playlist_alloc(const char* spec,
+        const char* mimetype);
+
+/**
+ * Returns the index of the item which follows the item having the given
+ * index.
+ *
+ * @param playlist
+ *     The playlist containing the item.
+ *
+ * @param index
+ *     The index of the current item.
+ *
+ * @param loop
+ *     Whether the first item follows the last.
+ *
+ * @return
+ *     The index of the next item, or -1 if the given item is the last and
+ *     the playlist is not looped.
+ */
+int streamtest_playlist_next(streamtest_playlist* playlist, int index,
+        bool loop);
+
+/**
+ * Frees the given playlist and all of its items.
+ *
+ * @param playlist
+ *     The playlist to free.
+ */
+void streamtest_playlist_free(streamtest_playlist* playlist);
+
+#endif
+
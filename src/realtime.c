@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+#include "realtime.h"
+
+#include <string.h>
+
+int streamtest_realtime_parse_policy(const char* name,
+        streamtest_realtime_policy* policy) {
+
+    if (name[0] == '\0' || strcmp(name, "none") == 0)
+        *policy = STREAMTEST_REALTIME_NONE;
+
+    else if (strcmp(name, "drop") == 0)
+        *policy = STREAMTEST_REALTIME_DROP;
+
+    else if (strcmp(name, "keyframe") == 0)
+        *policy = STREAMTEST_REALTIME_KEYFRAME;
+
+    else if (strcmp(name, "degrade") == 0)
+        *policy = STREAMTEST_REALTIME_DEGRADE;
+
+    else
+        return 1;
+
+    return 0;
+
+}
+
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef STREAMTEST_REALTIME_H
+#define STREAMTEST_REALTIME_H
+
+#include "config.h"
+
+/**
+ * All possible responses to a track falling more than a frame behind the
+ * wall clock, such as after a read or write which took longer than the
+ * frame interval.
+ */
+typedef enum streamtest_realtime_policy {
+
+    /**
+     * Every frame is still delivered, with pacing resuming from the current
+     * time. The track remains behind the wall clock by however long it was
+     * late, and each later delay adds to this.
+     */
+    STREAMTEST_REALTIME_NONE,
+
+    /**
+     * Data which would have been sent while the track was late is skipped,
+     * such that the track resumes from the position it would have reached
+     * had it kept pace. Images are read and dropped, data from non-seekable
+     * sources is read and discarded, and regular files are seeked.
+     */
+    STREAMTEST_REALTIME_DROP,
+
+    /**
+     * As STREAMTEST_REALTIME_DROP, except that the track resumes from the
+     * first keyframe at or after that position, waiting until that
+     * keyframe is due. This requires a pre-chunked file whose table marks
+     * keyframes. Other tracks drop stale data as STREAMTEST_REALTIME_DROP.
+     */
+    STREAMTEST_REALTIME_KEYFRAME,
+
+    /**
+     * The track switches to its lower-rate rendition at the same position,
+     * if it has one and has not already switched, and then drops stale data
+     * as STREAMTEST_REALTIME_DROP.
+     */
+    STREAMTEST_REALTIME_DEGRADE
+
+} streamtest_realtime_policy;
+
+/**
+ * Parses the given name of a real-time policy, which may be "none", "drop",
+ * "keyframe" or "degrade". An empty name is equivalent to "none".
+ *
+ * @param name
+ *     The name to parse.
+ *
+ * @param policy
+ *     Storage for the parsed policy.
+ *
+ * @return
+ *     Zero if the name was parsed successfully, non-zero if the name is not
+ *     recognized.
+ */
+int streamtest_realtime_parse_policy(const char* name,
+        streamtest_realtime_policy* policy);
+
+#endif
+
@@ -0,0 +1,375 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+#include "recorder.h"
+#include "recording.h"
+#include "timing.h"
+
+#include <guacamole/client.h>
+#include <guacamole/socket.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * Writes the entirety of the given buffer to the given file descriptor.
+ *
+ * @param fd
+ *     The file descriptor to write to.
+ *
+ * @param buffer
+ *     The data to write.
+ *
+ * @param length
+ *     The number of bytes to write.
+ *
+ * @return
+ *     Zero if all data was written, non-zero otherwise, in which case errno
+ *     is set appropriately.
+ */
+static int streamtest_recorder_write(int fd, const void* buffer,
+        size_t length) {
+
+    const unsigned char* current = buffer;
+    while (length > 0) {
+
+        ssize_t written = write(fd, current, length);
+        if (written == -1) {
+            if (errno == EINTR)
+                continue;
+            return 1;
+        }
+
+        current += written;
+        length -= written;
+
+    }
+
+    return 0;
+
+}
+
+/**
+ * Queues a record containing the given data for the writer thread. If too
+ * much data is already queued, recording stops instead.
+ *
+ * @param recorder
+ *     The recorder to queue the record within.
+ *
+ * @param buffer
+ *     The data written to the client.
+ *
+ * @param length
+ *     The number of bytes written to the client.
+ */
+static void streamtest_recorder_queue(streamtest_recorder* recorder,
+        const void* buffer, size_t length) {
+
+    int64_t now = streamtest_utime();
+
+    pthread_mutex_lock(&recorder->lock);
+
+    if (recorder->failed)
+        goto done;
+
+    /* Stop recording if the writer thread has fallen too far behind */
+    size_t needed = recorder->pending_length
+        + sizeof(streamtest_recording_record) + length;
+    if (needed > STREAMTEST_RECORDER_MAX_PENDING) {
+        recorder->failed = true;
+        goto done;
+    }
+
+    if (needed > recorder->pending_size) {
+        recorder->pending_size = needed * 2;
+        recorder->pending = realloc(recorder->pending,
+                recorder->pending_size);
+    }
+
+    /* Writes from different threads may race to this point */
+    int64_t timestamp = now - recorder->start;
+    if (timestamp < recorder->last_timestamp)
+        timestamp = recorder->last_timestamp;
+
+    streamtest_recording_record record = {
+        .timestamp = timestamp,
+        .length = length
+    };
+
+    unsigned char* current = recorder->pending + recorder->pending_length;
+    memcpy(current, &record, sizeof(record));
+    memcpy(current + sizeof(record), buffer, length);
+
+    recorder->pending_length = needed;
+    recorder->last_timestamp = timestamp;
+    recorder->records++;
+    recorder->bytes += length;
+
+    pthread_cond_signal(&recorder->modified);
+
+done:
+    pthread_mutex_unlock(&recorder->lock);
+
+}
+
+/**
+ * The body of the writer thread, which writes queued records to the
+ * recording file until signalled to stop.
+ *
+ * @param data
+ *     The streamtest_recorder being serviced.
+ *
+ * @return
+ *     Always NULL.
+ */
+static void* streamtest_recorder_thread(void* data) {
+
+    streamtest_recorder* recorder = (streamtest_recorder*) data;
+
+    /* Records are written from a buffer swapped with the pending buffer,
+     * such that queueing continues while writing */
+    unsigned char* buffer = NULL;
+    int size = 0;
+
+    pthread_mutex_lock(&recorder->lock);
+
+    for (;;) {
+
+        while (recorder->pending_length == 0 && !recorder->stopping)
+            pthread_cond_wait(&recorder->modified, &recorder->lock);
+
+        /* Stop once all pending records have been written */
+        int length = recorder->pending_length;
+        if (length == 0)
+            break;
+
+        unsigned char* pending = recorder->pending;
+        int pending_size = recorder->pending_size;
+        recorder->pending = buffer;
+        recorder->pending_size = size;
+        recorder->pending_length = 0;
+        buffer = pending;
+        size = pending_size;
+
+        /* Nothing further can be written after a failed write */
+        if (recorder->error)
+            continue;
+
+        pthread_mutex_unlock(&recorder->lock);
+        int result = streamtest_recorder_write(recorder->fd, buffer, length);
+        int error = errno;
+        pthread_mutex_lock(&recorder->lock);
+
+        if (result) {
+            recorder->failed = true;
+            recorder->error = error;
+        }
+
+    }
+
+    pthread_mutex_unlock(&recorder->lock);
+
+    free(buffer);
+    return NULL;
+
+}
+
+/**
+ * Handler which forwards reads from the socket installed while recording to
+ * the original socket of the client.
+ *
+ * @param socket
+ *     The socket installed while recording.
+ *
+ * @param buf
+ *     The buffer to read into.
+ *
+ * @param count
+ *     The maximum number of bytes to read.
+ *
+ * @return
+ *     The number of bytes read, or -1 if an error occurs.
+ */
+static ssize_t streamtest_recorder_read_handler(guac_socket* socket,
+        void* buf, size_t count) {
+
+    streamtest_recorder* recorder = (streamtest_recorder*) socket->data;
+    return guac_socket_read(recorder->socket, buf, count);
+
+}
+
+/**
+ * Handler which records all data written to the socket installed while
+ * recording, forwarding that data to the original socket of the client.
+ *
+ * @param socket
+ *     The socket installed while recording.
+ *
+ * @param buf
+ *     The data to write.
+ *
+ * @param count
+ *     The number of bytes to write.
+ *
+ * @return
+ *     The number of bytes written, or -1 if an error occurs.
+ */
+static ssize_t streamtest_recorder_write_handler(guac_socket* socket,
+        const void* buf, size_t count) {
+
+    streamtest_recorder* recorder = (streamtest_recorder*) socket->data;
+    streamtest_recorder_queue(recorder, buf, count);
+
+    if (guac_socket_write(recorder->socket, buf, count)
+            || guac_socket_flush(recorder->socket))
+        return -1;
+
+    return count;
+
+}
+
+/**
+ * Handler which forwards waits for data on the socket installed while
+ * recording to the original socket of the client.
+ *
+ * @param socket
+ *     The socket installed while recording.
+ *
+ * @param usec_timeout
+ *     The maximum time to wait, in microseconds.
+ *
+ * @return
+ *     A positive value if data is available, zero if the timeout elapsed,
+ *     or a negative value if an error occurs.
+ */
+static int streamtest_recorder_select_handler(guac_socket* socket,
+        int usec_timeout) {
+
+    streamtest_recorder* recorder = (streamtest_recorder*) socket->data;
+    return guac_socket_select(recorder->socket, usec_timeout);
+
+}
+
+streamtest_recorder* streamtest_recorder_alloc(guac_client* client,
+        const char* path) {
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
+        return NULL;
+
+    streamtest_recording_header header = {
+        .magic = STREAMTEST_RECORDING_MAGIC,
+        .byte_order = STREAMTEST_RECORDING_BYTE_ORDER
+    };
+
+    if (streamtest_recorder_write(fd, &header, sizeof(header)))
+        goto fail_header;
+
+    streamtest_recorder* recorder = calloc(1, sizeof(streamtest_recorder));
+    recorder->socket = client->socket;
+    recorder->fd = fd;
+    recorder->start = streamtest_utime();
+
+    pthread_mutex_init(&recorder->lock, NULL);
+    pthread_cond_init(&recorder->modified, NULL);
+
+    int error = pthread_create(&recorder->thread, NULL,
+            streamtest_recorder_thread, recorder);
+    if (error) {
+        errno = error;
+        goto fail_thread;
+    }
+
+    /* Route all further output through the recorder */
+    guac_socket* tee = guac_socket_alloc();
+    tee->data = recorder;
+    tee->read_handler = streamtest_recorder_read_handler;
+    tee->write_handler = streamtest_recorder_write_handler;
+    tee->select_handler = streamtest_recorder_select_handler;
+
+    recorder->tee = tee;
+    client->socket = tee;
+
+    return recorder;
+
+fail_thread:
+    pthread_cond_destroy(&recorder->modified);
+    pthread_mutex_destroy(&recorder->lock);
+    free(recorder);
+
+fail_header:
+    close(fd);
+    return NULL;
+
+}
+
+void streamtest_recorder_free(guac_client* client,
+        streamtest_recorder* recorder) {
+
+    /* Restore original socket, recording anything still buffered */
+    client->socket = recorder->socket;
+    guac_socket_flush(recorder->tee);
+    guac_socket_free(recorder->tee);
+
+    /* Wait for all queued records to be written */
+    pthread_mutex_lock(&recorder->lock);
+    recorder->stopping = true;
+    pthread_cond_signal(&recorder->modified);
+    pthread_mutex_unlock(&recorder->lock);
+
+    pthread_join(recorder->thread, NULL);
+
+    if (close(recorder->fd) && !recorder->error) {
+        recorder->failed = true;
+        recorder->error = errno;
+    }
+
+    if (recorder->error)
+        guac_client_log(client, GUAC_LOG_WARNING, "Recording stopped after "
+                "%" PRIu64 " writes: %s", recorder->records,
+                strerror(recorder->error));
+
+    else if (recorder->failed)
+        guac_client_log(client, GUAC_LOG_WARNING, "Recording stopped after "
+                "%" PRIu64 " writes, as the recording could not be written "
+                "quickly enough", recorder->records);
+
+    else
+        guac_client_log(client, GUAC_LOG_DEBUG, "Recorded %" PRIu64 " bytes "
+                "within %" PRIu64 " writes", recorder->bytes,
+                recorder->records);
+
+    pthread_cond_destroy(&recorder->modified);
+    pthread_mutex_destroy(&recorder->lock);
+    free(recorder->pending);
+    free(recorder);
+
+}
+
@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef STREAMTEST_RECORDER_H
+#define STREAMTEST_RECORDER_H
+
+#include "config.h"
+
+#include <guacamole/client.h>
+#include <guacamole/socket.h>
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * The largest amount of recorded data which may await the writer thread, in
+ * bytes. If the recording file cannot keep up, recording stops rather than
+ * delaying the connection.
+ */
+#define STREAMTEST_RECORDER_MAX_PENDING 16777216
+
+/**
+ * Records everything written to the client, in the format defined by
+ * recording.h. Data is queued by whichever thread writes to the client and
+ * written to the recording file by a dedicated writer thread, such that
+ * recording never waits on the file.
+ */
+typedef struct streamtest_recorder {
+
+    /**
+     * The socket of the client prior to recording, to which all data is
+     * forwarded.
+     */
+    guac_socket* socket;
+
+    /**
+     * The socket installed as the socket of the client while recording,
+     * which forwards to the original socket.
+     */
+    guac_socket* tee;
+
+    /**
+     * The file descriptor of the recording file.
+     */
+    int fd;
+
+    /**
+     * The time recording began, as returned by streamtest_utime().
+     */
+    int64_t start;
+
+    /**
+     * The timestamp of the most recent record, in microseconds relative to
+     * start.
+     */
+    int64_t last_timestamp;
+
+    /**
+     * The writer thread.
+     */
+    pthread_t thread;
+
+    /**
+     * Lock which guards all members below.
+     */
+    pthread_mutex_t lock;
+
+    /**
+     * Condition which is signalled when data is queued or the writer thread
+     * should stop.
+     */
+    pthread_cond_t modified;
+
+    /**
+     * Records which have been queued but not yet written.
+     */
+    unsigned char* pending;
+
+    /**
+     * The number of bytes within pending.
+     */
+    int pending_length;
+
+    /**
+     * The number of bytes allocated for pending.
+     */
+    int pending_size;
+
+    /**
+     * Whether the writer thread should stop once all pending records have
+     * been written.
+     */
+    bool stopping;
+
+    /**
+     * Whether recording has stopped prematurely, due to the writer thread
+     * falling too far behind or failing to write. Once set, nothing further
+     * is recorded, such that the recording ends cleanly between records.
+     */
+    bool failed;
+
+    /**
+     * The errno of the write which failed, or zero if recording stopped
+     * because the writer thread fell too far behind.
+     */
+    int error;
+
+    /**
+     * The number of records queued.
+     */
+    uint64_t records;
+
+    /**
+     * The number of bytes of data recorded, excluding record headers.
+     */
+    uint64_t bytes;
+
+} streamtest_recorder;
+
+/**
+ * Begins recording everything written to the given client, replacing the
+ * socket of the client with one which forwards to the original socket. The
+ * recording file is created (or truncated) and its header written before
+ * this function returns.
+ *
+ * @param client
+ *     The guac_client to record.
+ *
+ * @param path
+ *     The path of the recording file.
+ *
+ * @return
+ *     A newly-allocated streamtest_recorder, or NULL if recording could not
+ *     be started, in which case errno is set appropriately.
+ */
+streamtest_recorder* streamtest_recorder_alloc(guac_client* client,
+        const char* path);
+
+/**
+ * Stops recording the given client, restoring its original socket, waiting
+ * for all queued records to be written, and freeing the recorder. Nothing
+ * may be writing to the client while this function runs.
+ *
+ * @param client
+ *     The guac_client being recorded.
+ *
+ * @param recorder
+ *     The recorder to free.
+ */
+void streamtest_recorder_free(guac_client* client,
+        streamtest_recorder* recorder);
+
+#endif
+
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef STREAMTEST_RECORDING_H
+#define STREAMTEST_RECORDING_H
+
+#include "config.h"
+
+#include <stdint.h>
+
+/**
+ * The magic number at the beginning of all session recordings.
+ */
+#define STREAMTEST_RECORDING_MAGIC "GUACREC1"
+
+/**
+ * The length of STREAMTEST_RECORDING_MAGIC, in bytes.
+ */
+#define STREAMTEST_RECORDING_MAGIC_LENGTH 8
+
+/**
+ * The value of the byte_order field of every session recording, as written
+ * in the native byte order of the host which wrote the recording.
+ * Recordings written by a host of differing byte order will not contain
+ * this value, and cannot be replayed.
+ */
+#define STREAMTEST_RECORDING_BYTE_ORDER 0x01020304
+
+/**
+ * The header at the beginning of every session recording. The header is
+ * immediately followed by any number of records, each consisting of a
+ * streamtest_recording_record and the data written. All values are in the
+ * native byte order of the host which wrote the recording.
+ */
+typedef struct streamtest_recording_header {
+
+    /**
+     * STREAMTEST_RECORDING_MAGIC, without null terminator.
+     */
+    char magic[STREAMTEST_RECORDING_MAGIC_LENGTH];
+
+    /**
+     * STREAMTEST_RECORDING_BYTE_ORDER.
+     */
+    uint32_t byte_order;
+
+    /**
+     * Unused. Always zero.
+     */
+    uint32_t reserved;
+
+} streamtest_recording_header;
+
+/**
+ * The header of a single record within a session recording, which is
+ * immediately followed by the data written to the client.
+ */
+typedef struct streamtest_recording_record {
+
+    /**
+     * The time at which the data was written, in microseconds relative to
+     * the start of the recording. Timestamps never decrease from one record
+     * to the next.
+     */
+    int64_t timestamp;
+
+    /**
+     * The number of bytes of data following this header.
+     */
+    uint32_t length;
+
+    /**
+     * Unused. Always zero.
+     */
+    uint32_t reserved;
+
+} streamtest_recording_record;
+
+#endif
+
@@ -0,0 +1,1412 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+#include "scheduler.h"
+#include "timing.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/prctl.h>
+#include <sys/timerfd.h>
+
+/**
+ * Mask which, when applied to a shifted tick, produces the index of the
+ * corresponding slot within a level of the timer wheel.
+ */
+#define STREAMTEST_WHEEL_SLOT_MASK (STREAMTEST_WHEEL_SLOTS - 1)
+
+/**
+ * Tick value representing the absence of any planned wakeup.
+ */
+#define STREAMTEST_WHEEL_NEVER UINT64_MAX
+
+/**
+ * A single worker thread, along with the queue of due tasks that it will run
+ * (or that other workers may steal). While the scheduler has no worker
+ * threads, the queue of the first worker is serviced by the timer thread.
+ */
+typedef struct streamtest_worker {
+
+    /**
+     * The scheduler which owns this worker.
+     */
+    struct streamtest_scheduler* scheduler;
+
+    /**
+     * The thread running this worker.
+     */
+    pthread_t thread;
+
+    /**
+     * Lock which guards the ready queue of this worker.
+     */
+    pthread_mutex_t lock;
+
+    /**
+     * The first task in this worker's ready queue, or NULL if empty.
+     */
+    streamtest_task* head;
+
+    /**
+     * The last task in this worker's ready queue, or NULL if empty.
+     */
+    streamtest_task* tail;
+
+    /**
+     * The index of this worker within the scheduler's array of workers.
+     */
+    int index;
+
+} streamtest_worker;
+
+/**
+ * The process-wide scheduler, consisting of a hierarchical timer wheel
+ * serviced by a dedicated timer thread, and a pool of workers which run tasks
+ * as they fall due. As guacd forks a separate process for each connection,
+ * there is usually only one task, in which case the pool is empty and the
+ * timer thread runs that task itself. Workers are started only once a
+ * second task exists.
+ */
+typedef struct streamtest_scheduler {
+
+    /**
+     * The number of tasks which currently exist. The scheduler is started
+     * when this becomes non-zero and stopped when it returns to zero. This
+     * member is guarded by streamtest_scheduler_instance_lock.
+     */
+    int refcount;
+
+    /**
+     * Lock which guards the timer wheel, including the expires, in_wheel,
+     * prev and next members of all tasks.
+     */
+    pthread_mutex_t lock;
+
+    /**
+     * Condition which is signalled when the timer thread must wake earlier
+     * than planned, or when the scheduler is stopping.
+     */
+    pthread_cond_t timer_cond;
+
+    /**
+     * The thread responsible for advancing the timer wheel.
+     */
+    pthread_t timer_thread;
+
+    /**
+     * The slots of each level of the timer wheel, each slot being a
+     * doubly-linked list of tasks.
+     */
+    streamtest_task* slots[STREAMTEST_WHEEL_LEVELS][STREAMTEST_WHEEL_SLOTS];
+
+    /**
+     * Tasks whose deadlines lie beyond the range of the top level of the
+     * wheel. These are re-examined each time the top level wraps.
+     */
+    streamtest_task* overflow;
+
+    /**
+     * The most recent tick processed by the timer thread. All tasks which
+     * expire at or before this tick have been dispatched.
+     */
+    uint64_t current_tick;
+
+    /**
+     * The tick at which the timer thread next plans to wake, or
+     * STREAMTEST_WHEEL_NEVER if it is waiting indefinitely.
+     */
+    uint64_t wake_tick;
+
+    /**
+     * A timerfd which expires at the planned wakeup of the timer thread
+     * while the STREAMTEST_SLEEP_TIMERFD strategy is in use, or -1 if that
+     * strategy has not been used.
+     */
+    int timer_fd;
+
+    /**
+     * An eventfd which is signalled to wake the timer thread earlier than
+     * planned while it waits on timer_fd, or -1 if the
+     * STREAMTEST_SLEEP_TIMERFD strategy has not been used.
+     */
+    int interrupt_fd;
+
+    /**
+     * An epoll file descriptor containing timer_fd and interrupt_fd, or -1
+     * if the STREAMTEST_SLEEP_TIMERFD strategy has not been used.
+     */
+    int epoll_fd;
+
+    /**
+     * Whether the timer thread is waiting within epoll, and thus must be
+     * woken via interrupt_fd rather than timer_cond.
+     */
+    bool fd_waiting;
+
+    /**
+     * Whether the timer thread has been asked to wake earlier than planned
+     * while polling the clock. This member is accessed atomically.
+     */
+    bool interrupted;
+
+    /**
+     * Whether the timer slack of the timer thread has been reduced. This
+     * member is only accessed by the timer thread.
+     */
+    bool slack_reduced;
+
+    /**
+     * The processor time consumed by the timer thread as of its most recent
+     * wakeup, in microseconds. This member is only accessed by the timer
+     * thread.
+     */
+    int64_t cpu_usecs;
+
+    /**
+     * Lock which must be held while waiting on or signalling work_cond, and
+     * which guards the stopping flag.
+     */
+    pthread_mutex_t pool_lock;
+
+    /**
+     * Condition which is signalled whenever a task is added to any ready
+     * queue, or when the scheduler is stopping.
+     */
+    pthread_cond_t work_cond;
+
+    /**
+     * The total number of tasks within all ready queues. This member is
+     * accessed atomically.
+     */
+    int pending;
+
+    /**
+     * Whether the scheduler is stopping.
+     */
+    bool stopping;
+
+    /**
+     * The index of the worker which should be assigned as home to the next
+     * allocated task.
+     */
+    int next_home;
+
+    /**
+     * The maximum number of worker threads, based on the number of available
+     * processors. If this is less than two, tasks are always run by the
+     * timer thread.
+     */
+    int max_workers;
+
+    /**
+     * The number of workers within the workers array whose threads have been
+     * started, or zero if tasks are run by the timer thread. This only ever
+     * grows while the scheduler is running, is written only while the
+     * instance lock is held, and is otherwise accessed atomically.
+     */
+    int worker_count;
+
+    /**
+     * All workers within the pool. The ready queue of each is usable
+     * regardless of whether its thread has been started.
+     */
+    streamtest_worker workers[STREAMTEST_SCHEDULER_MAX_WORKERS];
+
+} streamtest_scheduler;
+
+/**
+ * The process-wide scheduler, or NULL if no tasks currently exist.
+ */
+static streamtest_scheduler* streamtest_scheduler_instance = NULL;
+
+/**
+ * Lock which guards creation and destruction of the process-wide scheduler.
+ */
+static pthread_mutex_t streamtest_scheduler_instance_lock =
+    PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * The strategy by which the timer thread sleeps, as selected by
+ * streamtest_scheduler_set_sleep(). This is accessed atomically.
+ */
+static int streamtest_sleep_strategy_instance = STREAMTEST_SLEEP_DEFAULT;
+
+/**
+ * Measurements of the accuracy and cost of the timer thread, accumulated
+ * across every scheduler started by this process.
+ */
+static streamtest_sleep_stats streamtest_sleep_stats_instance = { 0 };
+
+/**
+ * Lock which guards streamtest_sleep_stats_instance.
+ */
+static pthread_mutex_t streamtest_sleep_stats_lock =
+    PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Returns the timer wheel tick containing the given timestamp.
+ *
+ * @param usecs
+ *     A timestamp, as returned by streamtest_utime().
+ *
+ * @return
+ *     The tick containing the given timestamp.
+ */
+static uint64_t streamtest_wheel_tick(int64_t usecs) {
+    return (uint64_t) usecs >> STREAMTEST_WHEEL_TICK_BITS;
+}
+
+/**
+ * Adds the given task to the head of the given doubly-linked list.
+ *
+ * @param list
+ *     The list (timer wheel slot) to add the task to.
+ *
+ * @param task
+ *     The task to add.
+ */
+static void streamtest_wheel_link(streamtest_task** list,
+        streamtest_task* task) {
+
+    task->list = list;
+    task->prev = NULL;
+    task->next = *list;
+    if (*list != NULL)
+        (*list)->prev = task;
+    *list = task;
+
+}
+
+/**
+ * Removes the given task from the timer wheel. The timer wheel lock must be
+ * held and the task must currently be within the wheel.
+ *
+ * @param task
+ *     The task to remove.
+ */
+static void streamtest_wheel_unlink(streamtest_task* task) {
+
+    if (task->prev != NULL)
+        task->prev->next = task->next;
+    else
+        *task->list = task->next;
+
+    if (task->next != NULL)
+        task->next->prev = task->prev;
+
+    task->in_wheel = false;
+
+}
+
+/**
+ * Inserts the given task into the level of the timer wheel appropriate for
+ * its expiration tick relative to the current tick. The timer wheel lock must
+ * be held.
+ *
+ * @param scheduler
+ *     The scheduler whose timer wheel should receive the task.
+ *
+ * @param task
+ *     The task to insert, which must not already be within the wheel.
+ *
+ * @return
+ *     true if the task was inserted, false if the task has already expired
+ *     and must instead be run immediately.
+ */
+static bool streamtest_wheel_insert(streamtest_scheduler* scheduler,
+        streamtest_task* task) {
+
+    uint64_t expires = task->expires;
+    uint64_t current = scheduler->current_tick;
+
+    /* Tasks which are already due cannot be placed within the wheel */
+    if (expires <= current)
+        return false;
+
+    /* Use the lowest level at which both ticks share the same parent slot,
+     * such that the task is cascaded down exactly when that slot comes due */
+    for (int level = 0; level < STREAMTEST_WHEEL_LEVELS; level++) {
+
+        int shift = STREAMTEST_WHEEL_SLOT_BITS * level;
+        int parent_shift = shift + STREAMTEST_WHEEL_SLOT_BITS;
+
+        if ((expires >> parent_shift) == (current >> parent_shift)) {
+            int slot = (expires >> shift) & STREAMTEST_WHEEL_SLOT_MASK;
+            streamtest_wheel_link(&scheduler->slots[level][slot], task);
+            task->in_wheel = true;
+            return true;
+        }
+
+    }
+
+    /* Deadlines beyond the top level wait in the overflow list */
+    streamtest_wheel_link(&scheduler->overflow, task);
+    task->in_wheel = true;
+    return true;
+
+}
+
+/**
+ * Re-inserts all tasks within the given list into the timer wheel relative
+ * to the current tick, adding any which have expired to the given list of
+ * expired tasks.
+ *
+ * @param scheduler
+ *     The scheduler whose timer wheel is being advanced.
+ *
+ * @param list
+ *     The list of tasks to cascade. This list will be emptied.
+ *
+ * @param expired
+ *     The list of expired tasks, linked via their next members.
+ */
+static void streamtest_wheel_cascade(streamtest_scheduler* scheduler,
+        streamtest_task** list, streamtest_task** expired) {
+
+    streamtest_task* task = *list;
+    *list = NULL;
+
+    while (task != NULL) {
+
+        streamtest_task* next = task->next;
+
+        /* Move expired tasks to the expired list */
+        if (!streamtest_wheel_insert(scheduler, task)) {
+            task->in_wheel = false;
+            task->next = *expired;
+            *expired = task;
+        }
+
+        task = next;
+
+    }
+
+}
+
+/**
+ * Advances the timer wheel up to and including the given tick, removing all
+ * tasks which expire along the way. The timer wheel lock must be held.
+ *
+ * @param scheduler
+ *     The scheduler whose timer wheel should be advanced.
+ *
+ * @param tick
+ *     The tick to advance to.
+ *
+ * @return
+ *     A list of all expired tasks, linked via their next members, or NULL if
+ *     no tasks have expired.
+ */
+static streamtest_task* streamtest_wheel_advance(
+        streamtest_scheduler* scheduler, uint64_t tick) {
+
+    streamtest_task* expired = NULL;
+
+    while (scheduler->current_tick < tick) {
+
+        uint64_t current = ++scheduler->current_tick;
+
+        /* Tasks beyond the wheel may come within range as the top wraps */
+        int top_shift = STREAMTEST_WHEEL_SLOT_BITS * STREAMTEST_WHEEL_LEVELS;
+        if ((current & ((UINT64_C(1) << top_shift) - 1)) == 0)
+            streamtest_wheel_cascade(scheduler, &scheduler->overflow,
+                    &expired);
+
+        /* Cascade each higher level whose slot has come due, highest first,
+         * as tasks from one level may land in the next level down */
+        for (int level = STREAMTEST_WHEEL_LEVELS - 1; level > 0; level--) {
+
+            int shift = STREAMTEST_WHEEL_SLOT_BITS * level;
+            if ((current & ((UINT64_C(1) << shift) - 1)) != 0)
+                continue;
+
+            int slot = (current >> shift) & STREAMTEST_WHEEL_SLOT_MASK;
+            streamtest_wheel_cascade(scheduler,
+                    &scheduler->slots[level][slot], &expired);
+
+        }
+
+        /* Everything in the lowest level slot expires now */
+        int slot = current & STREAMTEST_WHEEL_SLOT_MASK;
+        streamtest_wheel_cascade(scheduler,
+                &scheduler->slots[0][slot], &expired);
+
+    }
+
+    return expired;
+
+}
+
+/**
+ * Returns the next tick at which the timer thread must wake to either expire
+ * or cascade tasks. The timer wheel lock must be held.
+ *
+ * @param scheduler
+ *     The scheduler whose timer wheel should be examined.
+ *
+ * @return
+ *     The next tick at which the timer thread must wake, or
+ *     STREAMTEST_WHEEL_NEVER if the wheel is empty.
+ */
+static uint64_t streamtest_wheel_next_tick(streamtest_scheduler* scheduler) {
+
+    uint64_t current = scheduler->current_tick;
+
+    /* Look for the next occupied slot within the current lowest-level
+     * rotation */
+    for (uint64_t tick = current + 1;
+            (tick & STREAMTEST_WHEEL_SLOT_MASK) != 0; tick++) {
+        if (scheduler->slots[0][tick & STREAMTEST_WHEEL_SLOT_MASK] != NULL)
+            return tick;
+    }
+
+    /* Otherwise, any tasks at higher levels cannot need attention before the
+     * lowest level wraps */
+    if (scheduler->overflow != NULL)
+        return (current | STREAMTEST_WHEEL_SLOT_MASK) + 1;
+
+    for (int level = 1; level < STREAMTEST_WHEEL_LEVELS; level++) {
+        for (int slot = 0; slot < STREAMTEST_WHEEL_SLOTS; slot++) {
+            if (scheduler->slots[level][slot] != NULL)
+                return (current | STREAMTEST_WHEEL_SLOT_MASK) + 1;
+        }
+    }
+
+    return STREAMTEST_WHEEL_NEVER;
+
+}
+
+/**
+ * Wakes the timer thread earlier than planned, regardless of the strategy by
+ * which it is sleeping. The lock of the timer wheel must be held.
+ *
+ * @param scheduler
+ *     The scheduler whose timer thread should be woken.
+ */
+static void streamtest_timer_interrupt(streamtest_scheduler* scheduler) {
+
+    pthread_cond_signal(&scheduler->timer_cond);
+    __atomic_store_n(&scheduler->interrupted, true, __ATOMIC_SEQ_CST);
+
+    /* Writes fail only if the counter is already non-zero, which wakes
+     * epoll regardless */
+    if (scheduler->fd_waiting) {
+        uint64_t value = 1;
+        while (write(scheduler->interrupt_fd, &value, sizeof(value)) == -1
+                && errno == EINTR);
+    }
+
+}
+
+/**
+ * Adds the given task to the ready queue of its home worker. The task's lock
+ * must be held.
+ *
+ * @param scheduler
+ *     The scheduler which should run the task.
+ *
+ * @param task
+ *     The task to add.
+ */
+static void streamtest_scheduler_enqueue(streamtest_scheduler* scheduler,
+        streamtest_task* task) {
+
+    streamtest_worker* worker = &scheduler->workers[task->home];
+
+    task->state = STREAMTEST_TASK_QUEUED;
+    task->ready_next = NULL;
+
+    /* Append to home worker's queue */
+    pthread_mutex_lock(&worker->lock);
+    if (worker->tail != NULL)
+        worker->tail->ready_next = task;
+    else
+        worker->head = task;
+    worker->tail = task;
+    pthread_mutex_unlock(&worker->lock);
+
+    /* Wake an idle worker, if any */
+    __atomic_add_fetch(&scheduler->pending, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_lock(&scheduler->pool_lock);
+    pthread_cond_signal(&scheduler->work_cond);
+    pthread_mutex_unlock(&scheduler->pool_lock);
+
+    /* Without workers, the timer thread must run the task */
+    if (__atomic_load_n(&scheduler->worker_count, __ATOMIC_SEQ_CST) == 0) {
+        pthread_mutex_lock(&scheduler->lock);
+        streamtest_timer_interrupt(scheduler);
+        pthread_mutex_unlock(&scheduler->lock);
+    }
+
+}
+
+/**
+ * Removes and returns the task at the head of the given worker's ready
+ * queue.
+ *
+ * @param scheduler
+ *     The scheduler which owns the worker.
+ *
+ * @param worker
+ *     The worker whose ready queue should be examined.
+ *
+ * @return
+ *     The removed task, or NULL if the queue is empty.
+ */
+static streamtest_task* streamtest_scheduler_dequeue(
+        streamtest_scheduler* scheduler, streamtest_worker* worker) {
+
+    pthread_mutex_lock(&worker->lock);
+
+    streamtest_task* task = worker->head;
+    if (task != NULL) {
+        worker->head = task->ready_next;
+        if (worker->head == NULL)
+            worker->tail = NULL;
+        __atomic_sub_fetch(&scheduler->pending, 1, __ATOMIC_SEQ_CST);
+    }
+
+    pthread_mutex_unlock(&worker->lock);
+    return task;
+
+}
+
+/**
+ * Marks the given task as idle after it has been cancelled, waking any
+ * thread waiting in streamtest_task_free(). The task's lock must be held.
+ *
+ * @param task
+ *     The cancelled task.
+ */
+static void streamtest_task_release(streamtest_task* task) {
+    task->state = STREAMTEST_TASK_IDLE;
+    pthread_cond_broadcast(&task->idle);
+}
+
+/**
+ * Schedules the given task to run at the given time, placing it within the
+ * timer wheel or, if already due, within a ready queue. The task's lock must
+ * be held.
+ *
+ * @param scheduler
+ *     The scheduler which should run the task.
+ *
+ * @param task
+ *     The task to schedule.
+ *
+ * @param deadline
+ *     The time at which the task should run, as returned by
+ *     streamtest_utime().
+ */
+static void streamtest_scheduler_schedule(streamtest_scheduler* scheduler,
+        streamtest_task* task, int64_t deadline) {
+
+    pthread_mutex_lock(&scheduler->lock);
+
+    /* Round up to the next tick such that tasks never run early */
+    task->expires = streamtest_wheel_tick(deadline
+            + (1 << STREAMTEST_WHEEL_TICK_BITS) - 1);
+
+    if (streamtest_wheel_insert(scheduler, task)) {
+
+        task->state = STREAMTEST_TASK_SCHEDULED;
+
+        /* Wake timer thread if this task is due before its planned wakeup */
+        if (task->expires < scheduler->wake_tick)
+            streamtest_timer_interrupt(scheduler);
+
+        pthread_mutex_unlock(&scheduler->lock);
+
+    }
+
+    /* Run immediately if already due */
+    else {
+        pthread_mutex_unlock(&scheduler->lock);
+        streamtest_scheduler_enqueue(scheduler, task);
+    }
+
+}
+
+/**
+ * Runs the given task, which has just been removed from a ready queue, and
+ * reschedules it according to the deadline returned by its callback.
+ *
+ * @param scheduler
+ *     The scheduler running the task.
+ *
+ * @param task
+ *     The task to run.
+ */
+static void streamtest_scheduler_run(streamtest_scheduler* scheduler,
+        streamtest_task* task) {
+
+    pthread_mutex_lock(&task->lock);
+
+    /* Do not run tasks which are being freed */
+    if (task->cancelled) {
+        streamtest_task_release(task);
+        pthread_mutex_unlock(&task->lock);
+        return;
+    }
+
+    task->state = STREAMTEST_TASK_RUNNING;
+    task->woken = false;
+    pthread_mutex_unlock(&task->lock);
+
+    int64_t deadline = task->callback(task, task->data);
+
+    pthread_mutex_lock(&task->lock);
+
+    /* Release tasks cancelled while running */
+    if (task->cancelled)
+        streamtest_task_release(task);
+
+    /* Run again immediately if woken while running */
+    else if (task->woken)
+        streamtest_scheduler_enqueue(scheduler, task);
+
+    /* Otherwise, honor requested deadline */
+    else if (deadline == STREAMTEST_TASK_WAIT)
+        task->state = STREAMTEST_TASK_IDLE;
+    else
+        streamtest_scheduler_schedule(scheduler, task, deadline);
+
+    pthread_mutex_unlock(&task->lock);
+
+}
+
+/**
+ * The body of each worker thread. Tasks are taken from the worker's own ready
+ * queue, or stolen from the queues of other workers if the worker's own
+ * queue is empty, such that a single slow task cannot delay other due tasks
+ * while workers are idle.
+ *
+ * @param data
+ *     The streamtest_worker associated with the thread.
+ *
+ * @return
+ *     Always NULL.
+ */
+static void* streamtest_worker_thread(void* data) {
+
+    streamtest_worker* worker = (streamtest_worker*) data;
+    streamtest_scheduler* scheduler = worker->scheduler;
+
+    for (;;) {
+
+        /* Prefer own queue */
+        streamtest_task* task = streamtest_scheduler_dequeue(scheduler,
+                worker);
+
+        /* Steal from other workers if own queue is empty */
+        int worker_count = __atomic_load_n(&scheduler->worker_count,
+                __ATOMIC_SEQ_CST);
+        for (int i = 1; task == NULL && i < worker_count; i++) {
+            int victim = (worker->index + i) % worker_count;
+            task = streamtest_scheduler_dequeue(scheduler,
+                    &scheduler->workers[victim]);
+        }
+
+        if (task != NULL) {
+            streamtest_scheduler_run(scheduler, task);
+            continue;
+        }
+
+        /* Wait for more work */
+        pthread_mutex_lock(&scheduler->pool_lock);
+        while (!scheduler->stopping
+                && __atomic_load_n(&scheduler->pending, __ATOMIC_SEQ_CST) == 0)
+            pthread_cond_wait(&scheduler->work_cond, &scheduler->pool_lock);
+
+        bool stopping = scheduler->stopping;
+        pthread_mutex_unlock(&scheduler->pool_lock);
+
+        if (stopping)
+            break;
+
+    }
+
+    return NULL;
+
+}
+
+/**
+ * Creates the timerfd, eventfd and epoll file descriptors required by the
+ * STREAMTEST_SLEEP_TIMERFD strategy, if not already created. This function
+ * is only called by the timer thread.
+ *
+ * @param scheduler
+ *     The scheduler whose timer thread will wait on the timerfd.
+ *
+ * @return
+ *     Zero if the file descriptors are ready for use, non-zero otherwise.
+ */
+static int streamtest_timer_open_fds(streamtest_scheduler* scheduler) {
+
+    if (scheduler->epoll_fd != -1)
+        return 0;
+
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC,
+            TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd == -1)
+        goto fail_timer;
+
+    int interrupt_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (interrupt_fd == -1)
+        goto fail_interrupt;
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1)
+        goto fail_epoll;
+
+    struct epoll_event event = { .events = EPOLLIN };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &event)
+            || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, interrupt_fd, &event))
+        goto fail_ctl;
+
+    scheduler->timer_fd = timer_fd;
+    scheduler->interrupt_fd = interrupt_fd;
+    scheduler->epoll_fd = epoll_fd;
+    return 0;
+
+fail_ctl:
+    close(epoll_fd);
+
+fail_epoll:
+    close(interrupt_fd);
+
+fail_interrupt:
+    close(timer_fd);
+
+fail_timer:
+    return 1;
+
+}
+
+/**
+ * Sets the timer slack of the calling thread, which must be the timer
+ * thread, to STREAMTEST_SLEEP_SLACK_NSECS if reduced slack is requested, or
+ * back to the default otherwise.
+ *
+ * @param scheduler
+ *     The scheduler whose timer thread is calling.
+ *
+ * @param reduce
+ *     Whether the timer slack should be reduced.
+ */
+static void streamtest_timer_set_slack(streamtest_scheduler* scheduler,
+        bool reduce) {
+
+    if (reduce == scheduler->slack_reduced)
+        return;
+
+    /* Zero restores the default slack of the thread */
+    unsigned long slack = reduce ? STREAMTEST_SLEEP_SLACK_NSECS : 0;
+    if (prctl(PR_SET_TIMERSLACK, slack, 0, 0, 0) == 0)
+        scheduler->slack_reduced = reduce;
+
+}
+
+/**
+ * Waits within epoll until the given time or until interrupted, using an
+ * absolute timerfd. The lock of the timer wheel must be held, and is
+ * released while waiting.
+ *
+ * @param scheduler
+ *     The scheduler whose timer thread is sleeping.
+ *
+ * @param deadline
+ *     The time at which to wake, as returned by streamtest_utime(), or
+ *     STREAMTEST_TASK_WAIT to wait until interrupted.
+ */
+static void streamtest_timer_wait_fd(streamtest_scheduler* scheduler,
+        int64_t deadline) {
+
+    /* A zero expiration disarms the timer */
+    struct itimerspec expiration = { { 0 } };
+    if (deadline != STREAMTEST_TASK_WAIT)
+        streamtest_utime_to_timespec(deadline, &expiration.it_value);
+
+    timerfd_settime(scheduler->timer_fd, TFD_TIMER_ABSTIME, &expiration,
+            NULL);
+
+    scheduler->fd_waiting = true;
+    pthread_mutex_unlock(&scheduler->lock);
+
+    struct epoll_event events[2];
+    epoll_wait(scheduler->epoll_fd, events, 2, -1);
+
+    pthread_mutex_lock(&scheduler->lock);
+    scheduler->fd_waiting = false;
+
+    /* Reset both descriptors, whichever woke the thread (both are
+     * non-blocking) */
+    uint64_t value;
+    while (read(scheduler->timer_fd, &value, sizeof(value)) > 0);
+    while (read(scheduler->interrupt_fd, &value, sizeof(value)) > 0);
+
+}
+
+/**
+ * Polls the clock until the given time or until interrupted. The lock of the
+ * timer wheel must be held, and is released while polling.
+ *
+ * @param scheduler
+ *     The scheduler whose timer thread is sleeping.
+ *
+ * @param deadline
+ *     The time at which to wake, as returned by streamtest_utime().
+ */
+static void streamtest_timer_spin(streamtest_scheduler* scheduler,
+        int64_t deadline) {
+
+    __atomic_store_n(&scheduler->interrupted, false, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&scheduler->lock);
+
+    while (streamtest_utime() < deadline
+            && !__atomic_load_n(&scheduler->interrupted, __ATOMIC_SEQ_CST));
+
+    pthread_mutex_lock(&scheduler->lock);
+
+}
+
+/**
+ * Returns the processor time consumed by the calling thread, which must be
+ * the timer thread.
+ *
+ * @param scheduler
+ *     The scheduler whose timer thread is calling.
+ *
+ * @return
+ *     The processor time consumed by the timer thread, in microseconds, or
+ *     the value most recently recorded if this cannot be determined.
+ */
+static int64_t streamtest_timer_cpu_usecs(streamtest_scheduler* scheduler) {
+
+    struct timespec cpu;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu))
+        return scheduler->cpu_usecs;
+
+    return (int64_t) cpu.tv_sec * 1000000 + cpu.tv_nsec / 1000;
+
+}
+
+/**
+ * Excludes the processor time consumed by the timer thread since its most
+ * recent wakeup from the processor time attributed to sleeping, such that
+ * tasks run by the timer thread itself do not count against the sleep
+ * strategy.
+ *
+ * @param scheduler
+ *     The scheduler whose timer thread is calling.
+ */
+static void streamtest_timer_skip_cpu(streamtest_scheduler* scheduler) {
+    scheduler->cpu_usecs = streamtest_timer_cpu_usecs(scheduler);
+}
+
+/**
+ * Sleeps until the planned wakeup of the timer thread (wake_tick) or until
+ * interrupted, using the currently-selected strategy, and records how late
+ * the thread woke and how much processor time it has consumed. The lock of
+ * the timer wheel must be held, and is released while sleeping.
+ *
+ * @param scheduler
+ *     The scheduler whose timer thread is sleeping.
+ */
+static void streamtest_timer_sleep(streamtest_scheduler* scheduler) {
+
+    streamtest_sleep_strategy strategy = __atomic_load_n(
+            &streamtest_sleep_strategy_instance, __ATOMIC_RELAXED);
+
+    /* Fall back to the default strategy if a timerfd is unavailable */
+    if (strategy == STREAMTEST_SLEEP_TIMERFD
+            && streamtest_timer_open_fds(scheduler))
+        strategy = STREAMTEST_SLEEP_DEFAULT;
+
+    streamtest_timer_set_slack(scheduler,
+            strategy == STREAMTEST_SLEEP_SLACK);
+
+    int64_t deadline = STREAMTEST_TASK_WAIT;
+    if (scheduler->wake_tick != STREAMTEST_WHEEL_NEVER)
+        deadline = scheduler->wake_tick << STREAMTEST_WHEEL_TICK_BITS;
+
+    /* Poll the clock only for the final moments before a wakeup */
+    int64_t wait_until = deadline;
+    if (strategy == STREAMTEST_SLEEP_SPIN && deadline != STREAMTEST_TASK_WAIT)
+        wait_until = deadline - STREAMTEST_SLEEP_SPIN_USECS;
+
+    if (strategy == STREAMTEST_SLEEP_TIMERFD)
+        streamtest_timer_wait_fd(scheduler, deadline);
+
+    else if (wait_until == STREAMTEST_TASK_WAIT)
+        pthread_cond_wait(&scheduler->timer_cond, &scheduler->lock);
+
+    else if (wait_until > streamtest_utime()) {
+        struct timespec timeout;
+        streamtest_utime_to_timespec(wait_until, &timeout);
+        pthread_cond_timedwait(&scheduler->timer_cond, &scheduler->lock,
+                &timeout);
+    }
+
+    /* Spinning continues from where the wait left off */
+    else
+        streamtest_timer_spin(scheduler, deadline);
+
+    int64_t now = streamtest_utime();
+
+    /* Processor time is accumulated since the previous sleep */
+    int64_t cpu_usecs = streamtest_timer_cpu_usecs(scheduler);
+
+    pthread_mutex_lock(&streamtest_sleep_stats_lock);
+
+    streamtest_sleep_stats* stats = &streamtest_sleep_stats_instance;
+    stats->strategy = strategy;
+    stats->cpu_usecs += cpu_usecs - scheduler->cpu_usecs;
+
+    /* Only wakeups which were not interrupted indicate accuracy */
+    if (deadline != STREAMTEST_TASK_WAIT && now >= deadline) {
+        int64_t late = now - deadline;
+        stats->wakeups++;
+        stats->late_total += late;
+        if (late > stats->late_max)
+            stats->late_max = late;
+    }
+
+    pthread_mutex_unlock(&streamtest_sleep_stats_lock);
+
+    scheduler->cpu_usecs = cpu_usecs;
+
+}
+
+/**
+ * The body of the timer thread, which advances the timer wheel in real time,
+ * handing expired tasks to the ready queues of their home workers. While no
+ * workers have been started, the timer thread also runs those tasks itself,
+ * one at a time, re-examining the wheel between each.
+ *
+ * @param data
+ *     The streamtest_scheduler whose timer wheel should be advanced.
+ *
+ * @return
+ *     Always NULL.
+ */
+static void* streamtest_timer_thread(void* data) {
+
+    streamtest_scheduler* scheduler = (streamtest_scheduler*) data;
+
+    pthread_mutex_lock(&scheduler->lock);
+    while (!scheduler->stopping) {
+
+        /* Expire everything up to the present */
+        streamtest_task* task = streamtest_wheel_advance(scheduler,
+                streamtest_wheel_tick(streamtest_utime()));
+
+        /* Dispatch expired tasks outside the wheel lock */
+        if (task != NULL) {
+
+            pthread_mutex_unlock(&scheduler->lock);
+
+            while (task != NULL) {
+
+                streamtest_task* next = task->next;
+
+                /* Tasks woken in the meantime will already be queued */
+                pthread_mutex_lock(&task->lock);
+                if (task->state == STREAMTEST_TASK_SCHEDULED) {
+                    if (task->cancelled)
+                        streamtest_task_release(task);
+                    else
+                        streamtest_scheduler_enqueue(scheduler, task);
+                }
+                pthread_mutex_unlock(&task->lock);
+
+                task = next;
+
+            }
+
+            pthread_mutex_lock(&scheduler->lock);
+            continue;
+
+        }
+
+        /* Run due tasks directly if there are no workers to do so */
+        if (__atomic_load_n(&scheduler->worker_count, __ATOMIC_SEQ_CST) == 0) {
+
+            task = streamtest_scheduler_dequeue(scheduler,
+                    &scheduler->workers[0]);
+
+            if (task != NULL) {
+                pthread_mutex_unlock(&scheduler->lock);
+                streamtest_scheduler_run(scheduler, task);
+                streamtest_timer_skip_cpu(scheduler);
+                pthread_mutex_lock(&scheduler->lock);
+                continue;
+            }
+
+        }
+
+        /* Sleep until next tick requiring attention */
+        scheduler->wake_tick = streamtest_wheel_next_tick(scheduler);
+        streamtest_timer_sleep(scheduler);
+
+        scheduler->wake_tick = STREAMTEST_WHEEL_NEVER;
+
+    }
+    pthread_mutex_unlock(&scheduler->lock);
+
+    return NULL;
+
+}
+
+/**
+ * Allocates and starts the process-wide scheduler, storing it within
+ * streamtest_scheduler_instance. The instance lock must be held.
+ *
+ * @return
+ *     Zero if the scheduler was started successfully, non-zero otherwise.
+ */
+static int streamtest_scheduler_start() {
+
+    streamtest_scheduler* scheduler = calloc(1,
+            sizeof(streamtest_scheduler));
+
+    /* Use at most one worker per processor, within reason */
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    if (processors < 1)
+        processors = 1;
+    else if (processors > STREAMTEST_SCHEDULER_MAX_WORKERS)
+        processors = STREAMTEST_SCHEDULER_MAX_WORKERS;
+
+    /* Workers are started only as tasks are added */
+    scheduler->max_workers = processors;
+    scheduler->worker_count = 0;
+    scheduler->current_tick = streamtest_wheel_tick(streamtest_utime());
+    scheduler->wake_tick = STREAMTEST_WHEEL_NEVER;
+    scheduler->timer_fd = -1;
+    scheduler->interrupt_fd = -1;
+    scheduler->epoll_fd = -1;
+
+    /* Timed waits are against the monotonic clock */
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&scheduler->timer_cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+
+    pthread_mutex_init(&scheduler->lock, NULL);
+    pthread_mutex_init(&scheduler->pool_lock, NULL);
+    pthread_cond_init(&scheduler->work_cond, NULL);
+
+    for (int i = 0; i < STREAMTEST_SCHEDULER_MAX_WORKERS; i++) {
+        scheduler->workers[i].scheduler = scheduler;
+        scheduler->workers[i].index = i;
+        pthread_mutex_init(&scheduler->workers[i].lock, NULL);
+    }
+
+    streamtest_scheduler_instance = scheduler;
+
+    /* Start timer thread */
+    if (pthread_create(&scheduler->timer_thread, NULL,
+                streamtest_timer_thread, scheduler))
+        goto fail_timer;
+
+    return 0;
+
+fail_timer:
+    for (int i = 0; i < STREAMTEST_SCHEDULER_MAX_WORKERS; i++)
+        pthread_mutex_destroy(&scheduler->workers[i].lock);
+
+    pthread_cond_destroy(&scheduler->work_cond);
+    pthread_cond_destroy(&scheduler->timer_cond);
+    pthread_mutex_destroy(&scheduler->pool_lock);
+    pthread_mutex_destroy(&scheduler->lock);
+    free(scheduler);
+
+    streamtest_scheduler_instance = NULL;
+    return 1;
+
+}
+
+/**
+ * Stops and frees the process-wide scheduler. No tasks may exist. The
+ * instance lock must be held.
+ */
+static void streamtest_scheduler_stop() {
+
+    streamtest_scheduler* scheduler = streamtest_scheduler_instance;
+
+    /* Signal all threads to stop */
+    pthread_mutex_lock(&scheduler->lock);
+    pthread_mutex_lock(&scheduler->pool_lock);
+    scheduler->stopping = true;
+    pthread_cond_broadcast(&scheduler->work_cond);
+    streamtest_timer_interrupt(scheduler);
+    pthread_mutex_unlock(&scheduler->pool_lock);
+    pthread_mutex_unlock(&scheduler->lock);
+
+    /* Wait for all threads to stop */
+    for (int i = 0; i < scheduler->worker_count; i++)
+        pthread_join(scheduler->workers[i].thread, NULL);
+    pthread_join(scheduler->timer_thread, NULL);
+
+    /* Close any file descriptors used by the timerfd strategy */
+    if (scheduler->epoll_fd != -1) {
+        close(scheduler->epoll_fd);
+        close(scheduler->interrupt_fd);
+        close(scheduler->timer_fd);
+    }
+
+    for (int i = 0; i < STREAMTEST_SCHEDULER_MAX_WORKERS; i++)
+        pthread_mutex_destroy(&scheduler->workers[i].lock);
+
+    pthread_cond_destroy(&scheduler->work_cond);
+    pthread_cond_destroy(&scheduler->timer_cond);
+    pthread_mutex_destroy(&scheduler->pool_lock);
+    pthread_mutex_destroy(&scheduler->lock);
+    free(scheduler);
+
+    streamtest_scheduler_instance = NULL;
+
+}
+
+/**
+ * Starts additional workers such that there is one worker per task, up to
+ * the number of available processors, or none at all if only one task
+ * exists. Workers are never stopped before the scheduler itself. Failure to
+ * start a worker is not fatal, as the tasks of the pool are still run by any
+ * existing workers or by the timer thread. The instance lock must be held.
+ *
+ * @param scheduler
+ *     The scheduler whose pool should be resized.
+ */
+static void streamtest_scheduler_grow(streamtest_scheduler* scheduler) {
+
+    /* A single task is best run directly by the timer thread, as is any
+     * number of tasks if there is only one processor */
+    int wanted = scheduler->refcount;
+    if (wanted < 2 || scheduler->max_workers < 2)
+        return;
+
+    if (wanted > scheduler->max_workers)
+        wanted = scheduler->max_workers;
+
+    /* Each worker is counted only once running, such that other workers
+     * never steal from it beforehand */
+    while (scheduler->worker_count < wanted) {
+
+        streamtest_worker* worker =
+            &scheduler->workers[scheduler->worker_count];
+
+        if (pthread_create(&worker->thread, NULL, streamtest_worker_thread,
+                    worker))
+            break;
+
+        __atomic_add_fetch(&scheduler->worker_count, 1, __ATOMIC_SEQ_CST);
+
+    }
+
+}
+
+streamtest_task* streamtest_task_alloc(streamtest_task_callback* callback,
+        void* data) {
+
+    pthread_mutex_lock(&streamtest_scheduler_instance_lock);
+
+    /* Start scheduler if this is the first task */
+    if (streamtest_scheduler_instance == NULL
+            && streamtest_scheduler_start()) {
+        pthread_mutex_unlock(&streamtest_scheduler_instance_lock);
+        return NULL;
+    }
+
+    streamtest_scheduler* scheduler = streamtest_scheduler_instance;
+    scheduler->refcount++;
+    streamtest_scheduler_grow(scheduler);
+
+    streamtest_task* task = calloc(1, sizeof(streamtest_task));
+    task->callback = callback;
+    task->data = data;
+    task->state = STREAMTEST_TASK_IDLE;
+
+    /* Spread tasks evenly across workers, if any */
+    int queues = scheduler->worker_count > 0 ? scheduler->worker_count : 1;
+    task->home = scheduler->next_home % queues;
+    scheduler->next_home = (task->home + 1) % queues;
+
+    pthread_mutex_init(&task->lock, NULL);
+    pthread_cond_init(&task->idle, NULL);
+
+    pthread_mutex_unlock(&streamtest_scheduler_instance_lock);
+    return task;
+
+}
+
+void streamtest_task_wake(streamtest_task* task) {
+
+    streamtest_scheduler* scheduler = streamtest_scheduler_instance;
+
+    pthread_mutex_lock(&task->lock);
+
+    switch (task->state) {
+
+        /* Idle tasks can be queued directly */
+        case STREAMTEST_TASK_IDLE:
+            if (!task->cancelled)
+                streamtest_scheduler_enqueue(scheduler, task);
+            break;
+
+        /* Scheduled tasks must first be pulled out of the wheel. If no
+         * longer in the wheel, the timer thread is already queueing it. */
+        case STREAMTEST_TASK_SCHEDULED:
+            pthread_mutex_lock(&scheduler->lock);
+            if (task->in_wheel) {
+                streamtest_wheel_unlink(task);
+                pthread_mutex_unlock(&scheduler->lock);
+                streamtest_scheduler_enqueue(scheduler, task);
+            }
+            else
+                pthread_mutex_unlock(&scheduler->lock);
+            break;
+
+        /* Running tasks are re-run as soon as they finish */
+        case STREAMTEST_TASK_RUNNING:
+            task->woken = true;
+            break;
+
+        /* Queued tasks will run soon anyway */
+        case STREAMTEST_TASK_QUEUED:
+            break;
+
+    }
+
+    pthread_mutex_unlock(&task->lock);
+
+}
+
+void streamtest_task_cancel(streamtest_task* task) {
+
+    streamtest_scheduler* scheduler = streamtest_scheduler_instance;
+
+    pthread_mutex_lock(&task->lock);
+    task->cancelled = true;
+
+    /* Pull task out of the wheel if possible */
+    if (task->state == STREAMTEST_TASK_SCHEDULED) {
+        pthread_mutex_lock(&scheduler->lock);
+        if (task->in_wheel) {
+            streamtest_wheel_unlink(task);
+            task->state = STREAMTEST_TASK_IDLE;
+        }
+        pthread_mutex_unlock(&scheduler->lock);
+    }
+
+    /* Otherwise wait for whichever thread holds the task to let go */
+    while (task->state != STREAMTEST_TASK_IDLE)
+        pthread_cond_wait(&task->idle, &task->lock);
+
+    pthread_mutex_unlock(&task->lock);
+
+}
+
+void streamtest_task_free(streamtest_task* task) {
+
+    streamtest_scheduler* scheduler = streamtest_scheduler_instance;
+
+    /* Ensure no thread still holds the task */
+    streamtest_task_cancel(task);
+
+    pthread_cond_destroy(&task->idle);
+    pthread_mutex_destroy(&task->lock);
+    free(task);
+
+    /* Stop scheduler if this was the last task */
+    pthread_mutex_lock(&streamtest_scheduler_instance_lock);
+    if (--scheduler->refcount == 0)
+        streamtest_scheduler_stop();
+    pthread_mutex_unlock(&streamtest_scheduler_instance_lock);
+
+}
+
+int streamtest_sleep_parse_strategy(const char* name,
+        streamtest_sleep_strategy* strategy) {
+
+    if (name[0] == '\0')
+        *strategy = STREAMTEST_SLEEP_DEFAULT;
+
+    else if (strcmp(name, "slack") == 0)
+        *strategy = STREAMTEST_SLEEP_SLACK;
+
+    else if (strcmp(name, "spin") == 0)
+        *strategy = STREAMTEST_SLEEP_SPIN;
+
+    else if (strcmp(name, "timerfd") == 0)
+        *strategy = STREAMTEST_SLEEP_TIMERFD;
+
+    else
+        return 1;
+
+    return 0;
+
+}
+
+const char* streamtest_sleep_strategy_name(
+        streamtest_sleep_strategy strategy) {
+
+    switch (strategy) {
+
+        case STREAMTEST_SLEEP_SLACK:
+            return "slack";
+
+        case STREAMTEST_SLEEP_SPIN:
+            return "spin";
+
+        case STREAMTEST_SLEEP_TIMERFD:
+            return "timerfd";
+
+        default:
+            return "default";
+
+    }
+
+}
+
+void streamtest_scheduler_set_sleep(streamtest_sleep_strategy strategy) {
+    __atomic_store_n(&streamtest_sleep_strategy_instance, strategy,
+            __ATOMIC_RELAXED);
+}
+
+void streamtest_scheduler_get_sleep_stats(streamtest_sleep_stats* stats) {
+    pthread_mutex_lock(&streamtest_sleep_stats_lock);
+    *stats = streamtest_sleep_stats_instance;
+    pthread_mutex_unlock(&streamtest_sleep_stats_lock);
+}
+
@@ -0,0 +1,394 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef STREAMTEST_SCHEDULER_H
+#define STREAMTEST_SCHEDULER_H
+
+#include "config.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * The number of bits by which a timestamp in microseconds must be shifted to
+ * produce the corresponding timer wheel tick. Each tick is thus 64
+ * microseconds long, which is also the maximum amount of time by which a task
+ * may be run late due to the granularity of the wheel.
+ */
+#define STREAMTEST_WHEEL_TICK_BITS 6
+
+/**
+ * The number of bits used to index the slots within each level of the timer
+ * wheel.
+ */
+#define STREAMTEST_WHEEL_SLOT_BITS 6
+
+/**
+ * The number of slots within each level of the timer wheel.
+ */
+#define STREAMTEST_WHEEL_SLOTS (1 << STREAMTEST_WHEEL_SLOT_BITS)
+
+/**
+ * The number of levels within the timer wheel. With 64 slots per level and
+ * 64-microsecond ticks, four levels cover deadlines up to roughly 17 minutes
+ * in the future. Deadlines beyond that are held in an overflow list.
+ */
+#define STREAMTEST_WHEEL_LEVELS 4
+
+/**
+ * The maximum number of worker threads which will be used to run tasks,
+ * regardless of the number of available processors or connections. No
+ * worker threads are used at all while only one task (one connection)
+ * exists, as is always the case within the process guacd forks for each
+ * connection; the timer thread then runs that task itself.
+ */
+#define STREAMTEST_SCHEDULER_MAX_WORKERS 4
+
+/**
+ * Value which may be returned by a task callback to indicate that the task
+ * has no deadline and should only be run again once explicitly woken.
+ */
+#define STREAMTEST_TASK_WAIT ((int64_t) -1)
+
+/**
+ * The timer slack requested of the timer thread by the
+ * STREAMTEST_SLEEP_SLACK strategy, in nanoseconds. This is the smallest
+ * slack the kernel permits.
+ */
+#define STREAMTEST_SLEEP_SLACK_NSECS 1
+
+/**
+ * How long before each planned wakeup the STREAMTEST_SLEEP_SPIN strategy
+ * stops sleeping and begins polling the clock, in microseconds.
+ */
+#define STREAMTEST_SLEEP_SPIN_USECS 200
+
+/**
+ * All strategies by which the timer thread may sleep until the next task
+ * falls due. The strategy is shared by all connections of the process.
+ */
+typedef enum streamtest_sleep_strategy {
+
+    /**
+     * Wait on a condition with a timeout, subject to the default timer slack
+     * of the thread. This is the cheapest strategy.
+     */
+    STREAMTEST_SLEEP_DEFAULT,
+
+    /**
+     * Wait on a condition with a timeout, having reduced the timer slack of
+     * the timer thread to STREAMTEST_SLEEP_SLACK_NSECS such that the kernel
+     * does not coalesce its wakeups with others.
+     */
+    STREAMTEST_SLEEP_SLACK,
+
+    /**
+     * Wait on a condition until STREAMTEST_SLEEP_SPIN_USECS before each
+     * wakeup, then poll the clock until the wakeup is due. This is the most
+     * precise strategy, at the cost of a busy processor while polling.
+     */
+    STREAMTEST_SLEEP_SPIN,
+
+    /**
+     * Wait within epoll for an absolute timerfd to expire, such that
+     * wakeups are driven by a high-resolution kernel timer rather than a
+     * futex timeout.
+     */
+    STREAMTEST_SLEEP_TIMERFD
+
+} streamtest_sleep_strategy;
+
+/**
+ * Measurements of how accurately, and at what cost, the timer thread has
+ * woken, accumulated over the lifetime of the process.
+ */
+typedef struct streamtest_sleep_stats {
+
+    /**
+     * The strategy most recently used by the timer thread.
+     */
+    streamtest_sleep_strategy strategy;
+
+    /**
+     * The total number of times the timer thread woke at or after a planned
+     * wakeup, as opposed to being woken early.
+     */
+    uint64_t wakeups;
+
+    /**
+     * The sum of how late each of those wakeups was, in microseconds.
+     */
+    uint64_t late_total;
+
+    /**
+     * The latest any of those wakeups was, in microseconds.
+     */
+    int64_t late_max;
+
+    /**
+     * The processor time consumed by the timer thread, in microseconds.
+     */
+    int64_t cpu_usecs;
+
+} streamtest_sleep_stats;
+
+typedef struct streamtest_task streamtest_task;
+
+/**
+ * Callback which is invoked by the scheduler (by a worker thread, or by the
+ * timer thread if there are no workers) whenever a task is due. A task's
+ * callback is never run concurrently with itself.
+ *
+ * @param task
+ *     The task being run.
+ *
+ * @param data
+ *     The arbitrary data associated with the task when it was allocated.
+ *
+ * @return
+ *     The absolute time at which the task should next be run, as returned by
+ *     streamtest_utime(), or STREAMTEST_TASK_WAIT if the task should not run
+ *     again until woken.
+ */
+typedef int64_t streamtest_task_callback(streamtest_task* task, void* data);
+
+/**
+ * All possible states of a task.
+ */
+typedef enum streamtest_task_state {
+
+    /**
+     * The task has no deadline and will only run again once woken.
+     */
+    STREAMTEST_TASK_IDLE,
+
+    /**
+     * The task is waiting within the timer wheel for its deadline.
+     */
+    STREAMTEST_TASK_SCHEDULED,
+
+    /**
+     * The task is due and is waiting within a ready queue.
+     */
+    STREAMTEST_TASK_QUEUED,
+
+    /**
+     * The task's callback is currently being run.
+     */
+    STREAMTEST_TASK_RUNNING
+
+} streamtest_task_state;
+
+/**
+ * A unit of periodic work which is run by the process-wide scheduler. Rather
+ * than each connection sleeping within its own thread, each connection owns
+ * a task, and all tasks share a single hierarchical timer wheel and a pool
+ * of worker threads sized to the number of tasks.
+ */
+struct streamtest_task {
+
+    /**
+     * The function to invoke when the task is due.
+     */
+    streamtest_task_callback* callback;
+
+    /**
+     * Arbitrary data to pass to the callback.
+     */
+    void* data;
+
+    /**
+     * Lock which guards the state, woken and cancelled members of this task.
+     */
+    pthread_mutex_t lock;
+
+    /**
+     * Condition which is signalled whenever the task becomes idle after
+     * having been cancelled.
+     */
+    pthread_cond_t idle;
+
+    /**
+     * The current state of this task.
+     */
+    streamtest_task_state state;
+
+    /**
+     * Whether the task has been woken while running, and thus must be run
+     * again immediately regardless of the deadline its callback returns.
+     */
+    bool woken;
+
+    /**
+     * Whether the task is being freed and must not run again.
+     */
+    bool cancelled;
+
+    /**
+     * The index of the worker whose ready queue receives this task. Other
+     * workers will only run this task if they steal it.
+     */
+    int home;
+
+    /**
+     * The timer wheel tick at which this task expires. This member is
+     * guarded by the lock of the timer wheel.
+     */
+    uint64_t expires;
+
+    /**
+     * Whether this task is currently linked into the timer wheel. This
+     * member is guarded by the lock of the timer wheel.
+     */
+    bool in_wheel;
+
+    /**
+     * The timer wheel slot (or overflow list) containing this task, if
+     * in_wheel is true.
+     */
+    streamtest_task** list;
+
+    /**
+     * The previous task within the same timer wheel slot, or NULL if this is
+     * the first task in the slot.
+     */
+    streamtest_task* prev;
+
+    /**
+     * The next task within the same timer wheel slot, or NULL if this is the
+     * last task in the slot.
+     */
+    streamtest_task* next;
+
+    /**
+     * The next task within the same worker ready queue, or NULL if this is
+     * the last task in the queue.
+     */
+    streamtest_task* ready_next;
+
+};
+
+/**
+ * Allocates a new task which will invoke the given callback with the given
+ * data whenever due. The task is initially idle, and will not run until
+ * woken with streamtest_task_wake(). The process-wide scheduler is started
+ * automatically if this is the first task in existence.
+ *
+ * @param callback
+ *     The function to invoke when the task is due.
+ *
+ * @param data
+ *     Arbitrary data to pass to the callback.
+ *
+ * @return
+ *     A newly-allocated task, or NULL if the scheduler could not be started.
+ */
+streamtest_task* streamtest_task_alloc(streamtest_task_callback* callback,
+        void* data);
+
+/**
+ * Requests that the given task run as soon as possible, regardless of its
+ * current deadline. If the task is currently running, it will be run again
+ * immediately after its callback returns.
+ *
+ * @param task
+ *     The task to wake.
+ */
+void streamtest_task_wake(streamtest_task* task);
+
+/**
+ * Cancels the given task, waiting for its callback to return if it is
+ * currently running. Once cancelled, the task will never run again, and
+ * further calls to streamtest_task_wake() have no effect, but the task is
+ * not freed. This function MUST NOT be called from within the callback of
+ * any task.
+ *
+ * @param task
+ *     The task to cancel.
+ */
+void streamtest_task_cancel(streamtest_task* task);
+
+/**
+ * Cancels the given task, waiting for its callback to return if it is
+ * currently running, and frees all associated resources. The process-wide
+ * scheduler is stopped automatically if this is the last task in existence.
+ * This function MUST NOT be called from within the callback of any task.
+ *
+ * @param task
+ *     The task to free.
+ */
+void streamtest_task_free(streamtest_task* task);
+
+/**
+ * Parses the given sleep strategy name, as accepted by the "sleep-strategy"
+ * parameter: "slack", "spin", "timerfd", or the empty string for the
+ * default strategy.
+ *
+ * @param name
+ *     The name of the strategy to parse.
+ *
+ * @param strategy
+ *     The strategy to populate.
+ *
+ * @return
+ *     Zero if the name is valid, non-zero otherwise.
+ */
+int streamtest_sleep_parse_strategy(const char* name,
+        streamtest_sleep_strategy* strategy);
+
+/**
+ * Returns a human-readable name for the given sleep strategy.
+ *
+ * @param strategy
+ *     The strategy to name.
+ *
+ * @return
+ *     The name of the strategy, as accepted by
+ *     streamtest_sleep_parse_strategy(), or "default" for the default
+ *     strategy.
+ */
+const char* streamtest_sleep_strategy_name(
+        streamtest_sleep_strategy strategy);
+
+/**
+ * Selects the strategy by which the timer thread sleeps. As the scheduler
+ * is shared by all connections of the process, the most recent selection
+ * applies to all connections, taking effect when the timer thread next
+ * sleeps.
+ *
+ * @param strategy
+ *     The strategy to use.
+ */
+void streamtest_scheduler_set_sleep(streamtest_sleep_strategy strategy);
+
+/**
+ * Retrieves measurements of the accuracy and processor cost of the timer
+ * thread, accumulated across every scheduler started by this process.
+ *
+ * @param stats
+ *     The streamtest_sleep_stats to populate.
+ */
+void streamtest_scheduler_get_sleep_stats(streamtest_sleep_stats* stats);
+
+#endif
+
@@ -0,0 +1,2411 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+#include "abr.h"
+#include "backpressure.h"
+#include "chunks.h"
+#include "client.h"
+#include "command.h"
+#include "events.h"
+#include "image.h"
+#include "latency.h"
+#include "metrics.h"
+#include "pcm.h"
+#include "realtime.h"
+#include "scheduler.h"
+#include "sender.h"
+#include "playlist.h"
+#include "shaper.h"
+#include "source.h"
+#include "stats.h"
+#include "timing.h"
+#include "trace.h"
+#include "track.h"
+#include "watch.h"
+
+#include <guacamole/client.h>
+#include <guacamole/protocol.h>
+#include <guacamole/socket.h>
+#include <guacamole/timestamp.h>
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/**
+ * Writes the given buffer as a set of blob instructions to the given socket.
+ * The buffer will be split into as many blob instructions as necessary.
+ *
+ * @param socket
+ *     The guac_socket over which the blob instructions should be sent.
+ *
+ * @param stream
+ *     The stream to associate with each blob.
+ *
+ * @param buffer
+ *     The buffer containing the data that should be sent over the given
+ *     guac_socket as blobs.
+ *
+ * @param length
+ *     The number of bytes within the given buffer.
+ *
+ * @return
+ *     The number of blob instructions written.
+ */
+static int streamtest_write_blobs(guac_socket* socket, guac_stream* stream,
+        unsigned char* buffer, int length) {
+
+    int blobs = 0;
+
+    /* Flush all data in buffer as blobs */
+    while (length > 0) {
+
+        /* Determine size of blob to be written */
+        int chunk_size = length;
+        if (chunk_size > STREAMTEST_BLOB_SIZE)
+            chunk_size = STREAMTEST_BLOB_SIZE;
+
+        /* Send audio data */
+        guac_protocol_send_blob(socket, stream, buffer, chunk_size);
+
+        /* Advance to next blob */
+        buffer += chunk_size;
+        length -= chunk_size;
+        blobs++;
+
+    }
+
+    return blobs;
+
+}
+
+/**
+ * Writes the given base64-encoded data as a set of blob instructions to the
+ * given socket, exactly as streamtest_write_blobs() would have written the
+ * data prior to encoding, but without encoding anything.
+ *
+ * @param socket
+ *     The guac_socket over which the blob instructions should be sent.
+ *
+ * @param stream
+ *     The stream to associate with each blob.
+ *
+ * @param data
+ *     The base64-encoded data, which must be the encoding of a multiple of
+ *     three bytes unless it is the encoding of the end of a chunk.
+ *
+ * @param length
+ *     The number of bytes of base64 within the given buffer.
+ *
+ * @return
+ *     The number of blob instructions written.
+ */
+static int streamtest_write_encoded_blobs(guac_socket* socket,
+        guac_stream* stream, const unsigned char* data, int length) {
+
+    int blobs = 0;
+
+    /* Blob instructions are written by hand, as libguac would encode the
+     * data again */
+    char index[16];
+    int index_length = snprintf(index, sizeof(index), "%i", stream->index);
+
+    while (length > 0) {
+
+        int chunk_size = length;
+        if (chunk_size > STREAMTEST_BLOB_SIZE / 3 * 4)
+            chunk_size = STREAMTEST_BLOB_SIZE / 3 * 4;
+
+        char prefix[64];
+        int prefix_length = snprintf(prefix, sizeof(prefix),
+                "4.blob,%i.%s,%i.", index_length, index, chunk_size);
+
+        guac_socket_instruction_begin(socket);
+        guac_socket_write(socket, prefix, prefix_length);
+        guac_socket_write(socket, data, chunk_size);
+        guac_socket_write(socket, ";", 1);
+        guac_socket_instruction_end(socket);
+
+        data += chunk_size;
+        length -= chunk_size;
+        blobs++;
+
+    }
+
+    return blobs;
+
+}
+
+/**
+ * Display a progress bar which indicates the current status of the given
+ * track. Only audio tracks of known length have progress bars.
+ *
+ * @param client
+ *     The guac_client associated with the libguac-client-streamtest
+ *     connection whose current status should be redrawn.
+ *
+ * @param track
+ *     The track whose progress bar should be redrawn.
+ */
+static void streamtest_render_progress(guac_client* client,
+        streamtest_track* track) {
+
+    /* Get stream state from client */
+    streamtest_state* state = (streamtest_state*) client->data;
+
+    /* Only render progress bar for audio streams of known length */
+    if (track->mode != STREAMTEST_AUDIO || track->file_size == -1)
+        return;
+
+    /* Get current position within file */
+    int position = streamtest_source_tell(track->source);
+    if (position == -1) {
+        guac_client_log(client, GUAC_LOG_WARNING,
+                "Unable to determine current position in stream: %s",
+                strerror(errno));
+        return;
+    }
+
+    /*
+     * Render background
+     */
+
+    guac_protocol_send_rect(client->socket,
+            GUAC_DEFAULT_LAYER,
+            0, track->progress_y,
+            STREAMTEST_PROGRESS_WIDTH, STREAMTEST_PROGRESS_HEIGHT);
+
+    guac_protocol_send_cfill(client->socket,
+            GUAC_COMP_OVER, GUAC_DEFAULT_LAYER,
+            0x40, 0x40, 0x40, 0xFF);
+
+    /*
+     * Render progress
+     */
+
+    guac_protocol_send_rect(client->socket,
+            GUAC_DEFAULT_LAYER, 0, track->progress_y,
+            (position+1) / ((track->file_size+1) / STREAMTEST_PROGRESS_WIDTH),
+            STREAMTEST_PROGRESS_HEIGHT);
+
+    if (state->paused)
+        guac_protocol_send_cfill(client->socket,
+                GUAC_COMP_OVER, GUAC_DEFAULT_LAYER,
+                0x80, 0x80, 0x00, 0xFF);
+    else
+        guac_protocol_send_cfill(client->socket,
+                GUAC_COMP_OVER, GUAC_DEFAULT_LAYER,
+                0x00, 0x80, 0x00, 0xFF);
+
+}
+
+/**
+ * Redraws the progress bars of all tracks.
+ *
+ * @param client
+ *     The guac_client associated with the connection being streamed.
+ */
+static void streamtest_render_all_progress(guac_client* client) {
+
+    /* Get stream state from client */
+    streamtest_state* state = (streamtest_state*) client->data;
+
+    for (int i = 0; i < state->track_count; i++)
+        streamtest_render_progress(client, state->tracks[i]);
+
+}
+
+/**
+ * Marks the end of the current frame by sending a sync instruction and
+ * flushing the socket. As this plugin does not use guacd's message handling
+ * loop, the sync which guacd would normally send after each frame must be
+ * sent here. The sync is recorded such that the round trip can be measured
+ * once the client acknowledges it.
+ *
+ * @param client
+ *     The guac_client associated with the connection whose frame is
+ *     complete.
+ */
+static void streamtest_end_frame(guac_client* client) {
+
+    /* Get stream state from client */
+    streamtest_state* state = (streamtest_state*) client->data;
+
+    /* Time the flush, which blocks if the socket cannot keep up */
+    int64_t flush_start = streamtest_utime();
+
+    client->last_sent_timestamp = guac_timestamp_current();
+    guac_protocol_send_sync(client->socket, client->last_sent_timestamp);
+    guac_socket_flush(client->socket);
+
+    int64_t flush_usecs = streamtest_utime() - flush_start;
+    streamtest_backpressure_flushed(&state->backpressure, flush_usecs);
+    streamtest_metrics_observe(&state->metrics->flush_latency, flush_usecs);
+    streamtest_metrics_add(&state->metrics->socket_blocked, flush_usecs);
+
+    streamtest_events_record(state->events, STREAMTEST_EVENT_FLUSH_DONE,
+            STREAMTEST_EVENTS_NO_TRACK, client->last_sent_timestamp);
+
+    /* Everything sent so far has been received once the sync is
+     * acknowledged */
+    uint64_t bytes = 0;
+    for (int i = 0; i < state->track_count; i++)
+        bytes += state->tracks[i]->stats.bytes_sent;
+
+    streamtest_latency_sent(&state->latency, client->last_sent_timestamp,
+            bytes, streamtest_utime());
+
+    /* Note how long the client waited for its first media data */
+    if (bytes > 0 && state->first_byte == -1) {
+        state->first_byte = streamtest_utime() - state->init_time;
+        streamtest_metrics_observe(&state->metrics->first_byte,
+                state->first_byte);
+        guac_client_log(client, GUAC_LOG_DEBUG, "First media data sent "
+                "%lli microseconds after connection began",
+                (long long) state->first_byte);
+    }
+
+}
+
+/**
+ * Returns the media time covered by the most recently read frame of the
+ * given track, in microseconds, regardless of the current playback rate. If
+ * a trace is being replayed or a pre-chunked file is being streamed, this is
+ * the interval between the trace records or chunks corresponding to that
+ * frame and the next.
+ *
+ * @param track
+ *     The track whose frame duration should be returned.
+ *
+ * @return
+ *     The media time covered by the most recently read frame, in
+ *     microseconds.
+ */
+static int64_t streamtest_frame_media_time(streamtest_track* track) {
+
+    if (streamtest_source_chunked(track->source, NULL))
+        return track->chunk_duration;
+
+    if (track->trace != NULL)
+        return track->trace_delta;
+
+    return track->frame_duration;
+
+}
+
+/**
+ * Converts the given amount of media time into the wall-clock time it
+ * occupies at the given playback rate. Passing the negation of the playback
+ * rate performs the reverse conversion.
+ *
+ * @param usecs
+ *     The amount of time to convert, in microseconds.
+ *
+ * @param rate
+ *     The playback rate, as a power of two.
+ *
+ * @return
+ *     The converted amount of time, in microseconds.
+ */
+static int64_t streamtest_scale_time(int64_t usecs, int rate) {
+
+    if (rate >= 0)
+        return usecs >> rate;
+
+    return usecs << -rate;
+
+}
+
+/**
+ * Returns the interval between the start of the current frame of the given
+ * track and the next, in microseconds, taking the current playback rate into
+ * account. If a trace is being replayed, this is the interval between the
+ * trace records corresponding to those frames.
+ *
+ * @param track
+ *     The track whose frame interval should be returned.
+ *
+ * @param rate
+ *     The current playback rate, as a power of two.
+ *
+ * @return
+ *     The interval between the start of the current frame and the next, in
+ *     microseconds.
+ */
+static int64_t streamtest_frame_interval(streamtest_track* track, int rate) {
+    return streamtest_scale_time(streamtest_frame_media_time(track), rate);
+}
+
+/**
+ * Repositions the pre-chunked file being streamed by the given track by the
+ * given amount of media time, as by streamtest_source_seek_time(),
+ * discarding any chunk still being sent. The media time of the track moves
+ * by the difference between the timestamps of the two chunks.
+ *
+ * @param client
+ *     The guac_client associated with the connection being streamed.
+ *
+ * @param track
+ *     The track to reposition, which must be streaming a pre-chunked file.
+ *
+ * @param usecs
+ *     The signed number of microseconds of media time to seek by.
+ *
+ * @param keyframe
+ *     Whether to continue on to the next keyframe, if the file marks
+ *     keyframes.
+ */
+static void streamtest_seek_chunk(guac_client* client,
+        streamtest_track* track, int64_t usecs, bool keyframe) {
+
+    int64_t current = streamtest_source_tell_time(track->source);
+
+    /* Chunk being sent (if any) is no longer relevant */
+    if (track->mode == STREAMTEST_IMAGE)
+        streamtest_track_end_stream(client, track);
+
+    int64_t delta = streamtest_source_seek_time(track->source,
+            current + usecs, keyframe) - current;
+
+    track->buffer_length = 0;
+    track->chunk_data = NULL;
+    track->eof = false;
+    track->live = false;
+
+    track->media_time += delta;
+    track->media_start += delta;
+
+}
+
+/**
+ * Seeks forward or backward within the file being streamed by the given
+ * track by the given amount of media time. The resulting position is clamped
+ * to the bounds of the file. Sources other than regular files cannot be
+ * seeked.
+ *
+ * @param client
+ *     The guac_client associated with the connection being streamed.
+ *
+ * @param track
+ *     The track to seek within.
+ *
+ * @param usecs
+ *     The signed number of microseconds of media time to seek by.
+ */
+static void streamtest_seek(guac_client* client, streamtest_track* track,
+        int usecs) {
+
+    if (!track->source->seekable) {
+        guac_client_log(client, GUAC_LOG_DEBUG,
+                "Ignoring seek within non-seekable source of stream %i",
+                track->index);
+        return;
+    }
+
+    /* Pre-chunked files are seeked by timestamp, to a chunk boundary */
+    if (streamtest_source_chunked(track->source, NULL)) {
+        streamtest_seek_chunk(client, track, usecs, false);
+        return;
+    }
+
+    /* Images vary in size, thus media time cannot be translated into
+     * bytes */
+    if (track->mode == STREAMTEST_IMAGE) {
+        guac_client_log(client, GUAC_LOG_DEBUG,
+                "Ignoring seek within image sequence of stream %i",
+                track->index);
+        return;
+    }
+
+    /* Get current position within file */
+    off_t current = streamtest_source_tell(track->source);
+    if (current == -1) {
+        guac_client_log(client, GUAC_LOG_WARNING,
+                "Unable to determine current position in stream: %s",
+                strerror(errno));
+        return;
+    }
+
+    /* Translate media time into bytes, clamping to file bounds */
+    off_t position = current
+        + (int64_t) usecs * track->frame_bytes / track->frame_duration;
+    if (position < 0)
+        position = 0;
+    else if (position > track->file_size)
+        position = track->file_size;
+
+    /* Raw PCM audio being converted must remain aligned to sample frames,
+     * and conversion must restart from the new position */
+    if (track->pcm != NULL) {
+        position -= position % track->pcm->input_frame_size;
+        streamtest_pcm_reset(track->pcm);
+    }
+
+    if (streamtest_source_seek(track->source, position)) {
+        guac_client_log(client, GUAC_LOG_WARNING,
+                "Unable to seek within stream: %s", strerror(errno));
+        return;
+    }
+
+    /* Data read prior to the seek is no longer relevant */
+    track->buffer_length = 0;
+    track->chunk_data = NULL;
+    track->eof = false;
+    track->live = false;
+
+    /* Media time moves with the actual (clamped) distance seeked */
+    int64_t delta = (int64_t) (position - current)
+        * track->frame_duration / track->frame_bytes;
+    track->media_time += delta;
+    track->media_start += delta;
+
+}
+
+/**
+ * Dumps the event log of the given connection, logging where the dump was
+ * written. If the connection has no event log, this function has no effect.
+ *
+ * @param client
+ *     The guac_client associated with the connection being streamed.
+ *
+ * @param reason
+ *     A human-readable description of why the dump was written, for the
+ *     sake of logging.
+ */
+static void streamtest_dump_events(guac_client* client, const char* reason) {
+
+    /* Get stream state from client */
+    streamtest_state* state = (streamtest_state*) client->data;
+
+    if (state->events == NULL)
+        return;
+
+    char* path;
+    int count = streamtest_events_dump(state->events, &path);
+    if (count == -1) {
+        guac_client_log(client, GUAC_LOG_WARNING, "Unable to dump events "
+                "(%s): %s", reason, strerror(errno));
+        return;
+    }
+
+    guac_client_log(client, GUAC_LOG_INFO, "Dumped %i events to \"%s\" "
+            "(%s)", count, path, reason);
+    free(path);
+
+}
+
+/**
+ * Applies all commands currently pending within the command queue of the
+ * given connection. Seeks and rate changes apply to all tracks.
+ *
+ * @param client
+ *     The guac_client associated with the connection being streamed.
+ *
+ * @return
+ *     true if any commands were applied, false otherwise.
+ */
+static bool streamtest_apply_commands(guac_client* client) {
+
+    /* Get stream state from client */
+    streamtest_state* state = (streamtest_state*) client->data;
+
+    streamtest_command command;
+    bool applied = false;
+
+    while (streamtest_command_queue_pop(&state->commands, &command)) {
+
+        switch (command.type) {
+
+            /* Toggle pause */
+            case STREAMTEST_COMMAND_PAUSE:
+                state->paused = !state->paused;
+                break;
+
+            /* Seek relative to current position */
+            case STREAMTEST_COMMAND_SEEK:
+                for (int i = 0; i < state->track_count; i++)
+                    streamtest_seek(client, state->tracks[i], command.value);
+                break;
+
+            /* Double or halve rate, within limits */
+            case STREAMTEST_COMMAND_RATE:
+                state->rate += command.value;
+                if (state->rate > STREAMTEST_MAX_RATE)
+                    state->rate = STREAMTEST_MAX_RATE;
+                else if (state->rate < -STREAMTEST_MAX_RATE)
+                    state->rate = -STREAMTEST_MAX_RATE;
+
+                for (int i = 0; i < state->track_count; i++)
+                    guac_client_log(client, GUAC_LOG_DEBUG,
+                            "Frames of stream %i will now last %i "
+                            "microseconds", i,
+                            (int) streamtest_frame_interval(state->tracks[i],
+                                state->rate));
+                break;
+
+            /* Dump event log */
+            case STREAMTEST_COMMAND_DUMP:
+                streamtest_dump_events(client, "requested by user");
+                break;
+
+        }
+
+        applied = true;
+
+    }
+
+    return applied;
+
+}
+
+/**
+ * Advances to the next record of the trace being replayed by the given
+ * track, storing the time between the current record and the next. If there
+ * are no further records, the current record becomes the last frame to be
+ * read.
+ *
+ * @param client
+ *     The guac_client associated with the connection being streamed.
+ *
+ * @param track
+ *     The track whose trace should be advanced.
+ *
+ * @return
+ *     Zero if the trace was advanced or has ended, non-zero if the trace is
+ *     malformed, in which case the connection is stopped.
+ */
+static int streamtest_advance_trace(guac_client* client,
+        streamtest_track* track) {
+
+    streamtest_trace_record record;
+    int result = streamtest_trace_next(track->trace, &record);
+
+    /* Abort connection if trace cannot be parsed */
+    if (result < 0) {
+        guac_client_log(client, GUAC_LOG_ERROR,
+                "Unable to read trace of stream %i (malformed or truncated "
+                "after record %i)", track->index, track->trace->records);
+        guac_client_stop(client);
+        return 1;
+    }
+
+    /* Current record is the last */
+    if (result == 0) {
+        guac_client_log(client, GUAC_LOG_DEBUG, "Trace replay of stream %i "
+                "complete", track->index);
+        track->trace_complete = true;
+        return 0;
+    }
+
+    track->trace_delta = record.timestamp - track->trace_record.timestamp;
+    track->trace_record = record;
+    return 0;
+
+}
+
+/**
+ * Moves the given track on to its prefetched next source, closing the
+ * current source and opening the source of the item after that in advance.
+ * The stream of the track is not changed.
+ *
+ * @param client
+ *     The guac_client associated with the connection being streamed.
+ *
+ * @param sender
+ *     The sender streaming the track.
+ *
+ * @param track
+ *     The track whose next source should become its current source.
+ */
+static void streamtest_next_source(guac_client* client,
+        streamtest_sender* sender, streamtest_track* track) {
+
+    streamtest_source* previous = track->source;
+    streamtest_watch* previous_watch = track->watch;
+
+    streamtest_playlist_item* item = &track->playlist->items[track->next_item];
+
+    track->source = track->next_source;
+    track->item = track->next_item;
+    track->file_size = streamtest_source_size(track->source);
+
+    free(track->mimetype);
+    track->mimetype = strdup(item->mimetype);
+    streamtest_track_mode(track->mimetype, &track->mode);
+
+    /* Wake when data arrives from the new source, if not a regular file.
+     * The new watch is created first such that the poller is not stopped
+     * and restarted if the old watch was the last. */
+    track->watch = NULL;
+    if (track->follow == NULL && !track->source->seekable) {
+        track->watch = streamtest_watch_alloc(sender->task,
+                track->source->fd);
+        if (track->watch == NULL)
+            guac_client_log(client, GUAC_LOG_WARNING, "Unable to watch "
+                    "\"%s\" for data: %s", item->spec, strerror(errno));
+    }
+
+    if (previous_watch != NULL)
+        streamtest_watch_free(previous_watch);
+
+    streamtest_source_close(previous);
+
+    guac_client_log(client, GUAC_LOG_DEBUG, "Stream %i is now playing item "
+            "%i of its playlist (\"%s\")", track->index, track->item + 1,
+            item->spec);
+
+    /* Prepare the item after this one */
+    streamtest_track_prefetch(client, track);
+    track->stats.transitions++;
+
+}
+
+/**
+ * Adds the samples mixed by the current source of the given track, and the
+ * time spent mixing them, to the statistics of the track. This must be
+ * invoked after each read, before the source can be closed.
+ *
+ * @param track
+ *     The track which was just read from.
+ */
+static void streamtest_collect_mix_stats(streamtest_track* track) {
+    streamtest_source_collect_mix(track->source, &track->stats.mixed_samples,
+            &track->stats.mix_nsecs);
+}
+
+/**
+ * Determines whether the image just read by the given image sequence track
+ * should be dropped rather than sent, which is the case if the previous
+ * image has not yet been sent in full (due to rate shaping), if the client
+ * is lagging further behind than the connection allows, or if the track is
+ * skipping stale images to catch up with the wall clock. Dropped images are
+ * counted within the statistics of the track.
+ *
+ * @param client
+ *     The guac_client associated with the connection being streamed.
+ *
+ * @param track
+ *     The track which just read an image.
+ *
+ * @return
+ *     true if the image should be dropped, false if it should be sent.
+ */
+static bool streamtest_drop_image(guac_client* client,
+        streamtest_track* track) {
+
+    /* Get stream state from client */
+    streamtest_state* state = (streamtest_state*) client->data;
+
+    /* Images read only to be skipped are always dropped */
+    if (track->catching_up) {
+        track->stats.frames_dropped++;
+        return true;
+    }
+
+    /* Drop while the socket is congested, if so configured */
+    streamtest_backpressure* backpressure = &state->backpressure;
+    bool congested = backpressure->congested
+        && backpressure->policy == STREAMTEST_BACKPRESSURE_DROP;
+
+    int lag = client->last_sent_timestamp - client->last_received_timestamp;
+    if (track->buffer_length == 0 && !congested
+            && (state->max_lag == 0 || lag <= state->max_lag))
+        return false;
+
+    guac_client_log(client, GUAC_LOG_DEBUG, "Dropping image of stream %i "
+            "(%i bytes still unsent, client lagging by %i milliseconds%s)",
+            track->index, track->buffer_length, lag,
+            congested ? ", socket congested" : "");
+
+    if (congested)
+        backpressure->frames_deferred++;
+
+    track->stats.frames_dropped++;
+    return true;
+
+}
+
+/**
+ * Reads the next image from the source of the given image sequence track,
+ * such that each frame is exactly one image streamed over its own img
+ * stream. The image is dropped, rather than sent, if
+ * streamtest_drop_image() deems the client unable to keep up. The
+ * connection is stopped if an error occurs.
+ *
+ * If the current source ends part way through an image, the incomplete image
+ * is discarded. If the track has a playlist, the next source is read from at
+ * the next frame.
+ *
+ * @param client
+ *     The guac_client associated with the connection being streamed.
+ *
+ * @param sender
+ *     The sender streaming the track.
+ *
+ * @param track
+ *     The track whose next image should be read.
+ *
+ * @return
+ *     Zero if the image was read, dropped or is not yet available, non-zero
+ *     if an error occurred.
+ */
+static int streamtest_read_image(guac_client* client,
+        streamtest_sender* sender, streamtest_track* track) {
+
+    /* Read until a complete image is buffered or no more data is
+     * available */
+    int length;
+    while ((length = streamtest_image_length(track->image_format,
+                    track->image_buffer, track->image_length)) == 0) {
+
+        /* Images may be arbitrarily large */
+        if (track->image_length == track->image_buffer_size) {
+            if (track->image_buffer_size == 0)
+                track->image_buffer_size = track->frame_bytes;
+            else
+                track->image_buffer_size *= 2;
+            track->image_buffer = realloc(track->image_buffer,
+                    track->image_buffer_size);
+        }
+
+        int result = streamtest_source_read(track->source,
+                track->image_buffer + track->image_length,
+                track->image_buffer_size - track->image_length);
+
+        /* Abort connection if we cannot read */
+        if (result == -1) {
+            guac_client_log(client, GUAC_LOG_ERROR,
+                    "Unable to read from source of stream %i: %s",
+                    track->index, strerror(errno));
+            guac_client_stop(client);
+            return 1;
+        }
+
+        if (result == 0)
+            break;
+
+        track->image_length += result;
+
+    }
+
+    /* Abort connection if the data is not an image of the expected type */
+    if (length == -1) {
+        guac_client_log(client, GUAC_LOG_ERROR, "Stream %i does not "
+                "contain a valid sequence of \"%s\" images", track->index,
+                track->mimetype);
+        guac_client_stop(client);
+        return 1;
+    }
+
+    /* Wait for the remainder of the image if more data may yet arrive */
+    track->live = (length == 0)
+        && (track->follow != NULL || !track->source->eof);
+    if (length == 0) {
+
+        if (track->live)
+            return 0;
+
+        if (track->image_length > 0)
+            guac_client_log(client, GUAC_LOG_WARNING, "Discarding %i bytes "
+                    "of incomplete image at end of stream %i",
+                    track->image_length, track->index);
+
+        track->image_length = 0;
+
+        /* Continue with the next item of the playlist, if any, beginning a
+         * new stream only if the type of data differs */
+        if (track->next_source == NULL)
+            track->eof = true;
+        else if (strcmp(track->playlist->items[track->next_item].mimetype,
+                    track->mimetype) != 0)
+            track->switch_pending = true;
+        else
+            streamtest_next_source(client, sender, track);
+
+        return 0;
+
+    }
+
+    track->stats.frames++;
+    track->media_start = track->media_time;
+    track->media_time += streamtest_frame_media_time(track);
+
+    /* Stream the image in its entirety unless dropped */
+    if (!streamtest_drop_image(client, track)) {
+
+        if (track->buffer_size < length) {
+            track->buffer_size = length;
+            track->frame_buffer = realloc(track->frame_buffer,
+                    track->buffer_size);
+        }
+
+        memcpy(track->frame_buffer, track->image_buffer, length);
+        track->buffer_length = length;
+        streamtest_track_begin_image(client, track);
+
+    }
+
+    /* Retain any data following the image */
+    track->image_length -= length;
+    memmove(track->image_buffer, track->image_buffer + length,
+            track->image_length);
+
+    return 0;
+
+}
+
+/**
+ * Advances to the next chunk of the pre-chunked file being streamed by the
+ * given track. The chunk is not copied, but is instead sent directly from
+ * the mapped file, and nothing is read until any previous frame has been
+ * sent in full. If the track is an image sequence, each chunk is one image,
+ * and images are dropped as by streamtest_drop_image(). The connection is
+ * stopped if an error occurs.
+ *
+ * Once all chunks have been sent, the track continues with the next item of
+ * its playlist (if any). Data from an item which is not pre-chunked is read
+ * from the next frame onward.
+ *
+ * @param client
+ *     The guac_client associated with the connection being streamed.
+ *
+ * @param sender
+ *     The sender streaming the track.
+ *
+ * @param track
+ *     The track whose next chunk should be read.
+ *
+ * @return
+ *     Zero if the chunk was read or skipped, non-zero if an error occurred.
+ */
+static int streamtest_read_chunk(guac_client* client,
+        streamtest_sender* sender, streamtest_track* track) {
+
+    streamtest_source* source = track->source;
+
+    /* Chunks are streamed exactly as stored */
+    if (track->pcm != NULL) {
+        guac_client_log(client, GUAC_LOG_ERROR, "Pre-chunked audio of "
+                "stream %i cannot be converted", track->index);
+        guac_client_stop(client);
+        return 1;
+    }
+
+    /* Continue with the next item of the playlist, if any, beginning a new
+     * stream only if the type of data differs. The mapping must remain
+     * until the final chunk has been sent. */
+    if (source->eof) {
+
+        if (track->buffer_length > 0)
+            return 0;
+
+        if (track->next_source == NULL)
+            track->eof = true;
+        else if (strcmp(track->playlist->items[track->next_item].mimetype,
+                    track->mimetype) != 0)
+            track->switch_pending = true;
+        else {
+
+            streamtest_next_source(client, sender, track);
+
+            /* Continue without a gap if the next item is also
+             * pre-chunked */
+            if (streamtest_source_chunked(track->source, NULL))
+                return streamtest_read_chunk(client, sender, track);
+
+        }
+
+        return 0;
+
+    }
+
+    /* Chunks cannot be appended to data still waiting on the shaper, though
+     * images are instead dropped */
+    if (track->buffer_length > 0 && track->mode != STREAMTEST_IMAGE) {
+        track->stats.source_stalls++;
+        return 0;
+    }
+
+    streamtest_source_chunk chunk;
+    if (streamtest_source_read_chunk(source, &chunk)) {
+        guac_client_log(client, GUAC_LOG_ERROR, "Unable to read chunk of "
+                "stream %i: %s", track->index, strerror(errno));
+        guac_client_stop(client);
+        return 1;
+    }
+
+    track->chunk_duration = chunk.duration;
+    track->stats.frames++;
+    track->media_start = track->media_time;
+    track->media_time += streamtest_frame_media_time(track);
+
+    if (track->mode == STREAMTEST_IMAGE && streamtest_drop_image(client,
+                track))
+        return 0;
+
+    if (chunk.length == 0)
+        return 0;
+
+    track->chunk_data = chunk.data;
+    track->chunk_length = chunk.length;
+    track->chunk_encoded = chunk.encoded;
+    track->buffer_length = chunk.length;
+
+    if (track->mode == STREAMTEST_IMAGE)
+        streamtest_track_begin_image(client, track);
+
+    return 0;
+
+}
+
+/**
+ * Switches the given track to the rendition having the given index, if the
+ * current position of the track is a point at which the two renditions are
+ * aligned, beginning a new stream for the new rendition. Pre-chunked
+ * renditions are aligned wherever a chunk of each begins at the same
+ * timestamp, provided that chunk begins with a keyframe if the new
+ * rendition marks keyframes. Other renditions are aligned at every frame
+ * boundary, with positions matched in proportion to bitrate and the frame
+ * size of the track scaled likewise. No switch occurs while data of the
+ * current rendition remains to be sent.
+ *
+ * @param client
+ *     The guac_client associated with the connection being streamed.
+ *
+ * @param track
+ *     The track which should switch renditions.
+ *
+ * @param target
+ *     The index of the rendition to switch to.
+ *
+ * @return
+ *     true if the track has switched renditions, false if the renditions
+ *     are not yet aligned or the new rendition cannot be positioned.
+ */
+static bool streamtest_switch_rendition(guac_client* client,
+        streamtest_track* track, int target) {
+
+    streamtest_renditions* renditions = track->renditions;
+    streamtest_rendition* current = &renditions->items[renditions->current];
+    streamtest_rendition* next = &renditions->items[target];
+
+    if (track->buffer_length > 0 || track->chunk_data != NULL)
+        return false;
+
+    /* Pre-chunked renditions switch only at aligned chunks */
+    int frame_bytes = track->frame_bytes;
+    if (streamtest_source_chunked(next->source, NULL)) {
+
+        if (current->source->eof)
+            return false;
+
+        int64_t timestamp = streamtest_source_tell_time(current->source);
+        if (streamtest_source_seek_time(next->source, timestamp, true)
+                    != timestamp || next->source->eof)
+            return false;
+
+    }
+
+    /* Other renditions are positioned by bitrate */
+    else {
+
+        off_t position = streamtest_source_tell(current->source);
+        if (position == -1) {
+            guac_client_log(client, GUAC_LOG_WARNING, "Unable to determine "
+                    "position within rendition of stream %i: %s",
+                    track->index, strerror(errno));
+            return false;
+        }
+
+        position = (int64_t) position * next->bitrate / current->bitrate;
+        frame_bytes = (int64_t) track->frame_bytes * next->bitrate
+            / current->bitrate;
+        if (frame_bytes < 1)
+            frame_bytes = 1;
+
+        if (streamtest_source_seek(next->source, position)) {
+            guac_client_log(client, GUAC_LOG_WARNING, "Unable to seek "
+                    "within rendition \"%s\" of stream %i: %s", next->spec,
+                    track->index, strerror(errno));
+            return false;
+        }
+
+    }
+
+    /* Each rendition is decoded separately */
+    streamtest_track_end_stream(client, track);
+
+    track->source = next->source;
+    track->file_size = streamtest_source_size(next->source);
+    track->frame_bytes = frame_bytes;
+    track->chunk_data = NULL;
+    track->eof = false;
+    track->live = false;
+
+    free(track->mimetype);
+    track->mimetype = strdup(next->mimetype);
+    streamtest_track_begin_stream(client, track);
+
+    if (target > renditions->current)
+        track->stats.switches_up++;
+    else
+        track->stats.switches_down++;
+
+    guac_client_log(client, GUAC_LOG_INFO, "Stream %i switched from "
+            "rendition %i (%i bits per second) to rendition %i (%i bits per "
+            "second)", track->index, renditions->current + 1,
+            current->bitrate, target + 1, next->bitrate);
+
+    renditions->current = target;
+    renditions->last_switch = streamtest_utime();
+    return true;
+
+}
+
+/**
+ * Consults the rate-selection policy of the connection as to which
+ * rendition the given track should stream, switching renditions if a
+ * different rendition is chosen and the renditions are aligned at the
+ * current position. If the track has no renditions, this function has no
+ * effect.
+ *
+ * @param client
+ *     The guac_client associated with the connection being streamed.
+ *
+ * @param track
+ *     The track whose next frame is about to be read.
+ */
+static void streamtest_adapt(guac_client* client, streamtest_track* track) {
+
+    /* Get stream state from client */
+    streamtest_state* state = (streamtest_state*) client->data;
+
+    streamtest_renditions* renditions = track->renditions;
+    if (renditions == NULL)
+        return;
+
+    int64_t now = streamtest_utime();
+    streamtest_abr_input input = {
+        .renditions   = renditions,
+        .throughput   = state->latency.throughput,
+        .lag          = streamtest_latency_lag(&state->latency, now),
+        .congested    = state->backpressure.congested,
+        .since_switch = now - renditions->last_switch
+    };
+
+    int target = state->abr_policy->select(&input);
+    if (target >= 0 && target < renditions->count
+            && target != renditions->current)
+        streamtest_switch_rendition(client, track, target);
+
+}
+
+/**
+ * Returns whether the frames of the given track may be read at a fraction
+ * of their usual size. Only frames of raw data which are neither converted,
+ * mixed, dictated by a trace nor pre-chunked may be resized.
+ *
+ * @param track
+ *     The track to test.
+ *
+ * @return
+ *     true if the frames of the track may be resized, false otherwise.
+ */
+static bool streamtest_frame_shrinkable(streamtest_track* track) {
+    return track->mode != STREAMTEST_IMAGE
+        && track->trace == NULL
+        && track->pcm == NULL
+        && !streamtest_source_indivisible(track->source);
+}
+
+/**
+ * Returns the number of times the next frame of the given track should be
+ * halved in size in response to backpressure from the socket.
+ *
+ * @param client
+ *     The guac_client associated with the connection being streamed.
+ *
+ * @param track
+ *     The track whose next frame is about to be read.
+ *
+ * @return
+ *     The number of times the next frame should be halved, which is zero if
+ *     the frame should be read at its usual size.
+ */
+static int streamtest_frame_shrink(guac_client* client,
+        streamtest_track* track) {
+
+    /* Get stream state from client */
+    streamtest_state* state = (streamtest_state*) client->data;
+
+    streamtest_backpressure* backpressure = &state->backpressure;
+    if (backpressure->policy != STREAMTEST_BACKPRESSURE_SHRINK
+            || !streamtest_frame_shrinkable(track))
+        return 0;
+
+    /* Never shrink frames to nothing */
+    int shrink = backpressure->shrink;
+    while (shrink > 0 && (track->frame_bytes >> shrink) == 0)
+        shrink--;
+
+    return shrink;
+
+}
+
+/**
+ * Returns whether the next frame of the given track should not be read, as
+ * the socket is congested and the backpressure policy of the connection
+ * offers no other way of reducing the data sent by the track. Images which
+ * are dropped when congested and frames which are shrunk are still read.
+ *
+ * @param client
+ *     The guac_client associated with the connection being streamed.
+ *
+ * @param track
+ *     The track whose next frame is due.
+ *
+ * @return
+ *     true if the frame should not be read until the next frame is due,
+ *     false if the frame should be read.
+ */
+static bool streamtest_defer_frame(guac_client* client,
+        streamtest_track* track) {
+
+    /* Get stream state from client */
+    streamtest_state* state = (streamtest_state*) client->data;
+
+    streamtest_backpressure* backpressure = &state->backpressure;
+    if (!backpressure->congested)
+        return false;
+
+    switch (backpressure->policy) {
+
+        /* Backpressure is only measured */
+        case STREAMTEST_BACKPRESSURE_NONE:
+            return false;
+
+        /* Only images can be dropped */
+        case STREAMTEST_BACKPRESSURE_DROP:
+            if (track->mode == STREAMTEST_IMAGE)
+                return false;
+            break;
+
+        /* Only raw frames can be shrunk */
+        case STREAMTEST_BACKPRESSURE_SHRINK:
+            if (streamtest_frame_shrinkable(track))
+                return false;
+            break;
+
+        /* All reads are paused */
+        case STREAMTEST_BACKPRESSURE_PAUSE:
+            break;
+
+    }
+
+    backpressure->frames_deferred++;
+    return true;
+
+}
+
+/**
+ * Reads the next frame of data from the file being streamed by the given
+ * track, appending it to any data still waiting to be sent. If a trace is
+ * being replayed, the size of the frame is dictated by the current trace
+ * record. If previously-read data is waiting on the rate shaper and there is
+ * insufficient space for a full frame, nothing is read. The connection is
+ * stopped if an error occurs.
+ *
+ * If the current source ends part way through the frame and the track has a
+ * playlist, the frame is completed from the next source without any gap, so
+ * long as both share the same mimetype. Otherwise, the next source is
+ * streamed over a new stream once all data of the current source has been
+ * sent.
+ *
+ * @param client
+ *     The guac_client associated with the connection being streamed.
+ *
+ * @param sender
+ *     The sender streaming the track.
+ *
+ * @param track
+ *     The track whose next frame should be read.
+ *
+ * @return
+ *     Zero if the frame was read or skipped, non-zero if an error occurred.
+ */
+static int streamtest_read_frame(guac_client* client,
+        streamtest_sender* sender, streamtest_track* track) {
+
+    /* Begin a new stream once all data of the previous source is sent */
+    if (track->switch_pending) {
+
+        if (track->buffer_length > 0)
+            return 0;
+
+        streamtest_track_end_stream(client, track);
+        streamtest_next_source(client, sender, track);
+        streamtest_track_begin_stream(client, track);
+
+        track->switch_pending = false;
+        track->stats.stream_restarts++;
+
+    }
+
+    /* Switch renditions if the client's throughput calls for it */
+    streamtest_adapt(client, track);
+
+    /* Pre-chunked files are sent directly from their mapping */
+    if (streamtest_source_chunked(track->source, NULL))
+        return streamtest_read_chunk(client, sender, track);
+
+    /* Nothing can be read until any chunk still being sent has been sent
+     * in full */
+    if (track->chunk_data != NULL) {
+        track->stats.source_stalls++;
+        return 0;
+    }
+
+    /* Image sequences are read one whole image at a time */
+    if (track->mode == STREAMTEST_IMAGE)
+        return streamtest_read_image(client, sender, track);
+
+    /* Determine size of frame, advancing through trace if replaying */
+    int size = track->frame_bytes;
+    if (track->trace != NULL) {
+        size = track->trace_record.length;
+        if (streamtest_advance_trace(client, track))
+            return 1;
+    }
+
+    /* Read smaller frames, covering proportionally less media time, if
+     * shrinking frames in response to backpressure */
+    int shrink = streamtest_frame_shrink(client, track);
+    size >>= shrink;
+
+    /* Send whole frames lent by the source, such as from a mapped file, in
+     * place rather than copying them into the frame buffer */
+    const unsigned char* lent;
+    if (track->pcm == NULL && track->buffer_length == 0
+            && streamtest_source_peek(track->source, &lent, size) == size) {
+
+        off_t position = streamtest_source_tell(track->source);
+        if (streamtest_source_seek(track->source, position + size)) {
+            guac_client_log(client, GUAC_LOG_ERROR,
+                    "Unable to read from source of stream %i: %s",
+                    track->index, strerror(errno));
+            guac_client_stop(client);
+            return 1;
+        }
+
+        track->chunk_data = lent;
+        track->chunk_length = size;
+        track->chunk_encoded = false;
+        track->buffer_length = size;
+        track->live = false;
+
+        track->stats.frames++;
+        track->stats.frames_lent++;
+        track->media_start = track->media_time;
+        track->media_time += streamtest_frame_media_time(track) >> shrink;
+        return 0;
+
+    }
+
+    /* Converted audio may be larger than the audio read */
+    int capacity = size;
+    if (track->pcm != NULL)
+        capacity = streamtest_pcm_max_output(track->pcm, size);
+
+    /* Ensure there is room for the frame */
+    if (track->buffer_size - track->buffer_length < capacity) {
+
+        /* Do not read more than the shaper allows to be buffered */
+        if (track->shaper != NULL && track->buffer_length > 0) {
+            track->stats.source_stalls++;
+            return 0;
+        }
+
+        /* Otherwise, the buffer is drained before the next frame is read,
+         * and need only grow if trace records or converted audio exceed the
+         * current size */
+        track->buffer_size = track->buffer_length + capacity;
+        track->frame_buffer = realloc(track->frame_buffer,
+                track->buffer_size);
+
+    }
+
+    /* Raw PCM audio is read into its own buffer, and only added to the frame
+     * buffer once converted */
+    unsigned char* frame = track->frame_buffer + track->buffer_length;
+    unsigned char* input = frame;
+    if (track->pcm != NULL) {
+        if (track->pcm_buffer_size < size) {
+            track->pcm_buffer_size = size;
+            track->pcm_buffer = realloc(track->pcm_buffer, size);
+        }
+        input = track->pcm_buffer;
+    }
+
+    /* Read whatever is available of the frame */
+    int length = streamtest_source_read(track->source, input, size);
+    streamtest_collect_mix_stats(track);
+
+    /* Continue into the next item of the playlist, if any, giving up only
+     * if an entire pass through the playlist yields no data */
+    int empty = 0;
+    while (length != -1 && length < size && track->source->eof
+            && track->next_source != NULL
+            && empty <= track->playlist->count) {
+
+        /* Data of differing types cannot share a stream */
+        const char* mimetype =
+            track->playlist->items[track->next_item].mimetype;
+        if (strcmp(mimetype, track->mimetype) != 0) {
+            track->switch_pending = true;
+            break;
+        }
+
+        streamtest_next_source(client, sender, track);
+
+        /* Pre-chunked files are never read into a frame */
+        if (streamtest_source_chunked(track->source, NULL))
+            break;
+
+        int result = streamtest_source_read(track->source, input + length,
+                size - length);
+        streamtest_collect_mix_stats(track);
+
+        if (result == -1)
+            length = -1;
+        else if (result == 0)
+            empty++;
+        else {
+            length += result;
+            empty = 0;
+        }
+
+    }
+
+    /* Abort connection if we cannot read */
+    if (length == -1) {
+        guac_client_log(client, GUAC_LOG_ERROR,
+                "Unable to read from source of stream %i: %s",
+                track->index, strerror(errno));
+        guac_client_stop(client);
+        return 1;
+    }
+
+    /* Note EOF (of source or trace) such that remaining data is flushed,
+     * unless more data may yet be appended to a followed file or there is a
+     * next source */
+    if (track->trace_complete || (track->source->eof
+                && track->follow == NULL && track->next_source == NULL))
+        track->eof = true;
+
+    /* Otherwise, wait for further data if the full frame is not yet
+     * available from a source which has not ended */
+    else
+        track->live = (length < size) && !track->switch_pending
+            && (track->follow != NULL || !track->source->eof);
+
+    /* Only converted audio is streamed */
+    int converted = length;
+    if (track->pcm != NULL)
+        converted = streamtest_pcm_convert(track->pcm, input, length, frame);
+
+    track->buffer_length += converted;
+    if (length > 0) {
+        track->stats.frames++;
+        track->media_start = track->media_time;
+        track->media_time += streamtest_frame_media_time(track) >> shrink;
+    }
+
+    return 0;
+
+}
+
+/**
+ * Returns the smallest number of buffered bytes which may be sent at once.
+ * Without a rate shaper, any amount of data may be sent. With a rate shaper,
+ * sends must be at least the shaper's quantum, except for the final send
+ * after end-of-file has been reached or of each image or chunk.
+ *
+ * @param track
+ *     The track being streamed.
+ *
+ * @return
+ *     The smallest number of bytes which may be sent at once, or zero if no
+ *     data may be sent until more is read.
+ */
+static int streamtest_min_send(streamtest_track* track) {
+
+    /* Send anything if not shaping */
+    if (track->shaper == NULL)
+        return track->buffer_length;
+
+    /* Remaining data may be smaller than a quantum only at EOF or at the
+     * end of an image or chunk, as nothing more is read until it is sent */
+    if (track->buffer_length < track->shaper->quantum)
+        return (track->eof || track->mode == STREAMTEST_IMAGE
+                || track->chunk_data != NULL) ? track->buffer_length : 0;
+
+    return track->shaper->quantum;
+
+}
+
+/**
+ * Sends as much buffered data of the given track as its rate shaper (if any)
+ * allows.
+ *
+ * @param client
+ *     The guac_client associated with the connection being streamed.
+ *
+ * @param track
+ *     The track whose buffered data should be sent.
+ *
+ * @param now
+ *     The current time, as returned by streamtest_utime().
+ *
+ * @return
+ *     true if any data was sent, false otherwise.
+ */
+static bool streamtest_send_buffered(guac_client* client,
+        streamtest_track* track, int64_t now) {
+
+    /* Get stream state from client */
+    streamtest_state* state = (streamtest_state*) client->data;
+
+    int blobs;
+    int length = track->buffer_length;
+    int minimum = streamtest_min_send(track);
+    if (minimum == 0)
+        return false;
+
+    /* Limit to available tokens */
+    streamtest_shaper* shaper = track->shaper;
+    if (shaper != NULL) {
+
+        int available = streamtest_shaper_available(shaper, now);
+        if (available < minimum) {
+            shaper->deferrals++;
+            return false;
+        }
+
+        if (length > available)
+            length = available;
+
+        /* Pre-encoded chunks can be split only between whole groups of
+         * three bytes, each of which is encoded as four characters */
+        if (track->chunk_encoded && length < track->buffer_length) {
+            length -= length % 3;
+            if (length == 0) {
+                shaper->deferrals++;
+                return false;
+            }
+        }
+
+        streamtest_shaper_consume(shaper, length);
+
+    }
+
+    /* Writes block if the socket cannot keep up */
+    int64_t write_start = streamtest_utime();
+
+    /* Write chunks directly from the mapped file */
+    if (track->chunk_data != NULL) {
+
+        int offset = track->chunk_length - track->buffer_length;
+
+        if (track->chunk_encoded)
+            blobs = streamtest_write_encoded_blobs(
+                    client->socket, track->stream,
+                    track->chunk_data + offset / 3 * 4,
+                    streamtest_chunks_stored_length(length, true));
+        else
+            blobs = streamtest_write_blobs(client->socket, track->stream,
+                    (unsigned char*) track->chunk_data + offset, length);
+
+        track->buffer_length -= length;
+        if (track->buffer_length == 0) {
+            track->chunk_data = NULL;
+            track->chunk_encoded = false;
+        }
+
+    }
+
+    /* Otherwise, write data as blobs, shifting any remaining data to the
+     * beginning of the buffer */
+    else {
+        blobs = streamtest_write_blobs(client->socket, track->stream,
+                track->frame_buffer, length);
+        track->buffer_length -= length;
+        memmove(track->frame_buffer, track->frame_buffer + length,
+                track->buffer_length);
+    }
+
+    int64_t write_usecs = streamtest_utime() - write_start;
+    streamtest_backpressure_blocked(&state->backpressure, write_usecs);
+    streamtest_metrics_add(&state->metrics->socket_blocked, write_usecs);
+
+    track->stats.blobs_sent += blobs;
+    track->stats.bytes_sent += length;
+
+    streamtest_metrics_add(&state->metrics->blobs_sent, blobs);
+    streamtest_metrics_add(&state->metrics->bytes_sent, length);
+
+    streamtest_events_record(state->events, STREAMTEST_EVENT_BLOB_SENT,
+            track->index, length);
+
+    /* Each image has its own stream */
+    if (track->mode == STREAMTEST_IMAGE && track->buffer_length == 0)
+        streamtest_track_end_stream(client, track);
+
+    return true;
+
+}
+
+/**
+ * Records the delay between the most recent modification of the file
+ * followed by the given track and the present, updating the known size of
+ * the file at the same time. This function should be invoked immediately
+ * after sending data read at the live edge of a followed file.
+ *
+ * @param track
+ *     The track whose followed file was just sent from.
+ */
+static void streamtest_record_live_delay(streamtest_track* track) {
+
+    streamtest_stats* stats = &track->stats;
+
+    struct stat stat_buf;
+    if (fstat(track->source->fd, &stat_buf))
+        return;
+
+    /* Modification times are wall-clock time */
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    int64_t delay = (int64_t) (now.tv_sec - stat_buf.st_mtim.tv_sec) * 1000000
+        + (now.tv_nsec - stat_buf.st_mtim.tv_nsec) / 1000;
+
+    stats->live_sends++;
+    stats->live_delay_total += delay;
+    if (delay > stats->live_delay_max)
+        stats->live_delay_max = delay;
+
+    /* The file has grown */
+    track->file_size = stat_buf.st_size;
+
+}
+
+/**
+ * Skips up to the given amount of media time of the given track, as if that
+ * media had been sent on time, discarding any data read but not yet sent.
+ * Regular files are seeked, images are read and dropped, and data already
+ * available from non-seekable sources is read and discarded. Frames whose
+ * size is dictated by a trace cannot be skipped, nor can raw audio being
+ * converted from a non-seekable source, which would lose its alignment with
+ * sample frames.
+ *
+ * @param client
+ *     The guac_client associated with the connection being streamed.
+ *
+ * @param sender
+ *     The sender streaming the track.
+ *
+ * @param track
+ *     The track whose stale data should be skipped.
+ *
+ * @param usecs
+ *     The amount of media time to skip, in microseconds.
+ *
+ * @return
+ *     The media time actually skipped, in microseconds, which may be less
+ *     than requested if the source has no more data or if media can only be
+ *     skipped in whole chunks or images.
+ */
+static int64_t streamtest_skip(guac_client* client,
+        streamtest_sender* sender, streamtest_track* track, int64_t usecs) {
+
+    if (track->trace != NULL)
+        return 0;
+
+    int64_t start = track->media_time;
+
+    /* Regular files and pre-chunked files (including pre-chunked images)
+     * can simply be seeked */
+    if (track->source->seekable
+            && (streamtest_source_chunked(track->source, NULL)
+                || track->mode != STREAMTEST_IMAGE)) {
+        streamtest_seek(client, track, usecs);
+        return track->media_time - start;
+    }
+
+    /* Images vary in size, and must be read to be skipped */
+    if (track->mode == STREAMTEST_IMAGE) {
+
+        track->catching_up = true;
+        while (!track->eof && !track->live && !track->switch_pending
+                && track->media_time - start + track->frame_duration
+                    <= usecs) {
+
+            int64_t previous = track->media_time;
+            if (streamtest_read_image(client, sender, track))
+                break;
+
+            /* Stop if no image could be read */
+            if (track->media_time == previous)
+                break;
+
+        }
+        track->catching_up = false;
+
+        return track->media_time - start;
+
+    }
+
+    if (track->pcm != NULL)
+        return 0;
+
+    /* Discard only what the non-seekable source has already produced */
+    int64_t bytes = usecs * track->frame_bytes / track->frame_duration;
+    int64_t discarded = 0;
+    while (discarded < bytes) {
+
+        unsigned char discard[4096];
+        int length = sizeof(discard);
+        if (bytes - discarded < length)
+            length = bytes - discarded;
+
+        /* Errors are reported by the next read of the frame */
+        int result = streamtest_source_read(track->source, discard, length);
+        streamtest_collect_mix_stats(track);
+        if (result <= 0)
+            break;
+
+        discarded += result;
+
+    }
+
+    track->buffer_length = 0;
+
+    int64_t delta = discarded * track->frame_duration / track->frame_bytes;
+    track->media_time += delta;
+    track->media_start += delta;
+    return delta;
+
+}
+
+/**
+ * Skips up to the given amount of media time of the given track, and then
+ * on to the next keyframe, such that playback resumes from a point which
+ * can be decoded without the data skipped. The track must be streaming a
+ * pre-chunked file whose table marks keyframes. If no keyframe follows, the
+ * remainder of the file is skipped.
+ *
+ * @param client
+ *     The guac_client associated with the connection being streamed.
+ *
+ * @param track
+ *     The track whose stale data should be skipped.
+ *
+ * @param usecs
+ *     The amount of media time to skip before searching for a keyframe, in
+ *     microseconds.
+ *
+ * @return
+ *     The media time actually skipped, in microseconds, which may be more
+ *     than requested.
+ */
+static int64_t streamtest_skip_to_keyframe(guac_client* client,
+        streamtest_track* track, int64_t usecs) {
+
+    int64_t start = track->media_time;
+    streamtest_seek_chunk(client, track, usecs, true);
+    return track->media_time - start;
+
+}
+
+/**
+ * Switches the given track to the lower-rate rendition of its source, if it
+ * has one and has not already switched, beginning a new stream from the
+ * equivalent position within the rendition. Positions within pre-chunked
+ * files are matched by timestamp (advancing to the next keyframe if the
+ * rendition marks keyframes), while positions within other files are
+ * matched in proportion to the size of each file, scaling the frame size
+ * of the track likewise.
+ *
+ * @param client
+ *     The guac_client associated with the connection being streamed.
+ *
+ * @param track
+ *     The track which should switch to its lower-rate rendition.
+ *
+ * @return
+ *     true if the track has switched to its lower-rate rendition, false if
+ *     there is no rendition to switch to or it cannot be positioned.
+ */
+static bool streamtest_degrade(guac_client* client, streamtest_track* track) {
+
+    streamtest_source* source = track->degrade_source;
+    if (source == NULL)
+        return false;
+
+    track->degrade_source = NULL;
+    streamtest_source* previous = track->source;
+
+    /* Match position by timestamp if pre-chunked */
+    int64_t delta = 0;
+    if (streamtest_source_chunked(previous, NULL)) {
+        int64_t timestamp = streamtest_source_tell_time(previous);
+        delta = streamtest_source_seek_time(source, timestamp, true)
+            - timestamp;
+    }
+
+    /* Otherwise, match position in proportion to size */
+    else {
+
+        off_t current = streamtest_source_tell(previous);
+        int size = streamtest_source_size(source);
+        if (current == -1 || size <= 0 || track->file_size <= 0) {
+            guac_client_log(client, GUAC_LOG_WARNING, "Unable to position "
+                    "lower-rate rendition of stream %i", track->index);
+            streamtest_source_close(source);
+            return false;
+        }
+
+        off_t position = (int64_t) current * size / track->file_size;
+        if (track->pcm != NULL)
+            position -= position % track->pcm->input_frame_size;
+
+        if (streamtest_source_seek(source, position)) {
+            guac_client_log(client, GUAC_LOG_WARNING, "Unable to seek "
+                    "within lower-rate rendition of stream %i: %s",
+                    track->index, strerror(errno));
+            streamtest_source_close(source);
+            return false;
+        }
+
+        /* Frames continue to cover the same media time */
+        track->frame_bytes = (int64_t) track->frame_bytes * size
+            / track->file_size;
+        if (track->frame_bytes < 1)
+            track->frame_bytes = 1;
+
+    }
+
+    /* The rendition is decoded separately from the original */
+    streamtest_track_end_stream(client, track);
+    streamtest_source_close(previous);
+
+    track->source = source;
+    track->file_size = streamtest_source_size(source);
+    track->buffer_length = 0;
+    track->chunk_data = NULL;
+    track->eof = false;
+    track->live = false;
+    track->media_time += delta;
+    track->media_start += delta;
+
+    streamtest_track_begin_stream(client, track);
+    track->stats.degradations++;
+
+    guac_client_log(client, GUAC_LOG_INFO, "Stream %i fell behind and has "
+            "switched to its lower-rate rendition (frames of %i bytes)",
+            track->index, track->frame_bytes);
+
+    return true;
+
+}
+
+/**
+ * Responds to the given track having fallen more than a frame behind the
+ * wall clock, as dictated by the real-time policy of the connection. Stale
+ * data is skipped if the policy calls for it, advancing the deadline of the
+ * next frame by the media time skipped. If the track remains too far
+ * behind, pacing resumes from the current time, such that the track never
+ * attempts to catch up by sending frames early.
+ *
+ * @param client
+ *     The guac_client associated with the connection being streamed.
+ *
+ * @param sender
+ *     The sender streaming the track.
+ *
+ * @param track
+ *     The track which has fallen behind.
+ *
+ * @param now
+ *     The current time, as returned by streamtest_utime().
+ *
+ * @param max_lag
+ *     The furthest the track may be behind the wall clock without pacing
+ *     resuming from the current time, in microseconds.
+ */
+static void streamtest_catch_up(guac_client* client,
+        streamtest_sender* sender, streamtest_track* track, int64_t now,
+        int64_t max_lag) {
+
+    /* Get stream state from client */
+    streamtest_state* state = (streamtest_state*) client->data;
+    streamtest_realtime_policy policy = state->realtime;
+
+    int64_t behind = now - track->next_frame;
+    int64_t usecs = streamtest_scale_time(behind, -state->rate);
+
+    /* Switch to the lower-rate rendition first, such that the track is
+     * less likely to fall behind again */
+    if (policy == STREAMTEST_REALTIME_DEGRADE)
+        streamtest_degrade(client, track);
+
+    /* Resume from a keyframe only if keyframes are known */
+    streamtest_source_layout layout;
+    bool keyframe = policy == STREAMTEST_REALTIME_KEYFRAME
+        && streamtest_source_chunked(track->source, &layout)
+        && layout.keyframes;
+
+    int64_t skipped = 0;
+    if (keyframe)
+        skipped = streamtest_skip_to_keyframe(client, track, usecs);
+    else if (policy != STREAMTEST_REALTIME_NONE)
+        skipped = streamtest_skip(client, sender, track, usecs);
+
+    if (skipped > 0) {
+
+        track->next_frame += streamtest_scale_time(skipped, state->rate);
+        track->stats.catch_ups++;
+        track->stats.skipped_usecs += skipped;
+        if (keyframe)
+            track->stats.keyframe_skips++;
+
+        guac_client_log(client, GUAC_LOG_DEBUG, "Stream %i fell %lli "
+                "microseconds behind and skipped %lli microseconds of "
+                "media%s", track->index, (long long) behind,
+                (long long) skipped, keyframe ? " to a keyframe" : "");
+
+    }
+
+    else
+        track->stats.slips++;
+
+    /* Do not attempt to catch up by sending early if still behind */
+    if (now - track->next_frame > max_lag)
+        track->next_frame = now;
+
+}
+
+/**
+ * Reads the next frame of the given track if due, and sends as much buffered
+ * data as its rate shaper (if any) allows. Frames are read at absolute
+ * deadlines spaced by the current frame interval of the track.
+ *
+ * @param client
+ *     The guac_client associated with the connection being streamed.
+ *
+ * @param sender
+ *     The sender streaming the track.
+ *
+ * @param track
+ *     The track to service.
+ *
+ * @param sent
+ *     Pointer to a bool which is set to true if any data or drawing
+ *     instructions were sent, and is left untouched otherwise.
+ *
+ * @return
+ *     The time at which the next frame of the track is due or its rate
+ *     shaper will permit buffered data to be sent (whichever is sooner), or
+ *     STREAMTEST_TASK_WAIT if the track need not be serviced until woken
+ *     for other reasons.
+ */
+static int64_t streamtest_service_track(guac_client* client,
+        streamtest_sender* sender, streamtest_track* track, bool* sent) {
+
+    /* Get stream state from client */
+    streamtest_state* state = (streamtest_state*) client->data;
+
+    /* Read next frame if due */
+    int64_t frame_start = streamtest_utime();
+    bool frame_due = !track->eof && frame_start >= track->next_frame;
+
+    /* At the live edge of a followed file or non-seekable source, read as
+     * soon as data lands, resuming normal pacing from that point */
+    bool live = track->live;
+    if (live) {
+
+        /* The followed file must be checked for modification, while
+         * non-seekable sources can simply be read without blocking */
+        if (track->follow != NULL)
+            frame_due = streamtest_follow_changed(track->follow);
+        else
+            frame_due = true;
+
+        if (frame_due)
+            track->next_frame = frame_start;
+
+    }
+
+    /* Read nothing while the socket is congested, if the backpressure
+     * policy calls for it. Data at the live edge is read regardless, as
+     * its arrival would not otherwise wake the sender again. */
+    if (frame_due && !live && streamtest_defer_frame(client, track)) {
+        track->next_frame = frame_start
+            + streamtest_frame_interval(track, state->rate);
+        frame_due = false;
+    }
+
+    /* Note time already spent blocked on the socket, such that overruns
+     * caused by the socket can be told apart from those caused by reads */
+    int64_t blocked_start = state->backpressure.blocked_total;
+
+    if (frame_due) {
+
+        /* Frames read at the live edge have no deadline to miss */
+        streamtest_metrics* metrics = state->metrics;
+        if (!live)
+            streamtest_metrics_observe(&metrics->sleep_error,
+                    frame_start - track->next_frame);
+
+        streamtest_events_record(state->events, STREAMTEST_EVENT_FRAME_START,
+                track->index, (frame_start - track->next_frame) * 1000);
+
+        if (streamtest_read_frame(client, sender, track))
+            return STREAMTEST_TASK_WAIT;
+
+        streamtest_events_record(state->events, STREAMTEST_EVENT_READ_DONE,
+                track->index, track->buffer_length);
+
+        streamtest_metrics_observe(&metrics->read_latency,
+                streamtest_utime() - frame_start);
+        streamtest_metrics_add(&metrics->frames, 1);
+
+    }
+
+    /* Send whatever the shaper allows, updating the progress bar */
+    if (streamtest_send_buffered(client, track, frame_start)) {
+
+        if (live && frame_due && track->follow != NULL)
+            streamtest_record_live_delay(track);
+
+        streamtest_render_progress(client, track);
+        *sent = true;
+
+    }
+
+    /* Wait for further data if the live edge has been reached */
+    if (track->live && track->watch != NULL
+            && streamtest_watch_arm(track->watch))
+        guac_client_log(client, GUAC_LOG_WARNING, "Unable to wait for "
+                "further data of stream %i: %s", track->index,
+                strerror(errno));
+
+    /* Nothing further once all data has been sent */
+    if (streamtest_track_complete(track))
+        return STREAMTEST_TASK_WAIT;
+
+    /* Advance to next frame */
+    if (frame_due) {
+
+        int64_t frame_end = streamtest_utime();
+        int64_t interval = streamtest_frame_interval(track, state->rate);
+        track->next_frame += interval;
+
+        /* Warn (at debug level) if frame takes too long */
+        if (interval > 0 && frame_end - frame_start > interval) {
+            track->stats.overruns++;
+            streamtest_metrics_add(&state->metrics->overruns, 1);
+            guac_client_log(client, GUAC_LOG_DEBUG,
+                    "Frame of stream %i took longer than requested "
+                    "duration: %i microseconds (%i blocked on the socket)",
+                    track->index, (int) (frame_end - frame_start),
+                    (int) (state->backpressure.blocked_total
+                        - blocked_start));
+        }
+
+        /* Respond as the real-time policy dictates if more than a frame
+         * behind. Trace records may be arbitrarily close together, thus the
+         * nominal frame duration is the minimum permitted lag. */
+        int64_t max_lag = interval;
+        if (max_lag < track->frame_duration)
+            max_lag = track->frame_duration;
+
+        if (frame_end - track->next_frame > max_lag)
+            streamtest_catch_up(client, sender, track, frame_end, max_lag);
+
+    }
+
+    /* Wake for the next frame unless waiting on the source */
+    int64_t next_wake = STREAMTEST_TASK_WAIT;
+    if (!track->eof && !track->live)
+        next_wake = track->next_frame;
+
+    /* Wake sooner if the shaper will allow buffered data to be sent */
+    int minimum = streamtest_min_send(track);
+    if (track->shaper != NULL && minimum > 0) {
+        int64_t ready = streamtest_shaper_ready_at(track->shaper, minimum);
+        if (next_wake == STREAMTEST_TASK_WAIT || ready < next_wake)
+            next_wake = ready;
+    }
+
+    return next_wake;
+
+}
+
+/**
+ * Compares the media time of all tracks which are still streaming, updating
+ * the synchronization statistics of the connection. As each track may be
+ * positioned anywhere within its most recently read frame, the skew between
+ * two tracks is the gap between those frames, if any, such that differing
+ * frame durations alone are never reported as skew. Tracks waiting on their
+ * source are excluded, as their timing is dictated by the producer.
+ *
+ * @param client
+ *     The guac_client associated with the connection being streamed.
+ */
+static void streamtest_check_sync(guac_client* client) {
+
+    /* Get stream state from client */
+    streamtest_state* state = (streamtest_state*) client->data;
+    streamtest_sync_stats* sync = &state->sync;
+
+    int64_t latest_start = INT64_MIN;
+    int64_t earliest_end = INT64_MAX;
+    int compared = 0;
+
+    for (int i = 0; i < state->track_count; i++) {
+
+        streamtest_track* track = state->tracks[i];
+        if (track->eof || track->live)
+            continue;
+
+        if (track->media_start > latest_start)
+            latest_start = track->media_start;
+
+        if (track->media_time < earliest_end)
+            earliest_end = track->media_time;
+
+        compared++;
+
+    }
+
+    /* Synchronization is meaningless without at least two tracks */
+    if (compared < 2)
+        return;
+
+    int64_t skew = latest_start - earliest_end;
+    if (skew < 0)
+        skew = 0;
+
+    sync->checks++;
+
+    if (skew > sync->max_skew)
+        sync->max_skew = skew;
+
+    if (skew > state->sync_tolerance) {
+        sync->violations++;
+        guac_client_log(client, GUAC_LOG_DEBUG, "Streams are out of sync "
+                "by %lli microseconds", (long long) skew);
+    }
+
+}
+
+/**
+ * Applies any pending commands and services each track of the connection,
+ * reading and sending frames as they become due.
+ *
+ * @param sender
+ *     The sender streaming the connection.
+ *
+ * @return
+ *     The time at which the next frame of any track is due or a rate shaper
+ *     will permit buffered data to be sent (whichever is sooner), or
+ *     STREAMTEST_TASK_WAIT if playback is paused or complete.
+ */
+static int64_t streamtest_sender_pass(streamtest_sender* sender) {
+
+    guac_client* client = sender->client;
+    streamtest_state* state = (streamtest_state*) client->data;
+
+    /* Render initial progress bars, flushing them together with the first
+     * frame of each track rather than separately */
+    if (!sender->started) {
+
+        streamtest_render_all_progress(client);
+
+        int64_t now = streamtest_utime();
+        for (int i = 0; i < state->track_count; i++)
+            state->tracks[i]->next_frame = now;
+
+        sender->next_report = now + STREAMTEST_STATS_INTERVAL;
+        sender->started = true;
+
+    }
+
+    /* Apply pending commands, redrawing if anything has changed */
+    bool was_paused = state->paused;
+    if (streamtest_apply_commands(client)) {
+
+        /* Resume pacing from the current time if unpaused */
+        if (was_paused && !state->paused) {
+            int64_t now = streamtest_utime();
+            for (int i = 0; i < state->track_count; i++)
+                state->tracks[i]->next_frame = now;
+        }
+
+        streamtest_render_all_progress(client);
+        streamtest_end_frame(client);
+
+    }
+
+    /* Nothing further to do until unpaused */
+    if (state->paused || client->state != GUAC_CLIENT_RUNNING)
+        return STREAMTEST_TASK_WAIT;
+
+    /* Measure any syncs acknowledged since the previous pass */
+    streamtest_latency_update(&state->latency,
+            client->last_received_timestamp, streamtest_utime());
+
+    /* Service each track which has data remaining, waking for whichever
+     * is next due */
+    int64_t next_wake = sender->next_report;
+    bool complete = true;
+    bool sent = false;
+    for (int i = 0; i < state->track_count; i++) {
+
+        streamtest_track* track = state->tracks[i];
+        if (streamtest_track_complete(track))
+            continue;
+
+        int64_t track_wake = streamtest_service_track(client, sender,
+                track, &sent);
+        if (track_wake != STREAMTEST_TASK_WAIT && track_wake < next_wake)
+            next_wake = track_wake;
+
+        if (!streamtest_track_complete(track))
+            complete = false;
+
+    }
+
+    /* Abort if any track failed, preserving the events leading up to the
+     * failure */
+    if (client->state != GUAC_CLIENT_RUNNING) {
+        streamtest_dump_events(client, "streaming failed");
+        return STREAMTEST_TASK_WAIT;
+    }
+
+    /* All tracks share one sync per pass, with syncs sent periodically
+     * regardless such that latency is measured even while idle */
+    int64_t probe = state->latency.last_sent + STREAMTEST_PROBE_INTERVAL;
+    if (sent || streamtest_utime() >= probe) {
+        streamtest_end_frame(client);
+        probe = state->latency.last_sent + STREAMTEST_PROBE_INTERVAL;
+    }
+
+    /* Disconnect once all data has been sent */
+    if (complete) {
+        guac_client_log(client, GUAC_LOG_INFO, "Media streaming complete");
+        guac_client_stop(client);
+        return STREAMTEST_TASK_WAIT;
+    }
+
+    /* Monitor drift between tracks, if requested */
+    if (state->sync_tolerance > 0)
+        streamtest_check_sync(client);
+
+    if (probe < next_wake)
+        next_wake = probe;
+
+    /* Report stats periodically, also taking over the export of metrics
+     * if the process which was exporting them has stopped */
+    if (streamtest_utime() >= sender->next_report) {
+        streamtest_stats_log(client);
+        streamtest_metrics_retry();
+        sender->next_report += STREAMTEST_STATS_INTERVAL;
+        if (sender->next_report < next_wake)
+            next_wake = sender->next_report;
+    }
+
+    return next_wake;
+
+}
+
+/**
+ * Scheduler callback which performs a single pass of the sender, recording
+ * when the sender wakes and sleeps within the event log of the connection
+ * (if any).
+ *
+ * @param task
+ *     The task associated with the sender.
+ *
+ * @param data
+ *     The streamtest_sender associated with the task.
+ *
+ * @return
+ *     The time at which the sender should next be woken, or
+ *     STREAMTEST_TASK_WAIT if the sender need not be woken until notified.
+ */
+static int64_t streamtest_sender_callback(streamtest_task* task, void* data) {
+
+    streamtest_sender* sender = (streamtest_sender*) data;
+    guac_client* client = sender->client;
+    streamtest_state* state = (streamtest_state*) client->data;
+    streamtest_events* events = state->events;
+
+    /* Lateness applies only if woken by the requested deadline */
+    int64_t now = streamtest_utime();
+    int64_t late = -1;
+    if (sender->wake_at != STREAMTEST_TASK_WAIT && now >= sender->wake_at)
+        late = (now - sender->wake_at) * 1000;
+
+    streamtest_events_record(events, STREAMTEST_EVENT_SLEEP_END,
+            STREAMTEST_EVENTS_NO_TRACK, late);
+
+    /* Signals cannot wake the sender, thus requested dumps are written at
+     * the next pass */
+    if (events != NULL && streamtest_events_dump_requested(events))
+        streamtest_dump_events(client, "requested via signal");
+
+    int64_t next_wake = streamtest_sender_pass(sender);
+
+    /* Detect sustained backpressure from the socket */
+    streamtest_backpressure* backpressure = &state->backpressure;
+    if (streamtest_backpressure_update(backpressure, streamtest_utime())) {
+        if (backpressure->congested)
+            guac_client_log(client, GUAC_LOG_DEBUG, "Socket is congested "
+                    "(averaging %lli microseconds blocked per pass)",
+                    (long long) backpressure->average);
+        else
+            guac_client_log(client, GUAC_LOG_DEBUG, "Socket is no longer "
+                    "congested");
+    }
+
+    int64_t duration = -1;
+    if (next_wake != STREAMTEST_TASK_WAIT) {
+        duration = (next_wake - streamtest_utime()) * 1000;
+        if (duration < 0)
+            duration = 0;
+    }
+
+    streamtest_events_record(events, STREAMTEST_EVENT_SLEEP_START,
+            STREAMTEST_EVENTS_NO_TRACK, duration);
+
+    sender->wake_at = next_wake;
+    return next_wake;
+
+}
+
+/**
+ * Frees the watches of all tracks of the given connection, such that their
+ * sources no longer wake the sender.
+ *
+ * @param state
+ *     The playback state of the connection being streamed.
+ */
+static void streamtest_free_watches(streamtest_state* state) {
+
+    for (int i = 0; i < state->track_count; i++) {
+        streamtest_track* track = state->tracks[i];
+        if (track->watch != NULL) {
+            streamtest_watch_free(track->watch);
+            track->watch = NULL;
+        }
+    }
+
+}
+
+streamtest_sender* streamtest_sender_alloc(guac_client* client) {
+
+    streamtest_sender* sender = malloc(sizeof(streamtest_sender));
+    sender->client = client;
+    sender->started = false;
+    sender->next_report = 0;
+    sender->wake_at = STREAMTEST_TASK_WAIT;
+
+    /* Register with process-wide scheduler */
+    sender->task = streamtest_task_alloc(streamtest_sender_callback, sender);
+    if (sender->task == NULL) {
+        free(sender);
+        return NULL;
+    }
+
+    /* Wake when a followed file is modified or data arrives from a
+     * non-seekable source (regular files are always readable) */
+    streamtest_state* state = (streamtest_state*) client->data;
+    for (int i = 0; i < state->track_count; i++) {
+
+        streamtest_track* track = state->tracks[i];
+
+        int watch_fd = -1;
+        if (track->follow != NULL)
+            watch_fd = track->follow->fd;
+        else if (!track->source->seekable)
+            watch_fd = track->source->fd;
+
+        track->watch = NULL;
+        if (watch_fd == -1)
+            continue;
+
+        track->watch = streamtest_watch_alloc(sender->task, watch_fd);
+        if (track->watch == NULL) {
+            streamtest_free_watches(state);
+            streamtest_task_free(sender->task);
+            free(sender);
+            return NULL;
+        }
+
+    }
+
+    /* Start streaming */
+    streamtest_task_wake(sender->task);
+    return sender;
+
+}
+
+void streamtest_sender_notify(streamtest_sender* sender) {
+    streamtest_task_wake(sender->task);
+}
+
+void streamtest_sender_free(streamtest_sender* sender) {
+
+    /* Wait for any in-progress frame and stop scheduling further frames */
+    streamtest_task_cancel(sender->task);
+
+    /* Sources may now safely stop waking the sender */
+    streamtest_state* state = (streamtest_state*) sender->client->data;
+    streamtest_free_watches(state);
+    streamtest_task_free(sender->task);
+
+    /* Report final stats */
+    streamtest_stats_log(sender->client);
+
+    free(sender);
+
+}
+
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef STREAMTEST_SENDER_H
+#define STREAMTEST_SENDER_H
+
+#include "config.h"
+#include "scheduler.h"
+
+#include <guacamole/client.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * The distance to seek forward or backward when the right or left arrow keys
+ * are pressed, in microseconds of media time.
+ */
+#define STREAMTEST_SEEK_USECS 5000000
+
+/**
+ * The maximum number of times the playback rate may be doubled or halved
+ * relative to the requested frame duration.
+ */
+#define STREAMTEST_MAX_RATE 3
+
+/**
+ * Streams all tracks of a libguac-client-streamtest connection. Each frame
+ * of each track is scheduled against an absolute deadline by the
+ * process-wide scheduler, independent of guacd's message handling loop, such
+ * that input handling never waits on output pacing and vice versa. All
+ * tracks of a connection share a single scheduler task, and thus never
+ * write to the connection's socket concurrently.
+ */
+typedef struct streamtest_sender {
+
+    /**
+     * The guac_client associated with the connection being streamed.
+     */
+    guac_client* client;
+
+    /**
+     * The scheduler task which streams each frame when due.
+     */
+    streamtest_task* task;
+
+    /**
+     * Whether the initial state of the display has been sent.
+     */
+    bool started;
+
+    /**
+     * The time at which the next periodic statistics report is due, as
+     * returned by streamtest_utime().
+     */
+    int64_t next_report;
+
+    /**
+     * The time at which the sender most recently requested to be woken, as
+     * returned by streamtest_utime(), or STREAMTEST_TASK_WAIT if the sender
+     * requested to sleep until notified.
+     */
+    int64_t wake_at;
+
+} streamtest_sender;
+
+/**
+ * Allocates a new streamtest_sender and schedules the first frame of each
+ * track. The given
+ * guac_client MUST have its data set to a fully-initialized streamtest_state.
+ *
+ * @param client
+ *     The guac_client associated with the connection to be streamed.
+ *
+ * @return
+ *     A newly-allocated streamtest_sender, or NULL if the process-wide
+ *     scheduler or poller could not be started.
+ */
+streamtest_sender* streamtest_sender_alloc(guac_client* client);
+
+/**
+ * Wakes the given sender such that any newly-queued commands are applied
+ * immediately, rather than when the next frame is due. This function should
+ * be called after each command is added to the command queue of the
+ * associated streamtest_state.
+ *
+ * @param sender
+ *     The sender to wake.
+ */
+void streamtest_sender_notify(streamtest_sender* sender);
+
+/**
+ * Stops the given sender, waiting for any in-progress frame to complete, and
+ * frees all associated resources. The guac_client and streamtest_state
+ * associated with the sender are not freed.
+ *
+ * @param sender
+ *     The sender to stop and free.
+ */
+void streamtest_sender_free(streamtest_sender* sender);
+
+#endif
+
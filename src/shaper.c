@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+#include "shaper.h"
+
+#include <stdint.h>
+
+void streamtest_shaper_init(streamtest_shaper* shaper, int bitrate,
+        int depth, int quantum, int64_t now) {
+
+    shaper->bitrate = bitrate;
+    shaper->depth = depth;
+    shaper->quantum = quantum;
+    shaper->credits = depth * STREAMTEST_SHAPER_CREDITS_PER_BYTE;
+    shaper->last_update = now;
+    shaper->deferrals = 0;
+
+}
+
+int streamtest_shaper_available(streamtest_shaper* shaper, int64_t now) {
+
+    int64_t max_credits = shaper->depth * STREAMTEST_SHAPER_CREDITS_PER_BYTE;
+
+    /* Tokens accumulate at bitrate credits per microsecond */
+    if (now > shaper->last_update) {
+        shaper->credits += (now - shaper->last_update) * shaper->bitrate;
+        shaper->last_update = now;
+    }
+
+    /* Excess tokens overflow the bucket */
+    if (shaper->credits > max_credits)
+        shaper->credits = max_credits;
+
+    return shaper->credits / STREAMTEST_SHAPER_CREDITS_PER_BYTE;
+
+}
+
+void streamtest_shaper_consume(streamtest_shaper* shaper, int length) {
+    shaper->credits -= length * STREAMTEST_SHAPER_CREDITS_PER_BYTE;
+}
+
+int64_t streamtest_shaper_ready_at(streamtest_shaper* shaper, int length) {
+
+    int64_t needed = length * STREAMTEST_SHAPER_CREDITS_PER_BYTE
+        - shaper->credits;
+
+    /* Already available */
+    if (needed <= 0)
+        return shaper->last_update;
+
+    /* Round up such that the tokens are guaranteed present */
+    return shaper->last_update
+        + (needed + shaper->bitrate - 1) / shaper->bitrate;
+
+}
+
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef STREAMTEST_SHAPER_H
+#define STREAMTEST_SHAPER_H
+
+#include "config.h"
+
+#include <stdint.h>
+
+/**
+ * The number of token bucket credits which correspond to a single byte.
+ * Credits are tracked in millionths of a bit such that a bitrate expressed in
+ * bits per second is exactly the number of credits gained per microsecond.
+ */
+#define STREAMTEST_SHAPER_CREDITS_PER_BYTE INT64_C(8000000)
+
+/**
+ * A token bucket rate shaper. Data may only be sent when the bucket contains
+ * enough tokens, with tokens accumulating at a sustained rate up to a fixed
+ * depth. Bursts of up to the bucket depth are thus permitted after periods of
+ * inactivity, while the long-term rate never exceeds the sustained rate.
+ */
+typedef struct streamtest_shaper {
+
+    /**
+     * The sustained rate at which tokens accumulate, in bits per second.
+     */
+    int bitrate;
+
+    /**
+     * The maximum number of bytes worth of tokens which the bucket may hold.
+     */
+    int depth;
+
+    /**
+     * The minimum number of bytes which may be sent at once, unless the
+     * remaining data is smaller.
+     */
+    int quantum;
+
+    /**
+     * The number of tokens currently within the bucket, in credits (see
+     * STREAMTEST_SHAPER_CREDITS_PER_BYTE).
+     */
+    int64_t credits;
+
+    /**
+     * The time at which tokens were last added to the bucket, as returned by
+     * streamtest_utime().
+     */
+    int64_t last_update;
+
+    /**
+     * The total number of times a send was deferred because the bucket did
+     * not contain enough tokens.
+     */
+    uint64_t deferrals;
+
+} streamtest_shaper;
+
+/**
+ * Initializes the given shaper with a full bucket.
+ *
+ * @param shaper
+ *     The shaper to initialize.
+ *
+ * @param bitrate
+ *     The sustained rate at which tokens accumulate, in bits per second.
+ *
+ * @param depth
+ *     The maximum number of bytes worth of tokens the bucket may hold.
+ *
+ * @param quantum
+ *     The minimum number of bytes which may be sent at once.
+ *
+ * @param now
+ *     The current time, as returned by streamtest_utime().
+ */
+void streamtest_shaper_init(streamtest_shaper* shaper, int bitrate,
+        int depth, int quantum, int64_t now);
+
+/**
+ * Adds any tokens accumulated since the last update and returns the number
+ * of whole bytes which may currently be sent.
+ *
+ * @param shaper
+ *     The shaper to update.
+ *
+ * @param now
+ *     The current time, as returned by streamtest_utime().
+ *
+ * @return
+ *     The number of bytes which may currently be sent.
+ */
+int streamtest_shaper_available(streamtest_shaper* shaper, int64_t now);
+
+/**
+ * Removes tokens for the given number of bytes from the bucket. The caller
+ * must have verified that enough tokens are available.
+ *
+ * @param shaper
+ *     The shaper to remove tokens from.
+ *
+ * @param length
+ *     The number of bytes being sent.
+ */
+void streamtest_shaper_consume(streamtest_shaper* shaper, int length);
+
+/**
+ * Returns the time at which the bucket will contain enough tokens to send
+ * the given number of bytes. The given number of bytes MUST NOT exceed the
+ * bucket depth.
+ *
+ * @param shaper
+ *     The shaper to examine.
+ *
+ * @param length
+ *     The number of bytes which will be sent.
+ *
+ * @return
+ *     The time at which the given number of bytes may be sent, as returned
+ *     by streamtest_utime().
+ */
+int64_t streamtest_shaper_ready_at(streamtest_shaper* shaper, int length);
+
+#endif
+
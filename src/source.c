@@ -0,0 +1,1864 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+#include "chunks.h"
+#include "mixer.h"
+#include "source.h"
+#include "store.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+extern char** environ;
+
+/**
+ * Connects to the UNIX domain socket at the given path.
+ *
+ * @param path
+ *     The path of the socket to connect to.
+ *
+ * @return
+ *     The file descriptor of the connected socket, or -1 if the connection
+ *     fails, in which case errno is set appropriately.
+ */
+static int streamtest_source_connect(const char* path) {
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+    /* Path must fit within address, including null terminator */
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1)
+        return -1;
+
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr))) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return -1;
+    }
+
+    return fd;
+
+}
+
+/**
+ * Spawns the given program, returning the read end of a pipe attached to
+ * its standard output. The standard input of the program is /dev/null.
+ *
+ * @param path
+ *     The path of the program to spawn.
+ *
+ * @param argv
+ *     The NULL-terminated arguments of the program, beginning with its name.
+ *
+ * @param pid
+ *     Storage for the process ID of the spawned child.
+ *
+ * @return
+ *     The file descriptor of the read end of the pipe, or -1 if the command
+ *     cannot be spawned, in which case errno is set appropriately.
+ */
+static int streamtest_source_spawn(const char* path, char* const argv[],
+        pid_t* pid) {
+
+    int pipe_fd[2];
+    if (pipe(pipe_fd))
+        return -1;
+
+    /* Our end of the pipe must not leak into the child */
+    fcntl(pipe_fd[0], F_SETFD, FD_CLOEXEC);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null",
+            O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, pipe_fd[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&actions, pipe_fd[1]);
+
+    int result = posix_spawn(pid, path, &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+
+    /* The write end belongs solely to the child */
+    close(pipe_fd[1]);
+
+    if (result != 0) {
+        close(pipe_fd[0]);
+        errno = result;
+        return -1;
+    }
+
+    return pipe_fd[0];
+
+}
+
+/**
+ * The state of a source whose data are produced by a child process.
+ */
+typedef struct streamtest_source_process {
+
+    /**
+     * The process ID of the child process producing data.
+     */
+    pid_t pid;
+
+} streamtest_source_process;
+
+/**
+ * Allocates the state of a source whose data are produced by the child
+ * process having the given process ID.
+ *
+ * @param pid
+ *     The process ID of the child process.
+ *
+ * @return
+ *     A newly-allocated streamtest_source_process.
+ */
+static streamtest_source_process* streamtest_source_process_alloc(pid_t pid) {
+
+    streamtest_source_process* process =
+        malloc(sizeof(streamtest_source_process));
+    process->pid = pid;
+    return process;
+
+}
+
+/**
+ * The state of a directory, whose regular files are read one after another
+ * as if concatenated.
+ */
+typedef struct streamtest_source_directory {
+
+    /**
+     * The paths of all regular files within the directory, in order. The
+     * file descriptor of the source is that of the current file.
+     */
+    char** files;
+
+    /**
+     * The number of files within the directory.
+     */
+    int file_count;
+
+    /**
+     * The index of the current file within the directory.
+     */
+    int file_index;
+
+    /**
+     * The offset of the start of each file within the concatenation of all
+     * files, followed by the total size of all files.
+     */
+    off_t* file_offsets;
+
+} streamtest_source_directory;
+
+/**
+ * Filter for scandir() which excludes hidden entries, including "." and
+ * "..".
+ *
+ * @param entry
+ *     The directory entry to test.
+ *
+ * @return
+ *     Non-zero if the entry should be listed, zero otherwise.
+ */
+static int streamtest_source_visible(const struct dirent* entry) {
+    return entry->d_name[0] != '.';
+}
+
+/**
+ * Lists the regular files within the given directory in order of name.
+ *
+ * @param path
+ *     The path of the directory.
+ *
+ * @return
+ *     A newly-allocated streamtest_source_directory listing the paths and
+ *     offsets of all regular files within the directory, none of which are
+ *     yet open, or NULL if the directory cannot be read or contains no
+ *     regular files, in which case errno is set appropriately.
+ */
+static streamtest_source_directory* streamtest_source_list(const char* path) {
+
+    struct dirent** entries;
+    int count = scandir(path, &entries, streamtest_source_visible,
+            alphasort);
+    if (count == -1)
+        return NULL;
+
+    streamtest_source_directory* directory =
+        malloc(sizeof(streamtest_source_directory));
+    directory->files = malloc(sizeof(char*) * (count + 1));
+    directory->file_offsets = malloc(sizeof(off_t) * (count + 1));
+    directory->file_count = 0;
+    directory->file_index = 0;
+
+    off_t total = 0;
+    for (int i = 0; i < count; i++) {
+
+        char* file = malloc(strlen(path) + strlen(entries[i]->d_name) + 2);
+        sprintf(file, "%s/%s", path, entries[i]->d_name);
+        free(entries[i]);
+
+        /* Only regular files have content */
+        struct stat stat_buf;
+        if (stat(file, &stat_buf) || !S_ISREG(stat_buf.st_mode)) {
+            free(file);
+            continue;
+        }
+
+        directory->files[directory->file_count] = file;
+        directory->file_offsets[directory->file_count++] = total;
+        total += stat_buf.st_size;
+
+    }
+
+    free(entries);
+    directory->file_offsets[directory->file_count] = total;
+
+    /* An empty directory cannot be streamed */
+    if (directory->file_count == 0) {
+        free(directory->files);
+        free(directory->file_offsets);
+        free(directory);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return directory;
+
+}
+
+/**
+ * Makes the file having the given index the current file of the given
+ * directory source, closing the previous file.
+ *
+ * @param source
+ *     The directory source whose current file should change.
+ *
+ * @param index
+ *     The index of the file to open.
+ *
+ * @return
+ *     Zero on success, non-zero if the file cannot be opened, in which case
+ *     errno is set appropriately.
+ */
+static int streamtest_source_select(streamtest_source* source, int index) {
+
+    streamtest_source_directory* directory = source->data;
+
+    int fd = open(directory->files[index], O_RDONLY);
+    if (fd == -1)
+        return 1;
+
+    close(source->fd);
+    source->fd = fd;
+    directory->file_index = index;
+    return 0;
+
+}
+
+/**
+ * Returns the size of the file having the file descriptor of the given
+ * source.
+ *
+ * @param source
+ *     The source whose size should be returned.
+ *
+ * @return
+ *     The size of the file in bytes, or -1 if its size cannot be determined.
+ */
+static int streamtest_source_stat_size(streamtest_source* source) {
+
+    struct stat stat_buf;
+    if (fstat(source->fd, &stat_buf))
+        return -1;
+
+    return stat_buf.st_size;
+
+}
+
+/**
+ * Hints that the given number of bytes following the current offset of the
+ * file descriptor of the given source will be read soon.
+ *
+ * @param source
+ *     The source which will be read soon.
+ *
+ * @param length
+ *     The number of bytes which will be read soon.
+ */
+static void streamtest_source_fd_prefetch(streamtest_source* source,
+        int length) {
+
+    /* Hint is purely advisory, thus failure is irrelevant */
+    posix_fadvise(source->fd, lseek(source->fd, 0, SEEK_CUR), length,
+            POSIX_FADV_WILLNEED);
+
+}
+
+/**
+ * Closes the file descriptor of the given source.
+ *
+ * @param source
+ *     The source to close.
+ */
+static void streamtest_source_fd_close(streamtest_source* source) {
+    close(source->fd);
+}
+
+/**
+ * The state of a regular file read through the "mmap" or "synthetic"
+ * backends, neither of which moves the offset of the file descriptor.
+ */
+typedef struct streamtest_source_mapping {
+
+    /**
+     * The mapping of the regular file, or NULL if the file is empty or is
+     * read through the "synthetic" backend.
+     */
+    const unsigned char* map;
+
+    /**
+     * The size of the regular file when last checked (and thus the size of
+     * the mapping, if any).
+     */
+    off_t size;
+
+    /**
+     * The number of bytes preceding the next byte to be read.
+     */
+    off_t position;
+
+} streamtest_source_mapping;
+
+/**
+ * Returns the position of the given source which is read through the
+ * "mmap" or "synthetic" backends.
+ *
+ * @param source
+ *     The source whose position should be returned.
+ *
+ * @return
+ *     The number of bytes preceding the next byte to be read.
+ */
+static off_t streamtest_source_mapping_tell(streamtest_source* source) {
+    streamtest_source_mapping* mapping = source->data;
+    return mapping->position;
+}
+
+/**
+ * Moves the given source which is read through the "mmap" or "synthetic"
+ * backends.
+ *
+ * @param source
+ *     The source to seek within.
+ *
+ * @param position
+ *     The number of bytes from the start of the source.
+ *
+ * @return
+ *     Always zero.
+ */
+static int streamtest_source_mapping_seek(streamtest_source* source,
+        off_t position) {
+    streamtest_source_mapping* mapping = source->data;
+    mapping->position = position;
+    return 0;
+}
+
+/**
+ * Reads from a regular file with read() until the buffer is full or
+ * end-of-file is reached.
+ */
+static int streamtest_source_file_read(streamtest_source* source,
+        unsigned char* buffer, int length) {
+
+    int bytes_read = 0;
+    source->eof = false;
+
+    /* Continue reading until buffer is full */
+    while (length > 0) {
+
+        int result = read(source->fd, buffer, length);
+        if (result == -1)
+            return -1;
+
+        if (result == 0) {
+            source->eof = true;
+            break;
+        }
+
+        bytes_read += result;
+        buffer += result;
+        length -= result;
+
+    }
+
+    return bytes_read;
+
+}
+
+/**
+ * Returns the offset of the file descriptor of a regular file.
+ */
+static off_t streamtest_source_file_tell(streamtest_source* source) {
+    return lseek(source->fd, 0, SEEK_CUR);
+}
+
+/**
+ * Moves the offset of the file descriptor of a regular file.
+ */
+static int streamtest_source_file_seek(streamtest_source* source,
+        off_t position) {
+    return lseek(source->fd, position, SEEK_SET) == -1;
+}
+
+/**
+ * Regular files read with read(), the default.
+ */
+static const streamtest_source_backend streamtest_source_file_backend = {
+    .name     = "read",
+    .open     = NULL,
+    .read     = streamtest_source_file_read,
+    .peek     = NULL,
+    .tell     = streamtest_source_file_tell,
+    .size     = streamtest_source_stat_size,
+    .seek     = streamtest_source_file_seek,
+    .prefetch = streamtest_source_fd_prefetch,
+    .close    = streamtest_source_fd_close
+};
+
+/**
+ * Maps the regular file of the given source again if its size has changed,
+ * such that data appended to a followed file becomes visible. Files must
+ * not be truncated while mapped.
+ *
+ * @param source
+ *     The source whose mapping should be refreshed.
+ *
+ * @return
+ *     Zero on success, non-zero if the file cannot be mapped, in which case
+ *     errno is set appropriately.
+ */
+static int streamtest_source_mmap_refresh(streamtest_source* source) {
+
+    streamtest_source_mapping* mapping = source->data;
+
+    struct stat stat_buf;
+    if (fstat(source->fd, &stat_buf))
+        return 1;
+
+    if (stat_buf.st_size == mapping->size)
+        return 0;
+
+    /* Empty files cannot be mapped, and have no data anyway */
+    void* map = NULL;
+    if (stat_buf.st_size > 0) {
+
+        map = mmap(NULL, stat_buf.st_size, PROT_READ, MAP_SHARED,
+                source->fd, 0);
+        if (map == MAP_FAILED)
+            return 1;
+
+        posix_madvise(map, stat_buf.st_size, POSIX_MADV_SEQUENTIAL);
+
+    }
+
+    if (mapping->map != NULL)
+        munmap((void*) mapping->map, mapping->size);
+
+    mapping->map = map;
+    mapping->size = stat_buf.st_size;
+    return 0;
+
+}
+
+/**
+ * Maps the regular file of a newly-opened source.
+ */
+static int streamtest_source_mmap_open(streamtest_source* source,
+        const char* path) {
+    source->data = calloc(1, sizeof(streamtest_source_mapping));
+    return streamtest_source_mmap_refresh(source);
+}
+
+/**
+ * Lends data directly from the mapping of a regular file.
+ */
+static int streamtest_source_mmap_peek(streamtest_source* source,
+        const unsigned char** data, int length) {
+
+    streamtest_source_mapping* mapping = source->data;
+
+    /* Check for appended data only once the mapping is exhausted */
+    if (mapping->position + length > mapping->size
+            && streamtest_source_mmap_refresh(source))
+        return 0;
+
+    off_t remaining = mapping->size - mapping->position;
+    if (remaining <= 0)
+        return 0;
+
+    if (length > remaining)
+        length = remaining;
+
+    *data = mapping->map + mapping->position;
+    return length;
+
+}
+
+/**
+ * Copies data from the mapping of a regular file.
+ */
+static int streamtest_source_mmap_read(streamtest_source* source,
+        unsigned char* buffer, int length) {
+
+    streamtest_source_mapping* mapping = source->data;
+
+    if (mapping->position + length > mapping->size
+            && streamtest_source_mmap_refresh(source))
+        return -1;
+
+    off_t remaining = mapping->size - mapping->position;
+    if (remaining < 0)
+        remaining = 0;
+
+    /* As with read(), the end is reached only by reading past it */
+    source->eof = length > remaining;
+    if (source->eof)
+        length = remaining;
+
+    memcpy(buffer, mapping->map + mapping->position, length);
+    mapping->position += length;
+    return length;
+
+}
+
+/**
+ * Hints that part of the mapping of a regular file will be read soon.
+ */
+static void streamtest_source_mmap_prefetch(streamtest_source* source,
+        int length) {
+
+    streamtest_source_mapping* mapping = source->data;
+    if (mapping->map == NULL || mapping->position >= mapping->size)
+        return;
+
+    /* Advice must begin at a page boundary */
+    off_t page = sysconf(_SC_PAGESIZE);
+    off_t start = mapping->position - mapping->position % page;
+    off_t end = mapping->position + length;
+    if (end > mapping->size)
+        end = mapping->size;
+
+    posix_madvise((void*) (mapping->map + start), end - start,
+            POSIX_MADV_WILLNEED);
+
+}
+
+/**
+ * Unmaps and closes a mapped regular file.
+ */
+static void streamtest_source_mmap_close(streamtest_source* source) {
+
+    streamtest_source_mapping* mapping = source->data;
+    if (mapping->map != NULL)
+        munmap((void*) mapping->map, mapping->size);
+
+    free(mapping);
+    close(source->fd);
+
+}
+
+/**
+ * Regular files mapped into memory, whose whole frames are sent directly
+ * from the mapping.
+ */
+static const streamtest_source_backend streamtest_source_mmap_backend = {
+    .name     = "mmap",
+    .open     = streamtest_source_mmap_open,
+    .read     = streamtest_source_mmap_read,
+    .peek     = streamtest_source_mmap_peek,
+    .tell     = streamtest_source_mapping_tell,
+    .size     = streamtest_source_stat_size,
+    .seek     = streamtest_source_mapping_seek,
+    .prefetch = streamtest_source_mmap_prefetch,
+    .close    = streamtest_source_mmap_close
+};
+
+#ifdef HAVE_LIBURING
+
+/**
+ * The state of a regular file read through an io_uring. After each read,
+ * the same number of bytes following it are read ahead, such that the next
+ * read is usually satisfied without waiting.
+ */
+typedef struct streamtest_source_uring {
+
+    /**
+     * The io_uring through which all reads are submitted.
+     */
+    struct io_uring ring;
+
+    /**
+     * The buffer receiving data read ahead.
+     */
+    unsigned char* ahead;
+
+    /**
+     * The size of the ahead buffer, in bytes.
+     */
+    int ahead_size;
+
+    /**
+     * The position within the file of the data read ahead.
+     */
+    off_t ahead_offset;
+
+    /**
+     * The number of bytes read ahead, once the read has completed.
+     */
+    int ahead_length;
+
+    /**
+     * Whether a read ahead has been submitted but not yet completed.
+     */
+    bool ahead_pending;
+
+    /**
+     * The number of bytes preceding the next byte to be read. Reads through
+     * the io_uring do not move the offset of the file descriptor.
+     */
+    off_t position;
+
+} streamtest_source_uring;
+
+/**
+ * Submits a read of the given regular file to the given io_uring.
+ *
+ * @param uring
+ *     The io_uring state of the source being read.
+ *
+ * @param fd
+ *     The file descriptor of the file to read.
+ *
+ * @param buffer
+ *     The buffer into which data should be read.
+ *
+ * @param length
+ *     The number of bytes to read.
+ *
+ * @param offset
+ *     The position within the file at which to begin reading.
+ *
+ * @return
+ *     Zero on success, non-zero if the read cannot be submitted, in which
+ *     case errno is set appropriately.
+ */
+static int streamtest_source_uring_submit(streamtest_source_uring* uring,
+        int fd, unsigned char* buffer, int length, off_t offset) {
+
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&uring->ring);
+    if (sqe == NULL) {
+        errno = EBUSY;
+        return 1;
+    }
+
+    io_uring_prep_read(sqe, fd, buffer, length, offset);
+
+    int result = io_uring_submit(&uring->ring);
+    if (result < 0) {
+        errno = -result;
+        return 1;
+    }
+
+    return 0;
+
+}
+
+/**
+ * Waits for the oldest read submitted to the given io_uring to complete.
+ *
+ * @param uring
+ *     The io_uring state of the source being read.
+ *
+ * @return
+ *     The number of bytes read, or -1 if the read failed, in which case
+ *     errno is set appropriately.
+ */
+static int streamtest_source_uring_wait(streamtest_source_uring* uring) {
+
+    struct io_uring_cqe* cqe;
+    int result;
+    while ((result = io_uring_wait_cqe(&uring->ring, &cqe)) == -EINTR);
+
+    if (result < 0) {
+        errno = -result;
+        return -1;
+    }
+
+    result = cqe->res;
+    io_uring_cqe_seen(&uring->ring, cqe);
+
+    if (result < 0) {
+        errno = -result;
+        return -1;
+    }
+
+    return result;
+
+}
+
+/**
+ * Prepares a newly-opened regular file for reading through an io_uring.
+ */
+static int streamtest_source_uring_open(streamtest_source* source,
+        const char* path) {
+
+    streamtest_source_uring* uring = calloc(1,
+            sizeof(streamtest_source_uring));
+
+    int result = io_uring_queue_init(STREAMTEST_SOURCE_URING_DEPTH,
+            &uring->ring, 0);
+    if (result < 0) {
+        free(uring);
+        errno = -result;
+        return 1;
+    }
+
+    source->data = uring;
+    return 0;
+
+}
+
+/**
+ * Reads a regular file through an io_uring, using any data already read
+ * ahead and then reading ahead again.
+ */
+static int streamtest_source_uring_read(streamtest_source* source,
+        unsigned char* buffer, int length) {
+
+    streamtest_source_uring* uring = source->data;
+    int bytes_read = 0;
+    source->eof = false;
+
+    /* Collect the previous read ahead, whose failure is instead reported by
+     * reading the same data again below */
+    if (uring->ahead_pending) {
+        uring->ahead_length = streamtest_source_uring_wait(uring);
+        uring->ahead_pending = false;
+        if (uring->ahead_length < 0)
+            uring->ahead_length = 0;
+    }
+
+    /* Use whatever was read ahead of the current position */
+    off_t skip = uring->position - uring->ahead_offset;
+    if (skip >= 0 && skip < uring->ahead_length) {
+
+        int available = uring->ahead_length - skip;
+        if (available > length)
+            available = length;
+
+        memcpy(buffer, uring->ahead + skip, available);
+        bytes_read = available;
+        uring->position += available;
+
+    }
+
+    /* Read the remainder directly */
+    while (bytes_read < length) {
+
+        if (streamtest_source_uring_submit(uring, source->fd,
+                    buffer + bytes_read, length - bytes_read,
+                    uring->position))
+            return -1;
+
+        int result = streamtest_source_uring_wait(uring);
+        if (result == -1)
+            return -1;
+
+        if (result == 0) {
+            source->eof = true;
+            break;
+        }
+
+        bytes_read += result;
+        uring->position += result;
+
+    }
+
+    /* Read the next frame while this frame is sent */
+    uring->ahead_length = 0;
+    if (!source->eof) {
+
+        if (uring->ahead_size < length) {
+            uring->ahead_size = length;
+            uring->ahead = realloc(uring->ahead, length);
+        }
+
+        /* Reading ahead is an optimization, thus failure is irrelevant */
+        if (!streamtest_source_uring_submit(uring, source->fd, uring->ahead,
+                    length, uring->position)) {
+            uring->ahead_offset = uring->position;
+            uring->ahead_pending = true;
+        }
+
+    }
+
+    return bytes_read;
+
+}
+
+/**
+ * Returns the position of a regular file read through an io_uring.
+ */
+static off_t streamtest_source_uring_tell(streamtest_source* source) {
+    streamtest_source_uring* uring = source->data;
+    return uring->position;
+}
+
+/**
+ * Moves the position of a regular file read through an io_uring. Data
+ * already read ahead are used only if they begin at the new position.
+ */
+static int streamtest_source_uring_seek(streamtest_source* source,
+        off_t position) {
+    streamtest_source_uring* uring = source->data;
+    uring->position = position;
+    return 0;
+}
+
+/**
+ * Hints that part of a regular file read through an io_uring will be read
+ * soon.
+ */
+static void streamtest_source_uring_prefetch(streamtest_source* source,
+        int length) {
+    streamtest_source_uring* uring = source->data;
+    posix_fadvise(source->fd, uring->position, length, POSIX_FADV_WILLNEED);
+}
+
+/**
+ * Waits for any read ahead, then frees the io_uring of a regular file and
+ * closes the file.
+ */
+static void streamtest_source_uring_close(streamtest_source* source) {
+
+    streamtest_source_uring* uring = source->data;
+    if (uring != NULL) {
+
+        if (uring->ahead_pending)
+            streamtest_source_uring_wait(uring);
+
+        io_uring_queue_exit(&uring->ring);
+        free(uring->ahead);
+        free(uring);
+
+    }
+
+    close(source->fd);
+
+}
+
+/**
+ * Regular files read through an io_uring, one frame ahead.
+ */
+static const streamtest_source_backend streamtest_source_uring_backend = {
+    .name     = "io_uring",
+    .open     = streamtest_source_uring_open,
+    .read     = streamtest_source_uring_read,
+    .peek     = NULL,
+    .tell     = streamtest_source_uring_tell,
+    .size     = streamtest_source_stat_size,
+    .seek     = streamtest_source_uring_seek,
+    .prefetch = streamtest_source_uring_prefetch,
+    .close    = streamtest_source_uring_close
+};
+
+#endif
+
+/**
+ * Two copies of a single block of pseudo-random data, such that any run of
+ * up to STREAMTEST_SOURCE_SYNTHETIC_BLOCK bytes of the infinitely-repeated
+ * block is contiguous within this buffer.
+ */
+static unsigned char
+    streamtest_source_pattern[STREAMTEST_SOURCE_SYNTHETIC_BLOCK * 2];
+
+/**
+ * Guards generation of streamtest_source_pattern, which happens only once.
+ */
+static pthread_once_t streamtest_source_pattern_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Fills streamtest_source_pattern with pseudo-random data. The data is the
+ * same for every process, such that synthetic streams are reproducible.
+ */
+static void streamtest_source_generate_pattern() {
+
+    /* xorshift64 */
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    for (int i = 0; i < STREAMTEST_SOURCE_SYNTHETIC_BLOCK; i += 8) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        memcpy(streamtest_source_pattern + i, &state, sizeof(state));
+    }
+
+    memcpy(streamtest_source_pattern + STREAMTEST_SOURCE_SYNTHETIC_BLOCK,
+            streamtest_source_pattern, STREAMTEST_SOURCE_SYNTHETIC_BLOCK);
+
+}
+
+/**
+ * Updates the size of the regular file of the given synthetic source, such
+ * that the synthetic data grows along with a followed file.
+ *
+ * @param source
+ *     The source whose size should be updated.
+ *
+ * @return
+ *     Zero on success, non-zero if the size of the file cannot be
+ *     determined, in which case errno is set appropriately.
+ */
+static int streamtest_source_synthetic_refresh(streamtest_source* source) {
+
+    streamtest_source_mapping* mapping = source->data;
+
+    struct stat stat_buf;
+    if (fstat(source->fd, &stat_buf))
+        return 1;
+
+    mapping->size = stat_buf.st_size;
+    return 0;
+
+}
+
+/**
+ * Prepares a newly-opened regular file to be replaced by synthetic data.
+ */
+static int streamtest_source_synthetic_open(streamtest_source* source,
+        const char* path) {
+    pthread_once(&streamtest_source_pattern_once,
+            streamtest_source_generate_pattern);
+    source->data = calloc(1, sizeof(streamtest_source_mapping));
+    return streamtest_source_synthetic_refresh(source);
+}
+
+/**
+ * Lends synthetic data directly from the repeated block.
+ */
+static int streamtest_source_synthetic_peek(streamtest_source* source,
+        const unsigned char** data, int length) {
+
+    streamtest_source_mapping* mapping = source->data;
+
+    if (mapping->position + length > mapping->size
+            && streamtest_source_synthetic_refresh(source))
+        return 0;
+
+    off_t remaining = mapping->size - mapping->position;
+    if (remaining <= 0)
+        return 0;
+
+    if (length > remaining)
+        length = remaining;
+
+    if (length > STREAMTEST_SOURCE_SYNTHETIC_BLOCK)
+        length = STREAMTEST_SOURCE_SYNTHETIC_BLOCK;
+
+    *data = streamtest_source_pattern
+        + mapping->position % STREAMTEST_SOURCE_SYNTHETIC_BLOCK;
+    return length;
+
+}
+
+/**
+ * Copies synthetic data from the repeated block.
+ */
+static int streamtest_source_synthetic_read(streamtest_source* source,
+        unsigned char* buffer, int length) {
+
+    streamtest_source_mapping* mapping = source->data;
+
+    if (mapping->position + length > mapping->size
+            && streamtest_source_synthetic_refresh(source))
+        return -1;
+
+    off_t remaining = mapping->size - mapping->position;
+    if (remaining < 0)
+        remaining = 0;
+
+    source->eof = length > remaining;
+    if (source->eof)
+        length = remaining;
+
+    int bytes_read = 0;
+    while (bytes_read < length) {
+
+        int block = length - bytes_read;
+        if (block > STREAMTEST_SOURCE_SYNTHETIC_BLOCK)
+            block = STREAMTEST_SOURCE_SYNTHETIC_BLOCK;
+
+        memcpy(buffer + bytes_read, streamtest_source_pattern
+                + mapping->position % STREAMTEST_SOURCE_SYNTHETIC_BLOCK,
+                block);
+
+        bytes_read += block;
+        mapping->position += block;
+
+    }
+
+    return bytes_read;
+
+}
+
+/**
+ * Frees the state of a regular file replaced by synthetic data, and closes
+ * the file.
+ */
+static void streamtest_source_synthetic_close(streamtest_source* source) {
+    free(source->data);
+    close(source->fd);
+}
+
+/**
+ * Pseudo-random data in place of the content of regular files, such that
+ * the cost of everything other than reading can be measured. The data is
+ * as long as the file, but the file itself is never read.
+ */
+static const streamtest_source_backend streamtest_source_synthetic_backend = {
+    .name     = "synthetic",
+    .open     = streamtest_source_synthetic_open,
+    .read     = streamtest_source_synthetic_read,
+    .peek     = streamtest_source_synthetic_peek,
+    .tell     = streamtest_source_mapping_tell,
+    .size     = streamtest_source_stat_size,
+    .seek     = streamtest_source_mapping_seek,
+    .prefetch = NULL,
+    .close    = streamtest_source_synthetic_close
+};
+
+/**
+ * Replaces the file descriptor of a newly-opened regular file with a pipe
+ * from a child process which writes the file to the pipe.
+ */
+static int streamtest_source_pipe_open(streamtest_source* source,
+        const char* path) {
+
+    pid_t pid;
+    char* argv[] = { "cat", "--", (char*) path, NULL };
+    int fd = streamtest_source_spawn("/bin/cat", argv, &pid);
+    if (fd == -1)
+        return 1;
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    close(source->fd);
+    source->fd = fd;
+    source->data = streamtest_source_process_alloc(pid);
+    source->type = STREAMTEST_SOURCE_PROCESS;
+    source->seekable = false;
+    return 0;
+
+}
+
+/**
+ * Reads whatever data is immediately available from a named pipe, socket
+ * or child process.
+ */
+static int streamtest_source_pipe_read(streamtest_source* source,
+        unsigned char* buffer, int length) {
+
+    int bytes_read = 0;
+    source->eof = false;
+
+    /* Continue reading until buffer is full */
+    while (length > 0) {
+
+        /* Attempt to fill remaining space in buffer */
+        int result = read(source->fd, buffer, length);
+
+        /* Stop if no further data is available yet */
+        if (result == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+
+        /* Abort on error */
+        if (result == -1)
+            return -1;
+
+        /* Stop if end-of-file is reached. A named pipe reads as empty
+         * until its first writer connects, which is not the end. */
+        if (result == 0) {
+            source->eof = source->started
+                || source->type != STREAMTEST_SOURCE_FIFO;
+            break;
+        }
+
+        /* Advance to next block of data (if any) */
+        source->started = true;
+        bytes_read += result;
+        buffer += result;
+        length -= result;
+
+    }
+
+    return bytes_read;
+
+}
+
+/**
+ * Fails, as the size of a pipe is unknown.
+ */
+static int streamtest_source_pipe_size(streamtest_source* source) {
+    return -1;
+}
+
+/**
+ * Fails, as pipes cannot be seeked.
+ */
+static int streamtest_source_pipe_seek(streamtest_source* source,
+        off_t position) {
+    errno = ESPIPE;
+    return 1;
+}
+
+/**
+ * Closes a named pipe, socket or child process, terminating the child
+ * process (if any) such that the producer is not left running.
+ */
+static void streamtest_source_pipe_close(streamtest_source* source) {
+
+    close(source->fd);
+
+    streamtest_source_process* process = source->data;
+    if (process != NULL) {
+        kill(process->pid, SIGTERM);
+        waitpid(process->pid, NULL, 0);
+        free(process);
+    }
+
+}
+
+/**
+ * Named pipes, sockets and child processes, all of which are read without
+ * blocking as data arrives. Regular files read through this backend are
+ * written to a pipe by a child process.
+ */
+static const streamtest_source_backend streamtest_source_pipe_backend = {
+    .name     = "pipe",
+    .open     = streamtest_source_pipe_open,
+    .read     = streamtest_source_pipe_read,
+    .peek     = NULL,
+    .tell     = streamtest_source_file_tell,
+    .size     = streamtest_source_pipe_size,
+    .seek     = streamtest_source_pipe_seek,
+    .prefetch = NULL,
+    .close    = streamtest_source_pipe_close
+};
+
+/**
+ * Reads mixed audio from the mixer of a mix, which reads short only at its
+ * end.
+ */
+static int streamtest_source_mix_read(streamtest_source* source,
+        unsigned char* buffer, int length) {
+    streamtest_mixer* mixer = source->data;
+    int result = streamtest_mixer_read(mixer, buffer, length);
+    source->eof = mixer->eof;
+    return result;
+}
+
+/**
+ * Returns the position of the mixer of a mix.
+ */
+static off_t streamtest_source_mix_tell(streamtest_source* source) {
+    streamtest_mixer* mixer = source->data;
+    return mixer->position;
+}
+
+/**
+ * Returns the size of the mixed audio of a mix.
+ */
+static int streamtest_source_mix_size(streamtest_source* source) {
+    return streamtest_mixer_size(source->data);
+}
+
+/**
+ * Seeks the mixer of a mix.
+ */
+static int streamtest_source_mix_seek(streamtest_source* source,
+        off_t position) {
+    return streamtest_mixer_seek(source->data, position);
+}
+
+/**
+ * Hints that the inputs of a mix will be read soon.
+ */
+static void streamtest_source_mix_prefetch(streamtest_source* source,
+        int length) {
+    streamtest_mixer_prefetch(source->data, length);
+}
+
+/**
+ * Frees the mixer of a mix.
+ */
+static void streamtest_source_mix_close(streamtest_source* source) {
+    streamtest_mixer_free(source->data);
+}
+
+/**
+ * Adds the running totals of the mixer of a mix to the given totals,
+ * resetting those of the mixer.
+ */
+static void streamtest_source_mix_collect(streamtest_source* source,
+        uint64_t* samples, uint64_t* nsecs) {
+
+    streamtest_mixer* mixer = source->data;
+
+    *samples += mixer->samples;
+    *nsecs += mixer->mix_nsecs;
+    mixer->samples = 0;
+    mixer->mix_nsecs = 0;
+
+}
+
+/**
+ * Audio mixed from several regular files, which is only ever read in whole
+ * samples.
+ */
+static const streamtest_source_backend streamtest_source_mix_backend = {
+    .name        = "mix",
+    .open        = NULL,
+    .read        = streamtest_source_mix_read,
+    .peek        = NULL,
+    .tell        = streamtest_source_mix_tell,
+    .size        = streamtest_source_mix_size,
+    .seek        = streamtest_source_mix_seek,
+    .prefetch    = streamtest_source_mix_prefetch,
+    .close       = streamtest_source_mix_close,
+    .collect_mix = streamtest_source_mix_collect,
+    .indivisible = true
+};
+
+/**
+ * Reads the files of a directory as if concatenated, until the buffer is
+ * full or the end of the final file is reached.
+ */
+static int streamtest_source_directory_read(streamtest_source* source,
+        unsigned char* buffer, int length) {
+
+    streamtest_source_directory* directory = source->data;
+    int bytes_read = 0;
+    source->eof = false;
+
+    while (length > 0) {
+
+        int result = read(source->fd, buffer, length);
+        if (result == -1)
+            return -1;
+
+        /* Continue with the next file, if any */
+        if (result == 0) {
+
+            if (directory->file_index + 1 < directory->file_count) {
+                if (streamtest_source_select(source,
+                            directory->file_index + 1))
+                    return -1;
+                continue;
+            }
+
+            source->eof = true;
+            break;
+
+        }
+
+        bytes_read += result;
+        buffer += result;
+        length -= result;
+
+    }
+
+    return bytes_read;
+
+}
+
+/**
+ * Returns the position within the concatenation of the files of a
+ * directory.
+ */
+static off_t streamtest_source_directory_tell(streamtest_source* source) {
+
+    streamtest_source_directory* directory = source->data;
+
+    off_t position = lseek(source->fd, 0, SEEK_CUR);
+    if (position == -1)
+        return -1;
+
+    /* Positions include all preceding files */
+    return position + directory->file_offsets[directory->file_index];
+
+}
+
+/**
+ * Returns the total size of the files of a directory.
+ */
+static int streamtest_source_directory_size(streamtest_source* source) {
+    streamtest_source_directory* directory = source->data;
+    return directory->file_offsets[directory->file_count];
+}
+
+/**
+ * Moves to the given position within the concatenation of the files of a
+ * directory, opening whichever file contains that position.
+ */
+static int streamtest_source_directory_seek(streamtest_source* source,
+        off_t position) {
+
+    streamtest_source_directory* directory = source->data;
+
+    int index = directory->file_count - 1;
+    while (index > 0 && directory->file_offsets[index] > position)
+        index--;
+
+    if (index != directory->file_index
+            && streamtest_source_select(source, index))
+        return 1;
+
+    position -= directory->file_offsets[index];
+    return lseek(source->fd, position, SEEK_SET) == -1;
+
+}
+
+/**
+ * Closes the current file of a directory and frees the list of its files.
+ */
+static void streamtest_source_directory_close(streamtest_source* source) {
+
+    close(source->fd);
+
+    streamtest_source_directory* directory = source->data;
+    for (int i = 0; i < directory->file_count; i++)
+        free(directory->files[i]);
+    free(directory->files);
+    free(directory->file_offsets);
+    free(directory);
+
+}
+
+/**
+ * The regular files within a directory, read one after another.
+ */
+static const streamtest_source_backend streamtest_source_directory_backend = {
+    .name     = "directory",
+    .open     = NULL,
+    .read     = streamtest_source_directory_read,
+    .peek     = NULL,
+    .tell     = streamtest_source_directory_tell,
+    .size     = streamtest_source_directory_size,
+    .seek     = streamtest_source_directory_seek,
+    .prefetch = streamtest_source_fd_prefetch,
+    .close    = streamtest_source_directory_close
+};
+
+/**
+ * The state of a pre-chunked file, which is mapped and sent chunk by chunk.
+ */
+typedef struct streamtest_source_chunks {
+
+    /**
+     * The mapped pre-chunked file.
+     */
+    streamtest_chunks* chunks;
+
+    /**
+     * The index of the next chunk to be sent.
+     */
+    int chunk;
+
+} streamtest_source_chunks;
+
+/**
+ * Fails, as chunks are sent from the mapping, never copied.
+ */
+static int streamtest_source_chunks_read(streamtest_source* source,
+        unsigned char* buffer, int length) {
+    errno = EINVAL;
+    return -1;
+}
+
+/**
+ * Returns the position of the next chunk within a pre-chunked file.
+ */
+static off_t streamtest_source_chunks_tell(streamtest_source* source) {
+    streamtest_source_chunks* state = source->data;
+    streamtest_chunks* chunks = state->chunks;
+    return (chunks->payload - (const unsigned char*) chunks->data)
+        + chunks->entries[state->chunk].offset;
+}
+
+/**
+ * Fails, as pre-chunked files are positioned by time rather than by byte.
+ */
+static int streamtest_source_chunks_seek(streamtest_source* source,
+        off_t position) {
+    errno = EINVAL;
+    return 1;
+}
+
+/**
+ * Closes and unmaps a pre-chunked file.
+ */
+static void streamtest_source_chunks_close(streamtest_source* source) {
+    streamtest_source_chunks* state = source->data;
+    close(source->fd);
+    streamtest_chunks_unmap(state->chunks);
+    free(state);
+}
+
+/**
+ * Describes the chunks of a pre-chunked file.
+ */
+static void streamtest_source_chunks_layout(streamtest_source* source,
+        streamtest_source_layout* layout) {
+
+    streamtest_source_chunks* state = source->data;
+    layout->count = state->chunks->count;
+    layout->encoded = state->chunks->encoded;
+    layout->keyframes = state->chunks->indexed;
+
+}
+
+/**
+ * Lends the next chunk of a pre-chunked file directly from the mapping (or
+ * from the chunk store), advancing to the chunk following it.
+ */
+static int streamtest_source_chunks_read_chunk(streamtest_source* source,
+        streamtest_source_chunk* chunk) {
+
+    streamtest_source_chunks* state = source->data;
+    streamtest_chunks* chunks = state->chunks;
+
+    if (state->chunk >= chunks->count) {
+        errno = EINVAL;
+        return 1;
+    }
+
+    const streamtest_chunks_entry* entry = &chunks->entries[state->chunk];
+    chunk->data = streamtest_store_data(chunks, state->chunk);
+    chunk->length = entry->length;
+    chunk->encoded = chunks->encoded;
+    chunk->duration = entry[1].timestamp - entry->timestamp;
+
+    state->chunk++;
+    source->eof = state->chunk == chunks->count;
+    return 0;
+
+}
+
+/**
+ * Returns the timestamp of the next chunk of a pre-chunked file.
+ */
+static int64_t streamtest_source_chunks_tell_time(
+        streamtest_source* source) {
+    streamtest_source_chunks* state = source->data;
+    return state->chunks->entries[state->chunk].timestamp;
+}
+
+/**
+ * Moves to the chunk of a pre-chunked file which should be sent at the given
+ * time, continuing to the next keyframe if requested and keyframes are
+ * marked.
+ */
+static int64_t streamtest_source_chunks_seek_time(streamtest_source* source,
+        int64_t timestamp, bool keyframe) {
+
+    streamtest_source_chunks* state = source->data;
+    streamtest_chunks* chunks = state->chunks;
+
+    state->chunk = streamtest_chunks_find(chunks, timestamp);
+    if (keyframe && chunks->indexed)
+        state->chunk = streamtest_chunks_next_keyframe(chunks, state->chunk);
+
+    source->eof = state->chunk == chunks->count;
+    return chunks->entries[state->chunk].timestamp;
+
+}
+
+/**
+ * Pre-chunked files, which are mapped and sent chunk by chunk.
+ */
+static const streamtest_source_backend streamtest_source_chunks_backend = {
+    .name        = "chunks",
+    .open        = NULL,
+    .read        = streamtest_source_chunks_read,
+    .peek        = NULL,
+    .tell        = streamtest_source_chunks_tell,
+    .size        = streamtest_source_stat_size,
+    .seek        = streamtest_source_chunks_seek,
+    .prefetch    = streamtest_source_fd_prefetch,
+    .close       = streamtest_source_chunks_close,
+    .layout      = streamtest_source_chunks_layout,
+    .read_chunk  = streamtest_source_chunks_read_chunk,
+    .tell_time   = streamtest_source_chunks_tell_time,
+    .seek_time   = streamtest_source_chunks_seek_time,
+    .indivisible = true
+};
+
+/**
+ * All backends through which regular files may be read. The first is the
+ * default.
+ */
+static const streamtest_source_backend* streamtest_source_backends[] = {
+    &streamtest_source_file_backend,
+    &streamtest_source_mmap_backend,
+#ifdef HAVE_LIBURING
+    &streamtest_source_uring_backend,
+#endif
+    &streamtest_source_synthetic_backend,
+    &streamtest_source_pipe_backend
+};
+
+const streamtest_source_backend* streamtest_source_find_backend(
+        const char* name) {
+
+    if (name[0] == '\0')
+        return streamtest_source_backends[0];
+
+    int count = sizeof(streamtest_source_backends)
+        / sizeof(streamtest_source_backends[0]);
+
+    for (int i = 0; i < count; i++) {
+        if (strcmp(streamtest_source_backends[i]->name, name) == 0)
+            return streamtest_source_backends[i];
+    }
+
+    return NULL;
+
+}
+
+/**
+ * Allocates a new source of the given kind, read through the given backend.
+ * All other members are zeroed.
+ *
+ * @param type
+ *     The kind of source.
+ *
+ * @param backend
+ *     The backend through which the source is read.
+ *
+ * @param fd
+ *     The file descriptor of the source, or -1 if none.
+ *
+ * @return
+ *     A newly-allocated streamtest_source.
+ */
+static streamtest_source* streamtest_source_alloc(streamtest_source_type type,
+        const streamtest_source_backend* backend, int fd) {
+
+    streamtest_source* source = calloc(1, sizeof(streamtest_source));
+    source->type = type;
+    source->backend = backend;
+    source->fd = fd;
+    return source;
+
+}
+
+streamtest_source* streamtest_source_open(const char* spec,
+        const streamtest_source_backend* backend) {
+
+    streamtest_source_type type;
+    pid_t pid = -1;
+    int fd;
+
+    if (backend == NULL)
+        backend = &streamtest_source_file_backend;
+
+    /* Mix of files, read through its mixer rather than a file descriptor */
+    if (strncmp(spec, STREAMTEST_SOURCE_MIX_PREFIX,
+                strlen(STREAMTEST_SOURCE_MIX_PREFIX)) == 0) {
+
+        streamtest_mixer* mixer = streamtest_mixer_load(
+                spec + strlen(STREAMTEST_SOURCE_MIX_PREFIX));
+        if (mixer == NULL)
+            return NULL;
+
+        streamtest_source* source = streamtest_source_alloc(
+                STREAMTEST_SOURCE_MIX, &streamtest_source_mix_backend, -1);
+        source->data = mixer;
+        source->seekable = true;
+        return source;
+
+    }
+
+    /* UNIX domain socket */
+    if (strncmp(spec, STREAMTEST_SOURCE_UNIX_PREFIX,
+                strlen(STREAMTEST_SOURCE_UNIX_PREFIX)) == 0) {
+        type = STREAMTEST_SOURCE_SOCKET;
+        fd = streamtest_source_connect(
+                spec + strlen(STREAMTEST_SOURCE_UNIX_PREFIX));
+    }
+
+    /* Child process */
+    else if (strncmp(spec, STREAMTEST_SOURCE_EXEC_PREFIX,
+                strlen(STREAMTEST_SOURCE_EXEC_PREFIX)) == 0) {
+        char* argv[] = { "sh", "-c",
+            (char*) spec + strlen(STREAMTEST_SOURCE_EXEC_PREFIX), NULL };
+        type = STREAMTEST_SOURCE_PROCESS;
+        fd = streamtest_source_spawn("/bin/sh", argv, &pid);
+    }
+
+    /* Regular file or named pipe (opening a pipe without O_NONBLOCK would
+     * block until a writer connects) */
+    else {
+
+        fd = open(spec, O_RDONLY | O_NONBLOCK);
+        if (fd == -1)
+            return NULL;
+
+        struct stat stat_buf;
+        if (fstat(fd, &stat_buf)) {
+            int error = errno;
+            close(fd);
+            errno = error;
+            return NULL;
+        }
+
+        if (S_ISFIFO(stat_buf.st_mode))
+            type = STREAMTEST_SOURCE_FIFO;
+
+        /* Directories are read file by file, beginning with the first */
+        else if (S_ISDIR(stat_buf.st_mode)) {
+
+            close(fd);
+
+            streamtest_source_directory* directory =
+                streamtest_source_list(spec);
+            if (directory == NULL)
+                return NULL;
+
+            streamtest_source* source = streamtest_source_alloc(
+                    STREAMTEST_SOURCE_DIRECTORY,
+                    &streamtest_source_directory_backend, -1);
+            source->data = directory;
+            source->seekable = true;
+
+            source->fd = open(directory->files[0], O_RDONLY);
+            if (source->fd == -1) {
+                int error = errno;
+                streamtest_source_close(source);
+                errno = error;
+                return NULL;
+            }
+
+            return source;
+
+        }
+
+        /* Pre-chunked files are mapped rather than read */
+        else if (streamtest_chunks_detect(fd)) {
+
+            streamtest_chunks* chunks = streamtest_chunks_map(fd);
+            if (chunks == NULL) {
+                int error = errno;
+                close(fd);
+                errno = error;
+                return NULL;
+            }
+
+            /* Identical chunks of all files and connections are held only
+             * once */
+            streamtest_store_add(chunks);
+
+            streamtest_source_chunks* state =
+                calloc(1, sizeof(streamtest_source_chunks));
+            state->chunks = chunks;
+
+            streamtest_source* source = streamtest_source_alloc(
+                    STREAMTEST_SOURCE_CHUNKS,
+                    &streamtest_source_chunks_backend, fd);
+            source->data = state;
+            source->seekable = true;
+            source->eof = chunks->count == 0;
+            return source;
+
+        }
+
+        /* Anything else is read just as the original regular file, through
+         * the requested backend */
+        else {
+
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+
+            streamtest_source* source = streamtest_source_alloc(
+                    STREAMTEST_SOURCE_FILE, backend, fd);
+            source->seekable = true;
+
+            if (backend->open != NULL && backend->open(source, spec)) {
+                int error = errno;
+                streamtest_source_close(source);
+                errno = error;
+                return NULL;
+            }
+
+            return source;
+
+        }
+
+    }
+
+    if (fd == -1)
+        return NULL;
+
+    /* Never block on anything other than a regular file */
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    streamtest_source* source = streamtest_source_alloc(type,
+            &streamtest_source_pipe_backend, fd);
+    if (pid != -1)
+        source->data = streamtest_source_process_alloc(pid);
+    return source;
+
+}
+
+int streamtest_source_size(streamtest_source* source) {
+    return source->backend->size(source);
+}
+
+int streamtest_source_read(streamtest_source* source, unsigned char* buffer,
+        int length) {
+    return source->backend->read(source, buffer, length);
+}
+
+int streamtest_source_peek(streamtest_source* source,
+        const unsigned char** data, int length) {
+
+    if (source->backend->peek == NULL)
+        return 0;
+
+    return source->backend->peek(source, data, length);
+
+}
+
+off_t streamtest_source_tell(streamtest_source* source) {
+    return source->backend->tell(source);
+}
+
+int streamtest_source_seek(streamtest_source* source, off_t position) {
+    source->eof = false;
+    return source->backend->seek(source, position);
+}
+
+void streamtest_source_prefetch(streamtest_source* source, int length) {
+    if (source->backend->prefetch != NULL)
+        source->backend->prefetch(source, length);
+}
+
+bool streamtest_source_indivisible(streamtest_source* source) {
+    return source->backend->indivisible;
+}
+
+void streamtest_source_collect_mix(streamtest_source* source,
+        uint64_t* samples, uint64_t* nsecs) {
+    if (source->backend->collect_mix != NULL)
+        source->backend->collect_mix(source, samples, nsecs);
+}
+
+bool streamtest_source_chunked(streamtest_source* source,
+        streamtest_source_layout* layout) {
+
+    if (source->backend->layout == NULL)
+        return false;
+
+    if (layout != NULL)
+        source->backend->layout(source, layout);
+
+    return true;
+
+}
+
+int streamtest_source_read_chunk(streamtest_source* source,
+        streamtest_source_chunk* chunk) {
+
+    if (source->backend->read_chunk == NULL) {
+        errno = EINVAL;
+        return 1;
+    }
+
+    return source->backend->read_chunk(source, chunk);
+
+}
+
+int64_t streamtest_source_tell_time(streamtest_source* source) {
+
+    if (source->backend->tell_time == NULL)
+        return -1;
+
+    return source->backend->tell_time(source);
+
+}
+
+int64_t streamtest_source_seek_time(streamtest_source* source,
+        int64_t timestamp, bool keyframe) {
+
+    if (source->backend->seek_time == NULL)
+        return -1;
+
+    return source->backend->seek_time(source, timestamp, keyframe);
+
+}
+
+void streamtest_source_close(streamtest_source* source) {
+    source->backend->close(source);
+    free(source);
+}
+
@@ -0,0 +1,599 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef STREAMTEST_SOURCE_H
+#define STREAMTEST_SOURCE_H
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <sys/types.h>
+
+/**
+ * The prefix which denotes a source spec that refers to a UNIX domain socket
+ * rather than a file. The remainder of the spec is the path of the socket.
+ */
+#define STREAMTEST_SOURCE_UNIX_PREFIX "unix:"
+
+/**
+ * The prefix which denotes a source spec that refers to a command whose
+ * standard output should be streamed. The remainder of the spec is passed to
+ * "/bin/sh -c".
+ */
+#define STREAMTEST_SOURCE_EXEC_PREFIX "exec:"
+
+/**
+ * The prefix which denotes a source spec that refers to a mix of several
+ * 16-bit raw PCM audio files. The remainder of the spec is the path of the
+ * file describing the mix, as accepted by streamtest_mixer_load().
+ */
+#define STREAMTEST_SOURCE_MIX_PREFIX "mix:"
+
+/**
+ * The size of the block of pseudo-random data repeated by the "synthetic"
+ * backend, in bytes. Frames no larger than this can be lent by the backend
+ * without copying.
+ */
+#define STREAMTEST_SOURCE_SYNTHETIC_BLOCK 1048576
+
+/**
+ * The number of entries within the submission queue of each io_uring used
+ * by the "io_uring" backend. At most two reads are ever in flight.
+ */
+#define STREAMTEST_SOURCE_URING_DEPTH 4
+
+/**
+ * The operations through which a source is read, defined below.
+ */
+struct streamtest_source_backend;
+
+/**
+ * All supported kinds of media source.
+ */
+typedef enum streamtest_source_type {
+
+    /**
+     * A regular file, which can be seeked and whose size is known.
+     */
+    STREAMTEST_SOURCE_FILE,
+
+    /**
+     * A named pipe.
+     */
+    STREAMTEST_SOURCE_FIFO,
+
+    /**
+     * A connected UNIX domain socket.
+     */
+    STREAMTEST_SOURCE_SOCKET,
+
+    /**
+     * The standard output of a child process.
+     */
+    STREAMTEST_SOURCE_PROCESS,
+
+    /**
+     * Audio mixed from several regular files, which can be seeked and whose
+     * size is known.
+     */
+    STREAMTEST_SOURCE_MIX,
+
+    /**
+     * The regular files within a directory, read one after another in order
+     * of name as if concatenated. Directories can be seeked and their size
+     * is known.
+     */
+    STREAMTEST_SOURCE_DIRECTORY,
+
+    /**
+     * A regular file in the pre-chunked format defined by chunks.h, which is
+     * mapped into memory and sent chunk by chunk rather than read. Chunks
+     * can be seeked by timestamp, and the size of the file is known.
+     */
+    STREAMTEST_SOURCE_CHUNKS
+
+} streamtest_source_type;
+
+/**
+ * The layout of a pre-chunked source, as returned by
+ * streamtest_source_chunked().
+ */
+typedef struct streamtest_source_layout {
+
+    /**
+     * The number of chunks within the source.
+     */
+    int count;
+
+    /**
+     * Whether the data of each chunk is stored base64-encoded.
+     */
+    bool encoded;
+
+    /**
+     * Whether chunks beginning with a keyframe are marked as such. If not,
+     * every chunk must be assumed to begin with a keyframe.
+     */
+    bool keyframes;
+
+} streamtest_source_layout;
+
+/**
+ * A single chunk of a pre-chunked source, as lent by
+ * streamtest_source_read_chunk().
+ */
+typedef struct streamtest_source_chunk {
+
+    /**
+     * The data of the chunk as stored, which remain valid until the source
+     * is closed.
+     */
+    const unsigned char* data;
+
+    /**
+     * The length of the data of the chunk once decoded, in bytes.
+     */
+    int length;
+
+    /**
+     * Whether the data of the chunk is stored base64-encoded, in which case
+     * the stored data are longer than the given length.
+     */
+    bool encoded;
+
+    /**
+     * The media time covered by the chunk, being the interval between its
+     * timestamp and that of the chunk following it, in microseconds.
+     */
+    int64_t duration;
+
+} streamtest_source_chunk;
+
+/**
+ * A source of media data. All sources other than regular files are read
+ * without blocking, with readiness signalled through the file descriptor of
+ * the source, such that a slow producer never stalls the sender.
+ */
+typedef struct streamtest_source {
+
+    /**
+     * The kind of source.
+     */
+    streamtest_source_type type;
+
+    /**
+     * The operations through which this source is read. Regular files are
+     * read through the backend selected for the connection, while all other
+     * kinds of source have a backend of their own.
+     */
+    const struct streamtest_source_backend* backend;
+
+    /**
+     * The file descriptor from which data is currently read, or -1 if the
+     * source is a mix.
+     */
+    int fd;
+
+    /**
+     * State specific to the backend of this source, which only that backend
+     * may access, or NULL if the backend needs no state of its own.
+     */
+    void* data;
+
+    /**
+     * Whether the source is a regular file (or mix or directory of regular
+     * files) which may be seeked and whose size is known.
+     */
+    bool seekable;
+
+    /**
+     * Whether any data has been read from the source. A named pipe reads as
+     * empty until a writer connects, and is only considered complete once a
+     * writer has provided data.
+     */
+    bool started;
+
+    /**
+     * Whether the most recent read reached the end of the source. Pre-chunked
+     * sources reach their end as soon as their final chunk has been read.
+     */
+    bool eof;
+
+} streamtest_source;
+
+/**
+ * A set of operations through which a source is read. Each operation is
+ * invoked only through the corresponding streamtest_source_*() function,
+ * which documents its behavior.
+ */
+typedef struct streamtest_source_backend {
+
+    /**
+     * The name by which the backend is selected.
+     */
+    const char* name;
+
+    /**
+     * Prepares a newly-opened regular file for reading through this
+     * backend, returning zero on success or non-zero with errno set if the
+     * file cannot be read through this backend. The file descriptor of the
+     * source is already open. NULL if no preparation is needed.
+     */
+    int (*open)(streamtest_source* source, const char* path);
+
+    /**
+     * Implementation of streamtest_source_read().
+     */
+    int (*read)(streamtest_source* source, unsigned char* buffer,
+            int length);
+
+    /**
+     * Implementation of streamtest_source_peek(), or NULL if this backend
+     * cannot lend its data.
+     */
+    int (*peek)(streamtest_source* source, const unsigned char** data,
+            int length);
+
+    /**
+     * Implementation of streamtest_source_tell().
+     */
+    off_t (*tell)(streamtest_source* source);
+
+    /**
+     * Implementation of streamtest_source_size().
+     */
+    int (*size)(streamtest_source* source);
+
+    /**
+     * Implementation of streamtest_source_seek().
+     */
+    int (*seek)(streamtest_source* source, off_t position);
+
+    /**
+     * Implementation of streamtest_source_prefetch(), or NULL if this
+     * backend needs no hint.
+     */
+    void (*prefetch)(streamtest_source* source, int length);
+
+    /**
+     * Frees all resources specific to this backend and closes the file
+     * descriptor of the source, if any.
+     */
+    void (*close)(streamtest_source* source);
+
+    /**
+     * Implementation of streamtest_source_collect_mix(), or NULL if this
+     * backend does not mix audio.
+     */
+    void (*collect_mix)(streamtest_source* source, uint64_t* samples,
+            uint64_t* nsecs);
+
+    /**
+     * Implementation of streamtest_source_chunked(), or NULL if this backend
+     * does not divide its data into chunks, in which case none of the chunk
+     * operations below are provided.
+     */
+    void (*layout)(streamtest_source* source,
+            streamtest_source_layout* layout);
+
+    /**
+     * Implementation of streamtest_source_read_chunk().
+     */
+    int (*read_chunk)(streamtest_source* source,
+            streamtest_source_chunk* chunk);
+
+    /**
+     * Implementation of streamtest_source_tell_time().
+     */
+    int64_t (*tell_time)(streamtest_source* source);
+
+    /**
+     * Implementation of streamtest_source_seek_time().
+     */
+    int64_t (*seek_time)(streamtest_source* source, int64_t timestamp,
+            bool keyframe);
+
+    /**
+     * Whether the data of this backend can only be read in whole units
+     * larger than a byte (such as whole samples of a mix, or whole chunks),
+     * such that the length of each read cannot be chosen freely.
+     */
+    bool indivisible;
+
+} streamtest_source_backend;
+
+/**
+ * Returns the backend having the given name, through which regular files
+ * may be read. The available backends are "read" (the default, used if the
+ * name is empty), which reads the file with read(), "mmap", which maps the
+ * file and lends its data without copying, "io_uring", which reads the file
+ * through an io_uring while reading the next frame ahead, "synthetic", which
+ * never reads the file and instead produces pseudo-random data of the same
+ * size, and "pipe", which streams the file through a pipe from a child
+ * process as if it were the output of a command (and thus cannot be seeked).
+ * The "io_uring" backend is only available if built with liburing.
+ *
+ * @param name
+ *     The name of the backend.
+ *
+ * @return
+ *     The backend having the given name, or NULL if there is no such
+ *     backend.
+ */
+const streamtest_source_backend* streamtest_source_find_backend(
+        const char* name);
+
+/**
+ * Opens the media source described by the given spec. Specs beginning with
+ * STREAMTEST_SOURCE_UNIX_PREFIX connect to a UNIX domain socket, specs
+ * beginning with STREAMTEST_SOURCE_EXEC_PREFIX spawn a child process, specs
+ * beginning with STREAMTEST_SOURCE_MIX_PREFIX mix several files, and all
+ * other specs are paths to regular files, directories or named pipes.
+ * Regular files beginning with STREAMTEST_CHUNKS_MAGIC are mapped as
+ * pre-chunked files, while all other regular files are read through the
+ * given backend.
+ *
+ * @param spec
+ *     The spec describing the source to open.
+ *
+ * @param backend
+ *     The backend through which a regular file should be read, as returned
+ *     by streamtest_source_find_backend(), or NULL to read regular files
+ *     with read().
+ *
+ * @return
+ *     A newly-allocated streamtest_source, or NULL if the source cannot be
+ *     opened, in which case errno is set appropriately.
+ */
+streamtest_source* streamtest_source_open(const char* spec,
+        const streamtest_source_backend* backend);
+
+/**
+ * Returns the total number of bytes within the given source, if known.
+ *
+ * @param source
+ *     The source whose size should be returned.
+ *
+ * @return
+ *     The size of the source in bytes, or -1 if the source is not a regular
+ *     file or its size cannot be determined.
+ */
+int streamtest_source_size(streamtest_source* source);
+
+/**
+ * Reads up to the given number of bytes from the given source. Regular files
+ * are read until the buffer is full or end-of-file is reached. All other
+ * sources are read only until no further data is immediately available. The
+ * eof flag of the source is updated to reflect whether the end of the source
+ * was reached. Pre-chunked files cannot be read, as their chunks are instead
+ * lent by streamtest_source_read_chunk().
+ *
+ * @param source
+ *     The source to read from.
+ *
+ * @param buffer
+ *     The buffer into which data should be read.
+ *
+ * @param length
+ *     The maximum number of bytes to read.
+ *
+ * @return
+ *     The number of bytes read, which may be less than requested even if the
+ *     end of the source has not been reached, or -1 if an error occurs, in
+ *     which case errno is set appropriately. If the source is pre-chunked,
+ *     this is always -1, with errno set to EINVAL.
+ */
+int streamtest_source_read(streamtest_source* source, unsigned char* buffer,
+        int length);
+
+/**
+ * Lends up to the given number of bytes following the current position of
+ * the given source, without copying them and without advancing the
+ * position. The data remain valid until the source is next read, peeked or
+ * closed, and may be consumed by seeking past them. Only regular files read
+ * through the "mmap" or "synthetic" backends can lend their data.
+ *
+ * @param source
+ *     The source whose data should be lent.
+ *
+ * @param data
+ *     Storage for a pointer to the lent data.
+ *
+ * @param length
+ *     The maximum number of bytes to lend.
+ *
+ * @return
+ *     The number of bytes lent, which may be less than requested, or zero
+ *     if the source cannot lend its data or has no more data.
+ */
+int streamtest_source_peek(streamtest_source* source,
+        const unsigned char** data, int length);
+
+/**
+ * Returns the current position within the given seekable source.
+ *
+ * @param source
+ *     The source whose position should be returned.
+ *
+ * @return
+ *     The number of bytes preceding the next byte to be read (or, if
+ *     pre-chunked, preceding the next chunk), or -1 if the position cannot
+ *     be determined, in which case errno is set appropriately.
+ */
+off_t streamtest_source_tell(streamtest_source* source);
+
+/**
+ * Moves to the given position within the given seekable source, such that
+ * the next read begins at that position.
+ *
+ * @param source
+ *     The source to seek within.
+ *
+ * @param position
+ *     The number of bytes from the start of the source. Mixes are only
+ *     seeked to whole samples, and will round this position down if
+ *     necessary.
+ *
+ * @return
+ *     Zero on success, non-zero if an error occurs, in which case errno is
+ *     set appropriately. Pre-chunked files are positioned by time rather
+ *     than by byte (see streamtest_source_seek_time()), and always fail with
+ *     errno set to EINVAL.
+ */
+int streamtest_source_seek(streamtest_source* source, off_t position);
+
+/**
+ * Hints that the first bytes of the given source will be read soon, such
+ * that they may be fetched in advance. Regular files are read into the page
+ * cache. Other sources need no hint, as their producers begin running as
+ * soon as they are opened.
+ *
+ * @param source
+ *     The source which will be read soon.
+ *
+ * @param length
+ *     The number of bytes which will be read soon.
+ */
+void streamtest_source_prefetch(streamtest_source* source, int length);
+
+/**
+ * Returns whether the given source can only be read in whole units larger
+ * than a byte, such as the samples of a mix or the chunks of a pre-chunked
+ * file, such that the length of each read cannot be chosen freely.
+ *
+ * @param source
+ *     The source to test.
+ *
+ * @return
+ *     true if the source can only be read in whole units, false if it can
+ *     be read in any number of bytes.
+ */
+bool streamtest_source_indivisible(streamtest_source* source);
+
+/**
+ * Adds the number of input samples mixed by the given source since this
+ * function was last invoked, and the time spent mixing them, to the given
+ * totals. Sources other than mixes leave the totals unchanged.
+ *
+ * @param source
+ *     The source whose mixing should be accounted for.
+ *
+ * @param samples
+ *     The total number of samples mixed, counting each input separately.
+ *
+ * @param nsecs
+ *     The total time spent mixing, in nanoseconds.
+ */
+void streamtest_source_collect_mix(streamtest_source* source,
+        uint64_t* samples, uint64_t* nsecs);
+
+/**
+ * Returns whether the given source is pre-chunked, in which case its data
+ * are sent chunk by chunk with streamtest_source_read_chunk() and it is
+ * positioned by time with streamtest_source_seek_time(), rather than being
+ * read and seeked by byte.
+ *
+ * @param source
+ *     The source to test.
+ *
+ * @param layout
+ *     Storage for the layout of the chunks of the source, which is only
+ *     written if the source is pre-chunked, or NULL if the layout is not
+ *     needed.
+ *
+ * @return
+ *     true if the source is pre-chunked, false otherwise.
+ */
+bool streamtest_source_chunked(streamtest_source* source,
+        streamtest_source_layout* layout);
+
+/**
+ * Lends the next chunk of the given pre-chunked source without copying it,
+ * advancing to the chunk following it. The eof flag of the source is set
+ * once the final chunk has been read.
+ *
+ * @param source
+ *     The pre-chunked source to read from.
+ *
+ * @param chunk
+ *     Storage for a description of the chunk read.
+ *
+ * @return
+ *     Zero if a chunk was read, non-zero if all chunks have already been
+ *     read or the source is not pre-chunked, in which case errno is set to
+ *     EINVAL.
+ */
+int streamtest_source_read_chunk(streamtest_source* source,
+        streamtest_source_chunk* chunk);
+
+/**
+ * Returns the timestamp of the next chunk of the given pre-chunked source.
+ *
+ * @param source
+ *     The pre-chunked source whose position should be returned.
+ *
+ * @return
+ *     The timestamp of the next chunk to be read, or of the end of the
+ *     final chunk if all chunks have been read, in microseconds relative to
+ *     the start of the source, or -1 if the source is not pre-chunked.
+ */
+int64_t streamtest_source_tell_time(streamtest_source* source);
+
+/**
+ * Moves to the last chunk of the given pre-chunked source whose timestamp
+ * is not later than the given time, such that it is the next chunk read.
+ * Times beyond either end of the source are clamped to its first chunk or
+ * to its end. The eof flag of the source is updated to reflect whether any
+ * chunks remain.
+ *
+ * @param source
+ *     The pre-chunked source to seek within.
+ *
+ * @param timestamp
+ *     The time to seek to, in microseconds relative to the start of the
+ *     source.
+ *
+ * @param keyframe
+ *     Whether to continue on to the first chunk at or after that chunk
+ *     which begins with a keyframe, if the source marks keyframes.
+ *
+ * @return
+ *     The timestamp of the chunk now to be read next, as would be returned
+ *     by streamtest_source_tell_time(), or -1 if the source is not
+ *     pre-chunked.
+ */
+int64_t streamtest_source_seek_time(streamtest_source* source,
+        int64_t timestamp, bool keyframe);
+
+/**
+ * Closes the given source, terminating its child process if any, and freeing
+ * all associated resources.
+ *
+ * @param source
+ *     The source to close.
+ */
+void streamtest_source_close(streamtest_source* source);
+
+#endif
+
@@ -0,0 +1,327 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+#include "backpressure.h"
+#include "client.h"
+#include "latency.h"
+#include "scheduler.h"
+#include "shaper.h"
+#include "stats.h"
+#include "store.h"
+#include "timing.h"
+#include "track.h"
+
+#include <guacamole/client.h>
+
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Logs the current statistics of the given track, including the state of
+ * its rate shaper (if any), at the info level.
+ *
+ * @param client
+ *     The guac_client associated with the connection being streamed.
+ *
+ * @param track
+ *     The track whose statistics should be logged.
+ */
+static void streamtest_stats_log_track(guac_client* client,
+        streamtest_track* track) {
+
+    streamtest_stats* stats = &track->stats;
+
+    guac_client_log(client, GUAC_LOG_INFO, "Stats (stream %i): %llu frames, "
+            "%llu bytes in %llu blobs, %llu overruns, %llu source stalls",
+            track->index,
+            (unsigned long long) stats->frames,
+            (unsigned long long) stats->bytes_sent,
+            (unsigned long long) stats->blobs_sent,
+            (unsigned long long) stats->overruns,
+            (unsigned long long) stats->source_stalls);
+
+    /* Include how the source was read, such that backends can be compared
+     * side by side */
+    guac_client_log(client, GUAC_LOG_INFO, "Stats (stream %i): regular "
+            "files read through the \"%s\" backend, %llu of %llu frames "
+            "sent without copying", track->index,
+            track->source_backend->name,
+            (unsigned long long) stats->frames_lent,
+            (unsigned long long) stats->frames);
+
+    /* Include requested frames if batched */
+    if (track->batch > 1)
+        guac_client_log(client, GUAC_LOG_INFO, "Stats (stream %i): each "
+                "frame batches %i requested frames (%llu requested frames "
+                "in total)", track->index, track->batch,
+                (unsigned long long) stats->frames * track->batch);
+
+    /* Include images dropped if streaming images */
+    if (track->mode == STREAMTEST_IMAGE)
+        guac_client_log(client, GUAC_LOG_INFO, "Stats (stream %i): %llu of "
+                "%llu images dropped as the client fell behind",
+                track->index,
+                (unsigned long long) stats->frames_dropped,
+                (unsigned long long) stats->frames);
+
+    /* Include token bucket state if shaping */
+    streamtest_shaper* shaper = track->shaper;
+    if (shaper != NULL)
+        guac_client_log(client, GUAC_LOG_INFO, "Stats (stream %i): token "
+                "bucket has %i/%i bytes available, %i bytes queued, %llu "
+                "sends deferred", track->index,
+                streamtest_shaper_available(shaper, streamtest_utime()),
+                shaper->depth, track->buffer_length,
+                (unsigned long long) shaper->deferrals);
+
+    /* Include playlist progress if any */
+    if (track->playlist != NULL)
+        guac_client_log(client, GUAC_LOG_INFO, "Stats (stream %i): playing "
+                "item %i of %i, %llu transitions (%llu requiring a new "
+                "stream)", track->index, track->item + 1,
+                track->playlist->count,
+                (unsigned long long) stats->transitions,
+                (unsigned long long) stats->stream_restarts);
+
+    /* Include append-to-send delay if following a live file */
+    if (track->follow != NULL && stats->live_sends > 0)
+        guac_client_log(client, GUAC_LOG_INFO, "Stats (stream %i): %llu live "
+                "sends, append-to-send delay averaging %llu microseconds "
+                "(maximum %lli microseconds)", track->index,
+                (unsigned long long) stats->live_sends,
+                (unsigned long long) (stats->live_delay_total
+                    / stats->live_sends),
+                (long long) stats->live_delay_max);
+
+    /* Include current rendition and switches, if adapting bitrate */
+    streamtest_renditions* renditions = track->renditions;
+    if (renditions != NULL)
+        guac_client_log(client, GUAC_LOG_INFO, "Stats (stream %i): "
+                "streaming rendition %i of %i (%i bits per second), %llu "
+                "switches up, %llu switches down", track->index,
+                renditions->current + 1, renditions->count,
+                renditions->items[renditions->current].bitrate,
+                (unsigned long long) stats->switches_up,
+                (unsigned long long) stats->switches_down);
+
+    /* Include how the track kept pace, if it ever fell behind */
+    if (stats->slips > 0 || stats->catch_ups > 0)
+        guac_client_log(client, GUAC_LOG_INFO, "Stats (stream %i): fell "
+                "behind %llu times, %llu slips, %llu catch-ups skipping %llu "
+                "microseconds (%llu to a keyframe), %llu degradations",
+                track->index,
+                (unsigned long long) (stats->slips + stats->catch_ups),
+                (unsigned long long) stats->slips,
+                (unsigned long long) stats->catch_ups,
+                (unsigned long long) stats->skipped_usecs,
+                (unsigned long long) stats->keyframe_skips,
+                (unsigned long long) stats->degradations);
+
+    /* Include cost of mixing if any audio has been mixed */
+    if (stats->mixed_samples > 0)
+        guac_client_log(client, GUAC_LOG_INFO, "Stats (stream %i): %llu "
+                "input samples mixed in %llu microseconds (%.2f nanoseconds "
+                "per sample per input)", track->index,
+                (unsigned long long) stats->mixed_samples,
+                (unsigned long long) (stats->mix_nsecs / 1000),
+                (double) stats->mix_nsecs / stats->mixed_samples);
+
+}
+
+/**
+ * Logs time spent blocked on the socket of the given connection, along with
+ * any periods of sustained backpressure, at the info level. Nothing is
+ * logged if the socket has not yet been flushed.
+ *
+ * @param client
+ *     The guac_client associated with the connection being streamed.
+ *
+ * @param backpressure
+ *     The backpressure detector of the connection.
+ */
+static void streamtest_stats_log_socket(guac_client* client,
+        const streamtest_backpressure* backpressure) {
+
+    if (backpressure->flushes == 0)
+        return;
+
+    /* Include any period of congestion still in progress */
+    int64_t congested_total = backpressure->congested_total;
+    if (backpressure->congested)
+        congested_total += streamtest_utime()
+            - backpressure->congested_since;
+
+    guac_client_log(client, GUAC_LOG_INFO, "Stats (socket): %llu flushes "
+            "averaging %lli microseconds (maximum %lli), %lli microseconds "
+            "blocked in total, %llu periods of backpressure lasting %lli "
+            "microseconds in total, %llu frames deferred or dropped",
+            (unsigned long long) backpressure->flushes,
+            (long long) (backpressure->flush_total / backpressure->flushes),
+            (long long) backpressure->flush_max,
+            (long long) backpressure->blocked_total,
+            (unsigned long long) backpressure->congestions,
+            (long long) congested_total,
+            (unsigned long long) backpressure->frames_deferred);
+
+}
+
+/**
+ * Logs the given latency histogram at the info level, including its average,
+ * approximate median and 99th percentile, maximum and the count of each
+ * non-empty bucket. Nothing is logged if the histogram is empty.
+ *
+ * @param client
+ *     The guac_client associated with the connection whose latency was
+ *     measured.
+ *
+ * @param name
+ *     A human-readable name for the measurement, such as "round trip".
+ *
+ * @param histogram
+ *     The histogram to log.
+ */
+static void streamtest_stats_log_latency(guac_client* client,
+        const char* name, const streamtest_latency_histogram* histogram) {
+
+    if (histogram->samples == 0)
+        return;
+
+    /* List non-empty buckets by their limits in milliseconds */
+    char buckets[512];
+    int length = 0;
+    for (int i = 0; i < STREAMTEST_LATENCY_BUCKETS; i++) {
+
+        if (histogram->buckets[i] == 0)
+            continue;
+
+        const char* comparison = "<";
+        int limit = 1 << i;
+        if (i == STREAMTEST_LATENCY_BUCKETS - 1) {
+            comparison = ">=";
+            limit = 1 << (i - 1);
+        }
+
+        length += snprintf(buckets + length, sizeof(buckets) - length,
+                " %s%ims:%llu", comparison, limit,
+                (unsigned long long) histogram->buckets[i]);
+
+    }
+
+    guac_client_log(client, GUAC_LOG_INFO, "Stats (latency): %s averaging "
+            "%llu microseconds over %llu samples (median under %lli, 99%% "
+            "under %lli, maximum %lli microseconds), distribution:%s", name,
+            (unsigned long long) (histogram->total / histogram->samples),
+            (unsigned long long) histogram->samples,
+            (long long) streamtest_latency_percentile(histogram, 50),
+            (long long) streamtest_latency_percentile(histogram, 99),
+            (long long) histogram->max, buckets);
+
+}
+
+void streamtest_stats_log(guac_client* client) {
+
+    /* Get stream state from client */
+    streamtest_state* state = (streamtest_state*) client->data;
+
+    uint64_t bytes_sent = 0;
+    uint64_t blobs_sent = 0;
+
+    for (int i = 0; i < state->track_count; i++) {
+        streamtest_track* track = state->tracks[i];
+        streamtest_stats_log_track(client, track);
+        bytes_sent += track->stats.bytes_sent;
+        blobs_sent += track->stats.blobs_sent;
+    }
+
+    /* Include latency observed by the client, as measured through syncs */
+    streamtest_stats_log_latency(client, "round trip", &state->latency.rtt);
+    streamtest_stats_log_latency(client, "client lag", &state->latency.lag);
+
+    /* Include startup latency, once known */
+    if (state->first_byte != -1)
+        guac_client_log(client, GUAC_LOG_INFO, "Stats (startup): first "
+                "media data sent %lli microseconds after connection began",
+                (long long) state->first_byte);
+
+    /* Include throughput of the client, once measured */
+    if (state->latency.throughput > 0)
+        guac_client_log(client, GUAC_LOG_INFO, "Stats (latency): client "
+                "throughput averaging %lli bits per second",
+                (long long) state->latency.throughput);
+
+    /* Include time blocked on the socket, distinguishing network saturation
+     * from slow reads */
+    streamtest_stats_log_socket(client, &state->backpressure);
+
+    /* Include accuracy and cost of the shared timer thread, distinguishing
+     * late wakeups from slow frames */
+    streamtest_sleep_stats sleep;
+    streamtest_scheduler_get_sleep_stats(&sleep);
+    if (sleep.wakeups > 0)
+        guac_client_log(client, GUAC_LOG_INFO, "Stats (scheduler): sleeping "
+                "via %s strategy, %llu timed wakeups averaging %llu "
+                "microseconds late (maximum %lli), %lli microseconds of "
+                "processor time in the timer thread",
+                streamtest_sleep_strategy_name(sleep.strategy),
+                (unsigned long long) sleep.wakeups,
+                (unsigned long long) (sleep.late_total / sleep.wakeups),
+                (long long) sleep.late_max, (long long) sleep.cpu_usecs);
+
+    /* Include memory saved by sharing identical chunks between files and
+     * connections */
+    streamtest_store_stats store;
+    streamtest_store_get_stats(&store);
+    if (store.files > 0)
+        guac_client_log(client, GUAC_LOG_INFO, "Stats (store): %llu chunks "
+                "(%llu bytes) of %llu hashed files read through the chunk "
+                "store, which holds %llu distinct chunks (%llu bytes) for "
+                "all connections",
+                (unsigned long long) store.references,
+                (unsigned long long) store.referenced_bytes,
+                (unsigned long long) store.files,
+                (unsigned long long) store.chunks,
+                (unsigned long long) store.bytes);
+
+    /* Per-track totals suffice if there is only one track */
+    if (state->track_count == 1)
+        return;
+
+    guac_client_log(client, GUAC_LOG_INFO, "Stats (combined): %llu bytes in "
+            "%llu blobs across %i streams",
+            (unsigned long long) bytes_sent,
+            (unsigned long long) blobs_sent,
+            state->track_count);
+
+    /* Include synchronization if monitored */
+    streamtest_sync_stats* sync = &state->sync;
+    if (state->sync_tolerance > 0)
+        guac_client_log(client, GUAC_LOG_INFO, "Stats (sync): maximum skew "
+                "%lli microseconds, %llu of %llu checks exceeded tolerance "
+                "of %i microseconds",
+                (long long) sync->max_skew,
+                (unsigned long long) sync->violations,
+                (unsigned long long) sync->checks,
+                state->sync_tolerance);
+
+}
+
@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef STREAMTEST_STATS_H
+#define STREAMTEST_STATS_H
+
+#include "config.h"
+
+#include <guacamole/client.h>
+
+#include <stdint.h>
+
+/**
+ * The interval between periodic statistics reports, in microseconds.
+ */
+#define STREAMTEST_STATS_INTERVAL 5000000
+
+/**
+ * Running totals describing the streaming performance of a single track.
+ * These values are only updated by the sender.
+ */
+typedef struct streamtest_stats {
+
+    /**
+     * The total number of frames read from the file being streamed.
+     */
+    uint64_t frames;
+
+    /**
+     * The total number of bytes sent as blobs.
+     */
+    uint64_t bytes_sent;
+
+    /**
+     * The total number of blob instructions sent.
+     */
+    uint64_t blobs_sent;
+
+    /**
+     * The total number of images which were read but deliberately not sent,
+     * as the client had fallen behind.
+     */
+    uint64_t frames_dropped;
+
+    /**
+     * The total number of frames which took longer than the frame interval.
+     */
+    uint64_t overruns;
+
+    /**
+     * The total number of frames which could not be read because data from
+     * previous frames was still waiting to be sent.
+     */
+    uint64_t source_stalls;
+
+    /**
+     * The total number of frames sent directly from data lent by the
+     * source, without being copied into the frame buffer.
+     */
+    uint64_t frames_lent;
+
+    /**
+     * The total number of times the track has moved on to the next source
+     * of its playlist.
+     */
+    uint64_t transitions;
+
+    /**
+     * The total number of transitions which required a new stream, as the
+     * mimetype of the next source differed from that of the previous.
+     */
+    uint64_t stream_restarts;
+
+    /**
+     * The total number of sends of data read at the live edge of a followed
+     * file.
+     */
+    uint64_t live_sends;
+
+    /**
+     * The sum of the delays between data being appended to a followed file
+     * and that data being sent, in microseconds.
+     */
+    uint64_t live_delay_total;
+
+    /**
+     * The largest delay between data being appended to a followed file and
+     * that data being sent, in microseconds.
+     */
+    int64_t live_delay_max;
+
+    /**
+     * The total number of input samples mixed, counting each input of a mix
+     * separately.
+     */
+    uint64_t mixed_samples;
+
+    /**
+     * The total time spent mixing, excluding reads, in nanoseconds.
+     */
+    uint64_t mix_nsecs;
+
+    /**
+     * The total number of times the track fell more than a frame behind the
+     * wall clock and resumed pacing from the current time, without skipping
+     * any data.
+     */
+    uint64_t slips;
+
+    /**
+     * The total number of times the track fell more than a frame behind the
+     * wall clock and skipped stale data to catch up.
+     */
+    uint64_t catch_ups;
+
+    /**
+     * The total media time skipped while catching up, in microseconds.
+     */
+    uint64_t skipped_usecs;
+
+    /**
+     * The total number of catch-ups which resumed from a keyframe.
+     */
+    uint64_t keyframe_skips;
+
+    /**
+     * The total number of times the track switched to a lower-rate
+     * rendition of its source after falling behind.
+     */
+    uint64_t degradations;
+
+    /**
+     * The total number of switches to a rendition of higher bitrate.
+     */
+    uint64_t switches_up;
+
+    /**
+     * The total number of switches to a rendition of lower bitrate.
+     */
+    uint64_t switches_down;
+
+} streamtest_stats;
+
+/**
+ * Running totals describing how closely the tracks of a connection are kept
+ * in step. These values are only updated by the sender.
+ */
+typedef struct streamtest_sync_stats {
+
+    /**
+     * The total number of times the media time of all tracks was compared.
+     */
+    uint64_t checks;
+
+    /**
+     * The total number of comparisons which found the difference in media
+     * time between two tracks to exceed the sync tolerance.
+     */
+    uint64_t violations;
+
+    /**
+     * The largest difference in media time between any two tracks observed
+     * so far, in microseconds.
+     */
+    int64_t max_skew;
+
+} streamtest_sync_stats;
+
+/**
+ * Logs the current statistics of each track of the given connection,
+ * including the state of any rate shapers, at the info level. If the
+ * connection has multiple tracks, combined totals and synchronization
+ * statistics are logged as well.
+ *
+ * @param client
+ *     The guac_client associated with the connection whose statistics should
+ *     be logged.
+ */
+void streamtest_stats_log(guac_client* client);
+
+#endif
+
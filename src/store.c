@@ -0,0 +1,491 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+#include "chunks.h"
+#include "store.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * The magic number at the beginning of the file holding the chunk store,
+ * identifying the layout of that file. Files of any other layout are left
+ * untouched, and the store is not used.
+ */
+#define STREAMTEST_STORE_MAGIC "GUACSTO1"
+
+/**
+ * The length of STREAMTEST_STORE_MAGIC, in bytes.
+ */
+#define STREAMTEST_STORE_MAGIC_LENGTH 8
+
+/**
+ * Flag within a slot of the chunk store which indicates that the slot holds
+ * a chunk. Slots are never emptied once used.
+ */
+#define STREAMTEST_STORE_USED 0x1
+
+/**
+ * Flag within a slot of the chunk store which indicates that the chunk is
+ * held base64-encoded.
+ */
+#define STREAMTEST_STORE_ENCODED 0x2
+
+/**
+ * The header at the beginning of the file holding the chunk store. The
+ * header is immediately followed by STREAMTEST_STORE_SLOTS slots, and then
+ * by the data of all chunks, one after another. All members other than the
+ * magic number are modified only while the file is locked.
+ */
+typedef struct streamtest_store_header {
+
+    /**
+     * STREAMTEST_STORE_MAGIC, without null terminator, or all zero if the
+     * file has not yet been initialized.
+     */
+    char magic[STREAMTEST_STORE_MAGIC_LENGTH];
+
+    /**
+     * The number of chunks held.
+     */
+    uint64_t chunks;
+
+    /**
+     * The number of bytes of chunk data held.
+     */
+    uint64_t used;
+
+    /**
+     * The number of bytes of space reserved for chunk data, which is never
+     * less than used.
+     */
+    uint64_t allocated;
+
+} streamtest_store_header;
+
+/**
+ * A single slot of the hash table of the chunk store, each of which holds
+ * at most one chunk. Chunks having equal hashes occupy consecutive slots.
+ */
+typedef struct streamtest_store_slot {
+
+    /**
+     * The content hash of the chunk.
+     */
+    uint64_t hash;
+
+    /**
+     * The offset of the data of the chunk, relative to the first byte
+     * following the last slot.
+     */
+    uint64_t offset;
+
+    /**
+     * The number of bytes of media data within the chunk, before any base64
+     * encoding.
+     */
+    uint32_t length;
+
+    /**
+     * Bitwise OR of all flags which apply to the slot, such as
+     * STREAMTEST_STORE_USED. This member is set only after all others, such
+     * that a slot may be read without locking once it is marked used.
+     */
+    uint32_t flags;
+
+} streamtest_store_slot;
+
+/**
+ * The chunk store as mapped by this process.
+ */
+typedef struct streamtest_store {
+
+    /**
+     * The open file holding the store, or -1 if the store could not be
+     * opened.
+     */
+    int fd;
+
+    /**
+     * The header of the mapped file, or NULL if the store could not be
+     * opened.
+     */
+    streamtest_store_header* header;
+
+    /**
+     * The slots of the mapped file.
+     */
+    streamtest_store_slot* slots;
+
+    /**
+     * The data of all chunks within the mapped file.
+     */
+    unsigned char* data;
+
+    /**
+     * Totals describing use of the store by this process. The chunks and
+     * bytes members are unused, being read from the header instead.
+     */
+    streamtest_store_stats stats;
+
+} streamtest_store;
+
+/**
+ * The chunk store as mapped by this process.
+ */
+static streamtest_store streamtest_store_instance = { .fd = -1 };
+
+/**
+ * Guards the one-time opening of the chunk store by this process.
+ */
+static pthread_once_t streamtest_store_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Lock which is held, in addition to the lock of the file, while adding
+ * chunks to the store. The lock of the file excludes only other processes.
+ */
+static pthread_mutex_t streamtest_store_instance_lock =
+    PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Returns the number of bytes which precede the data of all chunks within
+ * the file holding the chunk store.
+ *
+ * @return
+ *     The size of the header and slots, in bytes.
+ */
+static size_t streamtest_store_table_size(void) {
+    return sizeof(streamtest_store_header)
+        + sizeof(streamtest_store_slot) * STREAMTEST_STORE_SLOTS;
+}
+
+/**
+ * Opens, initializing if necessary, and maps the file holding the chunk
+ * store. If the store cannot be opened, the header of the process-wide
+ * store remains NULL and the store is not used.
+ */
+static void streamtest_store_open(void) {
+
+    streamtest_store* store = &streamtest_store_instance;
+    size_t table = streamtest_store_table_size();
+
+    int fd = open(STREAMTEST_STORE_PATH, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1)
+        return;
+
+    /* Only one process may initialize the file */
+    if (flock(fd, LOCK_EX)) {
+        close(fd);
+        return;
+    }
+
+    /* Space for the table is reserved up front, while space for chunks is
+     * reserved as chunks are added, thus the mapping extends beyond the end
+     * of the file */
+    struct stat file_stat;
+    void* mapped = MAP_FAILED;
+    if (fstat(fd, &file_stat) == 0
+            && (file_stat.st_size >= (off_t) table
+                || posix_fallocate(fd, 0, table) == 0))
+        mapped = mmap(NULL, table + STREAMTEST_STORE_CAPACITY,
+                PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (mapped == MAP_FAILED) {
+        flock(fd, LOCK_UN);
+        close(fd);
+        return;
+    }
+
+    streamtest_store_header* header = (streamtest_store_header*) mapped;
+
+    /* Slots are never used before the magic number is written, thus a file
+     * without one holds nothing, even if an earlier process died while
+     * initializing it */
+    static const char uninitialized[STREAMTEST_STORE_MAGIC_LENGTH] = { 0 };
+    if (memcmp(header->magic, uninitialized,
+                STREAMTEST_STORE_MAGIC_LENGTH) == 0) {
+        header->chunks = 0;
+        header->used = 0;
+        header->allocated = 0;
+        memcpy(header->magic, STREAMTEST_STORE_MAGIC,
+                STREAMTEST_STORE_MAGIC_LENGTH);
+    }
+
+    /* Leave files of any other layout alone */
+    else if (memcmp(header->magic, STREAMTEST_STORE_MAGIC,
+                STREAMTEST_STORE_MAGIC_LENGTH) != 0) {
+        munmap(mapped, table + STREAMTEST_STORE_CAPACITY);
+        flock(fd, LOCK_UN);
+        close(fd);
+        return;
+    }
+
+    flock(fd, LOCK_UN);
+
+    store->fd = fd;
+    store->header = header;
+    store->slots = (streamtest_store_slot*) (header + 1);
+    store->data = (unsigned char*) mapped + table;
+
+}
+
+/**
+ * Searches the given store for a chunk identical to the given chunk. This
+ * may be called without locking, as slots are never modified once used.
+ *
+ * @param store
+ *     The store to search.
+ *
+ * @param hash
+ *     The content hash of the chunk.
+ *
+ * @param length
+ *     The number of bytes of media data within the chunk.
+ *
+ * @param flags
+ *     The flags of a slot holding the chunk, being STREAMTEST_STORE_USED
+ *     plus STREAMTEST_STORE_ENCODED if the chunk is encoded.
+ *
+ * @param data
+ *     The stored data of the chunk.
+ *
+ * @param stored
+ *     The number of bytes of stored data.
+ *
+ * @param empty
+ *     Storage for the index of the unused slot at which the search ended,
+ *     if no identical chunk is held.
+ *
+ * @return
+ *     The data of the identical chunk held by the store, or NULL if no
+ *     identical chunk is held.
+ */
+static const unsigned char* streamtest_store_find(streamtest_store* store,
+        uint64_t hash, uint32_t length, uint32_t flags,
+        const unsigned char* data, uint64_t stored, uint64_t* empty) {
+
+    uint64_t index = hash & (STREAMTEST_STORE_SLOTS - 1);
+    for (;;) {
+
+        streamtest_store_slot* slot = &store->slots[index];
+        uint32_t slot_flags = __atomic_load_n(&slot->flags,
+                __ATOMIC_ACQUIRE);
+
+        if (!(slot_flags & STREAMTEST_STORE_USED)) {
+            *empty = index;
+            return NULL;
+        }
+
+        /* Compare the data itself, such that colliding hashes are never
+         * mistaken for identical chunks */
+        if (slot->hash == hash && slot->length == length
+                && slot_flags == flags
+                && memcmp(store->data + slot->offset, data, stored) == 0)
+            return store->data + slot->offset;
+
+        index = (index + 1) & (STREAMTEST_STORE_SLOTS - 1);
+
+    }
+
+}
+
+/**
+ * Returns the data of the chunk held by the given store which is identical
+ * to the given chunk, copying the chunk into the store if no identical chunk
+ * is held. Both the lock of the process and the lock of the file must be
+ * held.
+ *
+ * @param store
+ *     The store to add the chunk to.
+ *
+ * @param hash
+ *     The content hash of the chunk.
+ *
+ * @param length
+ *     The number of bytes of media data within the chunk.
+ *
+ * @param flags
+ *     The flags of a slot holding the chunk, as accepted by
+ *     streamtest_store_find().
+ *
+ * @param data
+ *     The stored data of the chunk.
+ *
+ * @param stored
+ *     The number of bytes of stored data.
+ *
+ * @return
+ *     The data of the identical chunk held by the store, or NULL if the
+ *     store is full.
+ */
+static const unsigned char* streamtest_store_insert(streamtest_store* store,
+        uint64_t hash, uint32_t length, uint32_t flags,
+        const unsigned char* data, uint64_t stored) {
+
+    /* Another process may have added the same chunk since it was sought */
+    uint64_t index;
+    const unsigned char* held = streamtest_store_find(store, hash, length,
+            flags, data, stored, &index);
+    if (held != NULL)
+        return held;
+
+    streamtest_store_header* header = store->header;
+    if (header->chunks >= STREAMTEST_STORE_SLOTS / 4 * 3
+            || stored > STREAMTEST_STORE_CAPACITY - header->used)
+        return NULL;
+
+    /* Reserve space before writing, as writing to a page of a tmpfs which
+     * has no room for it raises SIGBUS */
+    if (header->used + stored > header->allocated) {
+
+        uint64_t allocated = (header->used + stored + STREAMTEST_STORE_GROWTH
+                - 1) / STREAMTEST_STORE_GROWTH * STREAMTEST_STORE_GROWTH;
+        if (allocated > STREAMTEST_STORE_CAPACITY)
+            allocated = STREAMTEST_STORE_CAPACITY;
+
+        if (posix_fallocate(store->fd,
+                    streamtest_store_table_size() + header->allocated,
+                    allocated - header->allocated))
+            return NULL;
+
+        header->allocated = allocated;
+
+    }
+
+    unsigned char* copy = store->data + header->used;
+    memcpy(copy, data, stored);
+
+    /* Publish the slot only once complete */
+    streamtest_store_slot* slot = &store->slots[index];
+    slot->hash = hash;
+    slot->offset = header->used;
+    slot->length = length;
+    __atomic_store_n(&slot->flags, flags, __ATOMIC_RELEASE);
+
+    __atomic_store_n(&header->used, header->used + stored, __ATOMIC_RELAXED);
+    __atomic_store_n(&header->chunks, header->chunks + 1, __ATOMIC_RELAXED);
+
+    return copy;
+
+}
+
+void streamtest_store_add(streamtest_chunks* chunks) {
+
+    pthread_once(&streamtest_store_once, streamtest_store_open);
+
+    streamtest_store* store = &streamtest_store_instance;
+    if (chunks->hashes == NULL || store->header == NULL)
+        return;
+
+    /* Chunks are resolved through the store only as they are read */
+    chunks->shared = calloc(chunks->count, sizeof(const unsigned char*));
+
+    pthread_mutex_lock(&streamtest_store_instance_lock);
+    store->stats.files++;
+    pthread_mutex_unlock(&streamtest_store_instance_lock);
+
+}
+
+const unsigned char* streamtest_store_data(streamtest_chunks* chunks,
+        int chunk) {
+
+    if (chunks->shared == NULL)
+        return streamtest_chunks_data(chunks, chunk);
+
+    if (chunks->shared[chunk] != NULL)
+        return chunks->shared[chunk];
+
+    streamtest_store* store = &streamtest_store_instance;
+    const unsigned char* data = streamtest_chunks_data(chunks, chunk);
+
+    uint64_t hash = chunks->hashes[chunk];
+    uint32_t length = chunks->entries[chunk].length;
+    uint32_t flags = STREAMTEST_STORE_USED
+        | (chunks->encoded ? STREAMTEST_STORE_ENCODED : 0);
+    uint64_t stored = streamtest_chunks_stored_length(length,
+            chunks->encoded);
+
+    /* Chunks already held are found without locking */
+    uint64_t index;
+    const unsigned char* held = streamtest_store_find(store, hash, length,
+            flags, data, stored, &index);
+
+    if (held == NULL) {
+        pthread_mutex_lock(&streamtest_store_instance_lock);
+        if (flock(store->fd, LOCK_EX) == 0) {
+            held = streamtest_store_insert(store, hash, length, flags,
+                    data, stored);
+            flock(store->fd, LOCK_UN);
+        }
+        pthread_mutex_unlock(&streamtest_store_instance_lock);
+    }
+
+    /* Chunks which do not fit are read from their own file */
+    if (held == NULL)
+        held = data;
+
+    else {
+        __atomic_fetch_add(&store->stats.references, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&store->stats.referenced_bytes, stored,
+                __ATOMIC_RELAXED);
+    }
+
+    chunks->shared[chunk] = held;
+    return held;
+
+}
+
+void streamtest_store_get_stats(streamtest_store_stats* stats) {
+
+    streamtest_store* store = &streamtest_store_instance;
+
+    pthread_mutex_lock(&streamtest_store_instance_lock);
+
+    stats->files = store->stats.files;
+    stats->references = __atomic_load_n(&store->stats.references,
+            __ATOMIC_RELAXED);
+    stats->referenced_bytes = __atomic_load_n(&store->stats.referenced_bytes,
+            __ATOMIC_RELAXED);
+
+    /* The store is opened only once a hashed file is added */
+    stats->chunks = 0;
+    stats->bytes = 0;
+    if (stats->files > 0) {
+        stats->chunks = __atomic_load_n(&store->header->chunks,
+                __ATOMIC_RELAXED);
+        stats->bytes = __atomic_load_n(&store->header->used,
+                __ATOMIC_RELAXED);
+    }
+
+    pthread_mutex_unlock(&streamtest_store_instance_lock);
+
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef STREAMTEST_STORE_H
+#define STREAMTEST_STORE_H
+
+#include "config.h"
+#include "chunks.h"
+
+#include <stdint.h>
+
+/**
+ * The file holding the chunk store. As guacd forks a separate process for
+ * each connection, the store is kept within shared memory such that the
+ * chunks of all connections are held only once. This should be a tmpfs, as
+ * chunks are read from the store in place. The store persists after the
+ * last connection ends, and may be removed whenever no connection is using
+ * it.
+ */
+#define STREAMTEST_STORE_PATH "/dev/shm/guac-streamtest-chunks"
+
+/**
+ * The number of slots within the hash table of the chunk store. No further
+ * chunks are added once three quarters of the slots are used, keeping
+ * searches short. This must be a power of two.
+ */
+#define STREAMTEST_STORE_SLOTS 262144
+
+/**
+ * The maximum total size of all chunks held by the chunk store, in bytes.
+ * Chunks which do not fit are read from their own files instead.
+ */
+#define STREAMTEST_STORE_CAPACITY 268435456
+
+/**
+ * The number of bytes by which the space allocated for chunks within the
+ * chunk store grows at a time.
+ */
+#define STREAMTEST_STORE_GROWTH 4194304
+
+/**
+ * Totals describing use of the chunk store by this process, and the
+ * contents of the store as shared by all connections.
+ */
+typedef struct streamtest_store_stats {
+
+    /**
+     * The number of hashed pre-chunked files added by this process.
+     */
+    uint64_t files;
+
+    /**
+     * The number of distinct chunks held by the store, for all connections.
+     */
+    uint64_t chunks;
+
+    /**
+     * The total stored size of all distinct chunks held by the store, in
+     * bytes.
+     */
+    uint64_t bytes;
+
+    /**
+     * The number of chunks of all files added by this process which have
+     * been read through the store, counting duplicates separately.
+     */
+    uint64_t references;
+
+    /**
+     * The total stored size of the chunks of all files added by this
+     * process which have been read through the store, counting duplicates
+     * separately, in bytes.
+     */
+    uint64_t referenced_bytes;
+
+} streamtest_store_stats;
+
+/**
+ * Adds the given pre-chunked file to the chunk store, such that each of its
+ * chunks is read through the store by streamtest_store_data(). Nothing is
+ * read from the file until its chunks are. Files which are not hashed, and
+ * all files if the store cannot be opened, are left unchanged.
+ *
+ * @param chunks
+ *     The newly-mapped pre-chunked file to add.
+ */
+void streamtest_store_add(streamtest_chunks* chunks);
+
+/**
+ * Returns the data of the given chunk, as stored (base64-encoded if the file
+ * is encoded). The first time each chunk of a file added to the store is
+ * read, it is compared byte for byte with any chunk held by the store
+ * having the same content hash, length and encoding, and is copied into the
+ * store if no such chunk is held. The data returned is then that held by
+ * the store, shared by all files and connections containing the same
+ * chunk. Chunks of files which are not within the store, and chunks which
+ * do not fit, are read from their own file.
+ *
+ * @param chunks
+ *     The pre-chunked file containing the chunk.
+ *
+ * @param chunk
+ *     The index of the chunk.
+ *
+ * @return
+ *     The stored data of the chunk, which remains valid for as long as the
+ *     given file is mapped.
+ */
+const unsigned char* streamtest_store_data(streamtest_chunks* chunks,
+        int chunk);
+
+/**
+ * Retrieves totals describing use of the chunk store by this process and
+ * the current contents of the store.
+ *
+ * @param stats
+ *     The streamtest_store_stats to populate.
+ */
+void streamtest_store_get_stats(streamtest_store_stats* stats);
+
+#endif
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+#include "timing.h"
+
+#include <stdint.h>
+#include <time.h>
+
+int64_t streamtest_utime() {
+
+    struct timespec current;
+
+    /* Get current time */
+    clock_gettime(CLOCK_MONOTONIC, &current);
+
+    /* Calculate microseconds */
+    return (int64_t) current.tv_sec * 1000000 + current.tv_nsec / 1000;
+
+}
+
+int64_t streamtest_ntime() {
+
+    struct timespec current;
+
+    /* Get current time */
+    clock_gettime(CLOCK_MONOTONIC, &current);
+
+    /* Calculate nanoseconds */
+    return (int64_t) current.tv_sec * 1000000000 + current.tv_nsec;
+
+}
+
+void streamtest_utime_to_timespec(int64_t usecs, struct timespec* ts) {
+    ts->tv_sec  =  usecs / 1000000;
+    ts->tv_nsec = (usecs % 1000000) * 1000;
+}
+
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef STREAMTEST_TIMING_H
+#define STREAMTEST_TIMING_H
+
+#include "config.h"
+
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * Returns an arbitrary timestamp in microseconds. This timestamp is relative
+ * only to previous calls of streamtest_utime() and is intended only for the
+ * sake of determining relative or elapsed time. Unlike wall-clock time, the
+ * values returned are guaranteed to never decrease.
+ *
+ * @return
+ *     An arbitrary, monotonically-increasing timestamp in microseconds.
+ */
+int64_t streamtest_utime();
+
+/**
+ * Returns an arbitrary timestamp in nanoseconds, relative to the same clock
+ * as streamtest_utime(). This is intended only for measuring the duration
+ * of operations too brief to be measured in microseconds.
+ *
+ * @return
+ *     An arbitrary, monotonically-increasing timestamp in nanoseconds.
+ */
+int64_t streamtest_ntime();
+
+/**
+ * Converts the given timestamp, as returned by streamtest_utime(), into an
+ * absolute timespec relative to the same clock. The resulting timespec is
+ * suitable for use with functions like pthread_cond_timedwait() if the
+ * condition has been configured to use CLOCK_MONOTONIC.
+ *
+ * @param usecs
+ *     The timestamp to convert, in microseconds.
+ *
+ * @param ts
+ *     The timespec to populate.
+ */
+void streamtest_utime_to_timespec(int64_t usecs, struct timespec* ts);
+
+#endif
+
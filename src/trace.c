@@ -0,0 +1,298 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+#include "trace.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fcntl.h>
+
+/**
+ * Returns the next byte from the given trace file, refilling the trace
+ * buffer as necessary.
+ *
+ * @param trace
+ *     The trace file to read from.
+ *
+ * @return
+ *     The next byte from the trace file, or -1 if the end of the file has
+ *     been reached or an error occurs.
+ */
+static int streamtest_trace_getc(streamtest_trace* trace) {
+
+    /* Refill buffer if exhausted */
+    if (trace->offset >= trace->length) {
+
+        int result = read(trace->fd, trace->buffer,
+                STREAMTEST_TRACE_BUFFER_SIZE);
+        if (result <= 0)
+            return -1;
+
+        trace->offset = 0;
+        trace->length = result;
+
+    }
+
+    return trace->buffer[trace->offset++];
+
+}
+
+/**
+ * Reads a single unsigned LEB128 varint from the given trace file.
+ *
+ * @param trace
+ *     The trace file to read from.
+ *
+ * @param value
+ *     Pointer to the uint64_t which should receive the value read.
+ *
+ * @return
+ *     Positive if a value was read, zero if the end of the file was reached
+ *     before any bytes were read, or negative if the value is truncated or
+ *     too large.
+ */
+static int streamtest_trace_read_varint(streamtest_trace* trace,
+        uint64_t* value) {
+
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+
+        int c = streamtest_trace_getc(trace);
+        if (c == -1)
+            return shift == 0 ? 0 : -1;
+
+        *value |= (uint64_t) (c & 0x7F) << shift;
+
+        /* High bit is clear on the final byte */
+        if (!(c & 0x80))
+            return 1;
+
+    }
+
+    return -1;
+
+}
+
+/**
+ * Reads the next record from a binary trace file.
+ *
+ * @param trace
+ *     The trace file to read from.
+ *
+ * @param record
+ *     The streamtest_trace_record to populate with the record read.
+ *
+ * @return
+ *     Positive if a record was read, zero if the end of the trace has been
+ *     reached, or negative if the trace is malformed.
+ */
+static int streamtest_trace_next_binary(streamtest_trace* trace,
+        streamtest_trace_record* record) {
+
+    uint64_t delta;
+    uint64_t length;
+
+    /* End of trace may occur only between records */
+    int result = streamtest_trace_read_varint(trace, &delta);
+    if (result <= 0)
+        return result;
+
+    if (streamtest_trace_read_varint(trace, &length) <= 0
+            || length > INT32_MAX)
+        return -1;
+
+    trace->timestamp += delta;
+    record->timestamp = trace->timestamp;
+    record->length = length;
+    return 1;
+
+}
+
+/**
+ * Reads the next record from a CSV trace file, skipping any lines which do
+ * not contain records.
+ *
+ * @param trace
+ *     The trace file to read from.
+ *
+ * @param record
+ *     The streamtest_trace_record to populate with the record read.
+ *
+ * @return
+ *     Positive if a record was read, zero if the end of the trace has been
+ *     reached, or negative if the trace is malformed.
+ */
+static int streamtest_trace_next_csv(streamtest_trace* trace,
+        streamtest_trace_record* record) {
+
+    int c;
+
+    for (;;) {
+
+        /* Skip leading whitespace */
+        do {
+            c = streamtest_trace_getc(trace);
+        } while (c == ' ' || c == '\t' || c == '\r');
+
+        if (c == -1)
+            return 0;
+
+        /* Skip blank lines, comments and headers */
+        if (c < '0' || c > '9') {
+            while (c != '\n' && c != -1)
+                c = streamtest_trace_getc(trace);
+            continue;
+        }
+
+        break;
+
+    }
+
+    /* Parse whole seconds */
+    int64_t seconds = 0;
+    while (c >= '0' && c <= '9') {
+        seconds = seconds * 10 + (c - '0');
+        c = streamtest_trace_getc(trace);
+    }
+
+    /* Parse fractional part to microsecond precision */
+    int64_t usecs = 0;
+    if (c == '.') {
+
+        int64_t scale = 100000;
+
+        c = streamtest_trace_getc(trace);
+        while (c >= '0' && c <= '9') {
+            usecs += (c - '0') * scale;
+            scale /= 10;
+            c = streamtest_trace_getc(trace);
+        }
+
+    }
+
+    /* Skip separator */
+    while (c == ',' || c == ' ' || c == '\t')
+        c = streamtest_trace_getc(trace);
+
+    /* Byte count is required */
+    if (c < '0' || c > '9')
+        return -1;
+
+    int64_t length = 0;
+    while (c >= '0' && c <= '9') {
+        length = length * 10 + (c - '0');
+        if (length > INT32_MAX)
+            return -1;
+        c = streamtest_trace_getc(trace);
+    }
+
+    /* Ignore anything else on the line */
+    while (c != '\n' && c != -1)
+        c = streamtest_trace_getc(trace);
+
+    record->timestamp = seconds * 1000000 + usecs;
+    record->length = length;
+
+    /* Timestamps never go backwards */
+    if (record->timestamp < trace->timestamp)
+        record->timestamp = trace->timestamp;
+
+    trace->timestamp = record->timestamp;
+    return 1;
+
+}
+
+streamtest_trace* streamtest_trace_open(const char* filename) {
+
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+        return NULL;
+
+    streamtest_trace* trace = malloc(sizeof(streamtest_trace));
+    trace->fd = fd;
+    trace->offset = 0;
+    trace->length = 0;
+    trace->timestamp = 0;
+    trace->records = 0;
+
+    /* Read enough to check for binary header */
+    while (trace->length < STREAMTEST_TRACE_MAGIC_LENGTH) {
+
+        int result = read(fd, trace->buffer + trace->length,
+                STREAMTEST_TRACE_BUFFER_SIZE - trace->length);
+
+        if (result == -1) {
+            free(trace);
+            close(fd);
+            return NULL;
+        }
+
+        if (result == 0)
+            break;
+
+        trace->length += result;
+
+    }
+
+    /* Skip header if binary */
+    if (trace->length >= STREAMTEST_TRACE_MAGIC_LENGTH
+            && memcmp(trace->buffer, STREAMTEST_TRACE_MAGIC,
+                STREAMTEST_TRACE_MAGIC_LENGTH) == 0) {
+        trace->format = STREAMTEST_TRACE_BINARY;
+        trace->offset = STREAMTEST_TRACE_MAGIC_LENGTH;
+    }
+
+    /* Assume CSV otherwise */
+    else
+        trace->format = STREAMTEST_TRACE_CSV;
+
+    return trace;
+
+}
+
+int streamtest_trace_next(streamtest_trace* trace,
+        streamtest_trace_record* record) {
+
+    int result;
+
+    if (trace->format == STREAMTEST_TRACE_BINARY)
+        result = streamtest_trace_next_binary(trace, record);
+    else
+        result = streamtest_trace_next_csv(trace, record);
+
+    if (result > 0)
+        trace->records++;
+
+    return result;
+
+}
+
+void streamtest_trace_close(streamtest_trace* trace) {
+    close(trace->fd);
+    free(trace);
+}
+
@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef STREAMTEST_TRACE_H
+#define STREAMTEST_TRACE_H
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * The size of the buffer used to read trace files, in bytes. Trace files are
+ * read incrementally through this buffer, and are never loaded into memory in
+ * their entirety.
+ */
+#define STREAMTEST_TRACE_BUFFER_SIZE 8192
+
+/**
+ * The magic number at the beginning of all binary trace files. Files which do
+ * not begin with this value are parsed as CSV.
+ */
+#define STREAMTEST_TRACE_MAGIC "GUACTRC1"
+
+/**
+ * The length of STREAMTEST_TRACE_MAGIC, in bytes.
+ */
+#define STREAMTEST_TRACE_MAGIC_LENGTH 8
+
+/**
+ * The formats in which a trace file may be written.
+ */
+typedef enum streamtest_trace_format {
+
+    /**
+     * One record per line, each line consisting of a timestamp in seconds
+     * (with optional fractional part) and a byte count, separated by a comma
+     * or whitespace. Blank lines, lines beginning with "#", and lines which
+     * do not begin with a number (such as column headers) are ignored.
+     */
+    STREAMTEST_TRACE_CSV,
+
+    /**
+     * The STREAMTEST_TRACE_MAGIC header followed by any number of records,
+     * each record consisting of two unsigned LEB128 varints: the number of
+     * microseconds elapsed since the previous record (or since the start of
+     * the trace, for the first record), followed by the byte count.
+     */
+    STREAMTEST_TRACE_BINARY
+
+} streamtest_trace_format;
+
+/**
+ * A single record from a trace file, describing a point in time at which a
+ * given amount of data was sent.
+ */
+typedef struct streamtest_trace_record {
+
+    /**
+     * The time at which the data was sent, in microseconds relative to the
+     * start of the trace.
+     */
+    int64_t timestamp;
+
+    /**
+     * The number of bytes sent.
+     */
+    int length;
+
+} streamtest_trace_record;
+
+/**
+ * An open trace file which is being read one record at a time.
+ */
+typedef struct streamtest_trace {
+
+    /**
+     * The file descriptor of the trace file.
+     */
+    int fd;
+
+    /**
+     * The format of the trace file, as determined from its first bytes.
+     */
+    streamtest_trace_format format;
+
+    /**
+     * Buffer containing data read from the trace file but not yet parsed.
+     */
+    unsigned char buffer[STREAMTEST_TRACE_BUFFER_SIZE];
+
+    /**
+     * The offset of the first unparsed byte within the buffer.
+     */
+    int offset;
+
+    /**
+     * The number of valid bytes within the buffer.
+     */
+    int length;
+
+    /**
+     * The timestamp of the most recently parsed record, in microseconds.
+     */
+    int64_t timestamp;
+
+    /**
+     * The number of records successfully read from the trace file so far.
+     */
+    int records;
+
+} streamtest_trace;
+
+/**
+ * Opens the given trace file, determining its format automatically.
+ *
+ * @param filename
+ *     The path to the trace file to open.
+ *
+ * @return
+ *     A newly-allocated streamtest_trace, or NULL if the file could not be
+ *     opened, in which case errno is set appropriately.
+ */
+streamtest_trace* streamtest_trace_open(const char* filename);
+
+/**
+ * Reads the next record from the given trace file.
+ *
+ * @param trace
+ *     The trace file to read from.
+ *
+ * @param record
+ *     The streamtest_trace_record to populate with the record read.
+ *
+ * @return
+ *     Positive if a record was read, zero if the end of the trace has been
+ *     reached, or negative if the trace is malformed or cannot be read.
+ */
+int streamtest_trace_next(streamtest_trace* trace,
+        streamtest_trace_record* record);
+
+/**
+ * Closes the given trace file, freeing all associated resources.
+ *
+ * @param trace
+ *     The trace file to close.
+ */
+void streamtest_trace_close(streamtest_trace* trace);
+
+#endif
+
@@ -0,0 +1,261 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+#include "abr.h"
+#include "follow.h"
+#include "image.h"
+#include "pcm.h"
+#include "playlist.h"
+#include "source.h"
+#include "trace.h"
+#include "track.h"
+
+#include <guacamole/client.h>
+#include <guacamole/protocol.h>
+#include <guacamole/socket.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+int streamtest_track_mode(const char* mimetype,
+        streamtest_playback_mode* mode) {
+
+    streamtest_image_format format;
+
+    if (strncmp(mimetype, "audio/", 6) == 0)
+        *mode = STREAMTEST_AUDIO;
+    else if (strncmp(mimetype, "video/", 6) == 0)
+        *mode = STREAMTEST_VIDEO;
+    else if (streamtest_image_parse_format(mimetype, &format) == 0)
+        *mode = STREAMTEST_IMAGE;
+    else
+        return 1;
+
+    return 0;
+
+}
+
+/**
+ * Creates the converter for the current stream of the given track, if the
+ * track requests conversion and its source is raw PCM audio, freeing any
+ * converter of the previous stream.
+ *
+ * @param client
+ *     The guac_client associated with the connection being streamed.
+ *
+ * @param track
+ *     The track whose converter should be created.
+ *
+ * @param mimetype
+ *     A buffer of at least STREAMTEST_PCM_MIMETYPE_LENGTH bytes which
+ *     receives the mimetype of the converted audio.
+ *
+ * @return
+ *     true if audio will be converted, false otherwise.
+ */
+static bool streamtest_track_init_pcm(guac_client* client,
+        streamtest_track* track, char* mimetype) {
+
+    /* Conversion state never carries over between streams */
+    if (track->pcm != NULL) {
+        streamtest_pcm_converter_free(track->pcm);
+        track->pcm = NULL;
+    }
+
+    streamtest_pcm_format* requested = &track->pcm_output;
+    if (requested->rate == 0 && requested->channels == 0
+            && requested->bits == 0)
+        return false;
+
+    streamtest_pcm_format input;
+    if (streamtest_pcm_parse_format(track->mimetype, &input)) {
+        guac_client_log(client, GUAC_LOG_WARNING, "Stream %i is not raw PCM "
+                "audio (\"%s\") and will not be converted", track->index,
+                track->mimetype);
+        return false;
+    }
+
+    /* Keep properties of source unless overridden, noting that clients
+     * support only 8 and 16 bits per sample */
+    streamtest_pcm_format output = input;
+    if (requested->rate != 0)
+        output.rate = requested->rate;
+    if (requested->channels != 0)
+        output.channels = requested->channels;
+    if (requested->bits != 0)
+        output.bits = requested->bits;
+    else if (output.bits > 16)
+        output.bits = 16;
+
+    track->pcm = streamtest_pcm_converter_alloc(&input, &output);
+    streamtest_pcm_format_mimetype(&output, mimetype);
+
+    guac_client_log(client, GUAC_LOG_DEBUG, "Converting stream %i from "
+            "\"%s\" to \"%s\" (%s)", track->index, track->mimetype,
+            mimetype, streamtest_pcm_kernel_name());
+
+    return true;
+
+}
+
+void streamtest_track_begin_stream(guac_client* client,
+        streamtest_track* track) {
+
+    /* Each image has a stream of its own, begun once the image is read */
+    if (track->mode == STREAMTEST_IMAGE) {
+        streamtest_image_parse_format(track->mimetype, &track->image_format);
+        track->image_length = 0;
+        track->stream = NULL;
+        return;
+    }
+
+    /* Stream converted audio, if converting */
+    char converted[STREAMTEST_PCM_MIMETYPE_LENGTH];
+    const char* mimetype = track->mimetype;
+    if (streamtest_track_init_pcm(client, track, converted))
+        mimetype = converted;
+
+    track->stream = guac_client_alloc_stream(client);
+
+    switch (track->mode) {
+
+        case STREAMTEST_AUDIO:
+            guac_protocol_send_audio(client->socket, track->stream,
+                    mimetype);
+            break;
+
+        case STREAMTEST_VIDEO:
+            guac_protocol_send_video(client->socket, track->stream,
+                    GUAC_DEFAULT_LAYER, mimetype);
+            break;
+
+        /* There are no other playback modes */
+        default:
+            assert(false);
+
+    }
+
+}
+
+void streamtest_track_begin_image(guac_client* client,
+        streamtest_track* track) {
+    track->stream = guac_client_alloc_stream(client);
+    guac_protocol_send_img(client->socket, track->stream, GUAC_COMP_SRC,
+            GUAC_DEFAULT_LAYER, track->mimetype, 0, 0);
+}
+
+void streamtest_track_end_stream(guac_client* client,
+        streamtest_track* track) {
+
+    /* Image streams exist only while an image is being sent */
+    if (track->stream == NULL)
+        return;
+
+    guac_protocol_send_end(client->socket, track->stream);
+    guac_client_free_stream(client, track->stream);
+    track->stream = NULL;
+
+}
+
+void streamtest_track_prefetch(guac_client* client,
+        streamtest_track* track) {
+
+    track->next_source = NULL;
+    if (track->playlist == NULL)
+        return;
+
+    /* Try each other item at most once */
+    int index = track->item;
+    for (int i = 0; i < track->playlist->count; i++) {
+
+        index = streamtest_playlist_next(track->playlist, index, track->loop);
+        if (index == -1)
+            return;
+
+        streamtest_playlist_item* item = &track->playlist->items[index];
+        streamtest_source* source = streamtest_source_open(item->spec,
+                track->source_backend);
+
+        /* Warm up source such that the transition has no startup delay */
+        if (source != NULL) {
+            streamtest_source_prefetch(source, track->buffer_size);
+            track->next_source = source;
+            track->next_item = index;
+            return;
+        }
+
+        guac_client_log(client, GUAC_LOG_WARNING, "Skipping item %i of the "
+                "playlist of stream %i, as \"%s\" cannot be opened: %s",
+                index + 1, track->index, item->spec, strerror(errno));
+
+    }
+
+}
+
+bool streamtest_track_complete(streamtest_track* track) {
+    return track->eof && track->buffer_length == 0;
+}
+
+void streamtest_track_free(guac_client* client, streamtest_track* track) {
+
+    /* Close source being streamed, and any prefetched source */
+    if (track->renditions != NULL)
+        streamtest_renditions_free(track->renditions);
+    else
+        streamtest_source_close(track->source);
+    if (track->next_source != NULL)
+        streamtest_source_close(track->next_source);
+    if (track->degrade_source != NULL)
+        streamtest_source_close(track->degrade_source);
+
+    /* Free stream, if any */
+    if (track->stream != NULL)
+        guac_client_free_stream(client, track->stream);
+    free(track->frame_buffer);
+    free(track->shaper);
+
+    /* Free conversion state, if any */
+    if (track->pcm != NULL)
+        streamtest_pcm_converter_free(track->pcm);
+    free(track->pcm_buffer);
+    free(track->image_buffer);
+
+    /* Close trace, if any */
+    if (track->trace != NULL)
+        streamtest_trace_close(track->trace);
+
+    /* Stop following file, if followed */
+    if (track->follow != NULL)
+        streamtest_follow_free(track->follow);
+
+    if (track->playlist != NULL)
+        streamtest_playlist_free(track->playlist);
+
+    free(track->mimetype);
+    free(track);
+
+}
+
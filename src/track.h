@@ -0,0 +1,487 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef STREAMTEST_TRACK_H
+#define STREAMTEST_TRACK_H
+
+#include "config.h"
+#include "abr.h"
+#include "follow.h"
+#include "image.h"
+#include "pcm.h"
+#include "playlist.h"
+#include "shaper.h"
+#include "source.h"
+#include "stats.h"
+#include "trace.h"
+#include "watch.h"
+
+#include <guacamole/client.h>
+#include <guacamole/stream.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * The mode of playback to use. While data will be streamed identically
+ * regardless of its type, the manner of setup for the display is different.
+ * Audio streams will require a progress bar, while video streams need to use
+ * the display for their own output.
+ */
+typedef enum streamtest_playback_mode {
+
+    /**
+     * Audio is being streamed, and its current progress should be displayed as
+     * a progress bar.
+     */
+    STREAMTEST_AUDIO,
+
+    /**
+     * Video is being streamed. No progress bar should be displayed, and the
+     * Guacamole display should be used solely for video output.
+     */
+    STREAMTEST_VIDEO,
+
+    /**
+     * A sequence of pre-encoded images is being streamed, each over its own
+     * "img" stream drawn to the default layer. As with video, the Guacamole
+     * display is used solely for output.
+     */
+    STREAMTEST_IMAGE
+
+} streamtest_playback_mode;
+
+/**
+ * The playback state of a single media stream within a connection. Each
+ * track has its own source, frame rate and pacing, while all tracks of a
+ * connection are streamed by the same sender. With the exception of
+ * initialization, this state is only modified by the sender.
+ */
+typedef struct streamtest_track {
+
+    /**
+     * The zero-based index of this track within the connection.
+     */
+    int index;
+
+    /**
+     * Whether we are currently playing audio or video.
+     */
+    streamtest_playback_mode mode;
+
+    /**
+     * The mimetype of the media currently being streamed.
+     */
+    char* mimetype;
+
+    /**
+     * The vertical position of the progress bar of this track, in pixels.
+     * Only audio tracks have progress bars.
+     */
+    int progress_y;
+
+    /**
+     * The duration of each frame, in microseconds.
+     */
+    int frame_duration;
+
+    /**
+     * The number of bytes to stream with each frame.
+     */
+    int frame_bytes;
+
+    /**
+     * The number of requested frames coalesced into each frame, such that
+     * they are read and sent at once. The frame duration and size above
+     * include all frames of the batch.
+     */
+    int batch;
+
+    /**
+     * A buffer into which bytes pending streaming can be read. This buffer
+     * will be at least frame_bytes in size.
+     */
+    unsigned char* frame_buffer;
+
+    /**
+     * The size of frame_buffer, in bytes. If a rate shaper is in use, this
+     * will be large enough to hold a full frame in addition to a full bucket
+     * of data awaiting tokens.
+     */
+    int buffer_size;
+
+    /**
+     * The number of bytes within frame_buffer which have been read but not
+     * yet sent.
+     */
+    int buffer_length;
+
+    /**
+     * Whether the end of the file (or of the trace being replayed) has been
+     * reached.
+     */
+    bool eof;
+
+    /**
+     * The inotify monitor of the file being streamed, if the file is still
+     * being written and should be followed rather than treated as complete
+     * upon reaching its end, or NULL if the file is not being followed.
+     */
+    streamtest_follow* follow;
+
+    /**
+     * Whether all data currently available from the source has been read,
+     * such that further data should be read as soon as it is appended to the
+     * followed file or arrives from a non-seekable source, rather than when
+     * the next frame is due.
+     */
+    bool live;
+
+    /**
+     * The watch which wakes the sender when the followed file is modified or
+     * data arrives from a non-seekable source, or NULL if the source is a
+     * regular file which is not being followed. This is created by the
+     * sender.
+     */
+    streamtest_watch* watch;
+
+    /**
+     * The traffic trace being replayed, or NULL if frames are read at a fixed
+     * size and interval.
+     */
+    streamtest_trace* trace;
+
+    /**
+     * The trace record describing the next frame to be read, if a trace is
+     * being replayed.
+     */
+    streamtest_trace_record trace_record;
+
+    /**
+     * The number of microseconds between the trace record of the most
+     * recently read frame and the trace record of the next frame.
+     */
+    int64_t trace_delta;
+
+    /**
+     * Whether trace_record is the final record of the trace being replayed.
+     */
+    bool trace_complete;
+
+    /**
+     * The token bucket rate shaper which limits how quickly data read from
+     * the file may be sent, or NULL if data is sent as soon as it is read.
+     */
+    streamtest_shaper* shaper;
+
+    /**
+     * The raw PCM format which audio should be converted to before being
+     * streamed. Any property which is zero is left as in the source. If all
+     * properties are zero, no conversion is performed.
+     */
+    streamtest_pcm_format pcm_output;
+
+    /**
+     * The converter applied to raw PCM audio read from the source, or NULL
+     * if data is streamed exactly as read. This is recreated whenever a new
+     * stream begins.
+     */
+    streamtest_pcm_converter* pcm;
+
+    /**
+     * A buffer into which raw PCM audio is read prior to conversion, with
+     * only the converted audio added to frame_buffer, or NULL if no audio
+     * has yet been converted.
+     */
+    unsigned char* pcm_buffer;
+
+    /**
+     * The size of pcm_buffer, in bytes.
+     */
+    int pcm_buffer_size;
+
+    /**
+     * The format of the images being streamed, if streaming images.
+     */
+    streamtest_image_format image_format;
+
+    /**
+     * A buffer into which data is read until a whole image is available, if
+     * streaming images. Each image is moved to frame_buffer once complete,
+     * unless it is dropped.
+     */
+    unsigned char* image_buffer;
+
+    /**
+     * The size of image_buffer, in bytes.
+     */
+    int image_buffer_size;
+
+    /**
+     * The number of bytes within image_buffer.
+     */
+    int image_length;
+
+    /**
+     * The media data of the chunk currently being sent, if streaming a
+     * pre-chunked file, pointing directly into the mapped file, or of the
+     * frame currently being sent, if lent by the source without copying
+     * (see streamtest_source_peek()). The chunk is sent in place of
+     * frame_buffer, with buffer_length being the number of bytes of media
+     * data not yet sent. NULL if no chunk is being sent.
+     */
+    const unsigned char* chunk_data;
+
+    /**
+     * The number of bytes of media data within the chunk currently being
+     * sent.
+     */
+    int chunk_length;
+
+    /**
+     * Whether chunk_data is already base64-encoded.
+     */
+    bool chunk_encoded;
+
+    /**
+     * The time between the start of the chunk most recently read and the
+     * next, in microseconds, as dictated by the table of the pre-chunked
+     * file.
+     */
+    int64_t chunk_duration;
+
+    /**
+     * The stream over which data from the specified file will be streamed.
+     * If streaming images, this is the stream of the image currently being
+     * sent, or NULL if no image is being sent.
+     */
+    guac_stream* stream;
+
+    /**
+     * The source of the data being streamed.
+     */
+    streamtest_source* source;
+
+    /**
+     * The backend through which regular files streamed by this track,
+     * including those of its playlist, are read.
+     */
+    const streamtest_source_backend* source_backend;
+
+    /**
+     * The total number of bytes within the file, or -1 if the source is not
+     * a regular file and its size is unknown.
+     */
+    int file_size;
+
+    /**
+     * The sources to stream one after another, or NULL if only the original
+     * source is streamed.
+     */
+    streamtest_playlist* playlist;
+
+    /**
+     * Whether the playlist restarts from its first item once its last item
+     * has been streamed.
+     */
+    bool loop;
+
+    /**
+     * The index of the playlist item currently being streamed.
+     */
+    int item;
+
+    /**
+     * The source of the next playlist item, opened in advance such that it
+     * is ready to be read as soon as the current source ends, or NULL if
+     * there is no next item.
+     */
+    streamtest_source* next_source;
+
+    /**
+     * The index of the playlist item associated with next_source.
+     */
+    int next_item;
+
+    /**
+     * Whether the current source has ended and the next source has a
+     * different mimetype, such that a new stream must be started once all
+     * data of the current source has been sent.
+     */
+    bool switch_pending;
+
+    /**
+     * The renditions which the track switches between as the throughput of
+     * the client changes, or NULL if the track streams a single encoding.
+     * If present, the source of the track is that of the current rendition,
+     * and is owned by the renditions.
+     */
+    streamtest_renditions* renditions;
+
+    /**
+     * A lower-rate rendition of the source being streamed, opened in advance
+     * such that the track can switch to it without delay should it fall
+     * behind under STREAMTEST_REALTIME_DEGRADE, or NULL if there is no such
+     * rendition or the track has already switched to it.
+     */
+    streamtest_source* degrade_source;
+
+    /**
+     * Whether images are currently being read only to be dropped, as the
+     * track skips stale data to catch up with the wall clock.
+     */
+    bool catching_up;
+
+    /**
+     * The time at which the next frame is due, as returned by
+     * streamtest_utime().
+     */
+    int64_t next_frame;
+
+    /**
+     * The amount of media time read from the source so far, in
+     * microseconds, as implied by the frame duration (or trace timing) of
+     * each frame read.
+     */
+    int64_t media_time;
+
+    /**
+     * The media time at the start of the most recently read frame, in
+     * microseconds. The track is considered to be positioned anywhere
+     * between this time and media_time.
+     */
+    int64_t media_start;
+
+    /**
+     * Running statistics describing the performance of this track.
+     */
+    streamtest_stats stats;
+
+} streamtest_track;
+
+/**
+ * Determines the playback mode appropriate for the given mimetype. Images
+ * are only supported in the formats accepted by
+ * streamtest_image_parse_format().
+ *
+ * @param mimetype
+ *     The mimetype of the media to be streamed.
+ *
+ * @param mode
+ *     Pointer to the streamtest_playback_mode which should receive the
+ *     playback mode.
+ *
+ * @return
+ *     Zero if the mimetype is an audio, video or supported image type,
+ *     non-zero otherwise.
+ */
+int streamtest_track_mode(const char* mimetype,
+        streamtest_playback_mode* mode);
+
+/**
+ * Allocates a new stream for the given track and sends the instruction
+ * which begins playback of that stream, using the current mode and mimetype
+ * of the track. If the track requests conversion of raw PCM audio, a new
+ * converter is created for the stream, and the stream is given the mimetype
+ * of the converted audio. Sources which are not raw PCM are streamed
+ * without conversion. If streaming images, no stream is allocated until each
+ * image is sent (see streamtest_track_begin_image()).
+ *
+ * @param client
+ *     The guac_client associated with the connection being streamed.
+ *
+ * @param track
+ *     The track whose stream should begin.
+ */
+void streamtest_track_begin_stream(guac_client* client,
+        streamtest_track* track);
+
+/**
+ * Allocates a new stream for the next image of the given track and sends
+ * the "img" instruction which begins that image, drawing it to the default
+ * layer.
+ *
+ * @param client
+ *     The guac_client associated with the connection being streamed.
+ *
+ * @param track
+ *     The track whose next image is about to be sent.
+ */
+void streamtest_track_begin_image(guac_client* client,
+        streamtest_track* track);
+
+/**
+ * Ends the current stream of the given track, notifying the client and
+ * freeing the stream. If streaming images and no image is being sent, this
+ * has no effect.
+ *
+ * @param client
+ *     The guac_client associated with the connection being streamed.
+ *
+ * @param track
+ *     The track whose stream should end.
+ */
+void streamtest_track_end_stream(guac_client* client,
+        streamtest_track* track);
+
+/**
+ * Opens the source of the playlist item following the current item of the
+ * given track, storing it as the track's next source, such that the next
+ * item is ready to be read as soon as the current item ends. Items whose
+ * sources cannot be opened are skipped. If the track has no playlist or the
+ * current item is the last, the next source is set to NULL.
+ *
+ * @param client
+ *     The guac_client associated with the connection being streamed.
+ *
+ * @param track
+ *     The track whose next source should be opened.
+ */
+void streamtest_track_prefetch(guac_client* client, streamtest_track* track);
+
+/**
+ * Returns whether the given track has finished streaming, having reached
+ * the end of its source with all data sent.
+ *
+ * @param track
+ *     The track to check.
+ *
+ * @return
+ *     true if all data of the given track has been sent, false otherwise.
+ */
+bool streamtest_track_complete(streamtest_track* track);
+
+/**
+ * Frees the given track, closing its sources (including any renditions) and
+ * trace and freeing its stream and playlist. The sender MUST already have
+ * been freed, and the track's watch with it.
+ *
+ * @param client
+ *     The guac_client which owns the stream of the track.
+ *
+ * @param track
+ *     The track to free.
+ */
+void streamtest_track_free(guac_client* client, streamtest_track* track);
+
+#endif
+
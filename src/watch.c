@@ -0,0 +1,310 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+#include "scheduler.h"
+#include "watch.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+/**
+ * The process-wide poller which wakes tasks as their watched file
+ * descriptors become readable.
+ */
+typedef struct streamtest_poller {
+
+    /**
+     * The number of watches which currently exist. The poller is started
+     * when this becomes non-zero and stopped when it returns to zero. This
+     * member is guarded by streamtest_poller_instance_lock.
+     */
+    int refcount;
+
+    /**
+     * The epoll file descriptor containing all watched file descriptors.
+     */
+    int epoll_fd;
+
+    /**
+     * An eventfd which is signalled to stop the poller thread.
+     */
+    int stop_fd;
+
+    /**
+     * The poller thread.
+     */
+    pthread_t thread;
+
+    /**
+     * Lock which is held while the poller thread dispatches events, and
+     * which guards the active member of all watches and the list of freed
+     * watches.
+     */
+    pthread_mutex_t lock;
+
+    /**
+     * Watches which have been freed and removed from epoll, but which may
+     * still be referenced by events returned by an in-progress
+     * epoll_wait().
+     */
+    streamtest_watch* freed;
+
+} streamtest_poller;
+
+/**
+ * The process-wide poller, or NULL if no watches currently exist.
+ */
+static streamtest_poller* streamtest_poller_instance = NULL;
+
+/**
+ * Lock which guards creation and destruction of the process-wide poller.
+ */
+static pthread_mutex_t streamtest_poller_instance_lock =
+    PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * The body of the poller thread, which waits for watched file descriptors to
+ * become readable and wakes their associated tasks.
+ *
+ * @param data
+ *     The streamtest_poller being serviced.
+ *
+ * @return
+ *     Always NULL.
+ */
+static void* streamtest_poller_thread(void* data) {
+
+    streamtest_poller* poller = (streamtest_poller*) data;
+    struct epoll_event events[STREAMTEST_WATCH_MAX_EVENTS];
+
+    for (;;) {
+
+        int count = epoll_wait(poller->epoll_fd, events,
+                STREAMTEST_WATCH_MAX_EVENTS, -1);
+
+        if (count == -1 && errno != EINTR)
+            break;
+
+        pthread_mutex_lock(&poller->lock);
+
+        bool stopping = false;
+        for (int i = 0; i < count; i++) {
+
+            streamtest_watch* watch = (streamtest_watch*) events[i].data.ptr;
+
+            /* The stop eventfd has no associated watch */
+            if (watch == NULL)
+                stopping = true;
+
+            /* Wake only tasks whose watches have not been freed */
+            else if (watch->active)
+                streamtest_task_wake(watch->task);
+
+        }
+
+        /* Any freed watches were removed from epoll before this batch was
+         * dispatched, thus can no longer be referenced */
+        while (poller->freed != NULL) {
+            streamtest_watch* next = poller->freed->next;
+            free(poller->freed);
+            poller->freed = next;
+        }
+
+        pthread_mutex_unlock(&poller->lock);
+
+        if (stopping)
+            break;
+
+    }
+
+    return NULL;
+
+}
+
+/**
+ * Allocates and starts the process-wide poller, storing it within
+ * streamtest_poller_instance. The instance lock must be held.
+ *
+ * @return
+ *     Zero if the poller was started successfully, non-zero otherwise.
+ */
+static int streamtest_poller_start() {
+
+    streamtest_poller* poller = calloc(1, sizeof(streamtest_poller));
+
+    poller->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (poller->epoll_fd == -1)
+        goto fail_epoll;
+
+    poller->stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (poller->stop_fd == -1)
+        goto fail_eventfd;
+
+    /* Stop eventfd is identified by a NULL watch */
+    struct epoll_event event = {
+        .events = EPOLLIN,
+        .data.ptr = NULL
+    };
+
+    if (epoll_ctl(poller->epoll_fd, EPOLL_CTL_ADD, poller->stop_fd, &event))
+        goto fail_thread;
+
+    pthread_mutex_init(&poller->lock, NULL);
+
+    if (pthread_create(&poller->thread, NULL, streamtest_poller_thread,
+                poller)) {
+        pthread_mutex_destroy(&poller->lock);
+        goto fail_thread;
+    }
+
+    streamtest_poller_instance = poller;
+    return 0;
+
+fail_thread:
+    close(poller->stop_fd);
+
+fail_eventfd:
+    close(poller->epoll_fd);
+
+fail_epoll:
+    free(poller);
+    return 1;
+
+}
+
+/**
+ * Stops and frees the process-wide poller. No watches may exist. The
+ * instance lock must be held.
+ */
+static void streamtest_poller_stop() {
+
+    streamtest_poller* poller = streamtest_poller_instance;
+
+    /* Signal poller thread to stop and wait for it to do so */
+    uint64_t value = 1;
+    if (write(poller->stop_fd, &value, sizeof(value)) == sizeof(value))
+        pthread_join(poller->thread, NULL);
+
+    /* Free any watches which the poller thread did not get to */
+    while (poller->freed != NULL) {
+        streamtest_watch* next = poller->freed->next;
+        free(poller->freed);
+        poller->freed = next;
+    }
+
+    pthread_mutex_destroy(&poller->lock);
+    close(poller->stop_fd);
+    close(poller->epoll_fd);
+    free(poller);
+
+    streamtest_poller_instance = NULL;
+
+}
+
+streamtest_watch* streamtest_watch_alloc(streamtest_task* task, int fd) {
+
+    pthread_mutex_lock(&streamtest_poller_instance_lock);
+
+    /* Start poller if this is the first watch */
+    if (streamtest_poller_instance == NULL && streamtest_poller_start()) {
+        pthread_mutex_unlock(&streamtest_poller_instance_lock);
+        return NULL;
+    }
+
+    streamtest_poller* poller = streamtest_poller_instance;
+
+    streamtest_watch* watch = malloc(sizeof(streamtest_watch));
+    watch->task = task;
+    watch->fd = fd;
+    watch->active = true;
+    watch->next = NULL;
+
+    /* Register file descriptor, initially disabled */
+    struct epoll_event event = {
+        .events = EPOLLONESHOT,
+        .data.ptr = watch
+    };
+
+    if (epoll_ctl(poller->epoll_fd, EPOLL_CTL_ADD, fd, &event)) {
+
+        int error = errno;
+        free(watch);
+
+        if (poller->refcount == 0)
+            streamtest_poller_stop();
+
+        pthread_mutex_unlock(&streamtest_poller_instance_lock);
+        errno = error;
+        return NULL;
+
+    }
+
+    poller->refcount++;
+
+    pthread_mutex_unlock(&streamtest_poller_instance_lock);
+    return watch;
+
+}
+
+int streamtest_watch_arm(streamtest_watch* watch) {
+
+    struct epoll_event event = {
+        .events = EPOLLIN | EPOLLONESHOT,
+        .data.ptr = watch
+    };
+
+    return epoll_ctl(streamtest_poller_instance->epoll_fd, EPOLL_CTL_MOD,
+            watch->fd, &event);
+
+}
+
+void streamtest_watch_free(streamtest_watch* watch) {
+
+    pthread_mutex_lock(&streamtest_poller_instance_lock);
+    streamtest_poller* poller = streamtest_poller_instance;
+
+    /* Deactivate watch, waiting for any in-progress dispatch to finish */
+    pthread_mutex_lock(&poller->lock);
+    epoll_ctl(poller->epoll_fd, EPOLL_CTL_DEL, watch->fd, NULL);
+    watch->active = false;
+
+    /* Defer deallocation until no pending events can reference the watch */
+    watch->next = poller->freed;
+    poller->freed = watch;
+    pthread_mutex_unlock(&poller->lock);
+
+    /* Stop poller if this was the last watch */
+    if (--poller->refcount == 0)
+        streamtest_poller_stop();
+
+    pthread_mutex_unlock(&streamtest_poller_instance_lock);
+
+}
+
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef STREAMTEST_WATCH_H
+#define STREAMTEST_WATCH_H
+
+#include "config.h"
+#include "scheduler.h"
+
+#include <stdbool.h>
+
+/**
+ * The maximum number of events handled by the poller thread per call to
+ * epoll_wait().
+ */
+#define STREAMTEST_WATCH_MAX_EVENTS 64
+
+/**
+ * An association between a file descriptor and a scheduler task, such that
+ * the task is woken when the file descriptor becomes readable. All watches
+ * are serviced by a single process-wide poller thread using epoll, which is
+ * started with the first watch and stopped with the last.
+ *
+ * Watches are one-shot: once the task has been woken, the watch must be
+ * re-armed with streamtest_watch_arm() before the task will be woken again.
+ */
+typedef struct streamtest_watch {
+
+    /**
+     * The task to wake when the file descriptor becomes readable.
+     */
+    streamtest_task* task;
+
+    /**
+     * The file descriptor being watched.
+     */
+    int fd;
+
+    /**
+     * Whether the watch is still in use. Watches which have been freed
+     * remain allocated until the poller thread can guarantee that no events
+     * referencing them are pending. This member is guarded by the poller
+     * lock.
+     */
+    bool active;
+
+    /**
+     * The next watch awaiting deallocation, if this watch has been freed.
+     */
+    struct streamtest_watch* next;
+
+} streamtest_watch;
+
+/**
+ * Allocates a new watch which will wake the given task whenever the given
+ * file descriptor becomes readable. The watch is initially unarmed.
+ *
+ * @param task
+ *     The task to wake.
+ *
+ * @param fd
+ *     The file descriptor to watch.
+ *
+ * @return
+ *     A newly-allocated watch, or NULL if the file descriptor cannot be
+ *     watched or the poller thread cannot be started, in which case errno is
+ *     set appropriately.
+ */
+streamtest_watch* streamtest_watch_alloc(streamtest_task* task, int fd);
+
+/**
+ * Arms the given watch, such that its task will be woken once the watched
+ * file descriptor is readable. If the file descriptor is already readable,
+ * the task is woken immediately.
+ *
+ * @param watch
+ *     The watch to arm.
+ *
+ * @return
+ *     Zero on success, non-zero if the watch could not be armed, in which
+ *     case errno is set appropriately.
+ */
+int streamtest_watch_arm(streamtest_watch* watch);
+
+/**
+ * Stops watching the file descriptor associated with the given watch and
+ * frees the watch. Once this function returns, the watch will never again
+ * wake its task, thus the task may be safely freed. The watched file
+ * descriptor is not closed.
+ *
+ * @param watch
+ *     The watch to free.
+ */
+void streamtest_watch_free(streamtest_watch* watch);
+
+#endif
+
@@ -0,0 +1,400 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * streamtest-events: converts an event dump, as written by the plugin and
+ * defined by events.h, into the JSON trace event format understood by
+ * chrome://tracing and Perfetto, such that the timing of each connection can
+ * be inspected on a timeline.
+ */
+
+#include "config.h"
+#include "events.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * The thread ID under which events which do not relate to any one track are
+ * shown. Events of each track are shown under the thread ID one greater than
+ * the index of the track.
+ */
+#define STREAMTEST_EVENTS_SENDER_TID 0
+
+/**
+ * The largest number of tracks whose events are distinguished. Events of
+ * tracks beyond this are ignored.
+ */
+#define STREAMTEST_EVENTS_MAX_TRACKS 64
+
+/**
+ * The state of the conversion, tracking events which begin a span until the
+ * events which end that span are found.
+ */
+typedef struct streamtest_events_converter {
+
+    /**
+     * The file the converted events are written to.
+     */
+    FILE* output;
+
+    /**
+     * The timestamp of the first event, in nanoseconds. All timestamps are
+     * written relative to this.
+     */
+    int64_t base;
+
+    /**
+     * Whether any events have been written, and thus whether the next must
+     * be preceded by a comma.
+     */
+    bool written;
+
+    /**
+     * The most recent SLEEP_START event not yet matched by a SLEEP_END
+     * event, if sleeping is true.
+     */
+    streamtest_event sleep;
+
+    /**
+     * Whether the sender is asleep.
+     */
+    bool sleeping;
+
+    /**
+     * The most recent FRAME_START event of each track not yet matched by a
+     * READ_DONE event, if the corresponding reading flag is true.
+     */
+    streamtest_event frames[STREAMTEST_EVENTS_MAX_TRACKS];
+
+    /**
+     * Whether a frame of each track is being read.
+     */
+    bool reading[STREAMTEST_EVENTS_MAX_TRACKS];
+
+    /**
+     * Whether each track has been named.
+     */
+    bool named[STREAMTEST_EVENTS_MAX_TRACKS];
+
+} streamtest_events_converter;
+
+/**
+ * Prints usage information for this tool to STDERR.
+ *
+ * @param name
+ *     The name this tool was invoked as.
+ */
+static void streamtest_events_usage(const char* name) {
+    fprintf(stderr, "Usage: %s DUMP [OUTPUT]\n\n"
+            "Converts DUMP to JSON trace events, writing to OUTPUT or, if "
+            "omitted, STDOUT.\n", name);
+}
+
+/**
+ * Begins writing a single trace event, writing all fields common to all
+ * events. The caller must write any additional fields, followed by the
+ * closing brace.
+ *
+ * @param converter
+ *     The converter writing the event.
+ *
+ * @param phase
+ *     The trace event phase, such as "X" for a complete event or "i" for an
+ *     instant event.
+ *
+ * @param name
+ *     The name of the event.
+ *
+ * @param tid
+ *     The thread ID to show the event under.
+ *
+ * @param timestamp
+ *     The time of the event, in nanoseconds, as recorded.
+ */
+static void streamtest_events_begin(streamtest_events_converter* converter,
+        const char* phase, const char* name, int tid, int64_t timestamp) {
+
+    fprintf(converter->output, "%s\n{\"ph\":\"%s\",\"name\":\"%s\","
+            "\"pid\":0,\"tid\":%i,\"ts\":%.3f",
+            converter->written ? "," : "", phase, name, tid,
+            (timestamp - converter->base) / 1000.0);
+
+    converter->written = true;
+
+}
+
+/**
+ * Writes a metadata event naming the given thread ID.
+ *
+ * @param converter
+ *     The converter writing the event.
+ *
+ * @param tid
+ *     The thread ID to name.
+ *
+ * @param name
+ *     The name to show for the thread ID.
+ */
+static void streamtest_events_name(streamtest_events_converter* converter,
+        int tid, const char* name) {
+
+    streamtest_events_begin(converter, "M", "thread_name", tid,
+            converter->base);
+    fprintf(converter->output, ",\"args\":{\"name\":\"%s\"}}", name);
+
+}
+
+/**
+ * Writes an instant event having a single numeric argument.
+ *
+ * @param converter
+ *     The converter writing the event.
+ *
+ * @param name
+ *     The name of the event.
+ *
+ * @param tid
+ *     The thread ID to show the event under.
+ *
+ * @param event
+ *     The recorded event.
+ *
+ * @param arg
+ *     The name of the argument to store the value of the event within.
+ */
+static void streamtest_events_instant(streamtest_events_converter* converter,
+        const char* name, int tid, streamtest_event* event, const char* arg) {
+
+    streamtest_events_begin(converter, "i", name, tid, event->timestamp);
+    fprintf(converter->output, ",\"s\":\"t\",\"args\":{\"%s\":%" PRId64
+            "}}", arg, event->value);
+
+}
+
+/**
+ * Writes a complete event spanning the time between two recorded events.
+ *
+ * @param converter
+ *     The converter writing the event.
+ *
+ * @param name
+ *     The name of the event.
+ *
+ * @param tid
+ *     The thread ID to show the event under.
+ *
+ * @param start
+ *     The recorded event beginning the span.
+ *
+ * @param start_arg
+ *     The name of the argument to store the value of the first event
+ *     within.
+ *
+ * @param end
+ *     The recorded event ending the span.
+ *
+ * @param end_arg
+ *     The name of the argument to store the value of the second event
+ *     within.
+ */
+static void streamtest_events_span(streamtest_events_converter* converter,
+        const char* name, int tid, streamtest_event* start,
+        const char* start_arg, streamtest_event* end, const char* end_arg) {
+
+    streamtest_events_begin(converter, "X", name, tid, start->timestamp);
+    fprintf(converter->output, ",\"dur\":%.3f,\"args\":{\"%s\":%" PRId64
+            ",\"%s\":%" PRId64 "}}",
+            (end->timestamp - start->timestamp) / 1000.0,
+            start_arg, start->value, end_arg, end->value);
+
+}
+
+/**
+ * Converts a single recorded event, writing any trace events which it
+ * completes.
+ *
+ * @param converter
+ *     The converter writing the events.
+ *
+ * @param event
+ *     The recorded event to convert.
+ */
+static void streamtest_events_convert(streamtest_events_converter* converter,
+        streamtest_event* event) {
+
+    int tid = STREAMTEST_EVENTS_SENDER_TID;
+    int track = event->track;
+
+    /* Name each track on first sight */
+    if (track != STREAMTEST_EVENTS_NO_TRACK) {
+
+        if (track < 0 || track >= STREAMTEST_EVENTS_MAX_TRACKS)
+            return;
+
+        tid = track + 1;
+        if (!converter->named[track]) {
+            char name[32];
+            snprintf(name, sizeof(name), "stream %i", track);
+            streamtest_events_name(converter, tid, name);
+            converter->named[track] = true;
+        }
+
+    }
+
+    switch (event->type) {
+
+        case STREAMTEST_EVENT_SLEEP_START:
+            converter->sleep = *event;
+            converter->sleeping = true;
+            break;
+
+        case STREAMTEST_EVENT_SLEEP_END:
+            if (converter->sleeping)
+                streamtest_events_span(converter, "sleep", tid,
+                        &converter->sleep, "requested_ns", event, "late_ns");
+            converter->sleeping = false;
+            break;
+
+        case STREAMTEST_EVENT_FRAME_START:
+            converter->frames[track] = *event;
+            converter->reading[track] = true;
+            break;
+
+        case STREAMTEST_EVENT_READ_DONE:
+            if (converter->reading[track])
+                streamtest_events_span(converter, "read frame", tid,
+                        &converter->frames[track], "late_ns", event,
+                        "buffered_bytes");
+            converter->reading[track] = false;
+            break;
+
+        case STREAMTEST_EVENT_BLOB_SENT:
+            streamtest_events_instant(converter, "blobs sent", tid, event,
+                    "bytes");
+            break;
+
+        case STREAMTEST_EVENT_FLUSH_DONE:
+            streamtest_events_instant(converter, "flush", tid, event,
+                    "sync");
+            break;
+
+        case STREAMTEST_EVENT_KEY_PRESSED:
+            streamtest_events_instant(converter, "key pressed", tid, event,
+                    "keysym");
+            break;
+
+        case STREAMTEST_EVENT_KEY_RELEASED:
+            streamtest_events_instant(converter, "key released", tid, event,
+                    "keysym");
+            break;
+
+    }
+
+}
+
+int main(int argc, char** argv) {
+
+    if (argc != 2 && argc != 3) {
+        streamtest_events_usage(argv[0]);
+        return 1;
+    }
+
+    const char* input_path = argv[1];
+    FILE* input = fopen(input_path, "rb");
+    if (input == NULL) {
+        fprintf(stderr, "Unable to open \"%s\": %s\n", input_path,
+                strerror(errno));
+        return 1;
+    }
+
+    /* Verify dump was written by a compatible host */
+    streamtest_events_header header;
+    if (fread(&header, sizeof(header), 1, input) != 1
+            || memcmp(header.magic, STREAMTEST_EVENTS_MAGIC,
+                STREAMTEST_EVENTS_MAGIC_LENGTH) != 0
+            || header.byte_order != STREAMTEST_EVENTS_BYTE_ORDER) {
+        fprintf(stderr, "\"%s\" is not an event dump, or was written by a "
+                "host of differing byte order\n", input_path);
+        fclose(input);
+        return 1;
+    }
+
+    streamtest_events_converter* converter =
+        calloc(1, sizeof(streamtest_events_converter));
+
+    converter->output = stdout;
+    if (argc == 3) {
+        converter->output = fopen(argv[2], "w");
+        if (converter->output == NULL) {
+            fprintf(stderr, "Unable to open \"%s\": %s\n", argv[2],
+                    strerror(errno));
+            free(converter);
+            fclose(input);
+            return 1;
+        }
+    }
+
+    fprintf(converter->output, "{\"displayTimeUnit\":\"ns\","
+            "\"traceEvents\":[");
+
+    uint32_t count = 0;
+    streamtest_event event;
+    while (count < header.count
+            && fread(&event, sizeof(event), 1, input) == 1) {
+
+        if (count == 0) {
+            converter->base = event.timestamp;
+            streamtest_events_name(converter, STREAMTEST_EVENTS_SENDER_TID,
+                    "sender");
+        }
+
+        streamtest_events_convert(converter, &event);
+        count++;
+
+    }
+
+    fprintf(converter->output, "\n]}\n");
+
+    int result = 0;
+    if (count < header.count) {
+        fprintf(stderr, "Warning: \"%s\" is truncated after %" PRIu32
+                " of %" PRIu32 " events\n", input_path, count, header.count);
+    }
+
+    if (converter->output != stdout && fclose(converter->output)) {
+        fprintf(stderr, "Unable to write \"%s\": %s\n", argv[2],
+                strerror(errno));
+        result = 1;
+    }
+
+    free(converter);
+    fclose(input);
+    return result;
+
+}
+
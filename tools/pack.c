@@ -0,0 +1,800 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * streamtest-pack: converts a media file into the pre-chunked format defined
+ * by chunks.h, such that the plugin can stream it without reading, parsing
+ * or (optionally) encoding anything at runtime.
+ */
+
+#include "config.h"
+#include "chunks.h"
+#include "image.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * The characters of the base64 alphabet, in order of value.
+ */
+static const char streamtest_pack_base64[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/**
+ * All chunks found within the input file, in order.
+ */
+typedef struct streamtest_pack_table {
+
+    /**
+     * One entry per chunk, followed by an entry marking the end of the final
+     * chunk once the table is complete.
+     */
+    streamtest_chunks_entry* entries;
+
+    /**
+     * The number of chunks within the table.
+     */
+    int count;
+
+    /**
+     * The number of entries which may be stored before the table must grow.
+     */
+    int size;
+
+} streamtest_pack_table;
+
+/**
+ * Prints usage information for this tool to STDERR.
+ *
+ * @param name
+ *     The name this tool was invoked as.
+ */
+static void streamtest_pack_usage(const char* name) {
+    fprintf(stderr,
+            "Usage: %s [-e] [-k KEYFRAMES] [-s BYTES [-c] -d USECS | "
+            "-t TRACE |\n"
+            "       -m MIMETYPE -d USECS] INPUT OUTPUT\n\n"
+            "    -s BYTES     Split the input into chunks of BYTES bytes.\n"
+            "    -c           Split the input at boundaries chosen by its "
+            "content, averaging\n"
+            "                 roughly BYTES bytes per chunk, such that data "
+            "shared with other\n"
+            "                 files is chunked identically regardless of its "
+            "offset.\n"
+            "    -d USECS     Send one chunk (or image) every USECS "
+            "microseconds, or BYTES\n"
+            "                 bytes every USECS microseconds if splitting by "
+            "content.\n"
+            "    -t TRACE     Take the size and time of each chunk from the "
+            "given trace.\n"
+            "    -m MIMETYPE  Store one image per chunk, if MIMETYPE is a "
+            "supported image\n"
+            "                 type.\n"
+            "    -e           Store each chunk base64-encoded.\n"
+            "    -k KEYFRAMES Mark the chunks beginning at each byte offset "
+            "listed (one per\n"
+            "                 line) in KEYFRAMES as keyframes. Every image "
+            "is a keyframe.\n", name);
+}
+
+/**
+ * Reads the entire contents of the given file into memory.
+ *
+ * @param path
+ *     The path of the file to read.
+ *
+ * @param length
+ *     Storage for the number of bytes read.
+ *
+ * @return
+ *     A newly-allocated buffer containing the contents of the file, or NULL
+ *     if the file cannot be read, in which case errno is set appropriately.
+ */
+static unsigned char* streamtest_pack_read(const char* path, size_t* length) {
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return NULL;
+
+    size_t size = 65536;
+    unsigned char* data = malloc(size);
+    *length = 0;
+
+    for (;;) {
+
+        if (*length == size) {
+            size *= 2;
+            data = realloc(data, size);
+        }
+
+        ssize_t result = read(fd, data + *length, size - *length);
+        if (result == -1) {
+            int error = errno;
+            free(data);
+            close(fd);
+            errno = error;
+            return NULL;
+        }
+
+        if (result == 0)
+            break;
+
+        *length += result;
+
+    }
+
+    close(fd);
+    return data;
+
+}
+
+/**
+ * Appends an entry to the given table. The final entry, marking the end of
+ * the final chunk, is added in the same way, but is not counted as a chunk.
+ *
+ * @param table
+ *     The table to append to.
+ *
+ * @param timestamp
+ *     The time at which the chunk should be sent, in microseconds.
+ *
+ * @param offset
+ *     The offset of the chunk within the input file, in bytes.
+ *
+ * @param length
+ *     The number of bytes within the chunk.
+ */
+static void streamtest_pack_add(streamtest_pack_table* table,
+        int64_t timestamp, uint64_t offset, uint32_t length) {
+
+    if (table->count + 1 >= table->size) {
+        table->size = table->size ? table->size * 2 : 1024;
+        table->entries = realloc(table->entries,
+                sizeof(streamtest_chunks_entry) * table->size);
+    }
+
+    streamtest_chunks_entry* entry = &table->entries[table->count++];
+    entry->timestamp = timestamp;
+    entry->offset = offset;
+    entry->length = length;
+    entry->flags = 0;
+
+}
+
+/**
+ * Splits the given input into chunks of a fixed size and duration.
+ *
+ * @param table
+ *     The table to populate.
+ *
+ * @param length
+ *     The number of bytes within the input.
+ *
+ * @param bytes
+ *     The size of each chunk, in bytes.
+ *
+ * @param usecs
+ *     The duration of each chunk, in microseconds.
+ */
+static void streamtest_pack_fixed(streamtest_pack_table* table,
+        size_t length, int bytes, int usecs) {
+
+    for (size_t offset = 0; offset < length; offset += bytes) {
+
+        size_t chunk = length - offset;
+        if (chunk > (size_t) bytes)
+            chunk = bytes;
+
+        streamtest_pack_add(table, (int64_t) table->count * usecs, offset,
+                chunk);
+
+    }
+
+}
+
+/**
+ * Returns the next value of a splitmix64 sequence, used to generate the
+ * table of streamtest_pack_content() deterministically, such that all files
+ * are split identically.
+ *
+ * @param state
+ *     The state of the sequence, which is advanced.
+ *
+ * @return
+ *     The next pseudo-random value.
+ */
+static uint64_t streamtest_pack_splitmix(uint64_t* state) {
+    uint64_t value = (*state += 0x9E3779B97F4A7C15ULL);
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+    return value ^ (value >> 31);
+}
+
+/**
+ * Splits the given input into chunks at boundaries determined by a rolling
+ * "gear" hash of its content, such that runs of data shared between files
+ * (or repeated within a file) produce identical chunks even if preceded by
+ * differing data. Each chunk is between a quarter and four times the given
+ * size, averaging roughly the given size, and is sent at a time
+ * proportional to its offset.
+ *
+ * @param table
+ *     The table to populate.
+ *
+ * @param input
+ *     The input to split.
+ *
+ * @param length
+ *     The number of bytes within the input.
+ *
+ * @param bytes
+ *     The average size of each chunk, in bytes.
+ *
+ * @param usecs
+ *     The time taken to send the given number of bytes, in microseconds.
+ */
+static void streamtest_pack_content(streamtest_pack_table* table,
+        const unsigned char* input, size_t length, int bytes, int usecs) {
+
+    uint64_t gear[256];
+    uint64_t state = 0;
+    for (int i = 0; i < 256; i++)
+        gear[i] = streamtest_pack_splitmix(&state);
+
+    /* A boundary follows any byte for which the top bits of the hash are
+     * all zero, with as many bits as needed for the remainder of the
+     * average size beyond the minimum */
+    size_t minimum = bytes / 4 > 0 ? bytes / 4 : 1;
+    size_t maximum = (size_t) bytes * 4;
+    int bits = 1;
+    while (bits < 63 && ((size_t) 1 << bits) < (size_t) bytes - minimum)
+        bits++;
+
+    size_t start = 0;
+    while (start < length) {
+
+        size_t end = start + maximum < length ? start + maximum : length;
+        size_t offset = start + minimum < end ? start + minimum : end;
+
+        uint64_t hash = 0;
+        for (; offset < end; offset++) {
+            hash = (hash << 1) + gear[input[offset]];
+            if (hash >> (64 - bits) == 0) {
+                offset++;
+                break;
+            }
+        }
+
+        streamtest_pack_add(table, (int64_t) start * usecs / bytes, start,
+                offset - start);
+        start = offset;
+
+    }
+
+}
+
+/**
+ * Splits the given input into chunks as dictated by the records of the
+ * given trace. Input beyond the final record of the trace is not packed.
+ *
+ * @param table
+ *     The table to populate.
+ *
+ * @param length
+ *     The number of bytes within the input.
+ *
+ * @param path
+ *     The path of the trace file.
+ *
+ * @return
+ *     Zero on success, non-zero if the trace cannot be read or is
+ *     malformed.
+ */
+static int streamtest_pack_trace(streamtest_pack_table* table,
+        size_t length, const char* path) {
+
+    streamtest_trace* trace = streamtest_trace_open(path);
+    if (trace == NULL) {
+        fprintf(stderr, "Unable to open trace \"%s\": %s\n", path,
+                strerror(errno));
+        return 1;
+    }
+
+    int64_t start = 0;
+    size_t offset = 0;
+    int result;
+
+    streamtest_trace_record record;
+    while (offset < length
+            && (result = streamtest_trace_next(trace, &record)) > 0) {
+
+        if (table->count == 0)
+            start = record.timestamp;
+
+        size_t chunk = length - offset;
+        if (chunk > (size_t) record.length)
+            chunk = record.length;
+
+        streamtest_pack_add(table, record.timestamp - start, offset, chunk);
+        offset += chunk;
+
+    }
+
+    streamtest_trace_close(trace);
+
+    if (offset < length && result < 0) {
+        fprintf(stderr, "Trace \"%s\" is malformed or truncated after "
+                "record %i\n", path, table->count);
+        return 1;
+    }
+
+    if (offset < length)
+        fprintf(stderr, "Warning: %zu bytes beyond the end of trace \"%s\" "
+                "were not packed\n", length - offset, path);
+
+    return 0;
+
+}
+
+/**
+ * Splits the given input into chunks of one image each, lasting the given
+ * duration.
+ *
+ * @param table
+ *     The table to populate.
+ *
+ * @param input
+ *     The input, which must be a sequence of images of the given format.
+ *
+ * @param length
+ *     The number of bytes within the input.
+ *
+ * @param format
+ *     The format of each image.
+ *
+ * @param usecs
+ *     The duration of each image, in microseconds.
+ *
+ * @return
+ *     Zero on success, non-zero if the input is not a sequence of images of
+ *     the given format.
+ */
+static int streamtest_pack_images(streamtest_pack_table* table,
+        const unsigned char* input, size_t length,
+        streamtest_image_format format, int usecs) {
+
+    size_t offset = 0;
+    while (offset < length) {
+
+        int remaining = length - offset > INT32_MAX
+            ? INT32_MAX : (int) (length - offset);
+
+        int image = streamtest_image_length(format, input + offset,
+                remaining);
+        if (image == -1) {
+            fprintf(stderr, "Invalid image at offset %zu\n", offset);
+            return 1;
+        }
+
+        if (image == 0) {
+            fprintf(stderr, "Warning: %zu bytes of incomplete image at end "
+                    "of input were not packed\n", length - offset);
+            break;
+        }
+
+        streamtest_pack_add(table, (int64_t) table->count * usecs, offset,
+                image);
+        offset += image;
+
+    }
+
+    return 0;
+
+}
+
+/**
+ * Marks the chunk of the given table which begins at the given offset within
+ * the input as a keyframe.
+ *
+ * @param table
+ *     The table containing the chunk.
+ *
+ * @param offset
+ *     The offset of the keyframe within the input, in bytes.
+ *
+ * @return
+ *     Zero if the chunk was marked, non-zero if no chunk begins at the given
+ *     offset.
+ */
+static int streamtest_pack_mark(streamtest_pack_table* table,
+        uint64_t offset) {
+
+    /* Chunks are located in order of offset */
+    int low = 0;
+    int high = table->count - 1;
+    while (low <= high) {
+
+        int middle = low + (high - low) / 2;
+        streamtest_chunks_entry* entry = &table->entries[middle];
+
+        if (entry->offset == offset) {
+            entry->flags |= STREAMTEST_CHUNKS_KEYFRAME;
+            return 0;
+        }
+
+        if (entry->offset < offset)
+            low = middle + 1;
+        else
+            high = middle - 1;
+
+    }
+
+    return 1;
+
+}
+
+/**
+ * Marks the chunks of the given table which begin at the byte offsets
+ * listed within the given file, one decimal offset per line, as keyframes.
+ * Offsets which do not fall on a chunk boundary are ignored with a warning,
+ * as playback cannot resume part way through a chunk.
+ *
+ * @param table
+ *     The table to mark.
+ *
+ * @param path
+ *     The path of the file listing the offset of each keyframe.
+ *
+ * @return
+ *     Zero on success, non-zero if the file cannot be read or is malformed.
+ */
+static int streamtest_pack_keyframes(streamtest_pack_table* table,
+        const char* path) {
+
+    FILE* keyframes = fopen(path, "r");
+    if (keyframes == NULL) {
+        fprintf(stderr, "Unable to open keyframes \"%s\": %s\n", path,
+                strerror(errno));
+        return 1;
+    }
+
+    int marked = 0;
+    int line = 0;
+    char buffer[64];
+    while (fgets(buffer, sizeof(buffer), keyframes) != NULL) {
+
+        line++;
+
+        /* Ignore blank lines */
+        char* end;
+        unsigned long long offset = strtoull(buffer, &end, 10);
+        if (end == buffer && (*end == '\n' || *end == '\0'))
+            continue;
+
+        if (end == buffer || (*end != '\n' && *end != '\0')) {
+            fprintf(stderr, "Invalid keyframe offset on line %i of \"%s\"\n",
+                    line, path);
+            fclose(keyframes);
+            return 1;
+        }
+
+        if (streamtest_pack_mark(table, offset))
+            fprintf(stderr, "Warning: keyframe at offset %llu does not "
+                    "begin a chunk and was not marked\n", offset);
+        else
+            marked++;
+
+    }
+
+    fclose(keyframes);
+    fprintf(stderr, "Marked %i of %i chunks as keyframes\n", marked,
+            table->count);
+    return 0;
+
+}
+
+/**
+ * Writes the base64 encoding of the given data to the given file.
+ *
+ * @param output
+ *     The file to write to.
+ *
+ * @param data
+ *     The data to encode.
+ *
+ * @param length
+ *     The number of bytes of data to encode.
+ *
+ * @return
+ *     Zero on success, non-zero if the encoded data cannot be written.
+ */
+static int streamtest_pack_write_base64(FILE* output,
+        const unsigned char* data, size_t length) {
+
+    char buffer[4096];
+    size_t used = 0;
+
+    for (size_t i = 0; i < length; i += 3) {
+
+        uint32_t value = data[i] << 16;
+        if (i + 1 < length) value |= data[i + 1] << 8;
+        if (i + 2 < length) value |= data[i + 2];
+
+        buffer[used++] = streamtest_pack_base64[(value >> 18) & 0x3F];
+        buffer[used++] = streamtest_pack_base64[(value >> 12) & 0x3F];
+        buffer[used++] = i + 1 < length
+            ? streamtest_pack_base64[(value >> 6) & 0x3F] : '=';
+        buffer[used++] = i + 2 < length
+            ? streamtest_pack_base64[value & 0x3F] : '=';
+
+        if (used == sizeof(buffer)) {
+            if (fwrite(buffer, 1, used, output) != used)
+                return 1;
+            used = 0;
+        }
+
+    }
+
+    return fwrite(buffer, 1, used, output) != used;
+
+}
+
+/**
+ * Writes the given table, the content hash of each chunk, and the chunks
+ * themselves to the given file in the pre-chunked format. The offset of each
+ * entry is rewritten from an offset within the input to an offset within the
+ * payload.
+ *
+ * @param output
+ *     The file to write to.
+ *
+ * @param table
+ *     The complete table, including the entry marking the end of the final
+ *     chunk.
+ *
+ * @param input
+ *     The input file.
+ *
+ * @param encoded
+ *     Whether each chunk should be stored base64-encoded.
+ *
+ * @param indexed
+ *     Whether the table marks which chunks begin with a keyframe.
+ *
+ * @return
+ *     Zero on success, non-zero if the file cannot be written.
+ */
+static int streamtest_pack_write(FILE* output, streamtest_pack_table* table,
+        const unsigned char* input, bool encoded, bool indexed) {
+
+    streamtest_chunks_header header = {
+        .byte_order = STREAMTEST_CHUNKS_BYTE_ORDER,
+        .flags      = (encoded ? STREAMTEST_CHUNKS_BASE64 : 0)
+                    | (indexed ? STREAMTEST_CHUNKS_INDEXED : 0)
+                    | STREAMTEST_CHUNKS_HASHED,
+        .count      = table->count,
+        .reserved   = 0
+    };
+    memcpy(header.magic, STREAMTEST_CHUNKS_MAGIC,
+            STREAMTEST_CHUNKS_MAGIC_LENGTH);
+
+    /* Chunks are stored one after another, in order, each hashed such that
+     * the plugin need compare only chunks whose hashes match */
+    uint64_t* sources = malloc(sizeof(uint64_t) * table->count);
+    uint64_t* hashes = malloc(sizeof(uint64_t) * table->count);
+    uint64_t offset = 0;
+    for (int i = 0; i <= table->count; i++) {
+        if (i < table->count) {
+            sources[i] = table->entries[i].offset;
+            hashes[i] = streamtest_chunks_hash(input + sources[i],
+                    table->entries[i].length);
+        }
+        table->entries[i].offset = offset;
+        offset += streamtest_chunks_stored_length(table->entries[i].length,
+                encoded);
+    }
+
+    int result = fwrite(&header, sizeof(header), 1, output) != 1
+        || fwrite(table->entries, sizeof(streamtest_chunks_entry),
+                table->count + 1, output) != (size_t) table->count + 1
+        || fwrite(hashes, sizeof(uint64_t), table->count, output)
+                != (size_t) table->count;
+
+    for (int i = 0; i < table->count && !result; i++) {
+
+        const unsigned char* chunk = input + sources[i];
+        size_t length = table->entries[i].length;
+
+        if (encoded)
+            result = streamtest_pack_write_base64(output, chunk, length);
+        else
+            result = fwrite(chunk, 1, length, output) != length;
+
+    }
+
+    free(hashes);
+    free(sources);
+    return result;
+
+}
+
+int main(int argc, char** argv) {
+
+    bool encoded = false;
+    bool content = false;
+    int bytes = 0;
+    int usecs = 0;
+    const char* trace = NULL;
+    const char* mimetype = NULL;
+    const char* keyframes = NULL;
+
+    int option;
+    while ((option = getopt(argc, argv, "cek:s:d:t:m:")) != -1) {
+        switch (option) {
+
+            case 'c':
+                content = true;
+                break;
+
+            case 'e':
+                encoded = true;
+                break;
+
+            case 'k':
+                keyframes = optarg;
+                break;
+
+            case 's':
+                bytes = atoi(optarg);
+                break;
+
+            case 'd':
+                usecs = atoi(optarg);
+                break;
+
+            case 't':
+                trace = optarg;
+                break;
+
+            case 'm':
+                mimetype = optarg;
+                break;
+
+            default:
+                streamtest_pack_usage(argv[0]);
+                return 1;
+
+        }
+    }
+
+    /* Exactly one way of splitting the input must be given */
+    streamtest_image_format format = STREAMTEST_IMAGE_JPEG;
+    bool images = mimetype != NULL
+        && streamtest_image_parse_format(mimetype, &format) == 0;
+    if (argc - optind != 2
+            || (trace == NULL && (usecs <= 0 || (bytes <= 0 && !images)))
+            || (trace != NULL && (bytes > 0 || images))
+            || (content && (trace != NULL || images || bytes <= 0))) {
+        streamtest_pack_usage(argv[0]);
+        return 1;
+    }
+
+    const char* input_path = argv[optind];
+    const char* output_path = argv[optind + 1];
+
+    size_t length;
+    unsigned char* input = streamtest_pack_read(input_path, &length);
+    if (input == NULL) {
+        fprintf(stderr, "Unable to read \"%s\": %s\n", input_path,
+                strerror(errno));
+        return 1;
+    }
+
+    /* Locate each chunk */
+    streamtest_pack_table table = { 0 };
+    int result = 0;
+    if (trace != NULL)
+        result = streamtest_pack_trace(&table, length, trace);
+    else if (images)
+        result = streamtest_pack_images(&table, input, length, format,
+                usecs);
+    else if (content)
+        streamtest_pack_content(&table, input, length, bytes, usecs);
+    else
+        streamtest_pack_fixed(&table, length, bytes, usecs);
+
+    if (result == 0 && table.count == 0) {
+        fprintf(stderr, "\"%s\" contains no data to pack\n", input_path);
+        result = 1;
+    }
+
+    /* Each image can be decoded alone, while keyframes within other media
+     * must be listed */
+    bool indexed = images || keyframes != NULL;
+    if (result == 0 && images) {
+        for (int i = 0; i < table.count; i++)
+            table.entries[i].flags |= STREAMTEST_CHUNKS_KEYFRAME;
+    }
+
+    else if (result == 0 && keyframes != NULL)
+        result = streamtest_pack_keyframes(&table, keyframes);
+
+    /* Mark the end of the final chunk, which lasts as long as the chunk
+     * before it if replaying a trace (as the plugin would when replaying
+     * the same trace), or in proportion to its size if split by content */
+    if (result == 0) {
+
+        int64_t end = table.entries[table.count - 1].timestamp;
+        if (content)
+            end = (int64_t) length * usecs / bytes;
+        else if (trace == NULL)
+            end += usecs;
+        else if (table.count > 1)
+            end += end - table.entries[table.count - 2].timestamp;
+
+        streamtest_pack_add(&table, end, length, 0);
+        table.count--;
+
+    }
+
+    /* Write file */
+    if (result == 0) {
+
+        FILE* output = fopen(output_path, "wb");
+        if (output == NULL) {
+            fprintf(stderr, "Unable to open \"%s\": %s\n", output_path,
+                    strerror(errno));
+            result = 1;
+        }
+
+        else {
+
+            result = streamtest_pack_write(output, &table, input, encoded,
+                    indexed);
+            if (fclose(output))
+                result = 1;
+
+            if (result)
+                fprintf(stderr, "Unable to write \"%s\": %s\n", output_path,
+                        strerror(errno));
+            else
+                fprintf(stderr, "Packed %i chunks of \"%s\" into \"%s\"%s\n",
+                        table.count, input_path, output_path,
+                        encoded ? " (base64-encoded)" : "");
+
+        }
+
+    }
+
+    free(table.entries);
+    free(input);
+    return result;
+
+}
+
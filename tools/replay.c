@@ -0,0 +1,414 @@
+/*
+ * Copyright (C) 2015 Glyptodon LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * streamtest-replay: writes a session recording, as produced by the "record"
+ * parameter of the plugin and defined by recording.h, to a socket at its
+ * original pace or as quickly as possible, such that proxies and clients can
+ * be benchmarked without running the plugin.
+ */
+
+#include "config.h"
+#include "recording.h"
+#include "timing.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/**
+ * The prefix which denotes an address that refers to a UNIX domain socket
+ * rather than a TCP host and port.
+ */
+#define STREAMTEST_REPLAY_UNIX_PREFIX "unix:"
+
+/**
+ * Prints usage information for this tool to STDERR.
+ *
+ * @param name
+ *     The name this tool was invoked as.
+ */
+static void streamtest_replay_usage(const char* name) {
+    fprintf(stderr,
+            "Usage: %s [-f] [-l] RECORDING ADDRESS\n\n"
+            "    ADDRESS  Either HOST:PORT, unix:PATH, or - for STDOUT.\n"
+            "    -f       Replay as quickly as possible, rather than at the "
+            "original pace.\n"
+            "    -l       Listen at ADDRESS and replay to the first "
+            "connection, rather than\n"
+            "             connecting to ADDRESS.\n", name);
+}
+
+/**
+ * Opens a socket connected to (or, if listening, accepted from) the UNIX
+ * domain socket having the given path.
+ *
+ * @param path
+ *     The path of the UNIX domain socket.
+ *
+ * @param listening
+ *     Whether to create the socket and wait for a connection, rather than
+ *     connect to an existing socket.
+ *
+ * @return
+ *     The connected socket, or -1 if no connection could be made, in which
+ *     case errno is set appropriately.
+ */
+static int streamtest_replay_open_unix(const char* path, bool listening) {
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1)
+        return -1;
+
+    if (!listening) {
+        if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)))
+            goto fail;
+        return fd;
+    }
+
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)))
+        goto fail;
+
+    int connection = -1;
+    if (listen(fd, 1) == 0)
+        connection = accept(fd, NULL, NULL);
+
+    int error = errno;
+    unlink(path);
+    close(fd);
+    errno = error;
+    return connection;
+
+fail:
+    close(fd);
+    return -1;
+
+}
+
+/**
+ * Opens a socket connected to (or, if listening, accepted from) the given
+ * TCP host and port.
+ *
+ * @param address
+ *     The host and port, separated by a colon. If listening, the host may be
+ *     empty to listen on all interfaces.
+ *
+ * @param listening
+ *     Whether to listen for a connection, rather than connect.
+ *
+ * @return
+ *     The connected socket, or -1 if no connection could be made, in which
+ *     case an error has already been printed.
+ */
+static int streamtest_replay_open_tcp(const char* address, bool listening) {
+
+    const char* colon = strrchr(address, ':');
+    if (colon == NULL) {
+        fprintf(stderr, "\"%s\" is not of the form HOST:PORT\n", address);
+        return -1;
+    }
+
+    char* host = strndup(address, colon - address);
+
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+        .ai_flags = listening ? AI_PASSIVE : 0
+    };
+
+    struct addrinfo* addresses;
+    int result = getaddrinfo(host[0] != '\0' ? host : NULL, colon + 1,
+            &hints, &addresses);
+    free(host);
+
+    if (result) {
+        fprintf(stderr, "Unable to resolve \"%s\": %s\n", address,
+                gai_strerror(result));
+        return -1;
+    }
+
+    /* Use the first address which works */
+    int fd = -1;
+    for (struct addrinfo* current = addresses; current != NULL;
+            current = current->ai_next) {
+
+        fd = socket(current->ai_family, current->ai_socktype,
+                current->ai_protocol);
+        if (fd == -1)
+            continue;
+
+        if (!listening) {
+            if (connect(fd, current->ai_addr, current->ai_addrlen) == 0)
+                break;
+        }
+
+        else {
+
+            int reuse = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+            if (bind(fd, current->ai_addr, current->ai_addrlen) == 0
+                    && listen(fd, 1) == 0) {
+                int connection = accept(fd, NULL, NULL);
+                close(fd);
+                fd = connection;
+                break;
+            }
+
+        }
+
+        close(fd);
+        fd = -1;
+
+    }
+
+    freeaddrinfo(addresses);
+
+    if (fd == -1)
+        fprintf(stderr, "Unable to %s \"%s\": %s\n",
+                listening ? "listen at" : "connect to", address,
+                strerror(errno));
+
+    return fd;
+
+}
+
+/**
+ * Writes the entirety of the given buffer to the given file descriptor.
+ *
+ * @param fd
+ *     The file descriptor to write to.
+ *
+ * @param buffer
+ *     The data to write.
+ *
+ * @param length
+ *     The number of bytes to write.
+ *
+ * @return
+ *     Zero if all data was written, non-zero otherwise, in which case errno
+ *     is set appropriately.
+ */
+static int streamtest_replay_write(int fd, const unsigned char* buffer,
+        size_t length) {
+
+    while (length > 0) {
+
+        ssize_t written = write(fd, buffer, length);
+        if (written == -1) {
+            if (errno == EINTR)
+                continue;
+            return 1;
+        }
+
+        buffer += written;
+        length -= written;
+
+    }
+
+    return 0;
+
+}
+
+/**
+ * Writes each record of the given recording to the given file descriptor,
+ * optionally at the pace the data was originally written.
+ *
+ * @param input
+ *     The recording, positioned just after its header.
+ *
+ * @param fd
+ *     The file descriptor to write to.
+ *
+ * @param paced
+ *     Whether each record should be written at its original time relative
+ *     to the first, rather than as quickly as possible.
+ *
+ * @return
+ *     Zero if the entire recording was replayed, non-zero otherwise.
+ */
+static int streamtest_replay(FILE* input, int fd, bool paced) {
+
+    unsigned char* buffer = NULL;
+    size_t size = 0;
+
+    uint64_t records = 0;
+    uint64_t bytes = 0;
+    int64_t start = streamtest_utime();
+    int result = 0;
+
+    streamtest_recording_record record;
+    while (fread(&record, sizeof(record), 1, input) == 1) {
+
+        if (record.length > size) {
+            size = record.length;
+            buffer = realloc(buffer, size);
+        }
+
+        if (fread(buffer, 1, record.length, input) != record.length) {
+            fprintf(stderr, "Recording is truncated after %" PRIu64
+                    " writes\n", records);
+            result = 1;
+            break;
+        }
+
+        /* Wait until data would originally have been written */
+        if (paced) {
+            struct timespec deadline;
+            streamtest_utime_to_timespec(start + record.timestamp,
+                    &deadline);
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline,
+                        NULL) == EINTR);
+        }
+
+        if (streamtest_replay_write(fd, buffer, record.length)) {
+            fprintf(stderr, "Write failed after %" PRIu64 " writes: %s\n",
+                    records, strerror(errno));
+            result = 1;
+            break;
+        }
+
+        records++;
+        bytes += record.length;
+
+    }
+
+    double elapsed = (streamtest_utime() - start) / 1000000.0;
+    fprintf(stderr, "Replayed %" PRIu64 " bytes within %" PRIu64 " writes "
+            "in %.3f seconds", bytes, records, elapsed);
+
+    if (elapsed > 0)
+        fprintf(stderr, " (%.3f Mbit/s)", bytes * 8 / elapsed / 1000000.0);
+
+    fprintf(stderr, "\n");
+
+    free(buffer);
+    return result;
+
+}
+
+int main(int argc, char** argv) {
+
+    bool paced = true;
+    bool listening = false;
+
+    int option;
+    while ((option = getopt(argc, argv, "fl")) != -1) {
+        switch (option) {
+
+            case 'f':
+                paced = false;
+                break;
+
+            case 'l':
+                listening = true;
+                break;
+
+            default:
+                streamtest_replay_usage(argv[0]);
+                return 1;
+
+        }
+    }
+
+    if (argc - optind != 2) {
+        streamtest_replay_usage(argv[0]);
+        return 1;
+    }
+
+    const char* input_path = argv[optind];
+    const char* address = argv[optind + 1];
+
+    FILE* input = fopen(input_path, "rb");
+    if (input == NULL) {
+        fprintf(stderr, "Unable to open \"%s\": %s\n", input_path,
+                strerror(errno));
+        return 1;
+    }
+
+    /* Verify recording was written by a compatible host */
+    streamtest_recording_header header;
+    if (fread(&header, sizeof(header), 1, input) != 1
+            || memcmp(header.magic, STREAMTEST_RECORDING_MAGIC,
+                STREAMTEST_RECORDING_MAGIC_LENGTH) != 0
+            || header.byte_order != STREAMTEST_RECORDING_BYTE_ORDER) {
+        fprintf(stderr, "\"%s\" is not a recording, or was written by a "
+                "host of differing byte order\n", input_path);
+        fclose(input);
+        return 1;
+    }
+
+    /* Report failed writes rather than terminating */
+    signal(SIGPIPE, SIG_IGN);
+
+    int fd;
+    size_t prefix_length = strlen(STREAMTEST_REPLAY_UNIX_PREFIX);
+
+    if (strcmp(address, "-") == 0)
+        fd = STDOUT_FILENO;
+
+    else if (strncmp(address, STREAMTEST_REPLAY_UNIX_PREFIX,
+                prefix_length) == 0) {
+        fd = streamtest_replay_open_unix(address + prefix_length, listening);
+        if (fd == -1)
+            fprintf(stderr, "Unable to %s \"%s\": %s\n",
+                    listening ? "listen at" : "connect to", address,
+                    strerror(errno));
+    }
+
+    else
+        fd = streamtest_replay_open_tcp(address, listening);
+
+    if (fd == -1) {
+        fclose(input);
+        return 1;
+    }
+
+    int result = streamtest_replay(input, fd, paced);
+
+    if (fd != STDOUT_FILENO)
+        close(fd);
+
+    fclose(input);
+    return result;
+
+}
+